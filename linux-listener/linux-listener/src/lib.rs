@@ -1,6 +1,7 @@
 pub mod epoll;
 
 use std::ffi::{CStr, c_char, c_int, c_short};
+use std::mem::MaybeUninit;
 use std::os::fd::{AsFd, AsRawFd};
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::{Arc, Mutex};
@@ -304,6 +305,48 @@ pub unsafe extern "C" fn set_monitor(
     }
 }
 
+/// Remove a single monitor target from the provided kernel tracer.
+///
+/// # Returns
+/// - 0 on success
+/// - 1 on failure (including when `name` was not monitored)
+///
+/// # Safety
+/// All of the following conditions must be true:
+/// - `tracer` must be null or a valid pointer obtained from [`new_tracer`].
+/// - `name` must be null or a valid null-terminated string.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn remove_monitor(
+    tracer: *const KernelTracerHandle,
+    name: *const c_char,
+) -> c_int {
+    let tracer = tracer as *const KernelTracer;
+    if name.is_null() {
+        return 1;
+    }
+
+    if let Some(tracer) = unsafe { tracer.as_ref() }
+        && let Ok(name) = unsafe { CStr::from_ptr(name) }.to_str()
+    {
+        match tracer.names.lock() {
+            Ok(mut names) => {
+                if let Err(e) = names.remove(&StaticCommandName::from(name)) {
+                    error!("Failed to remove key {name:?}: {e}");
+                    1
+                } else {
+                    0
+                }
+            }
+            Err(e) => {
+                error!("NAMES is poisoned: {e}");
+                1
+            }
+        }
+    } else {
+        1
+    }
+}
+
 /// Clear all monitor targets from the provided kernel tracer.
 ///
 /// # Returns
@@ -347,6 +390,35 @@ pub unsafe extern "C" fn clear_monitor(tracer: *const KernelTracerHandle) -> c_i
     }
 }
 
+/// Wait up to `timeout_ms` milliseconds for the ring buffer to become readable.
+fn poll_readable(events: &RingBuf<MapData>, timeout_ms: c_int) -> bool {
+    let mut poll_fd = libc::pollfd {
+        fd: events.as_fd().as_raw_fd(),
+        events: libc::POLLIN,
+        revents: 0,
+    };
+
+    if unsafe { libc::poll(&mut poll_fd, 1, timeout_ms) } > 0 {
+        const ERROR_CONDITION: c_short = libc::POLLERR | libc::POLLHUP | libc::POLLNVAL;
+        (poll_fd.revents & ERROR_CONDITION) == 0 && (poll_fd.revents & libc::POLLIN) != 0
+    } else {
+        false
+    }
+}
+
+/// Copy as many pending records as fit into `out` without waiting.
+fn drain_ring_buffer(events: &mut RingBuf<MapData>, out: &mut [MaybeUninit<Event>]) -> usize {
+    let mut count = 0;
+    while count < out.len()
+        && let Some(item) = events.next()
+    {
+        out[count].write(unsafe { ptr::read_unaligned(item.as_ptr() as *const Event) });
+        count += 1;
+    }
+
+    count
+}
+
 /// Return the next event from the kernel tracer.
 /// In Linux, the following types of event may be returned:
 /// - Process creation event
@@ -367,27 +439,114 @@ pub unsafe extern "C" fn next_event(
     if let Some(tracer) = unsafe { tracer.as_ref() }
         && let Ok(mut events) = tracer.events.lock()
     {
-        let mut poll_fd = libc::pollfd {
-            fd: events.as_fd().as_raw_fd(),
-            events: libc::POLLIN,
-            revents: 0,
-        };
-
-        if unsafe { libc::poll(&mut poll_fd, 1, timeout_ms) } > 0 {
-            const ERROR_CONDITION: c_short = libc::POLLERR | libc::POLLHUP | libc::POLLNVAL;
-            if (poll_fd.revents & ERROR_CONDITION) == 0
-                && (poll_fd.revents & libc::POLLIN) != 0
-                && let Some(item) = events.next()
-            {
-                let event = unsafe { ptr::read_unaligned(item.as_ptr() as *const Event) };
-                return Box::into_raw(Box::new(event));
-            }
+        if poll_readable(&events, timeout_ms)
+            && let Some(item) = events.next()
+        {
+            let event = unsafe { ptr::read_unaligned(item.as_ptr() as *const Event) };
+            return Box::into_raw(Box::new(event));
         }
     }
 
     ptr::null_mut()
 }
 
+/// Drain up to `capacity` events from the kernel tracer into the caller-provided array `out`.
+///
+/// Unlike [`next_event`], all records already queued in the ring buffer are copied in a single
+/// call, without any heap allocation. If no record is pending, wait up to `timeout_ms`
+/// milliseconds for one to arrive (a negative value waits indefinitely).
+///
+/// # Returns
+/// The number of events written to the front of `out`, or 0 on timeout or failure.
+///
+/// # Safety
+/// The provided `tracer` must be null or a valid pointer obtained from [`new_tracer`], and
+/// `out` must be null or point to an array of at least `capacity` events.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn next_events(
+    tracer: *const KernelTracerHandle,
+    out: *mut Event,
+    capacity: usize,
+    timeout_ms: c_int,
+) -> usize {
+    if out.is_null() || capacity == 0 {
+        return 0;
+    }
+
+    let tracer = tracer as *const KernelTracer;
+    if let Some(tracer) = unsafe { tracer.as_ref() }
+        && let Ok(mut events) = tracer.events.lock()
+    {
+        let out = unsafe { std::slice::from_raw_parts_mut(out as *mut MaybeUninit<Event>, capacity) };
+
+        let count = drain_ring_buffer(&mut events, out);
+        if count > 0 || !poll_readable(&events, timeout_ms) {
+            return count;
+        }
+
+        return drain_ring_buffer(&mut events, out);
+    }
+
+    0
+}
+
+/// Drain up to `capacity` pending events from the kernel tracer into the caller-provided array
+/// `out`, without ever blocking.
+///
+/// This is meant to be called when the descriptor returned by [`tracer_event_fd`] is reported
+/// readable. If the return value equals `capacity`, more events may still be pending.
+///
+/// # Returns
+/// The number of events written to the front of `out`, or 0 if none is pending or on failure.
+///
+/// # Safety
+/// The provided `tracer` must be null or a valid pointer obtained from [`new_tracer`], and
+/// `out` must be null or point to an array of at least `capacity` events.
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn drain_events(
+    tracer: *const KernelTracerHandle,
+    out: *mut Event,
+    capacity: usize,
+) -> usize {
+    if out.is_null() || capacity == 0 {
+        return 0;
+    }
+
+    let tracer = tracer as *const KernelTracer;
+    if let Some(tracer) = unsafe { tracer.as_ref() }
+        && let Ok(mut events) = tracer.events.lock()
+    {
+        let out = unsafe { std::slice::from_raw_parts_mut(out as *mut MaybeUninit<Event>, capacity) };
+        return drain_ring_buffer(&mut events, out);
+    }
+
+    0
+}
+
+/// Return the file descriptor of the kernel event ring buffer, so that callers can wait for
+/// events with their own `poll`/`epoll` loop. The descriptor becomes readable whenever at least
+/// one event is pending; use [`drain_events`] to consume them.
+///
+/// The descriptor remains owned by the tracer: it must not be closed, and it is invalidated by
+/// [`free_tracer`].
+///
+/// # Returns
+/// The ring buffer file descriptor, or -1 on failure.
+///
+/// # Safety
+/// The provided pointer must be null or a valid pointer obtained from [`new_tracer`].
+#[unsafe(no_mangle)]
+pub unsafe extern "C" fn tracer_event_fd(tracer: *const KernelTracerHandle) -> c_int {
+    let tracer = tracer as *const KernelTracer;
+    if let Some(tracer) = unsafe { tracer.as_ref() }
+        && let Ok(events) = tracer.events.lock()
+    {
+        return events.as_fd().as_raw_fd();
+    }
+
+    -1
+}
+
 /// Free the event obtained from [`next_event`].
 ///
 /// # Safety
@@ -1,16 +1,335 @@
 #pragma once
 
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <type_traits>
+
+#include <nlohmann/json.hpp>
+
+#include "fs.hpp"
 #include "io.hpp"
 #include "generated/types.hpp"
 
 namespace procmon
 {
+    /**
+     * @brief Urgency of a violation. More severe reports are sent first and dropped last.
+     */
+    enum class Severity : uint8_t
+    {
+        Low = 0,
+        Normal = 1,
+        Critical = 2,
+    };
+
+    constexpr size_t SEVERITY_COUNT = 3;
+
+    /** @brief Number of metrics, i.e. of values in a `Threshold`. */
+    constexpr size_t METRIC_COUNT = std::extent_v<decltype(Threshold::values)>;
+
+    /**
+     * @brief What the agent does to a process while it violates one of its thresholds.
+     *
+     * Zero fields are not applied. Resource limits are enforced with a dedicated cgroup v2.
+     */
+    struct EnforcementAction
+    {
+        /** @brief `cpu.max` limit, in percent of one CPU. */
+        uint32_t cpu_max;
+        /** @brief `memory.high` limit, in MB. */
+        uint32_t memory_high;
+        /** @brief `io.max` read and write limit on every block device, in MB/s. */
+        uint32_t io_max;
+        /** @brief Nice value to set. */
+        int32_t nice;
+        /** @brief Best-effort I/O priority to set, plus one (1 for level 0 to 8 for level 7). */
+        uint32_t ionice;
+        /** @brief Minimum time in seconds between applying and releasing the action, in either order. */
+        uint32_t cooldown;
+
+        bool empty() const
+        {
+            return cpu_max == 0 && memory_high == 0 && io_max == 0 && nice == 0 && ionice == 0;
+        }
+    };
+
     struct ConfigEntry
     {
         StaticCommandName name;
         Threshold threshold;
+        /** @brief Severity of the violations of each metric, indexed like `threshold.values`. */
+        Severity severity[METRIC_COUNT];
+        EnforcementAction action;
     };
 
+    /**
+     * @brief Parse a severity name (`low`, `normal` or `critical`).
+     */
+    inline std::optional<Severity> parse_severity(const std::string &name)
+    {
+        if (name == "low")
+        {
+            return Severity::Low;
+        }
+
+        if (name == "normal")
+        {
+            return Severity::Normal;
+        }
+
+        if (name == "critical")
+        {
+            return Severity::Critical;
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Build a rule from one element of the JSON configuration sent by CTB.
+     *
+     * `severity` is either a single name applied to every metric, or an object mapping metric names
+     * (`cpu`, `memory`, `disk`, `network`) to severity names. Missing or unknown values mean `normal`.
+     *
+     * `action` is an optional object with the fields of `EnforcementAction`, `ionice` being the
+     * best-effort level itself (0 to 7). The cooldown defaults to 30 seconds.
+     */
+    inline ConfigEntry parse_config_entry(const nlohmann::json &item)
+    {
+        static const char *const METRIC_NAMES[METRIC_COUNT] = {"cpu", "memory", "disk", "network"};
+
+        ConfigEntry entry = {};
+
+        auto name = item.value("name", "");
+        size_t len = std::min(name.size(), COMMAND_LENGTH - 1);
+        std::memcpy(entry.name, name.data(), len);
+        entry.name[len] = '\0';
+
+        auto severity = item.find("severity");
+        for (size_t i = 0; i < METRIC_COUNT; i++)
+        {
+            entry.threshold.values[i] = item.value(METRIC_NAMES[i], 0);
+            entry.severity[i] = Severity::Normal;
+
+            std::optional<Severity> parsed;
+            if (severity != item.end() && severity->is_string())
+            {
+                parsed = parse_severity(severity->get<std::string>());
+            }
+            else if (severity != item.end() && severity->is_object())
+            {
+                auto value = severity->value(METRIC_NAMES[i], "normal");
+                parsed = parse_severity(value);
+            }
+
+            if (parsed.has_value())
+            {
+                entry.severity[i] = parsed.value();
+            }
+        }
+
+        auto action = item.find("action");
+        if (action != item.end() && action->is_object())
+        {
+            entry.action.cpu_max = action->value("cpu_max", 0u);
+            entry.action.memory_high = action->value("memory_high", 0u);
+            entry.action.io_max = action->value("io_max", 0u);
+            entry.action.nice = std::clamp(action->value("nice", 0), -20, 19);
+            if (action->contains("ionice"))
+            {
+                entry.action.ionice = std::min(action->value("ionice", 0u), 7u) + 1;
+            }
+
+            entry.action.cooldown = action->value("cooldown", 30u);
+        }
+
+        return entry;
+    }
+
+    /**
+     * @brief Parse and validate the JSON configuration served by CTB.
+     *
+     * `parse_config_entry` is lenient, since agents must apply whatever they receive: this rejects
+     * what it would silently misread, i.e. unknown fields, a missing name, values of the wrong type
+     * or out of range, and unknown severity or metric names.
+     */
+    inline io::Result<std::vector<ConfigEntry>> parse_config(std::string_view content)
+    {
+        using R = io::Result<std::vector<ConfigEntry>>;
+        static const char *const METRIC_NAMES[METRIC_COUNT] = {"cpu", "memory", "disk", "network"};
+        static const char *const ACTION_FIELDS[] = {"cpu_max", "memory_high", "io_max", "nice", "ionice", "cooldown"};
+
+        auto invalid = [](size_t index, const std::string &reason)
+        {
+            return R::err(io::Error(io::ErrorKind::InvalidData, std::format("Entry {}: {}", index, reason)));
+        };
+        auto is_uint = [](const nlohmann::json &value, int64_t max)
+        {
+            return value.is_number_integer() && value.get<int64_t>() >= 0 && value.get<int64_t>() <= max;
+        };
+        auto is_one_of = [](const auto &names, const std::string &key)
+        {
+            return std::find(std::begin(names), std::end(names), key) != std::end(names);
+        };
+
+        auto parsed = nlohmann::json::parse(content, nullptr, false);
+        if (parsed.is_discarded() || !parsed.is_array())
+        {
+            return R::err(io::Error(io::ErrorKind::InvalidData, "Configuration must be a JSON array of rules"));
+        }
+
+        std::vector<ConfigEntry> entries;
+        for (size_t i = 0; i < parsed.size(); i++)
+        {
+            const auto &item = parsed[i];
+            if (!item.is_object())
+            {
+                return invalid(i, "not an object");
+            }
+
+            for (const auto &[key, value] : item.items())
+            {
+                if (key == "name")
+                {
+                    if (!value.is_string() || value.get<std::string>().empty())
+                    {
+                        return invalid(i, "\"name\" must be a non-empty string");
+                    }
+                }
+                else if (is_one_of(METRIC_NAMES, key))
+                {
+                    if (!is_uint(value, UINT32_MAX))
+                    {
+                        return invalid(i, std::format("\"{}\" must be a non-negative integer", key));
+                    }
+                }
+                else if (key == "severity")
+                {
+                    if (value.is_string())
+                    {
+                        if (!parse_severity(value.get<std::string>()).has_value())
+                        {
+                            return invalid(i, "unknown severity");
+                        }
+                    }
+                    else if (value.is_object())
+                    {
+                        for (const auto &[metric_name, severity] : value.items())
+                        {
+                            if (!is_one_of(METRIC_NAMES, metric_name) || !severity.is_string() || !parse_severity(severity.get<std::string>()).has_value())
+                            {
+                                return invalid(i, std::format("invalid severity for \"{}\"", metric_name));
+                            }
+                        }
+                    }
+                    else
+                    {
+                        return invalid(i, "\"severity\" must be a string or an object");
+                    }
+                }
+                else if (key == "action")
+                {
+                    if (!value.is_object())
+                    {
+                        return invalid(i, "\"action\" must be an object");
+                    }
+
+                    for (const auto &[field, setting] : value.items())
+                    {
+                        if (!is_one_of(ACTION_FIELDS, field))
+                        {
+                            return invalid(i, std::format("unknown action \"{}\"", field));
+                        }
+
+                        auto valid = field == "nice"     ? setting.is_number_integer() && setting.get<int64_t>() >= -20 && setting.get<int64_t>() <= 19
+                                     : field == "ionice" ? is_uint(setting, 7)
+                                                         : is_uint(setting, UINT32_MAX);
+                        if (!valid)
+                        {
+                            return invalid(i, std::format("action \"{}\" is out of range", field));
+                        }
+                    }
+                }
+                else
+                {
+                    return invalid(i, std::format("unknown field \"{}\"", key));
+                }
+            }
+
+            if (!item.contains("name"))
+            {
+                return invalid(i, "missing \"name\"");
+            }
+
+            entries.push_back(parse_config_entry(item));
+        }
+
+        return R::ok(std::move(entries));
+    }
+
+    /** @brief Read the whole JSON configuration file at `path`. */
+    inline io::Result<std::string> read_config_file(const path::PathBuf &path)
+    {
+        auto file = SHORT_CIRCUIT(std::string, fs::File::open(path));
+
+        std::vector<char> buffer(8192);
+        std::string content;
+        while (true)
+        {
+            auto read = SHORT_CIRCUIT(std::string, file.read(std::span<char>(buffer.data(), buffer.size())));
+            if (read == 0)
+            {
+                return io::Result<std::string>::ok(std::move(content));
+            }
+
+            content.append(buffer.data(), read);
+        }
+    }
+
+    /**
+     * @brief Compute a fingerprint of a rule set which does not depend on the order of its entries.
+     *
+     * Entries are sorted by name and, when a name appears more than once, only its last entry
+     * (the one which ends up applied) is kept. The fingerprint is the 64-bit FNV-1a hash of the
+     * resulting entries.
+     */
+    inline uint64_t config_fingerprint(const std::vector<ConfigEntry> &entries)
+    {
+        std::vector<const ConfigEntry *> canonical;
+        canonical.reserve(entries.size());
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+        {
+            canonical.push_back(&*it);
+        }
+
+        auto by_name = [](const ConfigEntry *a, const ConfigEntry *b)
+        {
+            return std::memcmp(a->name, b->name, sizeof(StaticCommandName)) < 0;
+        };
+        auto same_name = [](const ConfigEntry *a, const ConfigEntry *b)
+        {
+            return std::memcmp(a->name, b->name, sizeof(StaticCommandName)) == 0;
+        };
+
+        // Iterating in reverse then stable sorting keeps the last occurrence of a name first.
+        std::stable_sort(canonical.begin(), canonical.end(), by_name);
+        canonical.erase(std::unique(canonical.begin(), canonical.end(), same_name), canonical.end());
+
+        uint64_t hash = 0xcbf29ce484222325;
+        for (auto entry : canonical)
+        {
+            auto bytes = reinterpret_cast<const uint8_t *>(entry);
+            for (size_t i = 0; i < sizeof(ConfigEntry); i++)
+            {
+                hash ^= bytes[i];
+                hash *= 0x100000001b3;
+            }
+        }
+
+        return hash;
+    }
+
     io::Result<std::vector<ConfigEntry>> load_config();
     io::Result<std::monostate> save_config(const std::vector<ConfigEntry> &entries);
 }
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "config.hpp"
+#include "path.hpp"
+
+namespace procmon
+{
+    /**
+     * @brief Applies the enforcement actions of rules to processes, and reverts them.
+     *
+     * Resource limits are applied by moving the process to a cgroup v2 of its own, created under a
+     * root managed by the agent, and reverted by moving it (and the children it forked since) back
+     * to its original cgroup. Every action still applied is reverted when the enforcer is destroyed.
+     */
+    class Enforcer
+    {
+    private:
+        struct _Applied
+        {
+            std::optional<path::PathBuf> cgroup;
+            std::string original_cgroup;
+            std::optional<int> nice;
+            std::optional<int> ioprio;
+
+            /** @brief Opened when the first action is applied, to tell the process from a later one reusing its PID. */
+            int pidfd = -1;
+        };
+
+        path::PathBuf _root;
+        bool _root_ready;
+        std::unordered_map<pid_t, _Applied> _applied;
+
+        io::Result<std::monostate> _prepare_root();
+        io::Result<std::monostate> _limit(pid_t pid, const EnforcementAction &action, _Applied &applied);
+
+    public:
+        static constexpr const char *DEFAULT_ROOT = "/sys/fs/cgroup/process-monitor";
+
+        explicit Enforcer(path::PathBuf root = DEFAULT_ROOT);
+        ~Enforcer();
+
+        Enforcer(const Enforcer &) = delete;
+        Enforcer &operator=(const Enforcer &) = delete;
+
+        /**
+         * @brief Apply `action` to `pid`.
+         *
+         * If a step fails, the steps which succeeded are kept (and reverted by `release`) and the
+         * first error is returned.
+         */
+        io::Result<std::monostate> apply(pid_t pid, const EnforcementAction &action);
+
+        /**
+         * @brief Revert everything applied to `pid`. Does nothing if no action is applied to it.
+         *
+         * Also called for processes which exited (or whose PID was reused), to remove their cgroup.
+         * The priorities are only restored if the process is still the one the actions were
+         * applied to.
+         */
+        void release(pid_t pid);
+
+        bool is_applied(pid_t pid) const
+        {
+            return _applied.find(pid) != _applied.end();
+        }
+    };
+}
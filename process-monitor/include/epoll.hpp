@@ -0,0 +1,191 @@
+#pragma once
+
+#include "io.hpp"
+#include "path.hpp"
+
+#include <string>
+#include <vector>
+
+#include <sys/epoll.h>
+
+namespace procmon
+{
+    /**
+     * @brief An owned Linux file descriptor which is closed when dropped.
+     *
+     * @see https://doc.rust-lang.org/std/os/fd/struct.OwnedFd.html
+     */
+    class OwnedFd : public NonConstructible
+    {
+    private:
+        int _fd;
+
+    public:
+        explicit OwnedFd(int fd);
+        OwnedFd(OwnedFd &&other) noexcept;
+        OwnedFd &operator=(OwnedFd &&other) noexcept;
+        ~OwnedFd();
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
+    };
+
+    /**
+     * @brief An epoll instance used to multiplex every event source of a loop in a single wait.
+     *
+     * Each registered file descriptor is associated with a caller-defined 64-bit token which is
+     * returned in `epoll_event::data.u64` when the descriptor becomes ready.
+     */
+    class Epoll : public NonConstructible
+    {
+    private:
+        OwnedFd _fd;
+
+        explicit Epoll(OwnedFd &&fd);
+
+    public:
+        /** @brief Create a new epoll instance. */
+        static io::Result<Epoll> create();
+
+        /** @brief Register `fd` for the specified `events` (a combination of `EPOLL*` flags). */
+        io::Result<std::monostate> add(int fd, uint32_t events, uint64_t token) const;
+
+        /** @brief Change the interest list of an already registered `fd`. */
+        io::Result<std::monostate> modify(int fd, uint32_t events, uint64_t token) const;
+
+        /** @brief Deregister `fd` from this epoll instance. */
+        io::Result<std::monostate> remove(int fd) const;
+
+        /**
+         * @brief Wait for at least one registered descriptor to become ready.
+         *
+         * If `timeout` is `std::nullopt`, this call blocks indefinitely. A wait interrupted by a
+         * signal handler returns 0 ready events instead of an error.
+         *
+         * @return The number of entries written to the front of `events`.
+         */
+        io::Result<size_t> wait(std::span<epoll_event> events, std::optional<std::chrono::milliseconds> timeout) const;
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
+    };
+
+    /**
+     * @brief A nonblocking `timerfd` driven by `CLOCK_MONOTONIC`.
+     */
+    class TimerFd : public NonConstructible
+    {
+    private:
+        OwnedFd _fd;
+
+        explicit TimerFd(OwnedFd &&fd);
+
+    public:
+        /** @brief Create a new disarmed timer. */
+        static io::Result<TimerFd> create();
+
+        /**
+         * @brief Arm the timer to expire after `initial`, then every `interval`.
+         *
+         * An `interval` of zero makes this a one-shot timer.
+         */
+        io::Result<std::monostate> arm(std::chrono::milliseconds initial, std::chrono::milliseconds interval) const;
+
+        /** @brief Stop the timer. Pending expirations are not cleared. */
+        io::Result<std::monostate> disarm() const;
+
+        /**
+         * @brief Consume and return the number of expirations since the last read.
+         *
+         * Returns an error of kind `WouldBlock` if the timer has not expired yet.
+         */
+        io::Result<uint64_t> read() const;
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
+    };
+
+    /**
+     * @brief A nonblocking `eventfd` used to wake up an epoll loop from another thread.
+     */
+    class EventFd : public NonConstructible
+    {
+    private:
+        OwnedFd _fd;
+
+        explicit EventFd(OwnedFd &&fd);
+
+    public:
+        /** @brief Create a new event counter initialized to zero. */
+        static io::Result<EventFd> create();
+
+        /** @brief Increment the counter, waking up any waiter. Safe to call from any thread. */
+        io::Result<std::monostate> notify() const;
+
+        /**
+         * @brief Consume and return the counter value, resetting it to zero.
+         *
+         * Returns an error of kind `WouldBlock` if the counter is zero.
+         */
+        io::Result<uint64_t> read() const;
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
+    };
+
+    /**
+     * @brief A nonblocking `signalfd` receiving a set of signals which are blocked for the calling thread.
+     *
+     * Create it before spawning any thread so that the signal mask is inherited and the signals
+     * are delivered to this descriptor only.
+     */
+    class SignalFd : public NonConstructible
+    {
+    private:
+        OwnedFd _fd;
+
+        explicit SignalFd(OwnedFd &&fd);
+
+    public:
+        /** @brief Block `signals` for the calling thread and route them to a new descriptor. */
+        static io::Result<SignalFd> create(std::initializer_list<int> signals);
+
+        /**
+         * @brief Consume one pending signal and return its number.
+         *
+         * Returns an error of kind `WouldBlock` if no signal is pending.
+         */
+        io::Result<int> read() const;
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
+    };
+
+    /**
+     * @brief A nonblocking `inotify` instance reporting changes to the entries of watched directories.
+     */
+    class InotifyFd : public NonConstructible
+    {
+    private:
+        OwnedFd _fd;
+
+        explicit InotifyFd(OwnedFd &&fd);
+
+    public:
+        /** @brief Create a new instance without any watch. */
+        static io::Result<InotifyFd> create();
+
+        /** @brief Watch `path` for the specified `events` (a combination of `IN_*` flags). */
+        io::Result<std::monostate> add_watch(const path::PathBuf &path, uint32_t events) const;
+
+        /**
+         * @brief Consume every pending event and return the names of the entries they refer to.
+         *
+         * Returns an error of kind `WouldBlock` if no event is pending.
+         */
+        io::Result<std::vector<std::string>> read() const;
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
+    };
+}
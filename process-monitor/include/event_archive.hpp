@@ -0,0 +1,141 @@
+#pragma once
+
+#include "event_store.hpp"
+
+namespace procmon
+{
+    /**
+     * @brief Append `values` to `out`, bit-packed to the width of the largest one (from 0 to 64 bits),
+     * as in the columns of an `EventArchive`.
+     */
+    void pack_bits(std::vector<char> &out, std::span<const uint64_t> values);
+
+    /**
+     * @brief Decode `rows` values packed by `pack_bits` at the start of `data`.
+     *
+     * @return The number of bytes read, or `std::nullopt` if `data` is truncated or malformed.
+     */
+    std::optional<size_t> unpack_bits(std::span<const char> data, uint64_t rows, std::vector<uint64_t> &values);
+
+    /**
+     * @brief Read-only columnar archive of a sealed `EventSegment`, for events which are no longer hot.
+     *
+     * Events are split into row groups of up to `GROUP_ROWS` events, and every row group stores each
+     * field in a column of its own:
+     * - timestamps, PIDs and sequence numbers as zigzag-encoded deltas to the previous row, in varints;
+     * - agents, process names, command lines, executables and cgroups as indexes (bit-packed to the
+     *   width of the largest one) into a dictionary of the distinct values of the row group;
+     * - metrics, severities, values, thresholds and UIDs bit-packed to the width of their largest value.
+     *
+     * Every column carries its own CRC-32C, and can be decoded without touching the others: scanning
+     * the values of one process only decodes the name, metric and value columns. The file is read
+     * through a memory mapping.
+     */
+    class EventArchive : public NonConstructible
+    {
+    public:
+        enum class Column : uint32_t
+        {
+            Timestamp,
+            Agent,
+            Sequence,
+            Severity,
+            Pid,
+            Name,
+            Metric,
+            Value,
+            Threshold,
+            /** @brief 1 if the process details were reported, 0 otherwise. */
+            HasDetails,
+            Uid,
+            Cmdline,
+            Exe,
+            Cgroup,
+        };
+
+        static constexpr size_t COLUMN_COUNT = static_cast<size_t>(Column::Cgroup) + 1;
+        /** @brief Maximum number of events in a row group. */
+        static constexpr size_t GROUP_ROWS = 65536;
+
+    private:
+        struct _ColumnRef
+        {
+            uint64_t offset;
+            uint64_t bytes;
+            uint32_t checksum;
+        };
+
+        struct _Group
+        {
+            uint64_t rows;
+            uint64_t min_ms;
+            uint64_t max_ms;
+            _ColumnRef columns[COLUMN_COUNT];
+        };
+
+        uint64_t _id;
+        path::PathBuf _path;
+        std::span<const char> _mapping;
+        std::vector<_Group> _groups;
+        uint64_t _rows;
+        uint64_t _min_ms;
+        uint64_t _max_ms;
+
+        explicit EventArchive(uint64_t id, path::PathBuf &&path, std::span<const char> mapping);
+
+        io::Result<std::monostate> _load();
+        io::Result<std::span<const char>> _column_data(size_t group, Column column) const;
+
+    public:
+        /** @brief Path of the archive of segment `id` in `directory`. */
+        static path::PathBuf path_of(const path::PathBuf &directory, uint64_t id);
+
+        /**
+         * @brief Write the archive of a sealed `segment`, next to its files.
+         *
+         * The archive is written to a temporary file, synced, and then renamed: it either exists
+         * complete or not at all.
+         */
+        static io::Result<std::monostate> write(EventSegment &segment, const path::PathBuf &directory);
+
+        /** @brief Map the archive of segment `id` in `directory`, and check its layout. */
+        static io::Result<std::unique_ptr<EventArchive>> open(const path::PathBuf &directory, uint64_t id);
+
+        ~EventArchive();
+
+        /**
+         * @brief Decode one column of a row group.
+         *
+         * Numeric columns (including `Agent`) yield their values. The other dictionary-encoded columns
+         * yield indexes into `dictionary(group, column)`.
+         */
+        io::Result<std::vector<uint64_t>> column(size_t group, Column column) const;
+
+        /** @brief The distinct values of a string column (`Name`, `Cmdline`, `Exe` or `Cgroup`) in a row group. */
+        io::Result<std::vector<std::string>> dictionary(size_t group, Column column) const;
+
+        /**
+         * @brief Call `visitor` for every archived event matching `query`, in storage order, until it
+         * returns `false`.
+         *
+         * Only the columns needed by the filters are decoded for row groups without any match.
+         *
+         * @return The number of events visited.
+         */
+        io::Result<size_t> query(const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor) const;
+
+        /** @brief Delete the file of this archive. The archive stays readable until destroyed. */
+        void remove();
+
+        uint64_t id() const { return _id; }
+        size_t groups() const { return _groups.size(); }
+        /** @brief Number of events in a row group. */
+        uint64_t rows(size_t group) const { return _groups[group].rows; }
+        /** @brief Number of events. */
+        uint64_t size() const { return _rows; }
+        /** @brief Size of the file, in bytes. */
+        uint64_t bytes() const { return _mapping.size(); }
+        uint64_t min_ms() const { return _min_ms; }
+        uint64_t max_ms() const { return _max_ms; }
+    };
+}
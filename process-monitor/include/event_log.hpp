@@ -0,0 +1,566 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "fs.hpp"
+#include "protocol.hpp"
+
+namespace procmon
+{
+    struct EventLogOptions
+    {
+        /** @brief Upper bound on the size of a single write to the log file. */
+        size_t batch_bytes = 1024 * 1024;
+        /** @brief Written records are synced to disk at least this often. 0 syncs after every write. */
+        std::chrono::milliseconds sync_interval = std::chrono::milliseconds(1000);
+        /** @brief Written records are also synced as soon as this many bytes are pending. */
+        size_t sync_bytes = 4 * 1024 * 1024;
+        /** @brief Number of records which can be queued for the writer. Rounded up to a power of 2. */
+        size_t queue_capacity = 16384;
+    };
+
+    /**
+     * @brief Receives the stored form of the records of an `EventLog`, from its writer thread.
+     *
+     * Records reach the sink in log order, and `sync` is called whenever the log itself is synced,
+     * so that a sink can group its own writes with the ones of the log.
+     */
+    class EventSink
+    {
+    public:
+        virtual ~EventSink() = default;
+
+        /** @brief Write a record encoded by the producer with `EventRecord::store`. */
+        virtual void append(std::span<const char> record) = 0;
+
+        /** @brief Make every record appended so far durable. */
+        virtual void sync() = 0;
+    };
+
+    /** @brief Text reported by a monitored process, appended to an `EventRecord` or a stream escaped. */
+    struct Escaped
+    {
+        std::string_view text;
+    };
+
+    /**
+     * @brief Append `text` with backslashes doubled and control characters as `\xNN`, so that a
+     * process cannot break or forge the lines of a log through its name or command line.
+     */
+    inline void append_escaped(std::string &out, std::string_view text)
+    {
+        static const char HEX[] = "0123456789abcdef";
+        for (unsigned char c : text)
+        {
+            if (c == '\\')
+            {
+                out.append("\\\\");
+            }
+            else if (c < 0x20 || c == 0x7f)
+            {
+                char code[] = {'\\', 'x', HEX[c >> 4], HEX[c & 0xf]};
+                out.append(code, sizeof(code));
+            }
+            else
+            {
+                out.push_back(static_cast<char>(c));
+            }
+        }
+    }
+
+    inline std::ostream &operator<<(std::ostream &stream, Escaped escaped)
+    {
+        std::string text;
+        append_escaped(text, escaped.text);
+        return stream << text;
+    }
+
+    /** @brief A violation report carried by a record, acknowledged once the record is synced. */
+    struct LoggedReport
+    {
+        DeliveryLedger *ledger;
+        uint64_t agent_id;
+        Severity severity;
+        uint64_t sequence;
+    };
+
+    /**
+     * @brief A log line being formatted in place, inside the queue slot which will carry it to the writer.
+     *
+     * Integers are formatted with `std::to_chars`: no locale, no stream state, no allocation once the
+     * slot has grown to its working size.
+     */
+    class EventRecord
+    {
+    private:
+        std::string &_text;
+        std::string *_stored;
+        std::optional<LoggedReport> *_report;
+
+    public:
+        explicit EventRecord(std::string &text, std::string *stored = nullptr, std::optional<LoggedReport> *report = nullptr)
+            : _text(text), _stored(stored), _report(report) {}
+
+        /**
+         * @brief Attach a stored form to this record, encoded by `encode(std::string &)`.
+         *
+         * `encode` is only called if the log has an `EventSink`.
+         */
+        template <typename F>
+        void store(F &&encode)
+        {
+            if (_stored != nullptr)
+            {
+                encode(*_stored);
+            }
+        }
+
+        /**
+         * @brief Mark report `sequence` of `agent_id` as durable in `ledger` once this record is
+         * synced, so that it is only acknowledged then.
+         */
+        void deliver(DeliveryLedger &ledger, uint64_t agent_id, Severity severity, uint64_t sequence)
+        {
+            if (_report != nullptr)
+            {
+                _report->emplace(LoggedReport{&ledger, agent_id, severity, sequence});
+            }
+        }
+
+        EventRecord &operator<<(std::string_view text)
+        {
+            _text.append(text);
+            return *this;
+        }
+
+        EventRecord &operator<<(char c)
+        {
+            _text.push_back(c);
+            return *this;
+        }
+
+        /** @brief Append text escaped as by `append_escaped`. */
+        EventRecord &operator<<(Escaped escaped)
+        {
+            append_escaped(_text, escaped.text);
+            return *this;
+        }
+
+        template <std::integral T>
+        EventRecord &operator<<(T value)
+        {
+            char buffer[24];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            _text.append(buffer, result.ptr);
+            return *this;
+        }
+    };
+
+    /**
+     * @brief Append-only log of the events received by CTB, written by a dedicated thread.
+     *
+     * Receivers format each record directly into a slot of a bounded lock-free queue (one producer
+     * ticket per record, so the log has a single total order), and return to their connections. The
+     * writer thread drains the queue into large sequential writes, and syncs them to disk in groups,
+     * bounded by `EventLogOptions::sync_interval` and `EventLogOptions::sync_bytes`. Producers only
+     * wait when the queue is full, i.e. when the disk cannot keep up. The reports carried by the
+     * records are marked durable in their `DeliveryLedger` after each sync.
+     *
+     * Without a path, records are written to the standard output and never synced.
+     */
+    class EventLog : public NonConstructible
+    {
+    private:
+        static constexpr std::chrono::milliseconds LINGER = std::chrono::milliseconds(1);
+        // Delay before a failed write or sync is tried again.
+        static constexpr std::chrono::milliseconds RETRY_INTERVAL = std::chrono::milliseconds(1000);
+
+        struct _Slot
+        {
+            std::atomic<size_t> sequence;
+            std::string text;
+            std::string stored;
+            std::optional<LoggedReport> report;
+        };
+
+        EventLogOptions _options;
+        std::optional<fs::File> _file;
+        EventSink *_sink;
+
+        std::unique_ptr<_Slot[]> _slots;
+        size_t _mask;
+        alignas(64) std::atomic<size_t> _enqueue_position;
+        alignas(64) size_t _dequeue_position;
+
+        std::atomic_bool _sleeping;
+        std::atomic_bool _stopping;
+        // Whether the last write (sync) failed, so that a failure is reported once and not on every retry.
+        bool _write_failed;
+        bool _sync_failed;
+        std::mutex _mutex;
+        std::condition_variable _wakeup;
+        std::thread _writer;
+
+        explicit EventLog(std::optional<fs::File> &&file, const EventLogOptions &options, EventSink *sink)
+            : NonConstructible(NonConstructibleTag::TAG),
+              _options(options),
+              _file(std::move(file)),
+              _sink(sink),
+              _dequeue_position(0),
+              _sleeping(false),
+              _stopping(false),
+              _write_failed(false),
+              _sync_failed(false)
+        {
+            size_t capacity = 1;
+            while (capacity < std::max<size_t>(_options.queue_capacity, 2))
+            {
+                capacity <<= 1;
+            }
+
+            _slots = std::make_unique<_Slot[]>(capacity);
+            _mask = capacity - 1;
+            for (size_t i = 0; i < capacity; i++)
+            {
+                _slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+
+            _enqueue_position.store(0, std::memory_order_relaxed);
+            _writer = std::thread(&EventLog::_run, this);
+        }
+
+        bool _has_pending() const
+        {
+            return _slots[_dequeue_position & _mask].sequence.load(std::memory_order_acquire) == _dequeue_position + 1;
+        }
+
+        /** @return The number of bytes of `batch` written: less than its size if a write failed. */
+        size_t _write(const std::vector<char> &batch)
+        {
+            if (!_file.has_value())
+            {
+                std::cout.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+                std::cout.flush();
+                return batch.size();
+            }
+
+            size_t offset = 0;
+            while (offset < batch.size())
+            {
+                auto written = _file->write(std::span<const char>(batch.data() + offset, batch.size() - offset));
+                if (written.is_err())
+                {
+                    if (written.unwrap_err().kind() == io::ErrorKind::Interrupted)
+                    {
+                        continue;
+                    }
+
+                    if (!_write_failed)
+                    {
+                        std::cerr << "Failed to write " << batch.size() - offset << " bytes to the event log, retrying: " << written.unwrap_err().message() << std::endl;
+                    }
+
+                    _write_failed = true;
+                    return offset;
+                }
+
+                offset += written.unwrap();
+            }
+
+            if (_write_failed)
+            {
+                std::cerr << "Resumed writing the event log" << std::endl;
+            }
+
+            _write_failed = false;
+            return offset;
+        }
+
+        /** @return `false` if the log file could not be synced. */
+        bool _sync()
+        {
+            if (_sink != nullptr)
+            {
+                _sink->sync();
+            }
+
+            if (_file.has_value())
+            {
+                auto sync = _file->sync_data();
+                if (sync.is_err())
+                {
+                    if (!_sync_failed)
+                    {
+                        std::cerr << "Failed to sync the event log, retrying: " << sync.unwrap_err().message() << std::endl;
+                    }
+
+                    _sync_failed = true;
+                    return false;
+                }
+            }
+
+            _sync_failed = false;
+            return true;
+        }
+
+        void _run()
+        {
+            std::vector<char> batch;
+            batch.reserve(_options.batch_bytes);
+
+            // Reports carried by the records of `batch`, with the offset at which their record ends,
+            // then the reports of every record written since the last sync.
+            std::deque<std::pair<size_t, LoggedReport>> batch_reports;
+            std::vector<LoggedReport> unsynced_reports;
+
+            size_t unsynced = 0;
+            auto last_sync = std::chrono::steady_clock::now();
+            while (true)
+            {
+                // Read before draining: everything appended before the destructor was called gets written.
+                bool stopping = _stopping.load();
+
+                while (batch.size() < _options.batch_bytes && _has_pending())
+                {
+                    auto &slot = _slots[_dequeue_position & _mask];
+                    batch.insert(batch.end(), slot.text.begin(), slot.text.end());
+                    if (_sink != nullptr && !slot.stored.empty())
+                    {
+                        _sink->append(std::span<const char>(slot.stored.data(), slot.stored.size()));
+                    }
+
+                    if (slot.report.has_value())
+                    {
+                        batch_reports.emplace_back(batch.size(), slot.report.value());
+                    }
+
+                    slot.sequence.store(_dequeue_position + _mask + 1, std::memory_order_release);
+                    _dequeue_position++;
+                }
+
+                bool drained = batch.size() < _options.batch_bytes;
+                bool wrote = !batch.empty();
+                if (wrote)
+                {
+                    // What could not be written stays at the front of the batch, and is retried before
+                    // anything queued after it: a report is never acknowledged ahead of an earlier one.
+                    auto written = _write(batch);
+                    while (!batch_reports.empty() && batch_reports.front().first <= written)
+                    {
+                        unsynced_reports.push_back(batch_reports.front().second);
+                        batch_reports.pop_front();
+                    }
+
+                    for (auto &[end, report] : batch_reports)
+                    {
+                        end -= written;
+                    }
+
+                    batch.erase(batch.begin(), batch.begin() + static_cast<std::ptrdiff_t>(written));
+                    unsynced += written;
+                }
+
+                bool failed = !batch.empty();
+                auto now = std::chrono::steady_clock::now();
+                if (unsynced > 0 && (unsynced >= _options.sync_bytes || now - last_sync >= _options.sync_interval || (stopping && (drained || failed))))
+                {
+                    // After a failed sync, the records are kept unacknowledged and synced again later.
+                    if (_sync())
+                    {
+                        for (const auto &report : unsynced_reports)
+                        {
+                            report.ledger->mark_durable(report.agent_id, report.severity, report.sequence);
+                        }
+
+                        // Records hardly ever carry reports of more than one ledger.
+                        DeliveryLedger *published = nullptr;
+                        for (const auto &report : unsynced_reports)
+                        {
+                            if (report.ledger != published)
+                            {
+                                published = report.ledger;
+                                published->publish_durable();
+                            }
+                        }
+
+                        unsynced_reports.clear();
+                        unsynced = 0;
+                    }
+
+                    last_sync = now;
+                }
+
+                if (failed)
+                {
+                    if (stopping)
+                    {
+                        std::cerr << "Giving up on " << batch.size() << " bytes of the event log" << std::endl;
+                        return;
+                    }
+
+                    std::unique_lock lock(_mutex);
+                    _wakeup.wait_for(
+                        lock,
+                        RETRY_INTERVAL,
+                        [this]
+                        { return _stopping.load(); });
+                    continue;
+                }
+
+                if (!drained)
+                {
+                    continue;
+                }
+
+                if (stopping)
+                {
+                    return;
+                }
+
+                std::unique_lock lock(_mutex);
+                if (wrote)
+                {
+                    // Under load, let records accumulate for a moment instead of being woken up by each of them.
+                    _wakeup.wait_for(
+                        lock,
+                        LINGER,
+                        [this]
+                        { return _stopping.load(); });
+                    continue;
+                }
+
+                // Pairs with the fence in `append`: either the producer sees `_sleeping` and wakes us up,
+                // or we see its record here.
+                _sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                auto timeout = unsynced > 0 ? last_sync + _options.sync_interval - now : _options.sync_interval;
+                _wakeup.wait_for(
+                    lock,
+                    std::max<std::chrono::steady_clock::duration>(timeout, std::chrono::milliseconds(1)),
+                    [this]
+                    { return _stopping.load() || _has_pending(); });
+
+                _sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+
+    public:
+        /**
+         * @brief Open (or create) the log at `path` in append mode, or log to the standard output if
+         * `path` is `std::nullopt`, and start the writer thread.
+         *
+         * If `sink` is not null, it receives the stored form of the records and must outlive the log.
+         */
+        static io::Result<std::unique_ptr<EventLog>> open(const std::optional<path::PathBuf> &path, const EventLogOptions &options, EventSink *sink = nullptr)
+        {
+            std::optional<fs::File> file;
+            if (path.has_value())
+            {
+                fs::OpenOptions open_options;
+                file.emplace(SHORT_CIRCUIT(std::unique_ptr<EventLog>, open_options.append(true).create(true).open(path.value())));
+            }
+
+            return io::Result<std::unique_ptr<EventLog>>::ok(std::unique_ptr<EventLog>(new EventLog(std::move(file), options, sink)));
+        }
+
+        /** @brief Write and sync every record appended so far, then stop the writer thread. */
+        ~EventLog()
+        {
+            {
+                std::lock_guard lock(_mutex);
+                _stopping.store(true);
+            }
+
+            _wakeup.notify_one();
+            _writer.join();
+        }
+
+        /**
+         * @brief Append a record, formatted by `format(EventRecord &)` directly into the queue.
+         *
+         * Safe to call from any thread. A newline is added after the record.
+         */
+        template <typename F>
+        void append(F &&format)
+        {
+            auto position = _enqueue_position.load(std::memory_order_relaxed);
+            _Slot *slot = nullptr;
+            while (true)
+            {
+                slot = &_slots[position & _mask];
+                auto sequence = slot->sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+                if (difference == 0)
+                {
+                    if (_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else
+                {
+                    // The queue is full: wait for the writer to free this slot.
+                    if (difference < 0)
+                    {
+                        std::this_thread::yield();
+                    }
+
+                    position = _enqueue_position.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->text.clear();
+            slot->stored.clear();
+            slot->report.reset();
+            EventRecord record(slot->text, _sink != nullptr ? &slot->stored : nullptr, &slot->report);
+            format(record);
+            slot->text.push_back('\n');
+            slot->sequence.store(position + 1, std::memory_order_release);
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_sleeping.load(std::memory_order_relaxed))
+            {
+                std::lock_guard lock(_mutex);
+                _wakeup.notify_one();
+            }
+        }
+    };
+
+    /** @brief The log line of a violation report received from `peer`. */
+    inline void format_violation(EventRecord &record, std::string_view peer, const ViolationMessage &violation, const std::optional<ProcessDetails> &details)
+    {
+        const auto &info = violation.info;
+        auto name = reinterpret_cast<const char *>(info.name);
+        record << "Received violation from " << peer << ": PID=" << info.pid
+               << ", Process=" << Escaped{std::string_view(name, strnlen(name, sizeof(info.name)))}
+               << ", Metric=" << static_cast<int>(info.violation.metric)
+               << ", Value=" << info.violation.value
+               << ", Threshold=" << info.violation.threshold
+               << ", Severity=" << static_cast<int>(violation.severity);
+        if (details.has_value())
+        {
+            record << ", Uid=" << details->uid
+                   << ", Exe=" << Escaped{details->exe}
+                   << ", Cgroup=" << Escaped{details->cgroup}
+                   << ", Cmdline=" << Escaped{details->cmdline};
+        }
+    }
+
+    /** @brief The log line of a telemetry report received from `peer`. */
+    inline void format_telemetry(EventRecord &record, std::string_view peer, const TelemetryMessage &telemetry)
+    {
+        // Telemetry is rare enough to go through the stream formatting of the agent report.
+        std::ostringstream text;
+        text << telemetry;
+        record << "Telemetry from " << peer << ": " << std::string_view(text.str());
+    }
+}
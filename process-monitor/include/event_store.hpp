@@ -0,0 +1,287 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <thread>
+#include <unordered_map>
+
+#include "event_log.hpp"
+#include "fs.hpp"
+#include "protocol.hpp"
+
+namespace procmon
+{
+    class EventArchive;
+
+    /** @brief CRC-32C (Castagnoli) of `data`, as used by the files of the event store. */
+    uint32_t crc32c(std::span<const char> data);
+
+    /**
+     * @brief Selects events from an `EventStore`. Every field which is set must match.
+     */
+    struct EventQuery
+    {
+        std::optional<uint64_t> agent_id;
+        /** @brief Process name, as reported by the agent (at most `COMMAND_LENGTH` bytes). */
+        std::optional<std::string> name;
+        std::optional<Metric> metric;
+        /** @brief Inclusive range of reception times, in milliseconds since the Unix epoch. */
+        uint64_t from_ms = 0;
+        uint64_t to_ms = UINT64_MAX;
+    };
+
+    /** @brief A violation report, as stored by CTB. */
+    struct StoredEvent
+    {
+        /** @brief Reception time, in milliseconds since the Unix epoch. */
+        uint64_t timestamp_ms;
+        uint64_t agent_id;
+        ViolationMessage violation;
+        std::optional<ProcessDetails> details;
+    };
+
+    /**
+     * @brief One segment of an `EventStore`: a pair of append-only data and index files.
+     *
+     * Records are appended to `<id>.dat` as `[uint32_t length][uint32_t crc32c][uint64_t timestamp]
+     * [uint64_t agent_id][body]`, where the body is the one of the `Violation` frame and the checksum
+     * covers everything after itself. Records are grouped into blocks of up to `BLOCK_EVENTS` events;
+     * when a block is complete, one sparse index entry is appended to `<id>.idx`, listing the
+     * agents, process names, metrics and time buckets found in the block.
+     *
+     * The index entries of every block are kept in memory as posting lists, so that a query only
+     * reads the blocks which can hold a match. Index entries are written after the data they refer to
+     * is synced; on `open`, torn or corrupt records at the end of the data, and index entries which
+     * do not match the data, are truncated and the missing entries are rebuilt from the data.
+     *
+     * Once sealed, a segment never changes and is read through a memory mapping.
+     */
+    class EventSegment : public NonConstructible
+    {
+    private:
+        struct _Block
+        {
+            uint64_t offset;
+            uint64_t bytes;
+            uint32_t count;
+            uint32_t metrics;
+            uint64_t min_ms;
+            uint64_t max_ms;
+        };
+
+        /** @brief Keys of the events of the block being filled, not indexed yet. */
+        struct _OpenBlock
+        {
+            _Block block;
+            uint32_t first_checksum;
+            std::vector<uint64_t> agents;
+            std::vector<std::string> names;
+            std::vector<uint64_t> buckets;
+        };
+
+        uint64_t _id;
+        path::PathBuf _data_path;
+        path::PathBuf _index_path;
+        fs::File _data;
+        fs::File _index;
+
+        mutable std::mutex _mutex;
+        /** @brief Size of the data including `_pending_data`, which the index already refers to. */
+        uint64_t _data_size;
+        std::vector<char> _pending_data;
+        /** @brief Whether the last write failed, in which case only `_sync` retries it. */
+        bool _write_failed;
+        uint64_t _dropped;
+        std::vector<char> _pending_index;
+        uint64_t _events;
+        uint64_t _min_ms;
+        uint64_t _max_ms;
+        std::span<const char> _mapping;
+
+        std::vector<_Block> _blocks;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> _by_agent;
+        std::unordered_map<std::string, std::vector<uint32_t>> _by_name;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> _by_metric;
+        std::map<uint64_t, std::vector<uint32_t>> _by_bucket;
+        _OpenBlock _open;
+
+        explicit EventSegment(uint64_t id, path::PathBuf &&data_path, path::PathBuf &&index_path, fs::File &&data, fs::File &&index);
+
+        void _add(std::span<const char> record);
+        void _seal_block();
+        void _index_block(const _OpenBlock &open);
+        bool _flush_data();
+        bool _sync();
+        io::Result<std::monostate> _map();
+        io::Result<std::monostate> _recover(bool writable);
+        io::Result<size_t> _scan_block(const _Block &block, const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor, bool &stopped);
+
+    public:
+        /** @brief Maximum number of events in a block, i.e. read by a query for each candidate block. */
+        static constexpr uint32_t BLOCK_EVENTS = 4096;
+        /** @brief A block is also complete as soon as it holds this many bytes. */
+        static constexpr uint64_t BLOCK_BYTES = 1024 * 1024;
+        /** @brief Records which could not be written are kept up to this size, then new ones are dropped. */
+        static constexpr uint64_t MAX_PENDING_BYTES = 64 * BLOCK_BYTES;
+        /** @brief Granularity of the time index, in milliseconds. */
+        static constexpr uint64_t BUCKET_MS = 60 * 1000;
+
+        /**
+         * @brief Open (or create) segment `id` in `directory`, recovering from an interrupted write.
+         *
+         * A non-empty `suffix` is appended to the file names, for a segment being built to replace another.
+         */
+        static io::Result<std::unique_ptr<EventSegment>> open(const path::PathBuf &directory, uint64_t id, const std::string &suffix = "");
+
+        /**
+         * @brief Open segment `id` in `directory` for reading only, e.g. while CTB is writing to it.
+         *
+         * Nothing is written: torn or corrupt records at the end of the data are ignored instead of
+         * truncated, and missing index entries are only rebuilt in memory. The valid part of the data
+         * is mapped, as for a sealed segment. The segment must not be appended to.
+         */
+        static io::Result<std::unique_ptr<EventSegment>> open_read_only(const path::PathBuf &directory, uint64_t id);
+
+        /**
+         * @brief Encode the record of a `Violation` frame body received at `timestamp_ms` from `agent_id`.
+         *
+         * Meant to be called by the receivers through `EventRecord::store`, so that the checksum is
+         * computed on their threads.
+         */
+        static void encode(std::string &out, uint64_t timestamp_ms, uint64_t agent_id, std::span<const char> body);
+
+        /** @brief Reception time of a record produced by `encode`. */
+        static uint64_t timestamp_of(std::span<const char> record);
+
+        ~EventSegment();
+
+        /** @brief Buffer a record produced by `encode`. */
+        void append(std::span<const char> record);
+
+        /** @brief Write and sync the buffered records, then the index entries of the completed blocks. */
+        void sync();
+
+        /** @brief Index the last block, sync everything and map the data for reading. */
+        io::Result<std::monostate> seal();
+
+        /**
+         * @brief Rewrite this sealed segment without its events received before `cutoff_ms`.
+         *
+         * The rewritten files atomically replace the ones of this segment, which stays readable
+         * until destroyed.
+         */
+        io::Result<std::unique_ptr<EventSegment>> compact(uint64_t cutoff_ms);
+
+        /** @brief Delete the files of this segment. A sealed segment stays readable until destroyed. */
+        void remove();
+
+        /**
+         * @brief Call `visitor` for every event of this segment matching `query`, in storage order,
+         * until it returns `false`.
+         *
+         * @return The number of events visited.
+         */
+        io::Result<size_t> query(const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor);
+
+        uint64_t id() const { return _id; }
+        bool sealed() const;
+        /** @brief Number of events. */
+        uint64_t size() const;
+        /** @brief Size of the data, in bytes. */
+        uint64_t bytes() const;
+        /** @brief Earliest reception time, or `UINT64_MAX` if the segment is empty. */
+        uint64_t min_ms() const;
+        /** @brief Latest reception time, or 0 if the segment is empty. */
+        uint64_t max_ms() const;
+    };
+
+    struct EventStoreOptions
+    {
+        /** @brief A new segment is started when the active one would grow past this size. */
+        uint64_t segment_bytes = 256 * 1024 * 1024;
+        /** @brief A new segment is also started for every period of this length. 0 disables time partitioning. */
+        std::chrono::hours segment_duration = std::chrono::hours(1);
+        /** @brief The oldest segments are deleted while the store is larger than this. 0 keeps everything. */
+        uint64_t retention_bytes = 0;
+        /** @brief Events older than this are deleted. 0 keeps everything. */
+        std::chrono::hours retention_age = std::chrono::hours(0);
+        /** @brief Sealed segments whose events are all older than this are converted to an `EventArchive`. 0 disables archiving. */
+        std::chrono::hours archive_age = std::chrono::hours(0);
+        /** @brief How often retention and archiving are applied. */
+        std::chrono::milliseconds maintenance_interval = std::chrono::milliseconds(10000);
+    };
+
+    /**
+     * @brief Append-only binary store of the violation reports received by CTB, indexed for lookups.
+     *
+     * Events are written to a sequence of `EventSegment`, rolled over by size and by time period. On
+     * roll-over, the writer swaps in a spare segment prepared in advance, and leaves the sealing of
+     * the previous one to a maintenance thread, which also applies retention: expired segments are
+     * deleted, and segments which only partly expired are compacted. Segments past
+     * `EventStoreOptions::archive_age` are converted to the much smaller `EventArchive` format, and
+     * archives are only deleted once all of their events expired.
+     *
+     * Records are written by a single thread (the writer of the `EventLog` feeding the store), and
+     * queries may run concurrently from any thread.
+     */
+    class EventStore : public NonConstructible, public EventSink
+    {
+    private:
+        path::PathBuf _directory;
+        EventStoreOptions _options;
+
+        mutable std::mutex _mutex;
+        std::vector<std::shared_ptr<EventArchive>> _archives;
+        std::vector<std::shared_ptr<EventSegment>> _segments;
+        std::vector<std::shared_ptr<EventSegment>> _rolled;
+        std::shared_ptr<EventSegment> _spare;
+        uint64_t _next_id;
+        bool _want_spare;
+        bool _stopping;
+        std::condition_variable _wakeup;
+        std::thread _maintenance;
+
+        // Only used by the writer thread.
+        std::shared_ptr<EventSegment> _active;
+        uint64_t _active_bytes;
+        uint64_t _active_period;
+
+        explicit EventStore(const path::PathBuf &directory, const EventStoreOptions &options);
+
+        uint64_t _period_of(uint64_t timestamp_ms) const;
+        io::Result<std::shared_ptr<EventSegment>> _create_segment();
+        void _roll();
+        void _apply_retention();
+        void _archive_cold();
+        void _run();
+
+    public:
+        /**
+         * @brief Open (or create) the store in `directory`, recovering from an interrupted write.
+         */
+        static io::Result<std::unique_ptr<EventStore>> open(const path::PathBuf &directory, const EventStoreOptions &options);
+
+        ~EventStore() override;
+
+        /** @brief Write a record produced by `EventSegment::encode`, rolling over to a new segment if needed. */
+        void append(std::span<const char> record) override;
+
+        /** @brief Sync the active segment. Rolled over segments are synced when sealed. */
+        void sync() override;
+
+        /**
+         * @brief Call `visitor` for every stored event matching `query`, in storage order, until it
+         * returns `false`.
+         *
+         * @return The number of events visited.
+         */
+        io::Result<size_t> query(const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor);
+
+        /** @brief Number of stored events. */
+        uint64_t size() const;
+
+        /** @brief Number of segments, including the active one and the archived ones. */
+        size_t segments() const;
+    };
+}
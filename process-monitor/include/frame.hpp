@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vector>
+
+#include "net.hpp"
+
+namespace procmon
+{
+    /**
+     * @brief Incremental decoder for length-prefixed frames (`[uint32_t length][payload]`).
+     *
+     * Incoming bytes are read in large chunks into a single receive buffer which is reused for the
+     * whole lifetime of the connection, so one `read` may yield several frames. A length prefix
+     * larger than the configured maximum is reported as an error before anything is allocated for it.
+     *
+     * Spans returned by `next` point into the receive buffer and are only valid until the next call
+     * to `fill`, `read_frame` or `reset`.
+     */
+    class FrameDecoder
+    {
+    private:
+        size_t _max_frame_size;
+        size_t _chunk_size;
+        std::vector<char> _buffer;
+        size_t _start;
+        size_t _end;
+
+    public:
+        static constexpr size_t DEFAULT_MAX_FRAME_SIZE = 1024 * 1024;
+        static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+        explicit FrameDecoder(size_t max_frame_size = DEFAULT_MAX_FRAME_SIZE, size_t chunk_size = DEFAULT_CHUNK_SIZE)
+            : _max_frame_size(max_frame_size), _chunk_size(chunk_size), _start(0), _end(0) {}
+
+        /**
+         * @brief Perform a single `read` from `stream` into the receive buffer.
+         *
+         * @return The number of bytes read, 0 meaning that the peer closed the connection. Errors
+         * of the stream (including `WouldBlock` and `TimedOut`) are returned as-is and leave any
+         * partially received frame in place.
+         */
+        io::Result<size_t> fill(net::TcpStream &stream)
+        {
+            // Move the unconsumed tail to the front before reading more.
+            if (_start > 0)
+            {
+                std::memmove(_buffer.data(), _buffer.data() + _start, _end - _start);
+                _end -= _start;
+                _start = 0;
+            }
+
+            if (_buffer.size() - _end < _chunk_size)
+            {
+                _buffer.resize(_end + _chunk_size);
+            }
+
+            auto size = SHORT_CIRCUIT(size_t, stream.read(std::span<char>(_buffer.data() + _end, _buffer.size() - _end)));
+            _end += size;
+            return io::Result<size_t>::ok(std::move(size));
+        }
+
+        /**
+         * @brief Extract the next complete frame from the data received so far.
+         *
+         * @return The payload of the frame, or `std::nullopt` if more data is needed. An error of kind
+         * `InvalidData` is returned if the peer announced a frame larger than the maximum size.
+         */
+        io::Result<std::optional<std::span<const char>>> next()
+        {
+            using R = io::Result<std::optional<std::span<const char>>>;
+
+            uint32_t length = 0;
+            if (_end - _start < sizeof(length))
+            {
+                return R::ok(std::nullopt);
+            }
+
+            std::memcpy(&length, _buffer.data() + _start, sizeof(length));
+            if (length > _max_frame_size)
+            {
+                return R::err(io::Error(io::ErrorKind::InvalidData, std::format("Frame of {} bytes exceeds the limit of {} bytes", length, _max_frame_size)));
+            }
+
+            if (_end - _start - sizeof(length) < length)
+            {
+                return R::ok(std::nullopt);
+            }
+
+            std::span<const char> payload(_buffer.data() + _start + sizeof(length), length);
+            _start += sizeof(length) + length;
+            return R::ok(std::move(payload));
+        }
+
+        /**
+         * @brief Block until a complete frame is available, reading from `stream` as needed.
+         *
+         * A timeout reported by the stream is returned as an error, and the partially received frame
+         * is kept so that a later call resumes where this one stopped.
+         */
+        io::Result<std::span<const char>> read_frame(net::TcpStream &stream)
+        {
+            while (true)
+            {
+                auto frame = SHORT_CIRCUIT(std::span<const char>, next());
+                if (frame.has_value())
+                {
+                    return io::Result<std::span<const char>>::ok(std::move(frame.value()));
+                }
+
+                auto size = SHORT_CIRCUIT(std::span<const char>, fill(stream));
+                if (size == 0)
+                {
+                    return io::Result<std::span<const char>>::err(io::Error(io::ErrorKind::UnexpectedEof, "Connection closed by peer"));
+                }
+            }
+        }
+
+        /** @brief Discard all buffered data, e.g. after reconnecting. The receive buffer is kept. */
+        void reset()
+        {
+            _start = 0;
+            _end = 0;
+        }
+    };
+}
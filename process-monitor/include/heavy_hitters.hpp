@@ -0,0 +1,453 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.hpp"
+
+namespace procmon
+{
+    /**
+     * @brief Space-Saving summary of the most frequent keys of a stream, in at most `capacity` counters.
+     *
+     * Once all counters are taken, a new key replaces the one with the lowest count and inherits
+     * that count as its error, so a count never underestimates and overestimates by at most the
+     * error. Counters are kept in a "stream summary": a list of buckets of equal counts, ordered by
+     * count, so that every update is O(1).
+     */
+    class SpaceSaving
+    {
+    public:
+        struct Key
+        {
+            uint64_t agent_id;
+            std::array<char, COMMAND_LENGTH> name;
+
+            bool operator==(const Key &other) const = default;
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key &key) const
+            {
+                static_assert(COMMAND_LENGTH == 2 * sizeof(uint64_t));
+                uint64_t name[2];
+                std::memcpy(name, key.name.data(), sizeof(name));
+
+                auto hash = (key.agent_id ^ name[0]) * 0x9e3779b97f4a7c15 + name[1];
+                hash *= 0xbf58476d1ce4e5b9;
+                return static_cast<size_t>(hash ^ (hash >> 31));
+            }
+        };
+
+    private:
+        static constexpr uint32_t NIL = UINT32_MAX;
+
+        struct _Counter
+        {
+            Key key;
+            uint64_t error;
+            uint32_t bucket;
+            /** @brief Neighbours in the bucket. */
+            uint32_t previous;
+            uint32_t next;
+        };
+
+        struct _Bucket
+        {
+            uint64_t count;
+            uint32_t first_counter;
+            /** @brief Neighbours in the list of buckets, by increasing count. */
+            uint32_t previous;
+            uint32_t next;
+        };
+
+        size_t _capacity;
+        std::vector<_Counter> _counters;
+        std::vector<_Bucket> _buckets;
+        std::vector<uint32_t> _free_buckets;
+        uint32_t _min_bucket;
+        /** @brief Open-addressing table of counter indexes, at most half full, so that evictions never allocate. */
+        std::vector<uint32_t> _index;
+
+        size_t _slot_of(const Key &key) const
+        {
+            auto mask = _index.size() - 1;
+            auto slot = KeyHash()(key) & mask;
+            while (_index[slot] != NIL && _counters[_index[slot]].key != key)
+            {
+                slot = (slot + 1) & mask;
+            }
+
+            return slot;
+        }
+
+        /** @brief Empty `slot`, moving back the entries which probed past it. */
+        void _erase_slot(size_t slot)
+        {
+            auto mask = _index.size() - 1;
+            auto hole = slot;
+            for (auto next = (hole + 1) & mask; _index[next] != NIL; next = (next + 1) & mask)
+            {
+                auto home = KeyHash()(_counters[_index[next]].key) & mask;
+                if (((next - home) & mask) >= ((next - hole) & mask))
+                {
+                    _index[hole] = _index[next];
+                    hole = next;
+                }
+            }
+
+            _index[hole] = NIL;
+        }
+
+        uint32_t _new_bucket(uint64_t count, uint32_t previous, uint32_t next)
+        {
+            uint32_t id;
+            if (_free_buckets.empty())
+            {
+                id = static_cast<uint32_t>(_buckets.size());
+                _buckets.emplace_back();
+            }
+            else
+            {
+                id = _free_buckets.back();
+                _free_buckets.pop_back();
+            }
+
+            _buckets[id] = {count, NIL, previous, next};
+            (previous == NIL ? _min_bucket : _buckets[previous].next) = id;
+            if (next != NIL)
+            {
+                _buckets[next].previous = id;
+            }
+
+            return id;
+        }
+
+        void _attach(uint32_t counter, uint32_t bucket)
+        {
+            auto &c = _counters[counter];
+            auto &b = _buckets[bucket];
+            c.bucket = bucket;
+            c.previous = NIL;
+            c.next = b.first_counter;
+            if (b.first_counter != NIL)
+            {
+                _counters[b.first_counter].previous = counter;
+            }
+
+            b.first_counter = counter;
+        }
+
+        /** @brief Remove `counter` from its bucket, and the bucket from the list if it is left empty. */
+        void _detach(uint32_t counter)
+        {
+            auto &c = _counters[counter];
+            auto &b = _buckets[c.bucket];
+            (c.previous == NIL ? b.first_counter : _counters[c.previous].next) = c.next;
+            if (c.next != NIL)
+            {
+                _counters[c.next].previous = c.previous;
+            }
+
+            if (b.first_counter == NIL)
+            {
+                (b.previous == NIL ? _min_bucket : _buckets[b.previous].next) = b.next;
+                if (b.next != NIL)
+                {
+                    _buckets[b.next].previous = b.previous;
+                }
+
+                _free_buckets.push_back(c.bucket);
+            }
+        }
+
+        void _increment(uint32_t counter)
+        {
+            auto bucket = _counters[counter].bucket;
+            auto &b = _buckets[bucket];
+            auto count = b.count + 1;
+
+            // Alone in its bucket, with no bucket for the next count: bump the bucket itself.
+            if (b.first_counter == counter && _counters[counter].next == NIL && (b.next == NIL || _buckets[b.next].count != count))
+            {
+                b.count = count;
+                return;
+            }
+
+            auto next = b.next;
+            if (next == NIL || _buckets[next].count != count)
+            {
+                next = _new_bucket(count, bucket, next);
+            }
+
+            _detach(counter);
+            _attach(counter, next);
+        }
+
+    public:
+        explicit SpaceSaving(size_t capacity) : _capacity(capacity), _min_bucket(NIL) {}
+
+        /** @brief Count one occurrence of `key`. */
+        void add(const Key &key)
+        {
+            if (_index.empty())
+            {
+                _index.assign(std::bit_ceil(std::max<size_t>(_capacity, 1) * 2), NIL);
+            }
+
+            auto slot = _slot_of(key);
+            if (_index[slot] != NIL)
+            {
+                _increment(_index[slot]);
+                return;
+            }
+
+            if (_counters.size() < _capacity)
+            {
+                auto counter = static_cast<uint32_t>(_counters.size());
+                _counters.push_back({key, 0, NIL, NIL, NIL});
+                _index[slot] = counter;
+
+                auto bucket = _min_bucket != NIL && _buckets[_min_bucket].count == 1 ? _min_bucket : _new_bucket(1, NIL, _min_bucket);
+                _attach(counter, bucket);
+                return;
+            }
+
+            // Take over a counter with the lowest count.
+            auto counter = _buckets[_min_bucket].first_counter;
+            _erase_slot(_slot_of(_counters[counter].key));
+            _counters[counter].key = key;
+            _counters[counter].error = _buckets[_min_bucket].count;
+            _index[_slot_of(key)] = counter;
+            _increment(counter);
+        }
+
+        /** @brief Bound on the count of any key without a counter: the lowest count once all counters are taken. */
+        uint64_t floor() const
+        {
+            return _counters.size() < _capacity || _min_bucket == NIL ? 0 : _buckets[_min_bucket].count;
+        }
+
+        void clear()
+        {
+            _counters.clear();
+            _buckets.clear();
+            _free_buckets.clear();
+            std::fill(_index.begin(), _index.end(), NIL);
+            _min_bucket = NIL;
+        }
+
+        /** @brief Call `visitor(key, count, error)` for every counter. */
+        template <typename F>
+        void for_each(F &&visitor) const
+        {
+            for (const auto &counter : _counters)
+            {
+                visitor(counter.key, _buckets[counter.bucket].count, counter.error);
+            }
+        }
+    };
+
+    /**
+     * @brief The heaviest violators over sliding windows of a minute, an hour and a day, by process
+     * name, by agent and by process name on each agent.
+     *
+     * Every window is a ring of panes (12 of 5 seconds, 12 of 5 minutes and 24 of 1 hour), and every
+     * pane holds one `SpaceSaving` summary per key. A violation updates the current pane of each
+     * window, and a query merges the panes of the window, so a window covers between its length
+     * minus one pane and its length. Memory is bounded by the number of counters, whatever the
+     * size of the fleet.
+     *
+     * Summaries are sharded by thread, so that CTB workers do not contend on updates; a query
+     * merges the shards as well.
+     */
+    class HeavyHitters
+    {
+    public:
+        /** @brief Counters per summary. */
+        static constexpr size_t CAPACITY = 128;
+
+    private:
+        struct _Pane
+        {
+            /** @brief Start of the pane, in units of the pane length. */
+            uint64_t period = UINT64_MAX;
+            std::vector<SpaceSaving> summaries;
+
+            _Pane()
+            {
+                for (size_t i = 0; i < HEAVY_HITTER_KEY_COUNT; i++)
+                {
+                    summaries.emplace_back(CAPACITY);
+                }
+            }
+        };
+
+        struct _Window
+        {
+            uint64_t pane_ms;
+            std::vector<_Pane> panes;
+        };
+
+        struct _Shard
+        {
+            std::mutex mutex;
+            std::vector<_Window> windows;
+        };
+
+        std::vector<std::unique_ptr<_Shard>> _shards;
+        std::atomic<size_t> _next_shard;
+
+        static SpaceSaving::Key _key_of(HeavyHitterKey key, uint64_t agent_id, const ViolationMessage &violation)
+        {
+            SpaceSaving::Key result = {};
+            if (key != HeavyHitterKey::Process)
+            {
+                result.agent_id = agent_id;
+            }
+
+            if (key != HeavyHitterKey::Agent)
+            {
+                std::memcpy(result.name.data(), violation.info.name, COMMAND_LENGTH);
+            }
+
+            return result;
+        }
+
+        _Shard &_shard()
+        {
+            thread_local size_t index = SIZE_MAX;
+            if (index == SIZE_MAX)
+            {
+                index = _next_shard++;
+            }
+
+            return *_shards[index % _shards.size()];
+        }
+
+    public:
+        /** @brief At most `shards` threads update the summaries without contending. */
+        explicit HeavyHitters(size_t shards = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8)) : _next_shard(0)
+        {
+            static const std::pair<uint64_t, size_t> WINDOWS[HEAVY_HITTER_WINDOW_COUNT] = {
+                {5 * 1000, 12},
+                {5 * 60 * 1000, 12},
+                {60 * 60 * 1000, 24},
+            };
+
+            for (size_t i = 0; i < shards; i++)
+            {
+                auto shard = std::make_unique<_Shard>();
+                for (auto [pane_ms, panes] : WINDOWS)
+                {
+                    shard->windows.push_back(_Window{pane_ms, std::vector<_Pane>(panes)});
+                }
+
+                _shards.push_back(std::move(shard));
+            }
+        }
+
+        /** @brief Count a violation of `agent_id`, received at `now_ms` (milliseconds since the Unix epoch). */
+        void record(uint64_t agent_id, const ViolationMessage &violation, uint64_t now_ms)
+        {
+            SpaceSaving::Key keys[HEAVY_HITTER_KEY_COUNT];
+            for (size_t key = 0; key < HEAVY_HITTER_KEY_COUNT; key++)
+            {
+                keys[key] = _key_of(static_cast<HeavyHitterKey>(key), agent_id, violation);
+            }
+
+            auto &shard = _shard();
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            for (auto &window : shard.windows)
+            {
+                auto period = now_ms / window.pane_ms;
+                auto &pane = window.panes[period % window.panes.size()];
+                if (pane.period != period)
+                {
+                    pane.period = period;
+                    for (auto &summary : pane.summaries)
+                    {
+                        summary.clear();
+                    }
+                }
+
+                for (size_t key = 0; key < HEAVY_HITTER_KEY_COUNT; key++)
+                {
+                    pane.summaries[key].add(keys[key]);
+                }
+            }
+        }
+
+        /**
+         * @brief The `count` heaviest violators of `window` at `now_ms`, by decreasing count.
+         *
+         * Merging summaries adds up their errors: a key missing from a full summary may have
+         * occurred up to `SpaceSaving::floor` times there.
+         */
+        std::vector<HeavyHitter> top(HeavyHitterKey key, HeavyHitterWindow window, size_t count, uint64_t now_ms)
+        {
+            struct Total
+            {
+                /** @brief Sum of `count - floor` over the summaries holding the key. */
+                uint64_t above_floor = 0;
+                /** @brief Sum of `count - error` over the summaries holding the key. */
+                uint64_t guaranteed = 0;
+            };
+
+            std::unordered_map<SpaceSaving::Key, Total, SpaceSaving::KeyHash> totals;
+            uint64_t floors = 0;
+
+            for (auto &shard : _shards)
+            {
+                std::lock_guard<std::mutex> guard(shard->mutex);
+                const auto &w = shard->windows[static_cast<size_t>(window)];
+                auto current = now_ms / w.pane_ms;
+                for (const auto &pane : w.panes)
+                {
+                    if (pane.period > current || pane.period + w.panes.size() <= current)
+                    {
+                        continue;
+                    }
+
+                    const auto &summary = pane.summaries[static_cast<size_t>(key)];
+                    auto floor = summary.floor();
+                    floors += floor;
+                    summary.for_each(
+                        [&](const SpaceSaving::Key &k, uint64_t c, uint64_t error)
+                        {
+                            auto &total = totals[k];
+                            total.above_floor += c - floor;
+                            total.guaranteed += c - error;
+                        });
+                }
+            }
+
+            std::vector<HeavyHitter> result;
+            result.reserve(totals.size());
+            for (const auto &[k, total] : totals)
+            {
+                HeavyHitter entry = {};
+                entry.agent_id = k.agent_id;
+                std::memcpy(entry.name, k.name.data(), COMMAND_LENGTH);
+                entry.count = floors + total.above_floor;
+                entry.error = entry.count - total.guaranteed;
+                result.push_back(entry);
+            }
+
+            auto middle = result.begin() + static_cast<ptrdiff_t>(std::min(count, result.size()));
+            std::partial_sort(
+                result.begin(), middle, result.end(),
+                [](const HeavyHitter &a, const HeavyHitter &b)
+                { return a.count > b.count; });
+            result.erase(middle, result.end());
+            return result;
+        }
+    };
+}
@@ -0,0 +1,594 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.hpp"
+
+namespace procmon
+{
+    /**
+     * @brief Type tag stored at the beginning of every frame exchanged between CTA and CTB.
+     *
+     * A frame on the wire is `[uint32_t length][MessageType type][body]`, where `length`
+     * covers both the type tag and the body.
+     */
+    enum class MessageType : uint32_t
+    {
+        /** @brief CTB -> CTA: JSON array of monitor rules. */
+        Config = 1,
+        /** @brief CTA -> CTB: first message on every connection, identifies the agent. */
+        Hello = 2,
+        /** @brief CTA -> CTB: a sequenced violation report. */
+        Violation = 3,
+        /** @brief CTB -> CTA: cumulative acknowledgement of violation reports. */
+        Ack = 4,
+        /** @brief CTA -> CTB: the configuration currently in effect on the agent. */
+        ConfigApplied = 5,
+        /** @brief CTA -> CTB: periodic report on the agent's own pipeline and resource usage. */
+        Telemetry = 6,
+        /** @brief Client -> CTB: ask for the heaviest violators of a sliding window. No `Hello` is needed. */
+        TopRequest = 7,
+        /** @brief CTB -> client: a `TopRequestMessage` echoing the request, then `HeavyHitter` x count. */
+        TopReport = 8,
+        /** @brief Client -> CTB: turn the connection into a subscriber of the live violation stream. No `Hello` is needed. */
+        Subscribe = 9,
+        /** @brief CTB -> subscriber: `[uint64_t timestamp_ms][uint64_t agent_id]` then the body of a `Violation` frame. */
+        StreamViolation = 10,
+        /** @brief CTB -> subscriber: a `StreamGapMessage`, for a subscriber which fell behind and skipped ahead. */
+        StreamGap = 11,
+    };
+
+    struct HelloMessage
+    {
+        /** @brief Random identifier of the agent process, stable across reconnections. */
+        uint64_t agent_id;
+    };
+
+    /**
+     * @brief A violation report.
+     *
+     * Each severity is an independent lane with its own sequence numbers, so that more severe
+     * reports can overtake queued ones without breaking deduplication on CTB.
+     */
+    struct ViolationMessage
+    {
+        /** @brief Per-agent, per-lane sequence number, starting from 1 and increasing by 1 for each report. */
+        uint64_t sequence;
+        Severity severity;
+        ViolationInfo info;
+    };
+
+    /**
+     * @brief Details of a process which do not fit in a `ViolationInfo`.
+     *
+     * When available, they are appended to the body of a `Violation` frame after the
+     * `ViolationMessage`, as `[uint32_t uid][uint32_t length, bytes] x 3` for the command line, the
+     * executable path and the cgroup path.
+     */
+    struct ProcessDetails
+    {
+        uint32_t uid;
+        /** @brief Arguments separated by spaces. */
+        std::string cmdline;
+        std::string exe;
+        std::string cgroup;
+    };
+
+    struct AckMessage
+    {
+        /**
+         * @brief For each lane (indexed by severity), every report with a sequence number up to (and
+         * including) this one has been logged.
+         */
+        uint64_t sequences[SEVERITY_COUNT];
+    };
+
+    struct ConfigAppliedMessage
+    {
+        /** @brief Result of `config_fingerprint` for the rules in effect. */
+        uint64_t fingerprint;
+    };
+
+    struct TelemetryMessage
+    {
+        /** @brief Time covered by the rates below, in milliseconds. */
+        uint64_t period_ms;
+        /** @brief Violation reports waiting to be acknowledged by CTB. */
+        uint64_t queue_depth;
+        /** @brief Violation reports produced since the agent started. */
+        uint64_t violations_produced;
+        /** @brief Violation reports written to CTB since the agent started, including resends. */
+        uint64_t violations_sent;
+        /** @brief Violation reports given up because the resend window was full. */
+        uint64_t violations_dropped;
+        /** @brief Kernel events read per second over the period. */
+        uint64_t kernel_events_per_sec;
+        /** @brief Duration of the last sampling round, in microseconds. */
+        uint64_t sample_round_us;
+        /** @brief Current sampling interval, in milliseconds. */
+        uint64_t sample_interval_ms;
+        /** @brief Failed reads of /proc since the agent started. */
+        uint64_t proc_read_failures;
+        /** @brief Connection attempts to CTB after the first one. */
+        uint64_t reconnects;
+        /** @brief Resident set size of the agent, in bytes. */
+        uint64_t rss_bytes;
+        /** @brief CPU usage of the agent over the period, in percent of one CPU scaled by 1000. */
+        uint64_t cpu_usage;
+    };
+
+    /** @brief What the violations are counted by, in a `TopRequestMessage`. */
+    enum class HeavyHitterKey : uint32_t
+    {
+        Process,
+        Agent,
+        /** @brief A process name on one agent. */
+        AgentProcess,
+    };
+
+    enum class HeavyHitterWindow : uint32_t
+    {
+        Minute,
+        Hour,
+        Day,
+    };
+
+    constexpr size_t HEAVY_HITTER_KEY_COUNT = 3;
+    constexpr size_t HEAVY_HITTER_WINDOW_COUNT = 3;
+
+    struct TopRequestMessage
+    {
+        HeavyHitterKey key;
+        HeavyHitterWindow window;
+        /** @brief Maximum number of entries to report. */
+        uint32_t count;
+    };
+
+    /** @brief One entry of a `TopReport`, by decreasing `count`. */
+    struct HeavyHitter
+    {
+        /** @brief 0 when counting by process only. */
+        uint64_t agent_id;
+        /** @brief Empty when counting by agent only. */
+        StaticCommandName name;
+        /** @brief Violations in the window, possibly overestimated by up to `error`. */
+        uint64_t count;
+        uint64_t error;
+    };
+
+    /** @brief A subscriber which falls behind skips to the newest violations instead of being disconnected. */
+    constexpr uint32_t SUBSCRIBE_SKIP_AHEAD = 1;
+
+    /**
+     * @brief Filter of a subscriber. Every field which is set must match.
+     */
+    struct SubscribeMessage
+    {
+        /** @brief 0 for every agent. */
+        uint64_t agent_id;
+        /** @brief Empty for every process. */
+        StaticCommandName name;
+        /** @brief Bit mask of `1 << Metric`, 0 for every metric. */
+        uint32_t metrics;
+        /** @brief Combination of `SUBSCRIBE_*` flags. */
+        uint32_t flags;
+    };
+
+    struct StreamGapMessage
+    {
+        /** @brief Violations (matching the filter or not) which the subscriber missed. */
+        uint64_t skipped;
+    };
+
+    inline std::ostream &operator<<(std::ostream &stream, const TelemetryMessage &telemetry)
+    {
+        return stream << "queue=" << telemetry.queue_depth
+                      << ", produced=" << telemetry.violations_produced
+                      << ", sent=" << telemetry.violations_sent
+                      << ", dropped=" << telemetry.violations_dropped
+                      << ", kernel_events/s=" << telemetry.kernel_events_per_sec
+                      << ", sample_round=" << telemetry.sample_round_us << "us"
+                      << ", sample_interval=" << telemetry.sample_interval_ms << "ms"
+                      << ", proc_read_failures=" << telemetry.proc_read_failures
+                      << ", reconnects=" << telemetry.reconnects
+                      << ", rss=" << telemetry.rss_bytes
+                      << ", cpu=" << telemetry.cpu_usage / 1000 << "." << std::setfill('0') << std::setw(3) << telemetry.cpu_usage % 1000 << std::setfill(' ') << "%";
+    }
+
+    /**
+     * @brief Append a complete frame of the specified type to `out`.
+     */
+    inline void encode_message(std::vector<char> &out, MessageType type, std::span<const char> body)
+    {
+        uint32_t length = static_cast<uint32_t>(sizeof(type) + body.size());
+        auto length_ptr = reinterpret_cast<const char *>(&length);
+        auto type_ptr = reinterpret_cast<const char *>(&type);
+
+        out.insert(out.end(), length_ptr, length_ptr + sizeof(length));
+        out.insert(out.end(), type_ptr, type_ptr + sizeof(type));
+        out.insert(out.end(), body.begin(), body.end());
+    }
+
+    /**
+     * @brief Append a complete frame carrying a fixed-size message to `out`.
+     */
+    template <typename T>
+    void encode_message(std::vector<char> &out, MessageType type, const T &message)
+    {
+        encode_message(out, type, std::span<const char>(reinterpret_cast<const char *>(&message), sizeof(message)));
+    }
+
+    /**
+     * @brief Append a complete `Violation` frame to `out`, with the details of the process if any.
+     */
+    inline void encode_violation(std::vector<char> &out, const ViolationMessage &message, const ProcessDetails *details)
+    {
+        if (details == nullptr)
+        {
+            encode_message(out, MessageType::Violation, message);
+            return;
+        }
+
+        std::vector<char> body(reinterpret_cast<const char *>(&message), reinterpret_cast<const char *>(&message) + sizeof(message));
+        auto append = [&body](const void *data, size_t size)
+        {
+            auto ptr = reinterpret_cast<const char *>(data);
+            body.insert(body.end(), ptr, ptr + size);
+        };
+
+        append(&details->uid, sizeof(details->uid));
+        for (const auto *field : {&details->cmdline, &details->exe, &details->cgroup})
+        {
+            uint32_t length = static_cast<uint32_t>(field->size());
+            append(&length, sizeof(length));
+            append(field->data(), field->size());
+        }
+
+        encode_message(out, MessageType::Violation, std::span<const char>(body.data(), body.size()));
+    }
+
+    /**
+     * @brief Split the payload of a frame (everything after the length prefix) into its type and body.
+     */
+    inline std::optional<std::pair<MessageType, std::span<const char>>> decode_message(std::span<const char> payload)
+    {
+        if (payload.size() < sizeof(MessageType))
+        {
+            return std::nullopt;
+        }
+
+        MessageType type;
+        std::memcpy(&type, payload.data(), sizeof(type));
+        return std::make_pair(type, payload.subspan(sizeof(type)));
+    }
+
+    /**
+     * @brief Copy a fixed-size message out of a frame body, checking its size.
+     */
+    template <typename T>
+    std::optional<T> message_as(std::span<const char> body)
+    {
+        if (body.size() != sizeof(T))
+        {
+            return std::nullopt;
+        }
+
+        T message;
+        std::memcpy(&message, body.data(), sizeof(T));
+        return message;
+    }
+
+    /**
+     * @brief Decode the body of a `Violation` frame, with the details of the process if they were sent.
+     */
+    inline std::optional<std::pair<ViolationMessage, std::optional<ProcessDetails>>> decode_violation(std::span<const char> body)
+    {
+        if (body.size() < sizeof(ViolationMessage))
+        {
+            return std::nullopt;
+        }
+
+        auto message = message_as<ViolationMessage>(body.first(sizeof(ViolationMessage))).value();
+        auto rest = body.subspan(sizeof(ViolationMessage));
+        if (rest.empty())
+        {
+            return std::make_pair(message, std::optional<ProcessDetails>());
+        }
+
+        auto take = [&rest](void *data, size_t size)
+        {
+            if (rest.size() < size)
+            {
+                return false;
+            }
+
+            std::memcpy(data, rest.data(), size);
+            rest = rest.subspan(size);
+            return true;
+        };
+
+        ProcessDetails details;
+        if (!take(&details.uid, sizeof(details.uid)))
+        {
+            return std::nullopt;
+        }
+
+        for (auto *field : {&details.cmdline, &details.exe, &details.cgroup})
+        {
+            uint32_t length = 0;
+            if (!take(&length, sizeof(length)) || rest.size() < length)
+            {
+                return std::nullopt;
+            }
+
+            field->assign(rest.data(), length);
+            rest = rest.subspan(length);
+        }
+
+        if (!rest.empty())
+        {
+            return std::nullopt;
+        }
+
+        return std::make_pair(message, std::make_optional(std::move(details)));
+    }
+
+    /**
+     * @brief CTA-side window of the violation reports of one severity not yet acknowledged by CTB, in sequence order.
+     *
+     * `send_sequence` is the sequence number of the next report to write on the current connection.
+     */
+    struct ViolationLane
+    {
+        struct Entry
+        {
+            ViolationMessage message;
+            std::shared_ptr<const ProcessDetails> details;
+        };
+
+        std::deque<Entry> unacked;
+        uint64_t next_sequence = 1;
+        uint64_t send_sequence = 1;
+
+        bool has_unsent() const
+        {
+            return send_sequence < next_sequence;
+        }
+
+        const Entry &unsent() const
+        {
+            return unacked[send_sequence - unacked.front().message.sequence];
+        }
+
+        void push(Severity severity, ViolationInfo &&info, std::shared_ptr<const ProcessDetails> details)
+        {
+            unacked.push_back(Entry{ViolationMessage{next_sequence++, severity, std::move(info)}, std::move(details)});
+        }
+
+        void drop_oldest()
+        {
+            unacked.pop_front();
+            send_sequence = std::max(send_sequence, unacked.empty() ? next_sequence : unacked.front().message.sequence);
+        }
+
+        void acknowledge(uint64_t sequence)
+        {
+            while (!unacked.empty() && unacked.front().message.sequence <= sequence)
+            {
+                unacked.pop_front();
+            }
+
+            // After a reconnection, CTB acknowledges what it logged before the link broke: skip resending those.
+            send_sequence = std::min(std::max(send_sequence, sequence + 1), next_sequence);
+        }
+
+        /** @brief Start resending from the oldest unacknowledged report, e.g. on a new connection. */
+        void rewind()
+        {
+            send_sequence = unacked.empty() ? next_sequence : unacked.front().message.sequence;
+        }
+    };
+
+    /** @brief Woken up by a `DeliveryLedger` when reports became durable, e.g. to acknowledge them. */
+    class DeliveryListener
+    {
+    public:
+        virtual ~DeliveryListener() = default;
+
+        /** @brief Called from the thread which marked the reports durable: must not block. */
+        virtual void on_durable() = 0;
+    };
+
+    /**
+     * @brief CTB-side record of the last violation logged for each agent and lane, and of the last
+     * one which is durable in the event log.
+     *
+     * CTA resends every unacknowledged report after reconnecting, so the same sequence number
+     * may arrive more than once. The ledger lets CTB log each report exactly once, and acknowledge
+     * it only once it is synced to disk: a report lost in a crash is resent instead.
+     *
+     * Agents are sharded by ID, so that connections of different agents do not contend. An agent
+     * picks a new ID whenever it starts, so the entry of an agent without a connection for longer
+     * than `IDLE_EVICTION` is dropped: it stopped, or it would have reconnected by then.
+     */
+    class DeliveryLedger
+    {
+    public:
+        /** @brief Well beyond the longest reconnection backoff of the agents (30 seconds). */
+        static constexpr std::chrono::minutes IDLE_EVICTION = std::chrono::minutes(10);
+
+    private:
+        static constexpr size_t SHARD_COUNT = 16;
+
+        struct _Agent
+        {
+            AckMessage logged;
+            AckMessage durable;
+            size_t connections = 0;
+            std::chrono::steady_clock::time_point idle_since;
+        };
+
+        struct alignas(64) _Shard
+        {
+            std::mutex mutex;
+            std::unordered_map<uint64_t, _Agent> agents;
+            std::chrono::steady_clock::time_point next_eviction;
+        };
+
+        _Shard _shards[SHARD_COUNT];
+        std::atomic<uint64_t> _durable_version{0};
+
+        std::mutex _listeners_mutex;
+        std::vector<DeliveryListener *> _listeners;
+        uint64_t _published_version = 0;
+
+        _Shard &_shard(uint64_t agent_id)
+        {
+            // Agent IDs are random: their low bits spread agents evenly.
+            return _shards[agent_id % SHARD_COUNT];
+        }
+
+    public:
+        /** @brief Wake up `listener` whenever `publish_durable` finds new durable reports, until it is removed. */
+        void add_listener(DeliveryListener &listener)
+        {
+            std::lock_guard<std::mutex> guard(_listeners_mutex);
+            _listeners.push_back(&listener);
+        }
+
+        /** @brief Stop waking up `listener`. It is not called anymore once this returns. */
+        void remove_listener(DeliveryListener &listener)
+        {
+            std::lock_guard<std::mutex> guard(_listeners_mutex);
+            std::erase(_listeners, &listener);
+        }
+
+        /** @brief Count a connection identified as `agent_id`, which keeps its entry from being evicted. */
+        void connect(uint64_t agent_id)
+        {
+            auto &shard = _shard(agent_id);
+            auto now = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            shard.agents[agent_id].connections++;
+
+            // Sweeping a shard is linear: do it at most once per eviction delay.
+            if (now >= shard.next_eviction)
+            {
+                shard.next_eviction = now + IDLE_EVICTION;
+                std::erase_if(
+                    shard.agents,
+                    [now](const auto &entry)
+                    { return entry.second.connections == 0 && now - entry.second.idle_since > IDLE_EVICTION; });
+            }
+        }
+
+        /** @brief Stop counting a connection counted by `connect`, e.g. when it is closed. */
+        void disconnect(uint64_t agent_id)
+        {
+            auto &shard = _shard(agent_id);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            auto it = shard.agents.find(agent_id);
+            if (it != shard.agents.end() && it->second.connections > 0 && --it->second.connections == 0)
+            {
+                it->second.idle_since = std::chrono::steady_clock::now();
+            }
+        }
+
+        /**
+         * @brief Returns the highest sequence number durably logged for `agent_id` in every lane (0
+         * if none), in the form of a cumulative acknowledgement.
+         */
+        AckMessage durable(uint64_t agent_id)
+        {
+            auto &shard = _shard(agent_id);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            auto it = shard.agents.find(agent_id);
+            return it == shard.agents.end() ? AckMessage{} : it->second.durable;
+        }
+
+        /** @brief Incremented whenever a durable sequence number moves forward. */
+        uint64_t durable_version() const
+        {
+            return _durable_version.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief Record `sequence` in the lane of `severity` as logged for `agent_id`.
+         *
+         * @return `false` if the report was already logged (or has an unknown severity) and must be skipped.
+         */
+        bool record(uint64_t agent_id, Severity severity, uint64_t sequence)
+        {
+            auto lane = static_cast<size_t>(severity);
+            if (lane >= SEVERITY_COUNT)
+            {
+                return false;
+            }
+
+            auto &shard = _shard(agent_id);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            auto &last = shard.agents[agent_id].logged.sequences[lane];
+            if (sequence <= last)
+            {
+                return false;
+            }
+
+            last = sequence;
+            return true;
+        }
+
+        /** @brief Record every report of `agent_id` in the lane of `severity` up to `sequence` as synced to disk. */
+        void mark_durable(uint64_t agent_id, Severity severity, uint64_t sequence)
+        {
+            auto lane = static_cast<size_t>(severity);
+            if (lane >= SEVERITY_COUNT)
+            {
+                return;
+            }
+
+            // An evicted agent is gone: there is nobody left to acknowledge.
+            auto &shard = _shard(agent_id);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            auto it = shard.agents.find(agent_id);
+            if (it == shard.agents.end())
+            {
+                return;
+            }
+
+            auto &durable = it->second.durable.sequences[lane];
+            if (sequence > durable)
+            {
+                durable = sequence;
+                _durable_version.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        /** @brief Wake up the listeners once if some reports were marked durable since the last call. */
+        void publish_durable()
+        {
+            std::lock_guard<std::mutex> guard(_listeners_mutex);
+            auto version = durable_version();
+            if (version == _published_version)
+            {
+                return;
+            }
+
+            _published_version = version;
+            for (auto listener : _listeners)
+            {
+                listener->on_durable();
+            }
+        }
+    };
+}
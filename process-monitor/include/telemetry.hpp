@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+
+namespace procmon
+{
+    /**
+     * @brief A counter or gauge updated on a hot path.
+     *
+     * Every value is independent of the others and is only read for periodic reports, so relaxed
+     * ordering is enough and an update never costs more than a plain atomic add or store.
+     */
+    class TelemetryCounter
+    {
+    private:
+        std::atomic<uint64_t> _value{0};
+
+    public:
+        void add(uint64_t value = 1)
+        {
+            _value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        void set(uint64_t value)
+        {
+            _value.store(value, std::memory_order_relaxed);
+        }
+
+        uint64_t load() const
+        {
+            return _value.load(std::memory_order_relaxed);
+        }
+    };
+
+    /**
+     * @brief Self-telemetry of the agent pipeline, reported to CTB as a `TelemetryMessage`.
+     */
+    struct AgentTelemetry
+    {
+        TelemetryCounter violations_produced;
+        TelemetryCounter violations_sent;
+        TelemetryCounter violations_dropped;
+        TelemetryCounter kernel_events;
+        TelemetryCounter proc_read_failures;
+        TelemetryCounter reconnects;
+        TelemetryCounter sample_round_us;
+    };
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "epoll.hpp"
+#include "generated/listener.hpp"
+
+namespace procmon
+{
+    /**
+     * @brief A source of kernel events which is also programmed with the monitor rules.
+     *
+     * The agent only talks to the tracer through this interface, so that its pipeline can run
+     * against a synthetic event stream (see @ref SyntheticTracer) without root privileges.
+     */
+    class Tracer
+    {
+    public:
+        virtual ~Tracer() = default;
+
+        /** @brief A descriptor which becomes readable when events are pending. It remains owned by the tracer. */
+        virtual int event_fd() const = 0;
+
+        /** @brief Copy pending events to the front of `out` without blocking, and return how many were copied. */
+        virtual size_t drain(std::span<Event> out) = 0;
+
+        /** @brief Start monitoring `command` with `threshold`, or update the threshold if it is already monitored. */
+        virtual io::Result<std::monostate> set_monitor(const std::string &command, const Threshold &threshold) = 0;
+
+        /** @brief Stop monitoring `command`. */
+        virtual io::Result<std::monostate> remove_monitor(const std::string &command) = 0;
+    };
+
+    /**
+     * @brief The eBPF tracer from linux-listener.
+     */
+    class EbpfTracer : public Tracer, public NonConstructible
+    {
+    private:
+        KernelTracerHandle *_handle;
+
+        explicit EbpfTracer(KernelTracerHandle *handle);
+
+    public:
+        /** @brief Load and attach the eBPF programs. Requires root privileges. */
+        static io::Result<std::unique_ptr<Tracer>> create();
+
+        ~EbpfTracer() override;
+
+        int event_fd() const override;
+        size_t drain(std::span<Event> out) override;
+        io::Result<std::monostate> set_monitor(const std::string &command, const Threshold &threshold) override;
+        io::Result<std::monostate> remove_monitor(const std::string &command) override;
+    };
+
+    struct SyntheticTracerOptions
+    {
+        /** @brief `NewProcess` events generated per second. */
+        uint32_t new_process_rate;
+        /** @brief `Violation` events generated per second. */
+        uint32_t violation_rate;
+        /** @brief Number of distinct fake PIDs the events are spread over. */
+        uint32_t pid_count;
+
+        /**
+         * @brief Parse options from a `new_process_rate,violation_rate[,pid_count]` specification.
+         */
+        static std::optional<SyntheticTracerOptions> parse(const std::string &spec);
+    };
+
+    /**
+     * @brief A tracer generating events at fixed rates, for load tests and benchmarks.
+     *
+     * Events are attributed to the monitored commands in round-robin order (or to a placeholder
+     * name when no rule is set) and to fake PIDs which do not exist in /proc.
+     */
+    class SyntheticTracer : public Tracer, public NonConstructible
+    {
+    private:
+        static constexpr uint32_t FIRST_PID = 0x40000000;
+
+        SyntheticTracerOptions _options;
+        TimerFd _timer;
+        std::chrono::steady_clock::time_point _last_generation;
+        double _pending_new_processes;
+        double _pending_violations;
+        uint64_t _counter;
+        std::minstd_rand _rng;
+        std::unordered_map<std::string, Threshold> _targets;
+        std::vector<std::string> _commands;
+
+        explicit SyntheticTracer(const SyntheticTracerOptions &options, TimerFd &&timer);
+
+        Event _make_event(EventType variant);
+
+    public:
+        static io::Result<std::unique_ptr<Tracer>> create(const SyntheticTracerOptions &options);
+
+        int event_fd() const override;
+        size_t drain(std::span<Event> out) override;
+        io::Result<std::monostate> set_monitor(const std::string &command, const Threshold &threshold) override;
+        io::Result<std::monostate> remove_monitor(const std::string &command) override;
+    };
+}
@@ -44,29 +44,14 @@ namespace procmon
         }
     }
 
-    inline io::Result<std::vector<char>> read_message(net::TcpStream &stream)
-    {
-        uint32_t length = 0;
-        auto size = SHORT_CIRCUIT(std::vector<char>, stream.read(std::span<char>(reinterpret_cast<char *>(&length), sizeof(length))));
-
-        std::vector<char> buffer(length);
-        char *ptr = buffer.data();
-        while (length > 0)
-        {
-            size = SHORT_CIRCUIT(std::vector<char>, stream.read(std::span<char>(ptr, length)));
-            ptr += size;
-            length -= size;
-        }
-
-        return io::Result<std::vector<char>>::ok(std::move(buffer));
-    }
-
     struct ViolationInfo
     {
         uint32_t pid;
         StaticCommandName name;
         Violation violation;
 
+        ViolationInfo() = default;
+
         explicit ViolationInfo(uint32_t pid, const StaticCommandName &_name, Violation &&violation)
             : pid(pid), violation(std::move(violation))
         {
@@ -74,6 +59,13 @@ namespace procmon
         }
     };
 
+    class EventLog;
+
     int cta_loop(uint16_t port);
-    int ctb_loop(net::TcpListener &listener, const std::string &json_config);
+
+    /**
+     * @brief Serve agents with the configuration `json_config`, read from `config_path`. On Linux, the
+     * file is watched and every valid change is pushed to the connected agents.
+     */
+    int ctb_loop(net::TcpListener &listener, const path::PathBuf &config_path, const std::string &json_config, EventLog &log);
 }
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "epoll.hpp"
+#include "protocol.hpp"
+
+namespace procmon
+{
+    /**
+     * @brief Fan-out of the violations logged by CTB to its subscribers, through a ring buffer.
+     *
+     * Receivers publish every violation as a ready-made `StreamViolation` frame into a fixed number
+     * of slots, overwriting the oldest one. Every subscriber reads from its own cursor, at its own
+     * pace: publishing never waits for a subscriber, and a subscriber which falls behind by more
+     * than the capacity finds its next violations overwritten and must either skip ahead or go.
+     *
+     * The ring takes no lock: a publisher claims its slot and the bytes of its frame with atomic
+     * heads, and every slot is a seqlock, whose version is odd while it is written. A reader copies
+     * a slot and its frame, then checks that neither was overwritten in the meantime.
+     *
+     * Subscribers are served by event loops. Each loop registers an `EventFd` as a listener, which
+     * is notified once when violations are published, until the loop calls `rearm`.
+     */
+    class ViolationFeed
+    {
+    public:
+        /** @brief Number of violations kept for the subscribers which are behind. */
+        static constexpr size_t DEFAULT_CAPACITY = 65536;
+
+        /** @brief Size of the ring holding the frames of these violations. */
+        static constexpr size_t DEFAULT_CAPACITY_BYTES = 32 * 1024 * 1024;
+
+    private:
+        struct _Entry
+        {
+            uint64_t agent_id;
+            uint32_t metric;
+            StaticCommandName name;
+            /** @brief Position of the frame in the stream of bytes written to `_bytes`. */
+            uint64_t offset;
+            uint32_t size;
+        };
+
+        struct _Slot
+        {
+            /** @brief `2 * sequence + 1` while violation `sequence` is written, `2 * sequence + 2` once it is. */
+            std::atomic<uint64_t> version{0};
+            _Entry entry;
+        };
+
+        struct _Listener
+        {
+            const EventFd *event;
+            std::atomic<bool> pending{false};
+            std::atomic<size_t> subscribers{0};
+        };
+
+        std::mutex _mutex;
+        std::vector<_Slot> _slots;
+        std::vector<char> _bytes;
+        /** @brief Sequence number of the next violation to be claimed by a publisher. */
+        alignas(64) std::atomic<uint64_t> _head;
+        /** @brief Position of the next frame claimed in `_bytes`. */
+        alignas(64) std::atomic<uint64_t> _bytes_head;
+        alignas(64) std::vector<std::unique_ptr<_Listener>> _listeners;
+        std::atomic<size_t> _subscribers;
+
+        static bool _matches(const _Entry &entry, const SubscribeMessage &filter);
+
+        /** @brief Copy `size` bytes to position `offset` of the byte stream, wrapping around `_bytes`. */
+        void _copy_in(uint64_t offset, const char *data, size_t size);
+
+        /** @brief Copy `size` bytes from position `offset` of the byte stream, wrapping around `_bytes`. */
+        void _copy_out(uint64_t offset, char *data, size_t size) const;
+
+    public:
+        explicit ViolationFeed(size_t capacity = DEFAULT_CAPACITY, size_t capacity_bytes = DEFAULT_CAPACITY_BYTES);
+
+        /**
+         * @brief Register an event loop, to be woken up through `event` while it has subscribers.
+         *
+         * Every listener must be registered before the first violation is published.
+         *
+         * @return The ID of the listener.
+         */
+        size_t add_listener(const EventFd &event);
+
+        /** @brief Count a subscriber of listener `listener`. */
+        void subscribe(size_t listener);
+
+        /** @brief Stop counting a subscriber of listener `listener`, e.g. when its connection is closed. */
+        void unsubscribe(size_t listener);
+
+        /** @brief Let `listener` be notified of the next violation, after it read its event. */
+        void rearm(size_t listener);
+
+        /** @brief Publish the violation of a `Violation` frame `body` received from `agent_id`. A no-op without subscribers. */
+        void publish(uint64_t timestamp_ms, uint64_t agent_id, const ViolationMessage &violation, std::span<const char> body);
+
+        /** @brief Sequence number of the next violation, i.e. the cursor of a new subscriber. */
+        uint64_t head();
+
+        /**
+         * @brief Append the frames of the violations from `cursor` on which match `filter` to `out`,
+         * until the newest one or until `out` holds at least `max_bytes`, and move `cursor` past them.
+         *
+         * A violation which is still being published ends the read: its publisher notifies the listeners once it is done.
+         *
+         * @return `false` if the violation at `cursor` was already overwritten: nothing is read.
+         */
+        bool read(uint64_t &cursor, const SubscribeMessage &filter, std::vector<char> &out, size_t max_bytes);
+    };
+}
@@ -1,64 +1,214 @@
+#include <csignal>
+
 #include "config.hpp"
+#include "event_log.hpp"
+#ifdef __linux__
+#include "event_store.hpp"
+#endif
 #include "fs.hpp"
 #include "net.hpp"
 #include "utils.hpp"
 
+static int show_ctb_help()
+{
+#ifdef __linux__
+    std::cout << "Usage: CTB <port> [-c config.json] [-l events.log] [--sync-interval ms] [--sync-bytes bytes]" << std::endl;
+    std::cout << "           [-s store-dir] [--segment-bytes bytes] [--segment-hours hours] [--retain-bytes bytes] [--retain-hours hours] [--archive-hours hours]" << std::endl;
+    std::cout << "Without -l, events are written to the standard output. With -s, violations are also kept in an indexed binary store." << std::endl;
+#else
+    std::cout << "Usage: CTB <port> [-c config.json] [-l events.log] [--sync-interval ms] [--sync-bytes bytes]" << std::endl;
+    std::cout << "Without -l, events are written to the standard output." << std::endl;
+#endif
+    return 1;
+}
+
+static std::optional<size_t> parse_size(const char *argv)
+{
+    try
+    {
+        size_t pos = 0;
+        unsigned long long value = std::stoull(argv, &pos);
+        if (pos != std::strlen(argv))
+        {
+            return std::nullopt;
+        }
+
+        return value;
+    }
+    catch (...)
+    {
+        return std::nullopt;
+    }
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 2)
+#ifdef __linux__
+    // Termination signals are read by the event loops from a signalfd: block them before the event
+    // log and the event store spawn their threads, which inherit the signal mask.
+    sigset_t termination;
+    sigemptyset(&termination);
+    sigaddset(&termination, SIGINT);
+    sigaddset(&termination, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &termination, nullptr);
+#endif
+
+    if (argc < 2)
     {
-        return procmon::show_help();
+        return show_ctb_help();
     }
 
     auto port = procmon::parse_port(argv[1]);
     if (!port.has_value())
     {
-        return procmon::show_help();
+        return show_ctb_help();
     }
 
-    Threshold sample = {0};
-    std::vector<procmon::ConfigEntry> entries;
-
-    // TODO: Better path handling
-    auto file_result = fs::File::open(path::PathBuf("monitor.json"));
-    if (file_result.is_ok())
+    path::PathBuf config_path("monitor.json");
+    std::optional<path::PathBuf> log_path;
+    std::optional<path::PathBuf> store_path;
+    procmon::EventLogOptions log_options;
+#ifdef __linux__
+    procmon::EventStoreOptions store_options;
+#endif
+    for (int i = 2; i < argc; i += 2)
     {
-        auto file = std::move(file_result).into_ok();
-
-        // Read file contents
-        std::vector<char> buffer(8192);
-        std::string content;
+        std::string option(argv[i]);
+        if (i + 1 >= argc)
+        {
+            return show_ctb_help();
+        }
 
-        while (true)
+        if (option == "-c")
+        {
+            config_path = argv[i + 1];
+        }
+        else if (option == "-l")
+        {
+            log_path = path::PathBuf(argv[i + 1]);
+        }
+#ifdef __linux__
+        else if (option == "-s")
         {
-            auto read_result = file.read(std::span<char>(buffer.data(), buffer.size()));
-            if (read_result.is_err())
+            store_path = path::PathBuf(argv[i + 1]);
+        }
+        else if (option == "--segment-bytes" || option == "--segment-hours" || option == "--retain-bytes" || option == "--retain-hours" || option == "--archive-hours")
+        {
+            auto value = parse_size(argv[i + 1]);
+            if (!value.has_value())
             {
-                break;
+                return show_ctb_help();
             }
 
-            size_t bytes_read = std::move(read_result).into_ok();
-            if (bytes_read == 0)
+            if (option == "--segment-bytes")
+            {
+                store_options.segment_bytes = value.value();
+            }
+            else if (option == "--segment-hours")
+            {
+                store_options.segment_duration = std::chrono::hours(value.value());
+            }
+            else if (option == "--retain-bytes")
+            {
+                store_options.retention_bytes = value.value();
+            }
+            else if (option == "--retain-hours")
             {
-                break;
+                store_options.retention_age = std::chrono::hours(value.value());
+            }
+            else
+            {
+                store_options.archive_age = std::chrono::hours(value.value());
+            }
+        }
+#endif
+        else if (option == "--sync-interval" || option == "--sync-bytes")
+        {
+            auto value = parse_size(argv[i + 1]);
+            if (!value.has_value())
+            {
+                return show_ctb_help();
             }
 
-            content.append(buffer.data(), bytes_read);
+            if (option == "--sync-interval")
+            {
+                log_options.sync_interval = std::chrono::milliseconds(value.value());
+            }
+            else
+            {
+                log_options.sync_bytes = value.value();
+            }
+        }
+        else
+        {
+            return show_ctb_help();
         }
+    }
+
+    auto content = procmon::read_config_file(config_path);
+    if (content.is_err())
+    {
+        std::cerr << "Unable to open JSON file: " << content.unwrap_err().message() << std::endl;
+        return 1;
+    }
+
+    auto entries = procmon::parse_config(content.unwrap());
+    if (entries.is_err())
+    {
+        std::cerr << "Invalid configuration in " << config_path << ": " << entries.unwrap_err().message() << std::endl;
+        return 1;
+    }
 
-        auto listener = net::TcpListener::bind(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, port.value()));
-        if (listener.is_ok())
+    // The store is fed by the writer thread of the log: it must outlive the log.
+    procmon::EventSink *sink = nullptr;
+#ifdef __linux__
+    std::unique_ptr<procmon::EventStore> store;
+    if (store_path.has_value())
+    {
+        auto store_result = procmon::EventStore::open(store_path.value(), store_options);
+        if (store_result.is_err())
         {
-            return procmon::ctb_loop(listener.unwrap(), content);
+            std::cerr << "Unable to open event store: " << store_result.unwrap_err().message() << std::endl;
+            return 1;
         }
-        else
+
+        store = std::move(store_result).into_ok();
+        sink = store.get();
+        std::cerr << "Event store holds " << store->size() << " events in " << store->segments() << " segment(s)" << std::endl;
+    }
+#endif
+
+    auto log = procmon::EventLog::open(log_path, log_options, sink);
+    if (log.is_err())
+    {
+        std::cerr << "Unable to open event log: " << log.unwrap_err().message() << std::endl;
+        return 1;
+    }
+
+    auto address = net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, port.value());
+#ifdef __linux__
+    // The Linux CTB accepts from a SO_REUSEPORT group of listeners, one per worker. Another process
+    // could join the group unnoticed, so first check that the port is free with a plain listener.
+    {
+        auto probe = net::TcpListener::bind(address);
+        if (probe.is_err())
         {
-            std::cerr << "Failed to bind to port " << port.value() << ": " << listener.unwrap_err().message() << std::endl;
+            std::cerr << "Failed to bind to port " << port.value() << ": " << probe.unwrap_err().message() << std::endl;
+            return 1;
         }
     }
+
+    auto listener = net::TcpListener::bind_reuse_port(address);
+#else
+    auto listener = net::TcpListener::bind(address);
+#endif
+    if (listener.is_ok())
+    {
+        return procmon::ctb_loop(listener.unwrap(), config_path, content.unwrap(), *log.unwrap());
+    }
     else
     {
-        std::cerr << "Unable to open JSON file: " << file_result.unwrap_err().message() << std::endl;
+        std::cerr << "Failed to bind to port " << port.value() << ": " << listener.unwrap_err().message() << std::endl;
     }
 
     return 1;
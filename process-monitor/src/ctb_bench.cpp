@@ -0,0 +1,231 @@
+#include <chrono>
+#include <random>
+
+#include <sys/resource.h>
+
+#include "epoll.hpp"
+#include "frame.hpp"
+#include "net.hpp"
+#include "protocol.hpp"
+#include "utils.hpp"
+
+/**
+ * @brief A fake agent: sends a handshake and a burst of violation reports, then waits for CTB to
+ * acknowledge all of them.
+ */
+struct _BenchAgent
+{
+    net::TcpStream stream;
+    procmon::FrameDecoder decoder;
+    std::vector<char> outbound;
+    size_t outbound_offset = 0;
+    uint64_t acknowledged = 0;
+    bool configured = false;
+    bool closed = false;
+
+    explicit _BenchAgent(net::TcpStream &&stream) : stream(std::move(stream)) {}
+
+    void flush()
+    {
+        while (!closed && outbound_offset < outbound.size())
+        {
+            auto written = stream.write(std::span<const char>(outbound.data() + outbound_offset, outbound.size() - outbound_offset));
+            if (written.is_err())
+            {
+                closed = written.unwrap_err().kind() != io::ErrorKind::WouldBlock;
+                return;
+            }
+
+            outbound_offset += written.unwrap();
+        }
+    }
+
+    void receive()
+    {
+        while (!closed)
+        {
+            auto read = decoder.fill(stream);
+            if (read.is_err())
+            {
+                closed = read.unwrap_err().kind() != io::ErrorKind::WouldBlock;
+                return;
+            }
+
+            if (read.unwrap() == 0)
+            {
+                closed = true;
+                return;
+            }
+
+            while (true)
+            {
+                auto frame = decoder.next();
+                if (frame.is_err() || !frame.unwrap().has_value())
+                {
+                    break;
+                }
+
+                auto decoded = procmon::decode_message(frame.unwrap().value());
+                if (!decoded.has_value())
+                {
+                    continue;
+                }
+
+                auto [type, body] = decoded.value();
+                if (type == procmon::MessageType::Config)
+                {
+                    configured = true;
+                }
+                else if (type == procmon::MessageType::Ack)
+                {
+                    auto ack = procmon::message_as<procmon::AckMessage>(body);
+                    if (ack.has_value())
+                    {
+                        acknowledged = ack->sequences[static_cast<size_t>(procmon::Severity::Normal)];
+                    }
+                }
+            }
+        }
+    }
+};
+
+static std::optional<size_t> _parse_count(char *argv)
+{
+    try
+    {
+        size_t pos = 0;
+        unsigned long value = std::stoul(argv, &pos);
+        if (pos != std::strlen(argv) || value == 0)
+        {
+            return std::nullopt;
+        }
+
+        return value;
+    }
+    catch (...)
+    {
+        return std::nullopt;
+    }
+}
+
+/**
+ * @brief Load generator for CTB.
+ *
+ * Usage: `CTBBench <port> [connections] [reports per connection]`. Every connection is held open
+ * until CTB acknowledged all of its reports; the benchmark then prints how many connections CTB
+ * held and how many reports per second it logged and acknowledged.
+ */
+int main(int argc, char **argv)
+{
+    constexpr auto DEADLINE = std::chrono::seconds(60);
+
+    auto port = argc >= 2 && argc <= 4 ? procmon::parse_port(argv[1]) : std::nullopt;
+    auto connections = argc >= 3 ? _parse_count(argv[2]) : std::optional<size_t>(1000);
+    auto reports = argc >= 4 ? _parse_count(argv[3]) : std::optional<size_t>(1000);
+    if (!port.has_value() || !connections.has_value() || !reports.has_value())
+    {
+        std::cout << "Usage: " << argv[0] << " <port> [connections] [reports per connection]" << std::endl;
+        return 1;
+    }
+
+    // Every connection needs a descriptor.
+    struct rlimit limit = {};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    auto epoll_result = procmon::Epoll::create();
+    if (epoll_result.is_err())
+    {
+        std::cerr << "Failed to create epoll instance: " << epoll_result.unwrap_err().message() << std::endl;
+        return 1;
+    }
+
+    auto epoll = std::move(epoll_result).into_ok();
+    auto agent_base = static_cast<uint64_t>(std::random_device{}()) << 32;
+
+    StaticCommandName name;
+    procmon::trim_command_name("ctb-bench", &name);
+
+    std::vector<std::unique_ptr<_BenchAgent>> agents;
+    size_t refused = 0;
+    for (size_t i = 0; i < connections.value(); i++)
+    {
+        auto stream = net::TcpStream::connect(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, port.value()));
+        if (stream.is_err())
+        {
+            refused++;
+            continue;
+        }
+
+        auto agent = std::make_unique<_BenchAgent>(std::move(stream).into_ok());
+        agent->stream.set_nonblocking(true);
+        agent->stream.set_nodelay(true);
+
+        procmon::encode_message(agent->outbound, procmon::MessageType::Hello, procmon::HelloMessage{agent_base + i});
+        for (uint64_t sequence = 1; sequence <= reports.value(); sequence++)
+        {
+            procmon::ViolationMessage message = {};
+            message.sequence = sequence;
+            message.severity = procmon::Severity::Normal;
+            message.info = procmon::ViolationInfo(static_cast<uint32_t>(i), name, Violation{Metric::Network, 2, 1});
+            procmon::encode_violation(agent->outbound, message, nullptr);
+        }
+
+        if (epoll.add(agent->stream.as_raw_fd(), EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, agents.size()).is_err())
+        {
+            refused++;
+            continue;
+        }
+
+        agents.push_back(std::move(agent));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t pending = agents.size();
+    epoll_event events[256];
+    while (pending > 0 && std::chrono::steady_clock::now() - start < DEADLINE)
+    {
+        auto wait = epoll.wait(std::span<epoll_event>(events, std::size(events)), std::chrono::milliseconds(1000));
+        if (wait.is_err())
+        {
+            std::cerr << "Failed to wait for events: " << wait.unwrap_err().message() << std::endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < wait.unwrap(); i++)
+        {
+            auto &agent = *agents[events[i].data.u64];
+            auto done_before = agent.closed || agent.acknowledged >= reports.value();
+
+            agent.flush();
+            agent.receive();
+
+            if (!done_before && (agent.closed || agent.acknowledged >= reports.value()))
+            {
+                pending--;
+                epoll.remove(agent.stream.as_raw_fd());
+            }
+        }
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t held = 0, configured = 0;
+    uint64_t acknowledged = 0;
+    for (const auto &agent : agents)
+    {
+        held += !agent->closed;
+        configured += agent->configured;
+        acknowledged += agent->acknowledged;
+    }
+
+    std::cout << "Connections: " << held << " held, " << agents.size() - held << " closed by CTB, " << refused << " refused" << std::endl;
+    std::cout << "Configuration received by " << configured << " connections" << std::endl;
+    std::cout << "Reports: " << acknowledged << " of " << agents.size() * reports.value() << " acknowledged in " << elapsed << "s ("
+              << static_cast<uint64_t>(acknowledged / elapsed) << " reports/s)" << std::endl;
+
+    return pending == 0 && held == agents.size() ? 0 : 1;
+}
@@ -0,0 +1,1182 @@
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <iomanip>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+
+#include "event_archive.hpp"
+#include "event_log.hpp"
+#include "event_store.hpp"
+#include "frame.hpp"
+#include "net.hpp"
+
+using json = nlohmann::json;
+
+static const char *const METRIC_NAMES[] = {"cpu", "memory", "disk", "network"};
+static const char *const SEVERITY_NAMES[] = {"low", "normal", "critical"};
+
+enum class _GroupKey
+{
+    Agent,
+    Process,
+    Metric,
+    Severity,
+    Pid,
+    Hour,
+    Day,
+};
+
+struct _Options
+{
+    procmon::EventQuery query;
+    double min_ratio = 0.0;
+    /** @brief Unset to list the matching events. Empty (`all`) aggregates every event into one group. */
+    std::optional<std::vector<_GroupKey>> group_by;
+    std::vector<double> percentiles = {50.0, 90.0, 99.0};
+    size_t limit = SIZE_MAX;
+    bool json = false;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+/** @brief A segment or an archive of the store, opened by the worker which scans it. */
+struct _Source
+{
+    path::PathBuf directory;
+    uint64_t id;
+    bool archive;
+};
+
+/**
+ * @brief Log-linear histogram of violation values: exact below 128, and within 1% above, in at
+ * most 1792 buckets.
+ */
+class _Histogram
+{
+private:
+    static constexpr uint32_t EXACT = 128;
+    static constexpr uint32_t HALF = EXACT / 2;
+
+    std::vector<uint64_t> _counts;
+    uint64_t _total = 0;
+
+    static size_t _bucket_of(uint32_t value)
+    {
+        if (value < EXACT)
+        {
+            return value;
+        }
+
+        auto shift = static_cast<uint32_t>(std::bit_width(value)) - 7;
+        return EXACT + (shift - 1) * HALF + ((value >> shift) - HALF);
+    }
+
+    /** @brief Middle of the values falling into `bucket`. */
+    static uint64_t _value_of(size_t bucket)
+    {
+        if (bucket < EXACT)
+        {
+            return bucket;
+        }
+
+        auto shift = static_cast<uint32_t>((bucket - EXACT) / HALF) + 1;
+        auto low = static_cast<uint64_t>((bucket - EXACT) % HALF + HALF) << shift;
+        return low + ((uint64_t(1) << shift) - 1) / 2;
+    }
+
+public:
+    void add(uint32_t value)
+    {
+        auto bucket = _bucket_of(value);
+        if (bucket >= _counts.size())
+        {
+            _counts.resize(bucket + 1);
+        }
+
+        _counts[bucket]++;
+        _total++;
+    }
+
+    void merge(const _Histogram &other)
+    {
+        if (other._counts.size() > _counts.size())
+        {
+            _counts.resize(other._counts.size());
+        }
+
+        for (size_t i = 0; i < other._counts.size(); i++)
+        {
+            _counts[i] += other._counts[i];
+        }
+
+        _total += other._total;
+    }
+
+    /** @brief The value below which `percentile`% of the values fall. */
+    uint64_t percentile(double percentile) const
+    {
+        auto rank = static_cast<uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(_total)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); i++)
+        {
+            seen += _counts[i];
+            if (seen >= std::max<uint64_t>(rank, 1))
+            {
+                return _value_of(i);
+            }
+        }
+
+        return 0;
+    }
+};
+
+struct _Group
+{
+    std::vector<std::string> key;
+    uint64_t count = 0;
+    uint32_t max_value = 0;
+    double max_ratio = 0.0;
+    uint64_t first_ms = UINT64_MAX;
+    uint64_t last_ms = 0;
+    _Histogram values;
+
+    void add(const procmon::StoredEvent &event, double ratio)
+    {
+        count++;
+        max_value = std::max(max_value, event.violation.info.violation.value);
+        max_ratio = std::max(max_ratio, ratio);
+        first_ms = std::min(first_ms, event.timestamp_ms);
+        last_ms = std::max(last_ms, event.timestamp_ms);
+        values.add(event.violation.info.violation.value);
+    }
+
+    void merge(_Group &&other)
+    {
+        count += other.count;
+        max_value = std::max(max_value, other.max_value);
+        max_ratio = std::max(max_ratio, other.max_ratio);
+        first_ms = std::min(first_ms, other.first_ms);
+        last_ms = std::max(last_ms, other.last_ms);
+        values.merge(other.values);
+    }
+};
+
+/** @brief What a worker produced for one source: the formatted events, or why the scan failed. */
+struct _Result
+{
+    bool done = false;
+    std::string output;
+    std::string error;
+};
+
+static int _show_help()
+{
+    std::cout << "Usage: CTBQuery <store-dir | segment.dat | archive.col>... [--from time] [--to time] [--agent id] [--process name]" << std::endl;
+    std::cout << "                [--metric cpu|memory|disk|network] [--min-ratio ratio] [--group-by keys] [--percentiles list]" << std::endl;
+    std::cout << "                [--limit n] [--format text|json] [--threads n]" << std::endl;
+    std::cout << "Times are milliseconds since the Unix epoch, or durations ago such as 30m, 12h or 7d." << std::endl;
+    std::cout << "Agent IDs are hexadecimal. The ratio is the value of a violation divided by its threshold." << std::endl;
+    std::cout << "--group-by takes a comma-separated list of agent, process, metric, severity, pid, hour and day, or all." << std::endl;
+    std::cout << "Without it, the matching events are listed." << std::endl;
+    std::cout << std::endl;
+    std::cout << "       CTBQuery --top <port> [--by process|agent|agent-process] [--window 1m|1h|1d] [--limit n] [--format text|json]" << std::endl;
+    std::cout << "Asks a running CTB for the heaviest violators of a sliding window (default: processes over the last hour)." << std::endl;
+    std::cout << std::endl;
+    std::cout << "       CTBQuery --follow <port> [--agent id] [--process name] [--metric list] [--lag skip|disconnect] [--format text|json]" << std::endl;
+    std::cout << "Prints the violations logged by a running CTB as they arrive. --metric takes a comma-separated list." << std::endl;
+    std::cout << "When this client falls behind, CTB either skips the violations it missed (default) or disconnects it." << std::endl;
+    return 1;
+}
+
+static std::optional<uint64_t> _parse_time(const std::string &value)
+{
+    try
+    {
+        size_t pos = 0;
+        uint64_t number = std::stoull(value, &pos);
+        if (pos == value.size())
+        {
+            return number;
+        }
+
+        static const std::pair<char, uint64_t> UNITS[] = {{'s', 1000}, {'m', 60 * 1000}, {'h', 60 * 60 * 1000}, {'d', 24 * 60 * 60 * 1000}};
+        for (auto [unit, ms] : UNITS)
+        {
+            if (pos + 1 == value.size() && value[pos] == unit)
+            {
+                auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+                auto ago = number * ms;
+                return static_cast<uint64_t>(now.count()) - std::min<uint64_t>(ago, now.count());
+            }
+        }
+    }
+    catch (...)
+    {
+    }
+
+    return std::nullopt;
+}
+
+static std::optional<std::vector<std::string>> _split(const std::string &value)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (true)
+    {
+        auto end = value.find(',', start);
+        parts.push_back(value.substr(start, end - start));
+        if (parts.back().empty())
+        {
+            return std::nullopt;
+        }
+
+        if (end == std::string::npos)
+        {
+            return parts;
+        }
+
+        start = end + 1;
+    }
+}
+
+static std::string _format_agent(uint64_t agent_id)
+{
+    std::ostringstream text;
+    text << std::hex << std::setw(16) << std::setfill('0') << agent_id;
+    return text.str();
+}
+
+/** @brief `timestamp_ms` in UTC, as ISO 8601 truncated to `length` characters (23 for milliseconds). */
+static std::string _format_time(uint64_t timestamp_ms, size_t length = 23)
+{
+    auto seconds = static_cast<time_t>(timestamp_ms / 1000);
+    struct tm utc = {};
+    gmtime_r(&seconds, &utc);
+
+    char buffer[32];
+    auto written = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(buffer + written, sizeof(buffer) - written, ".%03u", static_cast<unsigned>(timestamp_ms % 1000));
+    return std::string(buffer, std::min(length, std::strlen(buffer)));
+}
+
+static std::string_view _name_of(const procmon::ViolationMessage &violation)
+{
+    auto name = reinterpret_cast<const char *>(violation.info.name);
+    return std::string_view(name, strnlen(name, sizeof(violation.info.name)));
+}
+
+static const char *_metric_name(Metric metric)
+{
+    auto index = static_cast<size_t>(metric);
+    return index < std::size(METRIC_NAMES) ? METRIC_NAMES[index] : "unknown";
+}
+
+static const char *_severity_name(procmon::Severity severity)
+{
+    auto index = static_cast<size_t>(severity);
+    return index < std::size(SEVERITY_NAMES) ? SEVERITY_NAMES[index] : "unknown";
+}
+
+static double _ratio_of(const procmon::StoredEvent &event)
+{
+    const auto &violation = event.violation.info.violation;
+    return violation.threshold == 0 ? 0.0 : static_cast<double>(violation.value) / violation.threshold;
+}
+
+static std::string _format_event(const procmon::StoredEvent &event, bool as_json)
+{
+    const auto &info = event.violation.info;
+    if (as_json)
+    {
+        json line = {
+            {"time_ms", event.timestamp_ms},
+            {"agent", _format_agent(event.agent_id)},
+            {"sequence", event.violation.sequence},
+            {"severity", _severity_name(event.violation.severity)},
+            {"pid", info.pid},
+            {"process", _name_of(event.violation)},
+            {"metric", _metric_name(info.violation.metric)},
+            {"value", info.violation.value},
+            {"threshold", info.violation.threshold},
+        };
+
+        if (event.details.has_value())
+        {
+            line["uid"] = event.details->uid;
+            line["exe"] = event.details->exe;
+            line["cgroup"] = event.details->cgroup;
+            line["cmdline"] = event.details->cmdline;
+        }
+
+        return line.dump(-1, ' ', false, json::error_handler_t::replace) + "\n";
+    }
+
+    std::ostringstream text;
+    text << _format_time(event.timestamp_ms) << "Z agent=" << _format_agent(event.agent_id)
+         << " pid=" << info.pid
+         << " process=" << procmon::Escaped{_name_of(event.violation)}
+         << " metric=" << _metric_name(info.violation.metric)
+         << " value=" << info.violation.value
+         << " threshold=" << info.violation.threshold
+         << " severity=" << _severity_name(event.violation.severity);
+    if (event.details.has_value())
+    {
+        text << " uid=" << event.details->uid
+             << " exe=" << procmon::Escaped{event.details->exe}
+             << " cgroup=" << procmon::Escaped{event.details->cgroup}
+             << " cmdline=" << procmon::Escaped{event.details->cmdline};
+    }
+
+    text << '\n';
+    return text.str();
+}
+
+static std::vector<std::string> _key_of(const procmon::StoredEvent &event, const std::vector<_GroupKey> &keys)
+{
+    std::vector<std::string> key;
+    for (auto part : keys)
+    {
+        switch (part)
+        {
+        case _GroupKey::Agent:
+            key.push_back(_format_agent(event.agent_id));
+            break;
+        case _GroupKey::Process:
+            key.emplace_back(_name_of(event.violation));
+            break;
+        case _GroupKey::Metric:
+            key.emplace_back(_metric_name(event.violation.info.violation.metric));
+            break;
+        case _GroupKey::Severity:
+            key.emplace_back(_severity_name(event.violation.severity));
+            break;
+        case _GroupKey::Pid:
+            key.push_back(std::to_string(event.violation.info.pid));
+            break;
+        case _GroupKey::Hour:
+            key.push_back(_format_time(event.timestamp_ms, 13));
+            break;
+        case _GroupKey::Day:
+            key.push_back(_format_time(event.timestamp_ms, 10));
+            break;
+        }
+    }
+
+    return key;
+}
+
+static const char *_key_name(_GroupKey key)
+{
+    static const char *const NAMES[] = {"agent", "process", "metric", "severity", "pid", "hour", "day"};
+    return NAMES[static_cast<size_t>(key)];
+}
+
+static std::optional<_Options> _parse_options(int argc, char **argv, std::vector<path::PathBuf> &paths)
+{
+    _Options options;
+    int i = 1;
+    for (; i < argc && std::strncmp(argv[i], "--", 2) != 0; i++)
+    {
+        paths.emplace_back(argv[i]);
+    }
+
+    if (paths.empty())
+    {
+        return std::nullopt;
+    }
+
+    for (; i < argc; i += 2)
+    {
+        std::string option(argv[i]);
+        if (i + 1 >= argc)
+        {
+            return std::nullopt;
+        }
+
+        std::string value(argv[i + 1]);
+        try
+        {
+            if (option == "--from" || option == "--to")
+            {
+                auto time = _parse_time(value);
+                if (!time.has_value())
+                {
+                    return std::nullopt;
+                }
+
+                (option == "--from" ? options.query.from_ms : options.query.to_ms) = time.value();
+            }
+            else if (option == "--agent")
+            {
+                size_t pos = 0;
+                options.query.agent_id = std::stoull(value, &pos, 16);
+                if (pos != value.size())
+                {
+                    return std::nullopt;
+                }
+            }
+            else if (option == "--process")
+            {
+                // Agents report names truncated like the kernel does.
+                options.query.name = value.substr(0, COMMAND_LENGTH - 1);
+            }
+            else if (option == "--metric")
+            {
+                auto name = std::find(std::begin(METRIC_NAMES), std::end(METRIC_NAMES), value);
+                if (name == std::end(METRIC_NAMES))
+                {
+                    return std::nullopt;
+                }
+
+                options.query.metric = static_cast<Metric>(name - std::begin(METRIC_NAMES));
+            }
+            else if (option == "--min-ratio")
+            {
+                size_t pos = 0;
+                options.min_ratio = std::stod(value, &pos);
+                if (pos != value.size())
+                {
+                    return std::nullopt;
+                }
+            }
+            else if (option == "--group-by")
+            {
+                auto parts = _split(value);
+                if (!parts.has_value())
+                {
+                    return std::nullopt;
+                }
+
+                options.group_by.emplace();
+                for (const auto &part : parts.value())
+                {
+                    if (part == "all" && parts->size() == 1)
+                    {
+                        continue;
+                    }
+
+                    size_t key = 0;
+                    while (key <= static_cast<size_t>(_GroupKey::Day) && part != _key_name(static_cast<_GroupKey>(key)))
+                    {
+                        key++;
+                    }
+
+                    if (key > static_cast<size_t>(_GroupKey::Day))
+                    {
+                        return std::nullopt;
+                    }
+
+                    options.group_by->push_back(static_cast<_GroupKey>(key));
+                }
+            }
+            else if (option == "--percentiles")
+            {
+                auto parts = _split(value);
+                if (!parts.has_value())
+                {
+                    return std::nullopt;
+                }
+
+                options.percentiles.clear();
+                for (const auto &part : parts.value())
+                {
+                    size_t pos = 0;
+                    auto percentile = std::stod(part, &pos);
+                    if (pos != part.size() || percentile < 0.0 || percentile > 100.0)
+                    {
+                        return std::nullopt;
+                    }
+
+                    options.percentiles.push_back(percentile);
+                }
+            }
+            else if (option == "--limit" || option == "--threads")
+            {
+                size_t pos = 0;
+                auto number = std::stoull(value, &pos);
+                if (pos != value.size() || number == 0)
+                {
+                    return std::nullopt;
+                }
+
+                (option == "--limit" ? options.limit : options.threads) = number;
+            }
+            else if (option == "--format" && (value == "text" || value == "json"))
+            {
+                options.json = value == "json";
+            }
+            else
+            {
+                return std::nullopt;
+            }
+        }
+        catch (...)
+        {
+            return std::nullopt;
+        }
+    }
+
+    return options;
+}
+
+/**
+ * @brief Find the segments and archives given on the command line, as files or as store directories.
+ *
+ * Like `EventStore::open`, a segment next to its archive is skipped: it was about to be removed.
+ */
+static io::Result<std::vector<_Source>> _find_sources(const std::vector<path::PathBuf> &paths)
+{
+    std::vector<_Source> sources;
+    auto add = [&sources](const path::PathBuf &file)
+    {
+        auto name = file.filename().string();
+        if (name.size() != 20 || !(name.ends_with(".dat") || name.ends_with(".col")))
+        {
+            return false;
+        }
+
+        try
+        {
+            sources.push_back(_Source{file.parent_path(), std::stoull(name.substr(0, 16), nullptr, 16), name.ends_with(".col")});
+            return true;
+        }
+        catch (...)
+        {
+            return false;
+        }
+    };
+
+    for (const auto &path : paths)
+    {
+        std::error_code error;
+        if (std::filesystem::is_directory(path, error))
+        {
+            for (const auto &entry : std::filesystem::directory_iterator(path, error))
+            {
+                add(entry.path());
+            }
+        }
+        else if (!add(path))
+        {
+            return io::Result<std::vector<_Source>>::err(io::Error::other(path.string() + " is neither a store directory, a segment nor an archive"));
+        }
+
+        if (error)
+        {
+            return io::Result<std::vector<_Source>>::err(io::Error::from_raw_os_error(error.value()));
+        }
+    }
+
+    std::sort(
+        sources.begin(), sources.end(),
+        [](const _Source &a, const _Source &b)
+        { return std::tie(a.directory, a.id, a.archive) < std::tie(b.directory, b.id, b.archive); });
+
+    std::erase_if(
+        sources,
+        [&sources](const _Source &source)
+        {
+            return !source.archive && std::binary_search(
+                                          sources.begin(), sources.end(), _Source{source.directory, source.id, true},
+                                          [](const _Source &a, const _Source &b)
+                                          { return std::tie(a.directory, a.id, a.archive) < std::tie(b.directory, b.id, b.archive); });
+        });
+
+    sources.erase(
+        std::unique(
+            sources.begin(), sources.end(),
+            [](const _Source &a, const _Source &b)
+            { return a.directory == b.directory && a.id == b.id && a.archive == b.archive; }),
+        sources.end());
+
+    return io::Result<std::vector<_Source>>::ok(std::move(sources));
+}
+
+static io::Result<size_t> _scan(const _Source &source, const procmon::EventQuery &query, const std::function<bool(const procmon::StoredEvent &)> &visitor)
+{
+    if (source.archive)
+    {
+        auto archive = SHORT_CIRCUIT(size_t, procmon::EventArchive::open(source.directory, source.id));
+        return archive->query(query, visitor);
+    }
+
+    auto segment = SHORT_CIRCUIT(size_t, procmon::EventSegment::open_read_only(source.directory, source.id));
+    return segment->query(query, visitor);
+}
+
+static void _print_groups(std::vector<_Group> &groups, const _Options &options)
+{
+    std::sort(
+        groups.begin(), groups.end(),
+        [](const _Group &a, const _Group &b)
+        { return a.count != b.count ? a.count > b.count : a.key < b.key; });
+
+    auto percentile_name = [](double percentile)
+    {
+        std::ostringstream name;
+        name << 'p' << percentile;
+        return name.str();
+    };
+
+    for (size_t i = 0; i < groups.size() && i < options.limit; i++)
+    {
+        const auto &group = groups[i];
+        if (options.json)
+        {
+            json line;
+            for (size_t k = 0; k < group.key.size(); k++)
+            {
+                line[_key_name(options.group_by->at(k))] = group.key[k];
+            }
+
+            line["count"] = group.count;
+            line["max"] = group.max_value;
+            line["max_ratio"] = group.max_ratio;
+            for (auto percentile : options.percentiles)
+            {
+                line[percentile_name(percentile)] = group.values.percentile(percentile);
+            }
+
+            line["first_ms"] = group.first_ms;
+            line["last_ms"] = group.last_ms;
+            std::cout << line.dump(-1, ' ', false, json::error_handler_t::replace) << '\n';
+        }
+        else
+        {
+            for (size_t k = 0; k < group.key.size(); k++)
+            {
+                std::cout << _key_name(options.group_by->at(k)) << '=' << procmon::Escaped{group.key[k]} << ' ';
+            }
+
+            std::cout << "count=" << group.count << " max=" << group.max_value << " max_ratio=" << group.max_ratio;
+            for (auto percentile : options.percentiles)
+            {
+                std::cout << ' ' << percentile_name(percentile) << '=' << group.values.percentile(percentile);
+            }
+
+            std::cout << " first=" << _format_time(group.first_ms) << "Z last=" << _format_time(group.last_ms) << "Z\n";
+        }
+    }
+}
+
+static bool _send(net::TcpStream &stream, const std::vector<char> &frame)
+{
+    for (auto rest = std::span<const char>(frame.data(), frame.size()); !rest.empty();)
+    {
+        auto written = stream.write(rest);
+        if (written.is_err())
+        {
+            std::cerr << "Unable to send the request to CTB: " << written.unwrap_err().message() << std::endl;
+            return false;
+        }
+
+        rest = rest.subspan(written.unwrap());
+    }
+
+    return true;
+}
+
+/**
+ * @brief Print the heaviest violators tracked by the CTB listening on the local `port`.
+ */
+static int _query_top(int argc, char **argv)
+{
+    static const char *const KEYS[] = {"process", "agent", "agent-process"};
+    static const char *const WINDOWS[] = {"1m", "1h", "1d"};
+
+    auto port = procmon::parse_port(argv[2]);
+    if (!port.has_value())
+    {
+        return _show_help();
+    }
+
+    procmon::TopRequestMessage request = {procmon::HeavyHitterKey::Process, procmon::HeavyHitterWindow::Hour, 10};
+    bool as_json = false;
+    for (int i = 3; i < argc; i += 2)
+    {
+        std::string option(argv[i]);
+        if (i + 1 >= argc)
+        {
+            return _show_help();
+        }
+
+        std::string value(argv[i + 1]);
+        auto key = std::find(std::begin(KEYS), std::end(KEYS), value);
+        auto window = std::find(std::begin(WINDOWS), std::end(WINDOWS), value);
+        if (option == "--by" && key != std::end(KEYS))
+        {
+            request.key = static_cast<procmon::HeavyHitterKey>(key - std::begin(KEYS));
+        }
+        else if (option == "--window" && window != std::end(WINDOWS))
+        {
+            request.window = static_cast<procmon::HeavyHitterWindow>(window - std::begin(WINDOWS));
+        }
+        else if (option == "--limit")
+        {
+            try
+            {
+                size_t pos = 0;
+                auto limit = std::stoul(value, &pos);
+                if (pos != value.size() || limit == 0 || limit > UINT32_MAX)
+                {
+                    return _show_help();
+                }
+
+                request.count = static_cast<uint32_t>(limit);
+            }
+            catch (...)
+            {
+                return _show_help();
+            }
+        }
+        else if (option == "--format" && (value == "text" || value == "json"))
+        {
+            as_json = value == "json";
+        }
+        else
+        {
+            return _show_help();
+        }
+    }
+
+    auto stream_result = net::TcpStream::connect(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, port.value()));
+    if (stream_result.is_err())
+    {
+        std::cerr << "Unable to connect to CTB: " << stream_result.unwrap_err().message() << std::endl;
+        return 1;
+    }
+
+    auto stream = std::move(stream_result).into_ok();
+    std::vector<char> frame;
+    procmon::encode_message(frame, procmon::MessageType::TopRequest, request);
+    if (!_send(stream, frame))
+    {
+        return 1;
+    }
+
+    // CTB greets every connection with its configuration: skip it.
+    procmon::FrameDecoder decoder;
+    while (true)
+    {
+        auto payload = decoder.read_frame(stream);
+        if (payload.is_err())
+        {
+            std::cerr << "Unable to receive the report from CTB: " << payload.unwrap_err().message() << std::endl;
+            return 1;
+        }
+
+        auto decoded = procmon::decode_message(payload.unwrap());
+        if (!decoded.has_value() || decoded->first != procmon::MessageType::TopReport)
+        {
+            continue;
+        }
+
+        auto body = decoded->second;
+        auto header = procmon::message_as<procmon::TopRequestMessage>(body.first(std::min(body.size(), sizeof(procmon::TopRequestMessage))));
+        if (!header.has_value() || body.size() != sizeof(procmon::TopRequestMessage) + header->count * sizeof(procmon::HeavyHitter))
+        {
+            std::cerr << "Received a malformed report from CTB" << std::endl;
+            return 1;
+        }
+
+        for (uint32_t i = 0; i < header->count; i++)
+        {
+            procmon::HeavyHitter entry;
+            std::memcpy(&entry, body.data() + sizeof(procmon::TopRequestMessage) + i * sizeof(entry), sizeof(entry));
+            auto name = std::string_view(reinterpret_cast<const char *>(entry.name), strnlen(reinterpret_cast<const char *>(entry.name), sizeof(entry.name)));
+
+            if (as_json)
+            {
+                json line = {{"count", entry.count}, {"error", entry.error}};
+                if (request.key != procmon::HeavyHitterKey::Process)
+                {
+                    line["agent"] = _format_agent(entry.agent_id);
+                }
+
+                if (request.key != procmon::HeavyHitterKey::Agent)
+                {
+                    line["process"] = name;
+                }
+
+                std::cout << line.dump(-1, ' ', false, json::error_handler_t::replace) << '\n';
+            }
+            else
+            {
+                if (request.key != procmon::HeavyHitterKey::Process)
+                {
+                    std::cout << "agent=" << _format_agent(entry.agent_id) << ' ';
+                }
+
+                if (request.key != procmon::HeavyHitterKey::Agent)
+                {
+                    std::cout << "process=" << procmon::Escaped{name} << ' ';
+                }
+
+                std::cout << "count=" << entry.count << " error=" << entry.error << '\n';
+            }
+        }
+
+        std::cout << std::flush;
+        return 0;
+    }
+}
+
+/**
+ * @brief Print the violations logged by the CTB listening on the local `port`, until it goes away.
+ */
+static int _follow(int argc, char **argv)
+{
+    auto port = procmon::parse_port(argv[2]);
+    if (!port.has_value())
+    {
+        return _show_help();
+    }
+
+    procmon::SubscribeMessage subscription = {};
+    subscription.flags = procmon::SUBSCRIBE_SKIP_AHEAD;
+    bool as_json = false;
+    for (int i = 3; i < argc; i += 2)
+    {
+        std::string option(argv[i]);
+        if (i + 1 >= argc)
+        {
+            return _show_help();
+        }
+
+        std::string value(argv[i + 1]);
+        if (option == "--agent")
+        {
+            try
+            {
+                size_t pos = 0;
+                subscription.agent_id = std::stoull(value, &pos, 16);
+                if (pos != value.size() || subscription.agent_id == 0)
+                {
+                    return _show_help();
+                }
+            }
+            catch (...)
+            {
+                return _show_help();
+            }
+        }
+        else if (option == "--process" && !value.empty())
+        {
+            // Agents report names truncated like the kernel does.
+            std::memset(subscription.name, 0, sizeof(subscription.name));
+            std::memcpy(subscription.name, value.data(), std::min(value.size(), sizeof(subscription.name) - 1));
+        }
+        else if (option == "--metric")
+        {
+            auto names = _split(value);
+            if (!names.has_value())
+            {
+                return _show_help();
+            }
+
+            for (const auto &name : names.value())
+            {
+                auto metric = std::find(std::begin(METRIC_NAMES), std::end(METRIC_NAMES), name);
+                if (metric == std::end(METRIC_NAMES))
+                {
+                    return _show_help();
+                }
+
+                subscription.metrics |= 1u << (metric - std::begin(METRIC_NAMES));
+            }
+        }
+        else if (option == "--lag" && (value == "skip" || value == "disconnect"))
+        {
+            subscription.flags = value == "skip" ? procmon::SUBSCRIBE_SKIP_AHEAD : 0;
+        }
+        else if (option == "--format" && (value == "text" || value == "json"))
+        {
+            as_json = value == "json";
+        }
+        else
+        {
+            return _show_help();
+        }
+    }
+
+    auto stream_result = net::TcpStream::connect(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, port.value()));
+    if (stream_result.is_err())
+    {
+        std::cerr << "Unable to connect to CTB: " << stream_result.unwrap_err().message() << std::endl;
+        return 1;
+    }
+
+    auto stream = std::move(stream_result).into_ok();
+    std::vector<char> frame;
+    procmon::encode_message(frame, procmon::MessageType::Subscribe, subscription);
+    if (!_send(stream, frame))
+    {
+        return 1;
+    }
+
+    // CTB greets every connection with its configuration: skip it. The output is flushed whenever
+    // the received frames are consumed, since it is typically piped into another tool.
+    procmon::FrameDecoder decoder;
+    while (true)
+    {
+        auto payload = decoder.next();
+        if (payload.is_ok() && !payload.unwrap().has_value())
+        {
+            std::cout << std::flush;
+            auto size = decoder.fill(stream);
+            if (size.is_err() || size.unwrap() == 0)
+            {
+                std::cerr << "Lost the violation stream of CTB: " << (size.is_err() ? size.unwrap_err().message() : "Connection closed by peer") << std::endl;
+                return 1;
+            }
+
+            continue;
+        }
+
+        if (payload.is_err())
+        {
+            std::cerr << "Lost the violation stream of CTB: " << payload.unwrap_err().message() << std::endl;
+            return 1;
+        }
+
+        auto decoded = procmon::decode_message(payload.unwrap().value());
+        if (!decoded.has_value())
+        {
+            continue;
+        }
+
+        auto [type, body] = decoded.value();
+        if (type == procmon::MessageType::StreamGap)
+        {
+            auto gap = procmon::message_as<procmon::StreamGapMessage>(body);
+            if (gap.has_value())
+            {
+                std::cerr << "Fell behind, " << gap->skipped << " violations were skipped" << std::endl;
+            }
+
+            continue;
+        }
+
+        if (type != procmon::MessageType::StreamViolation)
+        {
+            continue;
+        }
+
+        procmon::StoredEvent event;
+        auto header = sizeof(event.timestamp_ms) + sizeof(event.agent_id);
+        auto violation = body.size() < header ? std::nullopt : procmon::decode_violation(body.subspan(header));
+        if (!violation.has_value())
+        {
+            std::cerr << "Received a malformed violation from CTB" << std::endl;
+            return 1;
+        }
+
+        std::memcpy(&event.timestamp_ms, body.data(), sizeof(event.timestamp_ms));
+        std::memcpy(&event.agent_id, body.data() + sizeof(event.timestamp_ms), sizeof(event.agent_id));
+        event.violation = violation->first;
+        event.details = std::move(violation->second);
+        std::cout << _format_event(event, as_json);
+    }
+}
+
+/**
+ * @brief Offline queries over the files of a CTB event store, heavy hitters of a running CTB with
+ * `--top`, or its live violations with `--follow`.
+ *
+ * Segments are opened read-only (CTB may be running and writing to them) and archives are mapped as
+ * is. Every worker thread takes the next source, pushes the filters down to its indexes, and either
+ * formats the matching events, which are printed in storage order, or folds them into its own
+ * groups, which are merged at the end.
+ */
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && std::strcmp(argv[1], "--top") == 0)
+    {
+        return _query_top(argc, argv);
+    }
+
+    if (argc >= 3 && std::strcmp(argv[1], "--follow") == 0)
+    {
+        return _follow(argc, argv);
+    }
+
+    std::vector<path::PathBuf> paths;
+    auto parsed = _parse_options(argc, argv, paths);
+    if (!parsed.has_value())
+    {
+        return _show_help();
+    }
+
+    const auto &options = parsed.value();
+    auto sources_result = _find_sources(paths);
+    if (sources_result.is_err())
+    {
+        std::cerr << "Unable to list the event store: " << sources_result.unwrap_err().message() << std::endl;
+        return 1;
+    }
+
+    auto sources = std::move(sources_result).into_ok();
+
+    std::mutex mutex;
+    std::condition_variable finished, advanced;
+    std::vector<_Result> results(sources.size());
+    std::atomic<size_t> next(0);
+    std::atomic<bool> stopping(false);
+    // Index of the next source to print.
+    size_t printing = 0;
+
+    using GroupMap = std::map<std::vector<std::string>, _Group>;
+    std::vector<GroupMap> partial_groups(std::min(options.threads, std::max<size_t>(sources.size(), 1)));
+
+    // When listing, the output of the sources finished ahead of the one being printed is held in
+    // memory: only scan that many sources ahead.
+    auto window = 2 * partial_groups.size();
+
+    auto work = [&](GroupMap &groups)
+    {
+        for (size_t index = next++; index < sources.size() && !stopping; index = next++)
+        {
+            if (!options.group_by.has_value())
+            {
+                std::unique_lock lock(mutex);
+                advanced.wait(
+                    lock,
+                    [&]
+                    { return index < printing + window || stopping; });
+                if (stopping)
+                {
+                    break;
+                }
+            }
+
+            // No source prints more than `limit` lines, so a scan stops there.
+            std::string output;
+            size_t lines = 0;
+            auto visitor = [&](const procmon::StoredEvent &event)
+            {
+                auto ratio = _ratio_of(event);
+                if (ratio < options.min_ratio)
+                {
+                    return !stopping;
+                }
+
+                if (options.group_by.has_value())
+                {
+                    auto key = _key_of(event, options.group_by.value());
+                    auto &group = groups[key];
+                    if (group.count == 0)
+                    {
+                        group.key = std::move(key);
+                    }
+
+                    group.add(event, ratio);
+                }
+                else
+                {
+                    output += _format_event(event, options.json);
+                    lines++;
+                }
+
+                return (options.group_by.has_value() || lines < options.limit) && !stopping;
+            };
+
+            auto scanned = _scan(sources[index], options.query, visitor);
+
+            std::lock_guard lock(mutex);
+            auto &result = results[index];
+            result.done = true;
+            result.output = std::move(output);
+            if (scanned.is_err())
+            {
+                result.error = scanned.unwrap_err().message();
+            }
+
+            finished.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < partial_groups.size(); i++)
+    {
+        workers.emplace_back(work, std::ref(partial_groups[i]));
+    }
+
+    // Print the sources in order, as soon as each one is done.
+    int status = 0;
+    size_t printed = 0;
+    for (size_t index = 0; index < sources.size(); index++)
+    {
+        std::unique_lock lock(mutex);
+        finished.wait(
+            lock,
+            [&]
+            { return results[index].done; });
+
+        auto result = std::move(results[index]);
+        printing = index + 1;
+        lock.unlock();
+        advanced.notify_all();
+
+        if (!result.error.empty())
+        {
+            const auto &source = sources[index];
+            auto name = _format_agent(source.id) + (source.archive ? ".col" : ".dat");
+            std::cerr << "Unable to read " << (source.directory / name).string() << ": " << result.error << std::endl;
+            status = 1;
+        }
+
+        // Only print whole events up to the limit: escaping keeps every event on a line of its own.
+        for (size_t start = 0; start < result.output.size() && printed < options.limit; printed++)
+        {
+            auto end = result.output.find('\n', start) + 1;
+            std::cout.write(result.output.data() + start, static_cast<std::streamsize>(end - start));
+            start = end;
+        }
+
+        if (printed >= options.limit && !options.group_by.has_value())
+        {
+            {
+                std::lock_guard stop_lock(mutex);
+                stopping = true;
+            }
+
+            advanced.notify_all();
+            break;
+        }
+    }
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    if (options.group_by.has_value())
+    {
+        GroupMap merged;
+        for (auto &groups : partial_groups)
+        {
+            for (auto &[key, group] : groups)
+            {
+                auto &target = merged[key];
+                if (target.count == 0)
+                {
+                    target.key = key;
+                }
+
+                target.merge(std::move(group));
+            }
+        }
+
+        std::vector<_Group> groups;
+        for (auto &[key, group] : merged)
+        {
+            groups.push_back(std::move(group));
+        }
+
+        _print_groups(groups, options);
+    }
+
+    std::cout << std::flush;
+    return status;
+}
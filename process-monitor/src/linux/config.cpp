@@ -25,9 +25,15 @@ namespace procmon
         std::vector<ConfigEntry> result(size);
         for (uint32_t i = 0; i < size; i++)
         {
-            SHORT_CIRCUIT(
+            auto read = SHORT_CIRCUIT(
                 std::vector<ConfigEntry>,
                 file.read(std::span<char>(reinterpret_cast<char *>(&result[i]), sizeof(ConfigEntry))));
+            if (read != sizeof(ConfigEntry))
+            {
+                // Most likely saved by a version with a different entry layout.
+                return io::Result<std::vector<ConfigEntry>>::err(
+                    io::Error(io::ErrorKind::InvalidData, "Saved configuration is truncated or has an unsupported format"));
+            }
         }
 
         return io::Result<std::vector<ConfigEntry>>::ok(std::move(result));
@@ -0,0 +1,314 @@
+#include <filesystem>
+#include <fstream>
+
+#include <sys/resource.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "enforcement.hpp"
+#include "fs.hpp"
+
+namespace
+{
+    constexpr int IOPRIO_WHO_PROCESS = 1;
+    constexpr int IOPRIO_CLASS_BE = 2;
+    constexpr int IOPRIO_CLASS_SHIFT = 13;
+    constexpr uint64_t CPU_PERIOD_US = 100000;
+    constexpr decltype(statfs::f_type) CGROUP2_SUPER_MAGIC = 0x63677270;
+
+    const path::PathBuf CGROUP_MOUNT = "/sys/fs/cgroup";
+
+    io::Result<std::monostate> _write_file(const path::PathBuf &path, const std::string &content)
+    {
+        auto file = SHORT_CIRCUIT(std::monostate, fs::OpenOptions().write(true).open(path));
+        auto written = SHORT_CIRCUIT(std::monostate, file.write(std::span<const char>(content.data(), content.size())));
+        if (written != content.size())
+        {
+            return io::Result<std::monostate>::err(io::Error::other("Short write to " + path.string()));
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    /**
+     * @brief Path of the cgroup v2 of `pid`, relative to the cgroup mount point (e.g. `/user.slice`).
+     */
+    std::optional<std::string> _current_cgroup(pid_t pid)
+    {
+        std::ifstream file("/proc/" + std::to_string(pid) + "/cgroup");
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.rfind("0::", 0) == 0)
+            {
+                return line.substr(3);
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Whether the process referred to by `pidfd` is still running (a zombie's PID cannot be reused either).
+     */
+    bool _alive(int pidfd)
+    {
+        return pidfd >= 0 && syscall(SYS_pidfd_send_signal, pidfd, 0, nullptr, 0) == 0;
+    }
+
+    /**
+     * @brief PIDs of the processes in the cgroup at `cgroup`.
+     */
+    std::vector<std::string> _cgroup_procs(const path::PathBuf &cgroup)
+    {
+        std::vector<std::string> pids;
+        std::ifstream file(cgroup / "cgroup.procs");
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty())
+            {
+                pids.push_back(line);
+            }
+        }
+
+        return pids;
+    }
+
+    /**
+     * @brief `MAJ:MIN` of every block device (whole disks only).
+     */
+    std::vector<std::string> _block_devices()
+    {
+        std::vector<std::string> devices;
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator("/sys/block", error))
+        {
+            std::ifstream file(entry.path() / "dev");
+            std::string device;
+            if (std::getline(file, device) && !device.empty())
+            {
+                devices.push_back(device);
+            }
+        }
+
+        return devices;
+    }
+
+    io::Result<std::monostate> _configure_cgroup(const path::PathBuf &cgroup, pid_t pid, const procmon::EnforcementAction &action)
+    {
+        if (action.cpu_max != 0)
+        {
+            auto quota = static_cast<uint64_t>(action.cpu_max) * CPU_PERIOD_US / 100;
+            SHORT_CIRCUIT(std::monostate, _write_file(cgroup / "cpu.max", std::to_string(quota) + " " + std::to_string(CPU_PERIOD_US)));
+        }
+
+        if (action.memory_high != 0)
+        {
+            auto bytes = static_cast<uint64_t>(action.memory_high) * 1024 * 1024;
+            SHORT_CIRCUIT(std::monostate, _write_file(cgroup / "memory.high", std::to_string(bytes)));
+        }
+
+        if (action.io_max != 0)
+        {
+            auto bps = std::to_string(static_cast<uint64_t>(action.io_max) * 1024 * 1024);
+            for (const auto &device : _block_devices())
+            {
+                SHORT_CIRCUIT(std::monostate, _write_file(cgroup / "io.max", device + " rbps=" + bps + " wbps=" + bps));
+            }
+        }
+
+        return _write_file(cgroup / "cgroup.procs", std::to_string(pid));
+    }
+
+    /**
+     * @brief Move the processes left in `cgroup` back to `original` (relative to the mount point), then remove it.
+     *
+     * Only the processes listed in the cgroup are moved: the throttled process if it is still
+     * running, and the children which inherited the cgroup from it.
+     */
+    void _remove_cgroup(const path::PathBuf &cgroup, const std::string &original)
+    {
+        auto procs = CGROUP_MOUNT / original.substr(1) / "cgroup.procs";
+        for (const auto &pid : _cgroup_procs(cgroup))
+        {
+            auto moved = _write_file(procs, pid);
+            if (moved.is_err())
+            {
+                std::cerr << "Unable to move PID " << pid << " back to " << original << ": " << moved.unwrap_err().message() << std::endl;
+            }
+        }
+
+        if (rmdir(cgroup.c_str()) != 0)
+        {
+            std::cerr << "Unable to remove " << cgroup.string() << ": " << io::Error::last_os_error().message() << std::endl;
+        }
+    }
+}
+
+namespace procmon
+{
+    Enforcer::Enforcer(path::PathBuf root) : _root(std::move(root)), _root_ready(false) {}
+
+    Enforcer::~Enforcer()
+    {
+        while (!_applied.empty())
+        {
+            release(_applied.begin()->first);
+        }
+    }
+
+    io::Result<std::monostate> Enforcer::_prepare_root()
+    {
+        if (_root_ready)
+        {
+            return io::Result<std::monostate>::ok(std::monostate{});
+        }
+
+        // On hosts with the legacy (v1) or hybrid layout, the parent is not a cgroup v2 hierarchy.
+        struct statfs info = {};
+        if (statfs(_root.parent_path().c_str(), &info) != 0)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+
+        if (info.f_type != CGROUP2_SUPER_MAGIC)
+        {
+            return io::Result<std::monostate>::err(io::Error::other(_root.parent_path().string() + " is not a cgroup v2 hierarchy"));
+        }
+
+        SHORT_CIRCUIT(std::monostate, fs::create_dir_all(_root));
+
+        // Controllers must be enabled on every level above the cgroups holding the processes. They
+        // are enabled one by one, so that a missing controller only fails the limits which need it.
+        for (const auto &dir : {_root.parent_path(), _root})
+        {
+            for (const char *controller : {"+cpu", "+memory", "+io"})
+            {
+                _write_file(dir / "cgroup.subtree_control", controller);
+            }
+        }
+
+        _root_ready = true;
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::monostate> Enforcer::_limit(pid_t pid, const EnforcementAction &action, _Applied &applied)
+    {
+        auto original = _current_cgroup(pid);
+        if (!original.has_value())
+        {
+            return io::Result<std::monostate>::err(io::Error::other("Process " + std::to_string(pid) + " is not in a cgroup v2 hierarchy"));
+        }
+
+        SHORT_CIRCUIT(std::monostate, _prepare_root());
+
+        auto cgroup = _root / ("pid-" + std::to_string(pid));
+        SHORT_CIRCUIT(std::monostate, fs::create_dir_all(cgroup));
+
+        auto configured = _configure_cgroup(cgroup, pid, action);
+        if (configured.is_err())
+        {
+            // The process was not moved yet: nothing but the directory itself is left to undo.
+            rmdir(cgroup.c_str());
+            return configured;
+        }
+
+        applied.cgroup = cgroup;
+        applied.original_cgroup = original.value();
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::monostate> Enforcer::apply(pid_t pid, const EnforcementAction &action)
+    {
+        auto &applied = _applied[pid];
+        std::optional<io::Error> first_error;
+
+        if (applied.pidfd < 0)
+        {
+            applied.pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+        }
+
+        if (action.cpu_max != 0 || action.memory_high != 0 || action.io_max != 0)
+        {
+            auto limit = _limit(pid, action, applied);
+            if (limit.is_err())
+            {
+                first_error = std::move(limit).into_err();
+            }
+        }
+
+        if (action.nice != 0)
+        {
+            errno = 0;
+            int original = getpriority(PRIO_PROCESS, static_cast<id_t>(pid));
+            if (errno == 0 && setpriority(PRIO_PROCESS, static_cast<id_t>(pid), action.nice) == 0)
+            {
+                applied.nice = original;
+            }
+            else if (!first_error.has_value())
+            {
+                first_error = io::Error::last_os_error();
+            }
+        }
+
+        if (action.ionice != 0)
+        {
+            auto original = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+            auto priority = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | static_cast<int>(action.ionice - 1);
+            if (original != -1 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, priority) == 0)
+            {
+                applied.ioprio = static_cast<int>(original);
+            }
+            else if (!first_error.has_value())
+            {
+                first_error = io::Error::last_os_error();
+            }
+        }
+
+        if (first_error.has_value())
+        {
+            return io::Result<std::monostate>::err(std::move(first_error.value()));
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    void Enforcer::release(pid_t pid)
+    {
+        auto it = _applied.find(pid);
+        if (it == _applied.end())
+        {
+            return;
+        }
+
+        // Once the process exited, its PID may belong to an unrelated process: the priorities are
+        // then left alone (without a pidfd, the process cannot be told apart and is assumed gone).
+        const auto &applied = it->second;
+        if (_alive(applied.pidfd))
+        {
+            if (applied.nice.has_value())
+            {
+                setpriority(PRIO_PROCESS, static_cast<id_t>(pid), applied.nice.value());
+            }
+
+            if (applied.ioprio.has_value())
+            {
+                syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, applied.ioprio.value());
+            }
+        }
+
+        if (applied.cgroup.has_value())
+        {
+            _remove_cgroup(applied.cgroup.value(), applied.original_cgroup);
+        }
+
+        if (applied.pidfd >= 0)
+        {
+            close(applied.pidfd);
+        }
+
+        _applied.erase(it);
+    }
+}
@@ -0,0 +1,362 @@
+#include "epoll.hpp"
+
+#include <csignal>
+
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+namespace
+{
+    template <typename T>
+    io::Result<T> _read_value(int fd)
+    {
+        T value = {};
+        while (true)
+        {
+            ssize_t size = ::read(fd, &value, sizeof(value));
+            if (size == sizeof(value))
+            {
+                return io::Result<T>::ok(std::move(value));
+            }
+
+            if (size == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (size == -1)
+            {
+                return io::Result<T>::err(io::Error::last_os_error());
+            }
+
+            return io::Result<T>::err(io::Error(io::ErrorKind::UnexpectedEof, "Short read from descriptor"));
+        }
+    }
+
+    timespec _to_timespec(std::chrono::milliseconds duration)
+    {
+        timespec result;
+        result.tv_sec = duration.count() / 1000;
+        result.tv_nsec = (duration.count() % 1000) * 1000000;
+        return result;
+    }
+}
+
+namespace procmon
+{
+    // ========== OwnedFd ==========
+
+    OwnedFd::OwnedFd(int fd)
+        : NonConstructible(NonConstructibleTag::TAG), _fd(fd)
+    {
+    }
+
+    OwnedFd::OwnedFd(OwnedFd &&other) noexcept
+        : NonConstructible(NonConstructibleTag::TAG), _fd(other._fd)
+    {
+        other._fd = -1;
+    }
+
+    OwnedFd &OwnedFd::operator=(OwnedFd &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (_fd != -1)
+            {
+                close(_fd);
+            }
+            _fd = other._fd;
+            other._fd = -1;
+        }
+        return *this;
+    }
+
+    OwnedFd::~OwnedFd()
+    {
+        if (_fd != -1)
+        {
+            close(_fd);
+        }
+    }
+
+    int OwnedFd::as_raw_fd() const noexcept
+    {
+        return _fd;
+    }
+
+    // ========== Epoll ==========
+
+    Epoll::Epoll(OwnedFd &&fd)
+        : NonConstructible(NonConstructibleTag::TAG), _fd(std::move(fd))
+    {
+    }
+
+    io::Result<Epoll> Epoll::create()
+    {
+        int fd = epoll_create1(EPOLL_CLOEXEC);
+        if (fd == -1)
+        {
+            return io::Result<Epoll>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<Epoll>::ok(Epoll(OwnedFd(fd)));
+    }
+
+    io::Result<std::monostate> Epoll::add(int fd, uint32_t events, uint64_t token) const
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.u64 = token;
+        if (epoll_ctl(_fd.as_raw_fd(), EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+        return io::Result<std::monostate>::ok({});
+    }
+
+    io::Result<std::monostate> Epoll::modify(int fd, uint32_t events, uint64_t token) const
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.u64 = token;
+        if (epoll_ctl(_fd.as_raw_fd(), EPOLL_CTL_MOD, fd, &event) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+        return io::Result<std::monostate>::ok({});
+    }
+
+    io::Result<std::monostate> Epoll::remove(int fd) const
+    {
+        if (epoll_ctl(_fd.as_raw_fd(), EPOLL_CTL_DEL, fd, nullptr) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+        return io::Result<std::monostate>::ok({});
+    }
+
+    io::Result<size_t> Epoll::wait(std::span<epoll_event> events, std::optional<std::chrono::milliseconds> timeout) const
+    {
+        int timeout_ms = timeout.has_value() ? static_cast<int>(timeout->count()) : -1;
+        int count = epoll_wait(_fd.as_raw_fd(), events.data(), static_cast<int>(events.size()), timeout_ms);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                return io::Result<size_t>::ok(0);
+            }
+
+            return io::Result<size_t>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<size_t>::ok(static_cast<size_t>(count));
+    }
+
+    int Epoll::as_raw_fd() const noexcept
+    {
+        return _fd.as_raw_fd();
+    }
+
+    // ========== TimerFd ==========
+
+    TimerFd::TimerFd(OwnedFd &&fd)
+        : NonConstructible(NonConstructibleTag::TAG), _fd(std::move(fd))
+    {
+    }
+
+    io::Result<TimerFd> TimerFd::create()
+    {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd == -1)
+        {
+            return io::Result<TimerFd>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<TimerFd>::ok(TimerFd(OwnedFd(fd)));
+    }
+
+    io::Result<std::monostate> TimerFd::arm(std::chrono::milliseconds initial, std::chrono::milliseconds interval) const
+    {
+        itimerspec spec = {};
+        spec.it_value = _to_timespec(initial);
+        spec.it_interval = _to_timespec(interval);
+
+        // A zero `it_value` would disarm the timer instead of firing immediately.
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        {
+            spec.it_value.tv_nsec = 1;
+        }
+
+        if (timerfd_settime(_fd.as_raw_fd(), 0, &spec, nullptr) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+        return io::Result<std::monostate>::ok({});
+    }
+
+    io::Result<std::monostate> TimerFd::disarm() const
+    {
+        itimerspec spec = {};
+        if (timerfd_settime(_fd.as_raw_fd(), 0, &spec, nullptr) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+        return io::Result<std::monostate>::ok({});
+    }
+
+    io::Result<uint64_t> TimerFd::read() const
+    {
+        return _read_value<uint64_t>(_fd.as_raw_fd());
+    }
+
+    int TimerFd::as_raw_fd() const noexcept
+    {
+        return _fd.as_raw_fd();
+    }
+
+    // ========== EventFd ==========
+
+    EventFd::EventFd(OwnedFd &&fd)
+        : NonConstructible(NonConstructibleTag::TAG), _fd(std::move(fd))
+    {
+    }
+
+    io::Result<EventFd> EventFd::create()
+    {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd == -1)
+        {
+            return io::Result<EventFd>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<EventFd>::ok(EventFd(OwnedFd(fd)));
+    }
+
+    io::Result<std::monostate> EventFd::notify() const
+    {
+        uint64_t value = 1;
+        if (::write(_fd.as_raw_fd(), &value, sizeof(value)) == -1 && errno != EAGAIN)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+        return io::Result<std::monostate>::ok({});
+    }
+
+    io::Result<uint64_t> EventFd::read() const
+    {
+        return _read_value<uint64_t>(_fd.as_raw_fd());
+    }
+
+    int EventFd::as_raw_fd() const noexcept
+    {
+        return _fd.as_raw_fd();
+    }
+
+    // ========== SignalFd ==========
+
+    SignalFd::SignalFd(OwnedFd &&fd)
+        : NonConstructible(NonConstructibleTag::TAG), _fd(std::move(fd))
+    {
+    }
+
+    io::Result<SignalFd> SignalFd::create(std::initializer_list<int> signals)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        for (int signal : signals)
+        {
+            sigaddset(&mask, signal);
+        }
+
+        int error = pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+        if (error != 0)
+        {
+            return io::Result<SignalFd>::err(io::Error::from_raw_os_error(error));
+        }
+
+        int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (fd == -1)
+        {
+            return io::Result<SignalFd>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<SignalFd>::ok(SignalFd(OwnedFd(fd)));
+    }
+
+    io::Result<int> SignalFd::read() const
+    {
+        auto info = SHORT_CIRCUIT(int, _read_value<signalfd_siginfo>(_fd.as_raw_fd()));
+        return io::Result<int>::ok(static_cast<int>(info.ssi_signo));
+    }
+
+    int SignalFd::as_raw_fd() const noexcept
+    {
+        return _fd.as_raw_fd();
+    }
+
+    // ========== InotifyFd ==========
+
+    InotifyFd::InotifyFd(OwnedFd &&fd)
+        : NonConstructible(NonConstructibleTag::TAG), _fd(std::move(fd))
+    {
+    }
+
+    io::Result<InotifyFd> InotifyFd::create()
+    {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd == -1)
+        {
+            return io::Result<InotifyFd>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<InotifyFd>::ok(InotifyFd(OwnedFd(fd)));
+    }
+
+    io::Result<std::monostate> InotifyFd::add_watch(const path::PathBuf &path, uint32_t events) const
+    {
+        if (inotify_add_watch(_fd.as_raw_fd(), path.c_str(), events) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<std::monostate>::ok({});
+    }
+
+    io::Result<std::vector<std::string>> InotifyFd::read() const
+    {
+        alignas(inotify_event) char buffer[4096];
+        std::vector<std::string> names;
+        while (true)
+        {
+            ssize_t size = ::read(_fd.as_raw_fd(), buffer, sizeof(buffer));
+            if (size == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (size == -1)
+            {
+                if (errno == EAGAIN && !names.empty())
+                {
+                    return io::Result<std::vector<std::string>>::ok(std::move(names));
+                }
+
+                return io::Result<std::vector<std::string>>::err(io::Error::last_os_error());
+            }
+
+            for (ssize_t offset = 0; offset < size;)
+            {
+                auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+                names.emplace_back(event->len > 0 ? event->name : "");
+                offset += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+
+    int InotifyFd::as_raw_fd() const noexcept
+    {
+        return _fd.as_raw_fd();
+    }
+}
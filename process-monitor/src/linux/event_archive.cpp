@@ -0,0 +1,797 @@
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "event_archive.hpp"
+
+namespace
+{
+    using Column = procmon::EventArchive::Column;
+
+    constexpr char MAGIC[8] = {'P', 'M', 'A', 'R', 'C', 'H', '0', '1'};
+    /** @brief Zero bytes after every bit-packed array, so that any value can be read with one 16-byte load. */
+    constexpr size_t PACKING_PADDING = 16;
+    constexpr size_t STRING_COLUMNS = 4;
+
+    struct _DiskColumn
+    {
+        uint64_t offset;
+        uint64_t bytes;
+        uint32_t checksum;
+        uint32_t reserved;
+    };
+
+    struct _DiskGroup
+    {
+        uint64_t rows;
+        uint64_t min_ms;
+        uint64_t max_ms;
+        _DiskColumn columns[procmon::EventArchive::COLUMN_COUNT];
+    };
+
+    struct _Footer
+    {
+        uint64_t directory_offset;
+        uint64_t groups;
+        uint32_t directory_checksum;
+        uint32_t reserved;
+        char magic[8];
+    };
+
+    enum class _Encoding
+    {
+        /** @brief Zigzag-encoded deltas to the previous row, in varints. */
+        Delta,
+        /** @brief Bit-packed to the width of the largest value. */
+        Packed,
+        /** @brief Dictionary of distinct 64-bit values, followed by the bit-packed indexes. */
+        Dictionary,
+        /** @brief Dictionary of distinct strings, followed by the bit-packed indexes. */
+        StringDictionary,
+    };
+
+    _Encoding _encoding_of(Column column)
+    {
+        switch (column)
+        {
+        case Column::Timestamp:
+        case Column::Sequence:
+        case Column::Pid:
+            return _Encoding::Delta;
+        case Column::Agent:
+            return _Encoding::Dictionary;
+        case Column::Name:
+        case Column::Cmdline:
+        case Column::Exe:
+        case Column::Cgroup:
+            return _Encoding::StringDictionary;
+        default:
+            return _Encoding::Packed;
+        }
+    }
+
+    /** @brief Index of a string column among `Name`, `Cmdline`, `Exe` and `Cgroup`. */
+    size_t _string_slot(Column column)
+    {
+        switch (column)
+        {
+        case Column::Name:
+            return 0;
+        case Column::Cmdline:
+            return 1;
+        case Column::Exe:
+            return 2;
+        default:
+            return 3;
+        }
+    }
+
+    void _put_varint(std::vector<char> &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+
+        out.push_back(static_cast<char>(value));
+    }
+
+    /** @brief Bounds-checked reader of a column. */
+    class _ColumnReader
+    {
+    private:
+        std::span<const char> _data;
+
+    public:
+        explicit _ColumnReader(std::span<const char> data) : _data(data) {}
+
+        std::optional<uint64_t> varint()
+        {
+            uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64 && !_data.empty(); shift += 7)
+            {
+                auto byte = static_cast<uint8_t>(_data[0]);
+                _data = _data.subspan(1);
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return value;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        std::optional<std::string> string()
+        {
+            auto length = varint();
+            if (!length.has_value() || _data.size() < length.value())
+            {
+                return std::nullopt;
+            }
+
+            std::string value(_data.data(), length.value());
+            _data = _data.subspan(length.value());
+            return value;
+        }
+
+        bool packed(uint64_t rows, std::vector<uint64_t> &values)
+        {
+            auto bytes = procmon::unpack_bits(_data, rows, values);
+            if (!bytes.has_value())
+            {
+                return false;
+            }
+
+            _data = _data.subspan(bytes.value());
+            return true;
+        }
+    };
+
+    io::Result<std::monostate> _write_all(fs::File &file, std::span<const char> data)
+    {
+        while (!data.empty())
+        {
+            auto written = file.write(data);
+            if (written.is_err())
+            {
+                if (written.unwrap_err().kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
+
+                return io::Result<std::monostate>::err(std::move(written).into_err());
+            }
+
+            data = data.subspan(written.unwrap());
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Error _corrupt(const path::PathBuf &path, const std::string &what)
+    {
+        return io::Error::other("Corrupt event archive " + path.string() + ": " + what);
+    }
+
+    /** @brief Columns of the row group being written. */
+    struct _GroupBuilder
+    {
+        uint64_t min_ms = UINT64_MAX;
+        uint64_t max_ms = 0;
+        std::array<std::vector<uint64_t>, procmon::EventArchive::COLUMN_COUNT> values;
+        std::vector<uint64_t> agents;
+        std::unordered_map<uint64_t, uint64_t> agent_indexes;
+        std::array<std::vector<std::string>, STRING_COLUMNS> strings;
+        std::array<std::unordered_map<std::string, uint64_t>, STRING_COLUMNS> string_indexes;
+
+        size_t rows() const
+        {
+            return values[0].size();
+        }
+
+        void put(Column column, uint64_t value)
+        {
+            values[static_cast<size_t>(column)].push_back(value);
+        }
+
+        void put_string(Column column, std::string_view value)
+        {
+            auto slot = _string_slot(column);
+            auto [it, inserted] = string_indexes[slot].try_emplace(std::string(value), strings[slot].size());
+            if (inserted)
+            {
+                strings[slot].emplace_back(value);
+            }
+
+            put(column, it->second);
+        }
+
+        void add(const procmon::StoredEvent &event)
+        {
+            min_ms = std::min(min_ms, event.timestamp_ms);
+            max_ms = std::max(max_ms, event.timestamp_ms);
+
+            auto [agent, inserted] = agent_indexes.try_emplace(event.agent_id, agents.size());
+            if (inserted)
+            {
+                agents.push_back(event.agent_id);
+            }
+
+            const auto &info = event.violation.info;
+            auto name = reinterpret_cast<const char *>(info.name);
+
+            put(Column::Timestamp, event.timestamp_ms);
+            put(Column::Agent, agent->second);
+            put(Column::Sequence, event.violation.sequence);
+            put(Column::Severity, static_cast<uint64_t>(event.violation.severity));
+            put(Column::Pid, info.pid);
+            put_string(Column::Name, std::string_view(name, strnlen(name, sizeof(info.name))));
+            put(Column::Metric, static_cast<uint64_t>(info.violation.metric));
+            put(Column::Value, info.violation.value);
+            put(Column::Threshold, info.violation.threshold);
+            put(Column::HasDetails, event.details.has_value());
+            put(Column::Uid, event.details.has_value() ? event.details->uid : 0);
+            put_string(Column::Cmdline, event.details.has_value() ? event.details->cmdline : "");
+            put_string(Column::Exe, event.details.has_value() ? event.details->exe : "");
+            put_string(Column::Cgroup, event.details.has_value() ? event.details->cgroup : "");
+        }
+
+        std::vector<char> encode(Column column) const
+        {
+            const auto &column_values = values[static_cast<size_t>(column)];
+
+            std::vector<char> out;
+            switch (_encoding_of(column))
+            {
+            case _Encoding::Delta:
+            {
+                uint64_t previous = 0;
+                for (auto value : column_values)
+                {
+                    auto delta = static_cast<int64_t>(value - previous);
+                    _put_varint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+                    previous = value;
+                }
+
+                break;
+            }
+            case _Encoding::Packed:
+                procmon::pack_bits(out, column_values);
+                break;
+            case _Encoding::Dictionary:
+                _put_varint(out, agents.size());
+                for (auto agent : agents)
+                {
+                    _put_varint(out, agent);
+                }
+
+                procmon::pack_bits(out, column_values);
+                break;
+            case _Encoding::StringDictionary:
+            {
+                const auto &dictionary = strings[_string_slot(column)];
+                _put_varint(out, dictionary.size());
+                for (const auto &value : dictionary)
+                {
+                    _put_varint(out, value.size());
+                    out.insert(out.end(), value.begin(), value.end());
+                }
+
+                procmon::pack_bits(out, column_values);
+                break;
+            }
+            }
+
+            return out;
+        }
+    };
+}
+
+namespace procmon
+{
+    void pack_bits(std::vector<char> &out, std::span<const uint64_t> values)
+    {
+        uint64_t max = 0;
+        for (auto value : values)
+        {
+            max |= value;
+        }
+
+        auto width = static_cast<unsigned>(std::bit_width(max));
+        out.push_back(static_cast<char>(width));
+
+        unsigned __int128 pending = 0;
+        unsigned bits = 0;
+        for (auto value : values)
+        {
+            pending |= static_cast<unsigned __int128>(value) << bits;
+            bits += width;
+            while (bits >= 8)
+            {
+                out.push_back(static_cast<char>(pending & 0xff));
+                pending >>= 8;
+                bits -= 8;
+            }
+        }
+
+        if (bits > 0)
+        {
+            out.push_back(static_cast<char>(pending & 0xff));
+        }
+
+        out.insert(out.end(), PACKING_PADDING, '\0');
+    }
+
+    std::optional<size_t> unpack_bits(std::span<const char> data, uint64_t rows, std::vector<uint64_t> &values)
+    {
+        if (data.empty())
+        {
+            return std::nullopt;
+        }
+
+        auto width = static_cast<unsigned>(static_cast<uint8_t>(data[0]));
+        auto bytes = (rows * width + 7) / 8 + PACKING_PADDING;
+        if (width > 64 || data.size() < 1 + bytes)
+        {
+            return std::nullopt;
+        }
+
+        auto packed = data.data() + 1;
+        auto mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+        values.resize(rows);
+        for (uint64_t i = 0; i < rows; i++)
+        {
+            auto bit = i * width;
+            unsigned __int128 word;
+            std::memcpy(&word, packed + bit / 8, sizeof(word));
+            values[i] = static_cast<uint64_t>(word >> (bit % 8)) & mask;
+        }
+
+        return 1 + bytes;
+    }
+
+    EventArchive::EventArchive(uint64_t id, path::PathBuf &&path, std::span<const char> mapping)
+        : NonConstructible(NonConstructibleTag::TAG),
+          _id(id),
+          _path(std::move(path)),
+          _mapping(mapping),
+          _rows(0),
+          _min_ms(UINT64_MAX),
+          _max_ms(0)
+    {
+    }
+
+    EventArchive::~EventArchive()
+    {
+        munmap(const_cast<char *>(_mapping.data()), _mapping.size());
+    }
+
+    path::PathBuf EventArchive::path_of(const path::PathBuf &directory, uint64_t id)
+    {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << id << ".col";
+        return directory / name.str();
+    }
+
+    io::Result<std::monostate> EventArchive::write(EventSegment &segment, const path::PathBuf &directory)
+    {
+        auto path = path_of(directory, segment.id());
+        auto temporary = path;
+        temporary += ".tmp";
+
+        fs::OpenOptions options;
+        auto file = SHORT_CIRCUIT(std::monostate, options.write(true).create(true).truncate(true).open(temporary));
+        SHORT_CIRCUIT(std::monostate, _write_all(file, std::span<const char>(MAGIC, sizeof(MAGIC))));
+
+        uint64_t offset = sizeof(MAGIC);
+        std::vector<_DiskGroup> directory_entries;
+        std::optional<io::Error> error;
+
+        _GroupBuilder builder;
+        auto flush = [&]()
+        {
+            _DiskGroup group = {builder.rows(), builder.min_ms, builder.max_ms, {}};
+            for (size_t i = 0; i < COLUMN_COUNT && !error.has_value(); i++)
+            {
+                auto data = builder.encode(static_cast<Column>(i));
+                auto written = _write_all(file, std::span<const char>(data.data(), data.size()));
+                if (written.is_err())
+                {
+                    error = std::move(written).into_err();
+                    return;
+                }
+
+                group.columns[i] = {offset, data.size(), crc32c(std::span<const char>(data.data(), data.size())), 0};
+                offset += data.size();
+            }
+
+            directory_entries.push_back(group);
+            builder = _GroupBuilder();
+        };
+
+        SHORT_CIRCUIT(
+            std::monostate,
+            segment.query(
+                EventQuery(),
+                [&](const StoredEvent &event)
+                {
+                    builder.add(event);
+                    if (builder.rows() >= GROUP_ROWS)
+                    {
+                        flush();
+                    }
+
+                    return !error.has_value();
+                }));
+
+        if (!error.has_value() && builder.rows() > 0)
+        {
+            flush();
+        }
+
+        if (error.has_value())
+        {
+            std::filesystem::remove(temporary);
+            return io::Result<std::monostate>::err(std::move(error.value()));
+        }
+
+        auto directory_data = std::span<const char>(reinterpret_cast<const char *>(directory_entries.data()), directory_entries.size() * sizeof(_DiskGroup));
+        _Footer footer = {offset, directory_entries.size(), crc32c(directory_data), 0, {}};
+        std::memcpy(footer.magic, MAGIC, sizeof(MAGIC));
+
+        SHORT_CIRCUIT(std::monostate, _write_all(file, directory_data));
+        SHORT_CIRCUIT(std::monostate, _write_all(file, std::span<const char>(reinterpret_cast<const char *>(&footer), sizeof(footer))));
+        SHORT_CIRCUIT(std::monostate, file.sync_data());
+
+        std::error_code rename_error;
+        std::filesystem::rename(temporary, path, rename_error);
+        if (rename_error)
+        {
+            return io::Result<std::monostate>::err(io::Error::from_raw_os_error(rename_error.value()));
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::unique_ptr<EventArchive>> EventArchive::open(const path::PathBuf &directory, uint64_t id)
+    {
+        auto path = path_of(directory, id);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return io::Result<std::unique_ptr<EventArchive>>::err(io::Error::last_os_error());
+        }
+
+        struct stat info = {};
+        if (fstat(fd, &info) == -1)
+        {
+            auto error = io::Error::last_os_error();
+            close(fd);
+            return io::Result<std::unique_ptr<EventArchive>>::err(std::move(error));
+        }
+
+        if (info.st_size < static_cast<off_t>(sizeof(MAGIC) + sizeof(_Footer)))
+        {
+            close(fd);
+            return io::Result<std::unique_ptr<EventArchive>>::err(_corrupt(path, "file too short"));
+        }
+
+        auto address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        auto error = io::Error::last_os_error();
+        close(fd);
+        if (address == MAP_FAILED)
+        {
+            return io::Result<std::unique_ptr<EventArchive>>::err(std::move(error));
+        }
+
+        auto mapping = std::span<const char>(static_cast<const char *>(address), static_cast<size_t>(info.st_size));
+        auto archive = std::unique_ptr<EventArchive>(new EventArchive(id, std::move(path), mapping));
+        SHORT_CIRCUIT(std::unique_ptr<EventArchive>, archive->_load());
+        return io::Result<std::unique_ptr<EventArchive>>::ok(std::move(archive));
+    }
+
+    io::Result<std::monostate> EventArchive::_load()
+    {
+        _Footer footer;
+        std::memcpy(&footer, _mapping.data() + _mapping.size() - sizeof(footer), sizeof(footer));
+
+        auto directory_bytes = footer.groups * sizeof(_DiskGroup);
+        if (std::memcmp(_mapping.data(), MAGIC, sizeof(MAGIC)) != 0 || std::memcmp(footer.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+            footer.directory_offset + directory_bytes + sizeof(footer) != _mapping.size())
+        {
+            return io::Result<std::monostate>::err(_corrupt(_path, "bad layout"));
+        }
+
+        auto directory = _mapping.subspan(footer.directory_offset, directory_bytes);
+        if (crc32c(directory) != footer.directory_checksum)
+        {
+            return io::Result<std::monostate>::err(_corrupt(_path, "directory checksum mismatch"));
+        }
+
+        for (uint64_t i = 0; i < footer.groups; i++)
+        {
+            _DiskGroup disk;
+            std::memcpy(&disk, directory.data() + i * sizeof(disk), sizeof(disk));
+
+            _Group group = {disk.rows, disk.min_ms, disk.max_ms, {}};
+            for (size_t c = 0; c < COLUMN_COUNT; c++)
+            {
+                const auto &column = disk.columns[c];
+                if (column.offset < sizeof(MAGIC) || column.offset + column.bytes > footer.directory_offset)
+                {
+                    return io::Result<std::monostate>::err(_corrupt(_path, "column out of bounds"));
+                }
+
+                group.columns[c] = {column.offset, column.bytes, column.checksum};
+            }
+
+            _groups.push_back(group);
+            _rows += group.rows;
+            _min_ms = std::min(_min_ms, group.min_ms);
+            _max_ms = std::max(_max_ms, group.max_ms);
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::span<const char>> EventArchive::_column_data(size_t group, Column column) const
+    {
+        const auto &ref = _groups[group].columns[static_cast<size_t>(column)];
+        auto data = _mapping.subspan(ref.offset, ref.bytes);
+        if (crc32c(data) != ref.checksum)
+        {
+            return io::Result<std::span<const char>>::err(_corrupt(_path, "column checksum mismatch"));
+        }
+
+        return io::Result<std::span<const char>>::ok(std::move(data));
+    }
+
+    io::Result<std::vector<uint64_t>> EventArchive::column(size_t group, Column column) const
+    {
+        auto rows = _groups[group].rows;
+        _ColumnReader reader(SHORT_CIRCUIT(std::vector<uint64_t>, _column_data(group, column)));
+
+        std::vector<uint64_t> values;
+        bool valid = true;
+        switch (_encoding_of(column))
+        {
+        case _Encoding::Delta:
+        {
+            values.reserve(rows);
+            uint64_t previous = 0;
+            for (uint64_t i = 0; valid && i < rows; i++)
+            {
+                auto zigzag = reader.varint();
+                valid = zigzag.has_value();
+                if (valid)
+                {
+                    auto delta = (zigzag.value() >> 1) ^ (~(zigzag.value() & 1) + 1);
+                    previous += delta;
+                    values.push_back(previous);
+                }
+            }
+
+            break;
+        }
+        case _Encoding::Packed:
+            valid = reader.packed(rows, values);
+            break;
+        case _Encoding::Dictionary:
+        {
+            auto count = reader.varint();
+            std::vector<uint64_t> dictionary;
+            for (uint64_t i = 0; count.has_value() && i < count.value(); i++)
+            {
+                auto value = reader.varint();
+                if (!value.has_value())
+                {
+                    break;
+                }
+
+                dictionary.push_back(value.value());
+            }
+
+            valid = count.has_value() && dictionary.size() == count.value() && reader.packed(rows, values);
+            for (size_t i = 0; valid && i < values.size(); i++)
+            {
+                valid = values[i] < dictionary.size();
+                if (valid)
+                {
+                    values[i] = dictionary[values[i]];
+                }
+            }
+
+            break;
+        }
+        case _Encoding::StringDictionary:
+        {
+            // Skip the dictionary: only the indexes are wanted.
+            auto count = reader.varint();
+            for (uint64_t i = 0; valid && count.has_value() && i < count.value(); i++)
+            {
+                valid = reader.string().has_value();
+            }
+
+            valid = valid && count.has_value() && reader.packed(rows, values);
+            break;
+        }
+        }
+
+        if (!valid)
+        {
+            return io::Result<std::vector<uint64_t>>::err(_corrupt(_path, "malformed column"));
+        }
+
+        return io::Result<std::vector<uint64_t>>::ok(std::move(values));
+    }
+
+    io::Result<std::vector<std::string>> EventArchive::dictionary(size_t group, Column column) const
+    {
+        if (_encoding_of(column) != _Encoding::StringDictionary)
+        {
+            return io::Result<std::vector<std::string>>::err(io::Error::other("Not a string column"));
+        }
+
+        _ColumnReader reader(SHORT_CIRCUIT(std::vector<std::string>, _column_data(group, column)));
+
+        std::vector<std::string> dictionary;
+        auto count = reader.varint();
+        for (uint64_t i = 0; count.has_value() && i < count.value(); i++)
+        {
+            auto value = reader.string();
+            if (!value.has_value())
+            {
+                return io::Result<std::vector<std::string>>::err(_corrupt(_path, "malformed dictionary"));
+            }
+
+            dictionary.push_back(std::move(value.value()));
+        }
+
+        return io::Result<std::vector<std::string>>::ok(std::move(dictionary));
+    }
+
+    io::Result<size_t> EventArchive::query(const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor) const
+    {
+        size_t matches = 0;
+        for (size_t g = 0; g < _groups.size(); g++)
+        {
+            const auto &group = _groups[g];
+            if (group.max_ms < query.from_ms || group.min_ms > query.to_ms)
+            {
+                continue;
+            }
+
+            // Decode the filtered columns first, and nothing else unless a row matches.
+            std::vector<uint8_t> selected(group.rows, 1);
+            auto filter = [&](Column column, auto &&predicate) -> io::Result<std::monostate>
+            {
+                auto values = SHORT_CIRCUIT(std::monostate, this->column(g, column));
+                for (size_t i = 0; i < values.size(); i++)
+                {
+                    selected[i] &= predicate(values[i]);
+                }
+
+                return io::Result<std::monostate>::ok(std::monostate{});
+            };
+
+            if (query.name.has_value())
+            {
+                auto names = SHORT_CIRCUIT(size_t, dictionary(g, Column::Name));
+                auto it = std::find(names.begin(), names.end(), query.name.value());
+                if (it == names.end())
+                {
+                    continue;
+                }
+
+                auto index = static_cast<uint64_t>(it - names.begin());
+                SHORT_CIRCUIT(size_t, filter(Column::Name, [index](uint64_t value)
+                                             { return value == index; }));
+            }
+
+            if (query.agent_id.has_value())
+            {
+                SHORT_CIRCUIT(size_t, filter(Column::Agent, [&query](uint64_t value)
+                                             { return value == query.agent_id.value(); }));
+            }
+
+            if (query.metric.has_value())
+            {
+                SHORT_CIRCUIT(size_t, filter(Column::Metric, [&query](uint64_t value)
+                                             { return value == static_cast<uint64_t>(query.metric.value()); }));
+            }
+
+            if (query.from_ms > group.min_ms || query.to_ms < group.max_ms)
+            {
+                SHORT_CIRCUIT(size_t, filter(Column::Timestamp, [&query](uint64_t value)
+                                             { return value >= query.from_ms && value <= query.to_ms; }));
+            }
+
+            if (std::find(selected.begin(), selected.end(), 1) == selected.end())
+            {
+                continue;
+            }
+
+            std::array<std::vector<uint64_t>, COLUMN_COUNT> columns;
+            for (size_t c = 0; c < COLUMN_COUNT; c++)
+            {
+                columns[c] = SHORT_CIRCUIT(size_t, column(g, static_cast<Column>(c)));
+            }
+
+            std::array<std::vector<std::string>, STRING_COLUMNS> strings;
+            for (auto column : {Column::Name, Column::Cmdline, Column::Exe, Column::Cgroup})
+            {
+                strings[_string_slot(column)] = SHORT_CIRCUIT(size_t, dictionary(g, column));
+            }
+
+            auto value = [&columns](size_t row, Column column)
+            {
+                return columns[static_cast<size_t>(column)][row];
+            };
+
+            auto string = [&](size_t row, Column column) -> const std::string &
+            {
+                static const std::string EMPTY;
+                const auto &dictionary = strings[_string_slot(column)];
+                auto index = value(row, column);
+                return index < dictionary.size() ? dictionary[index] : EMPTY;
+            };
+
+            for (size_t row = 0; row < group.rows; row++)
+            {
+                if (!selected[row])
+                {
+                    continue;
+                }
+
+                StoredEvent event = {};
+                event.timestamp_ms = value(row, Column::Timestamp);
+                event.agent_id = value(row, Column::Agent);
+                event.violation.sequence = value(row, Column::Sequence);
+                event.violation.severity = static_cast<Severity>(value(row, Column::Severity));
+
+                auto &info = event.violation.info;
+                const auto &name = string(row, Column::Name);
+                info.pid = static_cast<uint32_t>(value(row, Column::Pid));
+                std::memcpy(info.name, name.data(), std::min(name.size(), sizeof(info.name)));
+                info.violation.metric = static_cast<Metric>(value(row, Column::Metric));
+                info.violation.value = static_cast<uint32_t>(value(row, Column::Value));
+                info.violation.threshold = static_cast<uint32_t>(value(row, Column::Threshold));
+
+                if (value(row, Column::HasDetails))
+                {
+                    event.details = ProcessDetails{
+                        static_cast<uint32_t>(value(row, Column::Uid)),
+                        string(row, Column::Cmdline),
+                        string(row, Column::Exe),
+                        string(row, Column::Cgroup),
+                    };
+                }
+
+                matches++;
+                if (!visitor(event))
+                {
+                    return io::Result<size_t>::ok(std::move(matches));
+                }
+            }
+        }
+
+        return io::Result<size_t>::ok(std::move(matches));
+    }
+
+    void EventArchive::remove()
+    {
+        std::error_code error;
+        if (!std::filesystem::remove(_path, error) && error)
+        {
+            std::cerr << "Unable to remove " << _path.string() << ": " << error.message() << std::endl;
+        }
+    }
+}
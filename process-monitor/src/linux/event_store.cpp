@@ -0,0 +1,1400 @@
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "event_archive.hpp"
+#include "event_store.hpp"
+
+namespace
+{
+    constexpr uint64_t MAX_RECORD_BYTES = 16 * 1024 * 1024;
+    constexpr size_t RECOVERY_WINDOW = 4 * 1024 * 1024;
+
+    struct _RecordHeader
+    {
+        /** @brief Size of the body, after this header. */
+        uint32_t length;
+        /** @brief CRC-32C of everything after this field, including the body. */
+        uint32_t checksum;
+        uint64_t timestamp_ms;
+        uint64_t agent_id;
+    };
+
+    /**
+     * @brief Fixed part of an index entry, followed by `[uint64_t agent] x agents`,
+     * `[uint8_t length, bytes] x names` and `[uint64_t bucket] x buckets`.
+     */
+    struct _IndexHeader
+    {
+        /** @brief Size of the entry after this field and `checksum`. */
+        uint32_t length;
+        /** @brief CRC-32C of everything after this field. */
+        uint32_t checksum;
+        uint64_t offset;
+        uint64_t bytes;
+        uint32_t count;
+        uint32_t metrics;
+        uint64_t min_ms;
+        uint64_t max_ms;
+        uint32_t agents;
+        uint32_t names;
+        uint32_t buckets;
+        /** @brief Checksum of the first record of the block, to detect an index left over from a replaced data file. */
+        uint32_t first_checksum;
+    };
+
+    constexpr size_t CHECKED_OFFSET = offsetof(_RecordHeader, checksum) + sizeof(uint32_t);
+    static_assert(offsetof(_IndexHeader, checksum) + sizeof(uint32_t) == CHECKED_OFFSET);
+
+    constexpr std::array<uint32_t, 256> CRC32C_TABLE = []
+    {
+        std::array<uint32_t, 256> table = {};
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+            }
+
+            table[i] = crc;
+        }
+
+        return table;
+    }();
+
+    /** @brief Checksum of a record or index entry, whose fixed header starts with `length` and `checksum`. */
+    uint32_t _checksum_of(std::span<const char> entry)
+    {
+        return procmon::crc32c(entry.subspan(CHECKED_OFFSET));
+    }
+
+    std::string_view _name_of(const procmon::ViolationMessage &violation)
+    {
+        auto name = reinterpret_cast<const char *>(violation.info.name);
+        return std::string_view(name, strnlen(name, sizeof(violation.info.name)));
+    }
+
+    template <typename T>
+    void _put(std::vector<char> &out, const T &value)
+    {
+        auto ptr = reinterpret_cast<const char *>(&value);
+        out.insert(out.end(), ptr, ptr + sizeof(value));
+    }
+
+    io::Result<std::monostate> _write_all(fs::File &file, std::span<const char> data)
+    {
+        while (!data.empty())
+        {
+            auto written = file.write(data);
+            if (written.is_err())
+            {
+                if (written.unwrap_err().kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
+
+                return io::Result<std::monostate>::err(std::move(written).into_err());
+            }
+
+            data = data.subspan(written.unwrap());
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    /** @brief Read `buffer.size()` bytes at `offset`, or fewer if the file ends before. */
+    io::Result<size_t> _read_at(fs::File &file, std::span<char> buffer, uint64_t offset)
+    {
+        size_t total = 0;
+        while (total < buffer.size())
+        {
+            auto read = file.read_at(buffer.subspan(total), offset + total);
+            if (read.is_err())
+            {
+                if (read.unwrap_err().kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
+
+                return io::Result<size_t>::err(std::move(read).into_err());
+            }
+
+            if (read.unwrap() == 0)
+            {
+                break;
+            }
+
+            total += read.unwrap();
+        }
+
+        return io::Result<size_t>::ok(std::move(total));
+    }
+
+    /** @brief Sorted intersection of two sorted lists of block ids. */
+    std::vector<uint32_t> _intersect(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+    {
+        std::vector<uint32_t> result;
+        std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+        return result;
+    }
+
+    std::string _segment_name(uint64_t id)
+    {
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << id;
+        return name.str();
+    }
+
+    uint64_t _now_ms()
+    {
+        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+        return static_cast<uint64_t>(now.count());
+    }
+}
+
+namespace procmon
+{
+    uint32_t crc32c(std::span<const char> data)
+    {
+        uint32_t crc = 0xffffffff;
+        for (char c : data)
+        {
+            crc = (crc >> 8) ^ CRC32C_TABLE[(crc ^ static_cast<uint8_t>(c)) & 0xff];
+        }
+
+        return ~crc;
+    }
+
+    EventSegment::EventSegment(uint64_t id, path::PathBuf &&data_path, path::PathBuf &&index_path, fs::File &&data, fs::File &&index)
+        : NonConstructible(NonConstructibleTag::TAG),
+          _id(id),
+          _data_path(std::move(data_path)),
+          _index_path(std::move(index_path)),
+          _data(std::move(data)),
+          _index(std::move(index)),
+          _data_size(0),
+          _write_failed(false),
+          _dropped(0),
+          _events(0),
+          _min_ms(UINT64_MAX),
+          _max_ms(0),
+          _open{}
+    {
+    }
+
+    EventSegment::~EventSegment()
+    {
+        if (!_mapping.empty())
+        {
+            munmap(const_cast<char *>(_mapping.data()), _mapping.size());
+        }
+        else
+        {
+            sync();
+        }
+    }
+
+    io::Result<std::unique_ptr<EventSegment>> EventSegment::open(const path::PathBuf &directory, uint64_t id, const std::string &suffix)
+    {
+        auto name = _segment_name(id);
+        auto data_path = directory / (name + ".dat" + suffix);
+        auto index_path = directory / (name + ".idx" + suffix);
+
+        fs::OpenOptions options;
+        options.read(true).write(true).create(true);
+        auto data = SHORT_CIRCUIT(std::unique_ptr<EventSegment>, options.open(data_path));
+        auto index = SHORT_CIRCUIT(std::unique_ptr<EventSegment>, options.open(index_path));
+
+        auto segment = std::unique_ptr<EventSegment>(new EventSegment(id, std::move(data_path), std::move(index_path), std::move(data), std::move(index)));
+        SHORT_CIRCUIT(std::unique_ptr<EventSegment>, segment->_recover(true));
+        return io::Result<std::unique_ptr<EventSegment>>::ok(std::move(segment));
+    }
+
+    io::Result<std::unique_ptr<EventSegment>> EventSegment::open_read_only(const path::PathBuf &directory, uint64_t id)
+    {
+        auto name = _segment_name(id);
+        auto data_path = directory / (name + ".dat");
+        auto index_path = directory / (name + ".idx");
+
+        auto data = SHORT_CIRCUIT(std::unique_ptr<EventSegment>, fs::File::open(data_path));
+        auto open_index = [&index_path]
+        {
+            auto index = fs::File::open(index_path);
+            if (index.is_err() && index.unwrap_err().kind() == io::ErrorKind::NotFound)
+            {
+                // The index is removed first: the data is about to be removed too. Read it as empty.
+                return fs::File::open("/dev/null");
+            }
+
+            return index;
+        };
+
+        auto index = SHORT_CIRCUIT(std::unique_ptr<EventSegment>, open_index());
+        auto segment = std::unique_ptr<EventSegment>(new EventSegment(id, std::move(data_path), std::move(index_path), std::move(data), std::move(index)));
+        SHORT_CIRCUIT(std::unique_ptr<EventSegment>, segment->_recover(false));
+
+        if (segment->_open.block.count > 0)
+        {
+            segment->_seal_block();
+        }
+
+        segment->_pending_index.clear();
+        if (segment->_data_size > 0)
+        {
+            SHORT_CIRCUIT(std::unique_ptr<EventSegment>, segment->_map());
+        }
+
+        return io::Result<std::unique_ptr<EventSegment>>::ok(std::move(segment));
+    }
+
+    void EventSegment::encode(std::string &out, uint64_t timestamp_ms, uint64_t agent_id, std::span<const char> body)
+    {
+        _RecordHeader header = {static_cast<uint32_t>(body.size()), 0, timestamp_ms, agent_id};
+
+        out.resize(sizeof(header) + body.size());
+        std::memcpy(out.data() + sizeof(header), body.data(), body.size());
+        std::memcpy(out.data(), &header, sizeof(header));
+
+        header.checksum = _checksum_of(std::span<const char>(out.data(), out.size()));
+        std::memcpy(out.data(), &header, sizeof(header));
+    }
+
+    uint64_t EventSegment::timestamp_of(std::span<const char> record)
+    {
+        _RecordHeader header;
+        std::memcpy(&header, record.data(), sizeof(header));
+        return header.timestamp_ms;
+    }
+
+    void EventSegment::_add(std::span<const char> record)
+    {
+        _RecordHeader header;
+        std::memcpy(&header, record.data(), sizeof(header));
+
+        ViolationMessage violation;
+        std::memcpy(&violation, record.data() + sizeof(header), sizeof(violation));
+
+        auto &block = _open.block;
+        if (block.count == 0)
+        {
+            block = {_data_size, 0, 0, 0, header.timestamp_ms, header.timestamp_ms};
+            _open.first_checksum = header.checksum;
+        }
+
+        block.bytes += record.size();
+        block.count++;
+        block.metrics |= 1u << static_cast<uint32_t>(violation.info.violation.metric);
+        block.min_ms = std::min(block.min_ms, header.timestamp_ms);
+        block.max_ms = std::max(block.max_ms, header.timestamp_ms);
+
+        // Duplicates are removed when the block is sealed: only skip the common case of a run of
+        // events with the same key.
+        if (_open.agents.empty() || _open.agents.back() != header.agent_id)
+        {
+            _open.agents.push_back(header.agent_id);
+        }
+
+        auto name = _name_of(violation);
+        if (_open.names.empty() || _open.names.back() != name)
+        {
+            _open.names.emplace_back(name);
+        }
+
+        auto bucket = header.timestamp_ms / BUCKET_MS;
+        if (_open.buckets.empty() || _open.buckets.back() != bucket)
+        {
+            _open.buckets.push_back(bucket);
+        }
+
+        _data_size += record.size();
+        _events++;
+        _min_ms = std::min(_min_ms, header.timestamp_ms);
+        _max_ms = std::max(_max_ms, header.timestamp_ms);
+
+        if (block.count >= BLOCK_EVENTS || block.bytes >= BLOCK_BYTES)
+        {
+            _seal_block();
+        }
+    }
+
+    void EventSegment::_seal_block()
+    {
+        auto unique = [](auto &values)
+        {
+            std::sort(values.begin(), values.end());
+            values.erase(std::unique(values.begin(), values.end()), values.end());
+        };
+
+        unique(_open.agents);
+        unique(_open.names);
+        unique(_open.buckets);
+
+        const auto &block = _open.block;
+        _IndexHeader header = {
+            0,
+            0,
+            block.offset,
+            block.bytes,
+            block.count,
+            block.metrics,
+            block.min_ms,
+            block.max_ms,
+            static_cast<uint32_t>(_open.agents.size()),
+            static_cast<uint32_t>(_open.names.size()),
+            static_cast<uint32_t>(_open.buckets.size()),
+            _open.first_checksum,
+        };
+
+        std::vector<char> entry;
+        _put(entry, header);
+        for (auto agent : _open.agents)
+        {
+            _put(entry, agent);
+        }
+
+        for (const auto &name : _open.names)
+        {
+            _put(entry, static_cast<uint8_t>(name.size()));
+            entry.insert(entry.end(), name.begin(), name.end());
+        }
+
+        for (auto bucket : _open.buckets)
+        {
+            _put(entry, bucket);
+        }
+
+        header.length = static_cast<uint32_t>(entry.size() - CHECKED_OFFSET);
+        std::memcpy(entry.data(), &header, sizeof(header));
+        header.checksum = _checksum_of(std::span<const char>(entry.data(), entry.size()));
+        std::memcpy(entry.data(), &header, sizeof(header));
+
+        _pending_index.insert(_pending_index.end(), entry.begin(), entry.end());
+        _index_block(_open);
+
+        _open.block.count = 0;
+        _open.agents.clear();
+        _open.names.clear();
+        _open.buckets.clear();
+    }
+
+    void EventSegment::_index_block(const _OpenBlock &open)
+    {
+        auto id = static_cast<uint32_t>(_blocks.size());
+        _blocks.push_back(open.block);
+        _min_ms = std::min(_min_ms, open.block.min_ms);
+        _max_ms = std::max(_max_ms, open.block.max_ms);
+
+        for (auto agent : open.agents)
+        {
+            _by_agent[agent].push_back(id);
+        }
+
+        for (const auto &name : open.names)
+        {
+            _by_name[name].push_back(id);
+        }
+
+        for (uint32_t metric = 0; metric < 32; metric++)
+        {
+            if (open.block.metrics & (1u << metric))
+            {
+                _by_metric[metric].push_back(id);
+            }
+        }
+
+        for (auto bucket : open.buckets)
+        {
+            _by_bucket[bucket].push_back(id);
+        }
+    }
+
+    io::Result<std::monostate> EventSegment::_recover(bool writable)
+    {
+        auto data_size = SHORT_CIRCUIT(std::monostate, _data.seek(io::SeekFrom(io::SeekFrom::End, 0)));
+        auto index_size = SHORT_CIRCUIT(std::monostate, _index.seek(io::SeekFrom(io::SeekFrom::End, 0)));
+
+        // Load the index entries, up to the first one which is torn, corrupt or does not follow the
+        // previous block in the data.
+        std::vector<char> index(index_size);
+        index.resize(SHORT_CIRCUIT(std::monostate, _read_at(_index, std::span<char>(index.data(), index.size()), 0)));
+
+        size_t position = 0;
+        while (position + sizeof(_IndexHeader) <= index.size())
+        {
+            _IndexHeader header;
+            std::memcpy(&header, index.data() + position, sizeof(header));
+
+            auto size = CHECKED_OFFSET + header.length;
+            if (header.length < sizeof(header) - CHECKED_OFFSET || position + size > index.size())
+            {
+                break;
+            }
+
+            auto entry = std::span<const char>(index.data() + position, size);
+            if (_checksum_of(entry) != header.checksum || header.offset != _data_size || header.offset + header.bytes > data_size)
+            {
+                break;
+            }
+
+            _RecordHeader first = {};
+            auto read = SHORT_CIRCUIT(std::monostate, _read_at(_data, std::span<char>(reinterpret_cast<char *>(&first), sizeof(first)), header.offset));
+            if (read != sizeof(first) || first.checksum != header.first_checksum)
+            {
+                break;
+            }
+
+            _OpenBlock open = {{header.offset, header.bytes, header.count, header.metrics, header.min_ms, header.max_ms}, header.first_checksum, {}, {}, {}};
+            auto rest = entry.subspan(sizeof(header));
+            auto take = [&rest](void *out, size_t size)
+            {
+                if (rest.size() < size)
+                {
+                    return false;
+                }
+
+                std::memcpy(out, rest.data(), size);
+                rest = rest.subspan(size);
+                return true;
+            };
+
+            bool valid = true;
+            for (uint32_t i = 0; valid && i < header.agents; i++)
+            {
+                valid = take(&open.agents.emplace_back(), sizeof(uint64_t));
+            }
+
+            for (uint32_t i = 0; valid && i < header.names; i++)
+            {
+                uint8_t length = 0;
+                valid = take(&length, sizeof(length)) && rest.size() >= length;
+                if (valid)
+                {
+                    open.names.emplace_back(rest.data(), length);
+                    rest = rest.subspan(length);
+                }
+            }
+
+            for (uint32_t i = 0; valid && i < header.buckets; i++)
+            {
+                valid = take(&open.buckets.emplace_back(), sizeof(uint64_t));
+            }
+
+            if (!valid || !rest.empty())
+            {
+                break;
+            }
+
+            _index_block(open);
+            _data_size += header.bytes;
+            _events += header.count;
+            position += size;
+        }
+
+        if (position < index.size())
+        {
+            std::cerr << "Event store: " << (writable ? "discarding " : "ignoring ") << index.size() - position << " bytes of invalid index entries" << std::endl;
+            if (writable)
+            {
+                SHORT_CIRCUIT(std::monostate, _index.set_len(position));
+            }
+        }
+
+        if (writable)
+        {
+            SHORT_CIRCUIT(std::monostate, _index.seek(io::SeekFrom(io::SeekFrom::Start, static_cast<int64_t>(position))));
+        }
+
+        // Replay the records written after the last indexed block, up to the first torn or corrupt one.
+        // Complete blocks found on the way get their index entries back.
+        std::vector<char> window;
+        uint64_t window_offset = _data_size;
+        bool refilled = false;
+        while (_data_size < data_size)
+        {
+            auto available = std::span<const char>(window).subspan(_data_size - window_offset);
+
+            _RecordHeader header = {};
+            if (available.size() >= sizeof(header))
+            {
+                std::memcpy(&header, available.data(), sizeof(header));
+                if (header.length < sizeof(ViolationMessage) || header.length > MAX_RECORD_BYTES)
+                {
+                    break;
+                }
+            }
+
+            if (available.size() < sizeof(header) || available.size() < sizeof(header) + header.length)
+            {
+                if (refilled)
+                {
+                    break;
+                }
+
+                // Move the window to this record.
+                window_offset = _data_size;
+                window.resize(std::max<uint64_t>(RECOVERY_WINDOW, sizeof(header) + header.length));
+                window.resize(SHORT_CIRCUIT(std::monostate, _read_at(_data, std::span<char>(window.data(), window.size()), window_offset)));
+                refilled = true;
+                continue;
+            }
+
+            auto record = available.first(sizeof(header) + header.length);
+            if (_checksum_of(record) != header.checksum)
+            {
+                break;
+            }
+
+            _add(record);
+            refilled = false;
+        }
+
+        if (!writable)
+        {
+            // A segment being written may end with a record which is not complete yet.
+            return io::Result<std::monostate>::ok(std::monostate{});
+        }
+
+        if (_data_size < data_size)
+        {
+            std::cerr << "Event store: discarding " << data_size - _data_size << " bytes of torn or corrupt records" << std::endl;
+            SHORT_CIRCUIT(std::monostate, _data.set_len(_data_size));
+        }
+
+        SHORT_CIRCUIT(std::monostate, _data.seek(io::SeekFrom(io::SeekFrom::Start, static_cast<int64_t>(_data_size))));
+        if (!_pending_index.empty())
+        {
+            _sync();
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    void EventSegment::append(std::span<const char> record)
+    {
+        std::lock_guard lock(_mutex);
+
+        // The disk keeps failing: drop the record before it is indexed, so that the index still
+        // matches the data once the writes succeed again.
+        if (_pending_data.size() >= MAX_PENDING_BYTES)
+        {
+            if (_dropped++ % 100000 == 0)
+            {
+                std::cerr << "Event store is not writable, dropped " << _dropped << " record(s) so far" << std::endl;
+            }
+
+            return;
+        }
+
+        _pending_data.insert(_pending_data.end(), record.begin(), record.end());
+        _add(record);
+
+        if (_pending_data.size() >= BLOCK_BYTES && !_write_failed)
+        {
+            _flush_data();
+        }
+    }
+
+    bool EventSegment::_flush_data()
+    {
+        // The records are already indexed at their offsets: whatever could not be written is kept
+        // and retried by the next flush, which resumes where this one stopped.
+        size_t offset = 0;
+        while (offset < _pending_data.size())
+        {
+            auto written = _data.write(std::span<const char>(_pending_data.data() + offset, _pending_data.size() - offset));
+            if (written.is_err())
+            {
+                if (written.unwrap_err().kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
+
+                std::cerr << "Failed to write " << _pending_data.size() - offset << " bytes to the event store: " << written.unwrap_err().message() << std::endl;
+                _pending_data.erase(_pending_data.begin(), _pending_data.begin() + offset);
+                _write_failed = true;
+                return false;
+            }
+
+            offset += written.unwrap();
+        }
+
+        _pending_data.clear();
+        _write_failed = false;
+        return true;
+    }
+
+    void EventSegment::sync()
+    {
+        std::lock_guard lock(_mutex);
+        _sync();
+    }
+
+    bool EventSegment::_sync()
+    {
+        if (!_flush_data())
+        {
+            return false;
+        }
+
+        auto synced = _data.sync_data();
+        if (synced.is_err())
+        {
+            std::cerr << "Failed to sync the event store: " << synced.unwrap_err().message() << std::endl;
+            return false;
+        }
+
+        // Only index blocks whose records are on disk.
+        if (!_pending_index.empty())
+        {
+            auto written = _write_all(_index, std::span<const char>(_pending_index.data(), _pending_index.size()));
+            _pending_index.clear();
+            if (written.is_err())
+            {
+                std::cerr << "Failed to write the event store index: " << written.unwrap_err().message() << std::endl;
+                return true;
+            }
+
+            synced = _index.sync_data();
+            if (synced.is_err())
+            {
+                std::cerr << "Failed to sync the event store index: " << synced.unwrap_err().message() << std::endl;
+            }
+        }
+
+        return true;
+    }
+
+    bool EventSegment::sealed() const
+    {
+        std::lock_guard lock(_mutex);
+        return !_mapping.empty();
+    }
+
+    uint64_t EventSegment::size() const
+    {
+        std::lock_guard lock(_mutex);
+        return _events;
+    }
+
+    uint64_t EventSegment::bytes() const
+    {
+        std::lock_guard lock(_mutex);
+        return _data_size;
+    }
+
+    uint64_t EventSegment::min_ms() const
+    {
+        std::lock_guard lock(_mutex);
+        return _min_ms;
+    }
+
+    uint64_t EventSegment::max_ms() const
+    {
+        std::lock_guard lock(_mutex);
+        return _max_ms;
+    }
+
+    io::Result<std::monostate> EventSegment::seal()
+    {
+        std::lock_guard lock(_mutex);
+        if (!_mapping.empty() || _data_size == 0)
+        {
+            return io::Result<std::monostate>::ok(std::monostate{});
+        }
+
+        if (_open.block.count > 0)
+        {
+            _seal_block();
+        }
+
+        // Mapping beyond the end of the file would fault on the records still pending.
+        if (!_sync())
+        {
+            return io::Result<std::monostate>::err(io::Error(io::ErrorKind::Other, "Records of the segment are not all written yet"));
+        }
+
+        return _map();
+    }
+
+    io::Result<std::monostate> EventSegment::_map()
+    {
+        int fd = ::open(_data_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+
+        auto address = mmap(nullptr, _data_size, PROT_READ, MAP_SHARED, fd, 0);
+        auto error = io::Error::last_os_error();
+        close(fd);
+        if (address == MAP_FAILED)
+        {
+            return io::Result<std::monostate>::err(std::move(error));
+        }
+
+        _mapping = std::span<const char>(static_cast<const char *>(address), _data_size);
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::unique_ptr<EventSegment>> EventSegment::compact(uint64_t cutoff_ms)
+    {
+        if (!sealed())
+        {
+            return io::Result<std::unique_ptr<EventSegment>>::err(io::Error::other("Only sealed segments can be compacted"));
+        }
+
+        const std::string suffix = ".tmp";
+        auto directory = _data_path.parent_path();
+        std::filesystem::remove(_index_path.string() + suffix);
+        std::filesystem::remove(_data_path.string() + suffix);
+        auto compacted = SHORT_CIRCUIT(std::unique_ptr<EventSegment>, open(directory, _id, suffix));
+
+        // A sealed segment never changes: no lock is needed to read its mapping.
+        auto rest = _mapping;
+        while (!rest.empty())
+        {
+            _RecordHeader header;
+            std::memcpy(&header, rest.data(), sizeof(header));
+            auto record = rest.first(sizeof(header) + header.length);
+            rest = rest.subspan(record.size());
+
+            if (header.timestamp_ms >= cutoff_ms)
+            {
+                compacted->append(record);
+            }
+        }
+
+        SHORT_CIRCUIT(std::unique_ptr<EventSegment>, compacted->seal());
+
+        // Replace the data first: if the index is not replaced too, its entries no longer match the
+        // first record of their block and are rebuilt by `open`.
+        std::error_code error;
+        for (auto [from, to] : {std::make_pair(&compacted->_data_path, &_data_path), std::make_pair(&compacted->_index_path, &_index_path)})
+        {
+            std::filesystem::rename(*from, *to, error);
+            if (error)
+            {
+                return io::Result<std::unique_ptr<EventSegment>>::err(io::Error::from_raw_os_error(error.value()));
+            }
+
+            *from = *to;
+        }
+
+        return io::Result<std::unique_ptr<EventSegment>>::ok(std::move(compacted));
+    }
+
+    void EventSegment::remove()
+    {
+        // Data left without its index by a crash is indexed again by `open`, and removed again later.
+        std::error_code error;
+        for (const auto *path : {&_index_path, &_data_path})
+        {
+            if (!std::filesystem::remove(*path, error) && error)
+            {
+                std::cerr << "Unable to remove " << path->string() << ": " << error.message() << std::endl;
+            }
+        }
+    }
+
+    io::Result<size_t> EventSegment::_scan_block(const _Block &block, const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor, bool &stopped)
+    {
+        std::vector<char> buffer;
+        auto rest = _mapping.empty() ? std::span<const char>() : _mapping.subspan(block.offset, block.bytes);
+        if (_mapping.empty())
+        {
+            buffer.resize(block.bytes);
+            auto read = SHORT_CIRCUIT(size_t, _read_at(_data, std::span<char>(buffer.data(), buffer.size()), block.offset));
+            if (read != buffer.size())
+            {
+                return io::Result<size_t>::err(io::Error::other("Event store block at offset " + std::to_string(block.offset) + " is truncated"));
+            }
+
+            rest = std::span<const char>(buffer.data(), buffer.size());
+        }
+
+        size_t matches = 0;
+        while (!rest.empty())
+        {
+            _RecordHeader header;
+            if (rest.size() < sizeof(header))
+            {
+                return io::Result<size_t>::err(io::Error::other("Event store block at offset " + std::to_string(block.offset) + " is truncated"));
+            }
+
+            std::memcpy(&header, rest.data(), sizeof(header));
+            if (rest.size() < sizeof(header) + header.length)
+            {
+                return io::Result<size_t>::err(io::Error::other("Event store block at offset " + std::to_string(block.offset) + " is truncated"));
+            }
+
+            auto record = rest.first(sizeof(header) + header.length);
+            rest = rest.subspan(record.size());
+
+            if (header.timestamp_ms < query.from_ms || header.timestamp_ms > query.to_ms ||
+                (query.agent_id.has_value() && header.agent_id != query.agent_id.value()))
+            {
+                continue;
+            }
+
+            if (_checksum_of(record) != header.checksum)
+            {
+                return io::Result<size_t>::err(io::Error::other("Corrupt record in the event store block at offset " + std::to_string(block.offset)));
+            }
+
+            auto decoded = decode_violation(record.subspan(sizeof(header)));
+            if (!decoded.has_value())
+            {
+                continue;
+            }
+
+            auto &[violation, details] = decoded.value();
+            if ((query.name.has_value() && _name_of(violation) != query.name.value()) ||
+                (query.metric.has_value() && violation.info.violation.metric != query.metric.value()))
+            {
+                continue;
+            }
+
+            matches++;
+            if (!visitor(StoredEvent{header.timestamp_ms, header.agent_id, violation, std::move(details)}))
+            {
+                stopped = true;
+                break;
+            }
+        }
+
+        return io::Result<size_t>::ok(std::move(matches));
+    }
+
+    io::Result<size_t> EventSegment::query(const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor)
+    {
+        std::vector<_Block> candidates;
+        {
+            std::lock_guard lock(_mutex);
+
+            // Records of the open block must be readable from the file.
+            _flush_data();
+
+            static const std::vector<uint32_t> NONE;
+            std::vector<const std::vector<uint32_t> *> lists;
+            auto lookup = [&lists](const auto &map, const auto &key)
+            {
+                auto it = map.find(key);
+                lists.push_back(it == map.end() ? &NONE : &it->second);
+            };
+
+            if (query.agent_id.has_value())
+            {
+                lookup(_by_agent, query.agent_id.value());
+            }
+
+            if (query.name.has_value())
+            {
+                lookup(_by_name, query.name.value());
+            }
+
+            if (query.metric.has_value())
+            {
+                lookup(_by_metric, static_cast<uint32_t>(query.metric.value()));
+            }
+
+            std::vector<uint32_t> ids;
+            if (!lists.empty())
+            {
+                std::sort(
+                    lists.begin(), lists.end(),
+                    [](const auto *a, const auto *b)
+                    { return a->size() < b->size(); });
+
+                ids = *lists[0];
+                for (size_t i = 1; i < lists.size() && !ids.empty(); i++)
+                {
+                    ids = _intersect(ids, *lists[i]);
+                }
+            }
+            else if (query.from_ms > 0 || query.to_ms < UINT64_MAX)
+            {
+                auto end = _by_bucket.upper_bound(query.to_ms / BUCKET_MS);
+                for (auto it = _by_bucket.lower_bound(query.from_ms / BUCKET_MS); it != end; it++)
+                {
+                    ids.insert(ids.end(), it->second.begin(), it->second.end());
+                }
+
+                std::sort(ids.begin(), ids.end());
+                ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            }
+            else
+            {
+                ids.resize(_blocks.size());
+                for (uint32_t i = 0; i < ids.size(); i++)
+                {
+                    ids[i] = i;
+                }
+            }
+
+            for (auto id : ids)
+            {
+                const auto &block = _blocks[id];
+                if (block.max_ms >= query.from_ms && block.min_ms <= query.to_ms)
+                {
+                    candidates.push_back(block);
+                }
+            }
+
+            // The open block is not indexed yet: check its keys directly.
+            const auto &open = _open.block;
+            if (open.count > 0 && open.max_ms >= query.from_ms && open.min_ms <= query.to_ms &&
+                (!query.agent_id.has_value() || std::find(_open.agents.begin(), _open.agents.end(), query.agent_id.value()) != _open.agents.end()) &&
+                (!query.name.has_value() || std::find(_open.names.begin(), _open.names.end(), query.name.value()) != _open.names.end()) &&
+                (!query.metric.has_value() || (open.metrics & (1u << static_cast<uint32_t>(query.metric.value())))))
+            {
+                candidates.push_back(open);
+            }
+        }
+
+        // Sealed blocks never change, and the open one was copied: read them without blocking writes.
+        size_t matches = 0;
+        bool stopped = false;
+        for (size_t i = 0; i < candidates.size() && !stopped; i++)
+        {
+            matches += SHORT_CIRCUIT(size_t, _scan_block(candidates[i], query, visitor, stopped));
+        }
+
+        return io::Result<size_t>::ok(std::move(matches));
+    }
+
+    EventStore::EventStore(const path::PathBuf &directory, const EventStoreOptions &options)
+        : NonConstructible(NonConstructibleTag::TAG),
+          _directory(directory),
+          _options(options),
+          _next_id(1),
+          _want_spare(true),
+          _stopping(false),
+          _active_bytes(0),
+          _active_period(0)
+    {
+    }
+
+    io::Result<std::unique_ptr<EventStore>> EventStore::open(const path::PathBuf &directory, const EventStoreOptions &options)
+    {
+        SHORT_CIRCUIT(std::unique_ptr<EventStore>, fs::create_dir_all(directory));
+
+        // Segments and archives are named after their ID, in hexadecimal. Leftovers of an interrupted
+        // compaction or conversion are dropped: the segment they were replacing is still complete.
+        std::vector<uint64_t> ids, archive_ids;
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+        {
+            auto name = entry.path().filename().string();
+            if (name.ends_with(".tmp"))
+            {
+                std::filesystem::remove(entry.path(), error);
+            }
+            else if (name.size() == 20 && (name.ends_with(".dat") || name.ends_with(".col")))
+            {
+                try
+                {
+                    (name.ends_with(".dat") ? ids : archive_ids).push_back(std::stoull(name.substr(0, 16), nullptr, 16));
+                }
+                catch (...)
+                {
+                }
+            }
+        }
+
+        if (error)
+        {
+            return io::Result<std::unique_ptr<EventStore>>::err(io::Error::from_raw_os_error(error.value()));
+        }
+
+        std::sort(ids.begin(), ids.end());
+        std::sort(archive_ids.begin(), archive_ids.end());
+
+        auto store = std::unique_ptr<EventStore>(new EventStore(directory, options));
+        for (auto id : archive_ids)
+        {
+            std::shared_ptr<EventArchive> archive = SHORT_CIRCUIT(std::unique_ptr<EventStore>, EventArchive::open(directory, id));
+            store->_archives.push_back(std::move(archive));
+        }
+
+        // An archive is only renamed into place once complete: a segment still next to it was about
+        // to be removed.
+        std::erase_if(
+            ids,
+            [&](uint64_t id)
+            {
+                if (!std::binary_search(archive_ids.begin(), archive_ids.end(), id))
+                {
+                    return false;
+                }
+
+                auto name = _segment_name(id);
+                std::filesystem::remove(directory / (name + ".idx"), error);
+                std::filesystem::remove(directory / (name + ".dat"), error);
+                return true;
+            });
+
+        for (auto id : ids)
+        {
+            std::shared_ptr<EventSegment> segment = SHORT_CIRCUIT(std::unique_ptr<EventStore>, EventSegment::open(directory, id));
+            if (id != ids.back())
+            {
+                if (segment->size() == 0)
+                {
+                    segment->remove();
+                    continue;
+                }
+
+                SHORT_CIRCUIT(std::unique_ptr<EventStore>, segment->seal());
+            }
+
+            store->_segments.push_back(std::move(segment));
+        }
+
+        store->_next_id = std::max(ids.empty() ? 0 : ids.back(), archive_ids.empty() ? 0 : archive_ids.back()) + 1;
+        if (store->_segments.empty())
+        {
+            store->_segments.push_back(SHORT_CIRCUIT(std::unique_ptr<EventStore>, store->_create_segment()));
+        }
+
+        store->_active = store->_segments.back();
+        store->_active_bytes = store->_active->bytes();
+        store->_active_period = store->_period_of(store->_active->max_ms());
+        store->_maintenance = std::thread(&EventStore::_run, store.get());
+        return io::Result<std::unique_ptr<EventStore>>::ok(std::move(store));
+    }
+
+    EventStore::~EventStore()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+
+        _wakeup.notify_one();
+        _maintenance.join();
+        _active->sync();
+    }
+
+    uint64_t EventStore::_period_of(uint64_t timestamp_ms) const
+    {
+        auto period = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(_options.segment_duration).count());
+        return period == 0 ? 0 : timestamp_ms / period;
+    }
+
+    io::Result<std::shared_ptr<EventSegment>> EventStore::_create_segment()
+    {
+        uint64_t id;
+        {
+            std::lock_guard lock(_mutex);
+            id = _next_id++;
+        }
+
+        std::shared_ptr<EventSegment> segment = SHORT_CIRCUIT(std::shared_ptr<EventSegment>, EventSegment::open(_directory, id));
+        return io::Result<std::shared_ptr<EventSegment>>::ok(std::move(segment));
+    }
+
+    void EventStore::_roll()
+    {
+        std::shared_ptr<EventSegment> next;
+        {
+            std::lock_guard lock(_mutex);
+            next = std::move(_spare);
+            _spare.reset();
+        }
+
+        // Only create the segment here if the maintenance thread could not prepare one in time.
+        if (next == nullptr)
+        {
+            auto created = _create_segment();
+            if (created.is_err())
+            {
+                std::cerr << "Unable to roll over the event store, keeping segment " << _active->id() << ": " << created.unwrap_err().message() << std::endl;
+                return;
+            }
+
+            next = std::move(created).into_ok();
+        }
+
+        {
+            std::lock_guard lock(_mutex);
+            _rolled.push_back(_active);
+            _segments.push_back(next);
+            _want_spare = true;
+        }
+
+        _wakeup.notify_one();
+        _active = std::move(next);
+        _active_bytes = 0;
+    }
+
+    void EventStore::append(std::span<const char> record)
+    {
+        // Receivers stamp records before queueing them, so records around a period boundary arrive
+        // slightly out of order: a straggler from the previous period joins the current segment.
+        auto period = _period_of(EventSegment::timestamp_of(record));
+        if (_active_bytes > 0 && (_active_bytes + record.size() > _options.segment_bytes || period > _active_period))
+        {
+            _roll();
+        }
+
+        if (_active_bytes == 0)
+        {
+            _active_period = std::max(_active_period, period);
+        }
+
+        _active->append(record);
+        _active_bytes += record.size();
+    }
+
+    void EventStore::sync()
+    {
+        _active->sync();
+    }
+
+    void EventStore::_apply_retention()
+    {
+        std::vector<std::shared_ptr<EventArchive>> archives;
+        std::vector<std::shared_ptr<EventSegment>> segments;
+        {
+            std::lock_guard lock(_mutex);
+            archives = _archives;
+            segments = _segments;
+        }
+
+        uint64_t total = 0;
+        for (const auto &archive : archives)
+        {
+            total += archive->bytes();
+        }
+
+        for (const auto &segment : segments)
+        {
+            total += segment->bytes();
+        }
+
+        auto age = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(_options.retention_age).count());
+        auto now = _now_ms();
+        auto cutoff = age > 0 && now > age ? now - age : 0;
+
+        // Archives hold the oldest events. They are small enough not to be worth compacting.
+        for (const auto &archive : archives)
+        {
+            bool over_size = _options.retention_bytes > 0 && total > _options.retention_bytes;
+            if (over_size || archive->max_ms() < cutoff)
+            {
+                {
+                    std::lock_guard lock(_mutex);
+                    std::erase(_archives, archive);
+                }
+
+                archive->remove();
+                total -= archive->bytes();
+            }
+        }
+
+        // Oldest first. The active segment is the last one and never expires here: it is rolled over
+        // at least once per period, unless time partitioning is disabled.
+        for (const auto &segment : segments)
+        {
+            if (!segment->sealed())
+            {
+                continue;
+            }
+
+            auto bytes = segment->bytes();
+            bool over_size = _options.retention_bytes > 0 && total > _options.retention_bytes;
+            if (over_size || segment->max_ms() < cutoff)
+            {
+                {
+                    std::lock_guard lock(_mutex);
+                    std::erase(_segments, segment);
+                }
+
+                segment->remove();
+                total -= bytes;
+                continue;
+            }
+
+            if (segment->min_ms() < cutoff)
+            {
+                auto compacted = segment->compact(cutoff);
+                if (compacted.is_err())
+                {
+                    std::cerr << "Unable to compact event store segment " << segment->id() << ": " << compacted.unwrap_err().message() << std::endl;
+                    continue;
+                }
+
+                std::shared_ptr<EventSegment> replacement = std::move(compacted).into_ok();
+                total = total - bytes + replacement->bytes();
+
+                std::lock_guard lock(_mutex);
+                std::replace(_segments.begin(), _segments.end(), segment, replacement);
+            }
+        }
+    }
+
+    void EventStore::_archive_cold()
+    {
+        auto age = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(_options.archive_age).count());
+        auto now = _now_ms();
+        if (age == 0 || now <= age)
+        {
+            return;
+        }
+
+        std::vector<std::shared_ptr<EventSegment>> segments;
+        {
+            std::lock_guard lock(_mutex);
+            segments = _segments;
+        }
+
+        for (const auto &segment : segments)
+        {
+            if (!segment->sealed() || segment->max_ms() >= now - age)
+            {
+                continue;
+            }
+
+            auto written = EventArchive::write(*segment, _directory);
+            auto archive = written.is_ok() ? EventArchive::open(_directory, segment->id()) : io::Result<std::unique_ptr<EventArchive>>::err(std::move(written).into_err());
+            if (archive.is_err())
+            {
+                std::cerr << "Unable to archive event store segment " << segment->id() << ": " << archive.unwrap_err().message() << std::endl;
+                continue;
+            }
+
+            {
+                std::lock_guard lock(_mutex);
+                _archives.push_back(std::move(archive).into_ok());
+                std::erase(_segments, segment);
+            }
+
+            segment->remove();
+        }
+    }
+
+    void EventStore::_run()
+    {
+        // Segments whose records could not all be written yet: sealing is retried every round.
+        std::vector<std::shared_ptr<EventSegment>> unsealed;
+        while (true)
+        {
+            std::vector<std::shared_ptr<EventSegment>> rolled;
+            bool want_spare, stopping;
+            {
+                std::unique_lock lock(_mutex);
+                _wakeup.wait_for(
+                    lock,
+                    _options.maintenance_interval,
+                    [this]
+                    { return _stopping || _want_spare || !_rolled.empty(); });
+
+                rolled.swap(_rolled);
+                rolled.insert(rolled.begin(), unsealed.begin(), unsealed.end());
+                unsealed.clear();
+                want_spare = _want_spare && !_stopping;
+                stopping = _stopping;
+                _want_spare = false;
+            }
+
+            for (const auto &segment : rolled)
+            {
+                auto sealed = segment->seal();
+                if (sealed.is_err())
+                {
+                    std::cerr << "Unable to seal event store segment " << segment->id() << ": " << sealed.unwrap_err().message() << std::endl;
+                    unsealed.push_back(segment);
+                }
+            }
+
+            if (stopping)
+            {
+                return;
+            }
+
+            if (want_spare)
+            {
+                auto spare = _create_segment();
+                if (spare.is_err())
+                {
+                    std::cerr << "Unable to prepare the next event store segment: " << spare.unwrap_err().message() << std::endl;
+                }
+                else
+                {
+                    std::lock_guard lock(_mutex);
+                    _spare = std::move(spare).into_ok();
+                }
+            }
+
+            _apply_retention();
+            _archive_cold();
+        }
+    }
+
+    io::Result<size_t> EventStore::query(const EventQuery &query, const std::function<bool(const StoredEvent &)> &visitor)
+    {
+        std::vector<std::shared_ptr<EventArchive>> archives;
+        std::vector<std::shared_ptr<EventSegment>> segments;
+        {
+            std::lock_guard lock(_mutex);
+            archives = _archives;
+            segments = _segments;
+        }
+
+        bool stopped = false;
+        auto forward = [&](const StoredEvent &event)
+        {
+            stopped = !visitor(event);
+            return !stopped;
+        };
+
+        size_t matches = 0;
+        for (size_t i = 0; i < archives.size() && !stopped; i++)
+        {
+            if (archives[i]->max_ms() >= query.from_ms && archives[i]->min_ms() <= query.to_ms)
+            {
+                matches += SHORT_CIRCUIT(size_t, archives[i]->query(query, forward));
+            }
+        }
+
+        for (size_t i = 0; i < segments.size() && !stopped; i++)
+        {
+            if (segments[i]->max_ms() >= query.from_ms && segments[i]->min_ms() <= query.to_ms)
+            {
+                matches += SHORT_CIRCUIT(size_t, segments[i]->query(query, forward));
+            }
+        }
+
+        return io::Result<size_t>::ok(std::move(matches));
+    }
+
+    uint64_t EventStore::size() const
+    {
+        std::lock_guard lock(_mutex);
+
+        uint64_t events = 0;
+        for (const auto &archive : _archives)
+        {
+            events += archive->size();
+        }
+
+        for (const auto &segment : _segments)
+        {
+            events += segment->size();
+        }
+
+        return events;
+    }
+
+    size_t EventStore::segments() const
+    {
+        std::lock_guard lock(_mutex);
+        return _archives.size() + _segments.size();
+    }
+}
@@ -0,0 +1,196 @@
+#include "tracer.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace procmon
+{
+    // ========== EbpfTracer ==========
+
+    EbpfTracer::EbpfTracer(KernelTracerHandle *handle)
+        : NonConstructible(NonConstructibleTag::TAG), _handle(handle)
+    {
+    }
+
+    io::Result<std::unique_ptr<Tracer>> EbpfTracer::create()
+    {
+        auto handle = new_tracer();
+        if (handle == nullptr)
+        {
+            return io::Result<std::unique_ptr<Tracer>>::err(io::Error::other("Failed to create kernel tracer"));
+        }
+
+        return io::Result<std::unique_ptr<Tracer>>::ok(std::unique_ptr<Tracer>(new EbpfTracer(handle)));
+    }
+
+    EbpfTracer::~EbpfTracer()
+    {
+        free_tracer(_handle);
+    }
+
+    int EbpfTracer::event_fd() const
+    {
+        return tracer_event_fd(_handle);
+    }
+
+    size_t EbpfTracer::drain(std::span<Event> out)
+    {
+        return drain_events(_handle, out.data(), out.size());
+    }
+
+    io::Result<std::monostate> EbpfTracer::set_monitor(const std::string &command, const Threshold &threshold)
+    {
+        if (::set_monitor(_handle, command.c_str(), &threshold) != 0)
+        {
+            return io::Result<std::monostate>::err(io::Error::other("Failed to set monitor target " + command));
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::monostate> EbpfTracer::remove_monitor(const std::string &command)
+    {
+        if (::remove_monitor(_handle, command.c_str()) != 0)
+        {
+            return io::Result<std::monostate>::err(io::Error::other("Failed to remove monitor target " + command));
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    // ========== SyntheticTracerOptions ==========
+
+    std::optional<SyntheticTracerOptions> SyntheticTracerOptions::parse(const std::string &spec)
+    {
+        std::vector<uint32_t> values;
+        std::stringstream stream(spec);
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            try
+            {
+                size_t pos = 0;
+                unsigned long value = std::stoul(item, &pos);
+                if (pos != item.size() || value > std::numeric_limits<uint32_t>::max())
+                {
+                    return std::nullopt;
+                }
+
+                values.push_back(static_cast<uint32_t>(value));
+            }
+            catch (...)
+            {
+                return std::nullopt;
+            }
+        }
+
+        if (values.size() < 2 || values.size() > 3)
+        {
+            return std::nullopt;
+        }
+
+        SyntheticTracerOptions options;
+        options.new_process_rate = values[0];
+        options.violation_rate = values[1];
+        options.pid_count = values.size() > 2 ? std::max<uint32_t>(values[2], 1) : 1024;
+        return options;
+    }
+
+    // ========== SyntheticTracer ==========
+
+    SyntheticTracer::SyntheticTracer(const SyntheticTracerOptions &options, TimerFd &&timer)
+        : NonConstructible(NonConstructibleTag::TAG),
+          _options(options),
+          _timer(std::move(timer)),
+          _last_generation(std::chrono::steady_clock::now()),
+          _pending_new_processes(0),
+          _pending_violations(0),
+          _counter(0),
+          _rng(std::random_device{}())
+    {
+    }
+
+    io::Result<std::unique_ptr<Tracer>> SyntheticTracer::create(const SyntheticTracerOptions &options)
+    {
+        // Events are produced in small bursts, like a ring buffer drained by a busy kernel.
+        auto timer = SHORT_CIRCUIT(std::unique_ptr<Tracer>, TimerFd::create());
+        SHORT_CIRCUIT(std::unique_ptr<Tracer>, timer.arm(std::chrono::milliseconds(10), std::chrono::milliseconds(10)));
+
+        return io::Result<std::unique_ptr<Tracer>>::ok(std::unique_ptr<Tracer>(new SyntheticTracer(options, std::move(timer))));
+    }
+
+    Event SyntheticTracer::_make_event(EventType variant)
+    {
+        static const std::string PLACEHOLDER = "synthetic";
+        const auto &command = _commands.empty() ? PLACEHOLDER : _commands[_counter % _commands.size()];
+
+        Event event = {};
+        event.pid = FIRST_PID + static_cast<uint32_t>(_counter % _options.pid_count);
+        trim_command_name(command.c_str(), &event.name);
+        event.variant = variant;
+
+        if (variant == EventType::Violation)
+        {
+            auto target = _targets.find(command);
+            auto threshold = target == _targets.end() ? 0 : target->second.values[static_cast<size_t>(Metric::Network)];
+            event.data.violation = Violation{Metric::Network, threshold + 1 + static_cast<uint32_t>(_rng() % 1024), threshold};
+        }
+
+        _counter++;
+        return event;
+    }
+
+    int SyntheticTracer::event_fd() const
+    {
+        return _timer.as_raw_fd();
+    }
+
+    size_t SyntheticTracer::drain(std::span<Event> out)
+    {
+        _timer.read();
+
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration<double>(now - _last_generation).count();
+        _last_generation = now;
+
+        // Like a full ring buffer, never hold more than one second worth of undelivered events.
+        _pending_new_processes = std::min<double>(_pending_new_processes + elapsed * _options.new_process_rate, _options.new_process_rate);
+        _pending_violations = std::min<double>(_pending_violations + elapsed * _options.violation_rate, _options.violation_rate);
+
+        size_t count = 0;
+        while (count < out.size() && _pending_new_processes >= 1.0)
+        {
+            out[count++] = _make_event(EventType::NewProcess);
+            _pending_new_processes -= 1.0;
+        }
+
+        while (count < out.size() && _pending_violations >= 1.0)
+        {
+            out[count++] = _make_event(EventType::Violation);
+            _pending_violations -= 1.0;
+        }
+
+        return count;
+    }
+
+    io::Result<std::monostate> SyntheticTracer::set_monitor(const std::string &command, const Threshold &threshold)
+    {
+        if (_targets.insert_or_assign(command, threshold).second)
+        {
+            _commands.push_back(command);
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::monostate> SyntheticTracer::remove_monitor(const std::string &command)
+    {
+        if (_targets.erase(command) > 0)
+        {
+            _commands.erase(std::find(_commands.begin(), _commands.end(), command));
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+}
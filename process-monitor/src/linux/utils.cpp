@@ -3,9 +3,9 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
 #include <csignal>
 #include <cctype>
 #include <cstdlib>
@@ -13,22 +13,37 @@
 #include <deque>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <memory>
 #include <optional>
+#include <random>
 #include <span>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <mutex>
 
 #include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <nlohmann/json.hpp>
 
+#include "enforcement.hpp"
+#include "epoll.hpp"
+#include "event_log.hpp"
+#include "event_store.hpp"
+#include "frame.hpp"
+#include "heavy_hitters.hpp"
 #include "io.hpp"
+#include "protocol.hpp"
+#include "telemetry.hpp"
+#include "tracer.hpp"
 #include "utils.hpp"
+#include "violation_feed.hpp"
 #include "generated/listener.hpp"
 
 using json = nlohmann::json;
@@ -44,6 +59,14 @@ namespace
             .count();
     }
 
+    /** @brief Milliseconds since the Unix epoch, for times which are stored or reported. */
+    uint64_t _epoch_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
     std::string _to_command_string(const StaticCommandName &name)
     {
         const char *raw = reinterpret_cast<const char *>(name);
@@ -126,6 +149,69 @@ namespace
         return total;
     }
 
+    /**
+     * @brief Read the details attached to the violations of a process. Fields which cannot be read are left empty.
+     */
+    procmon::ProcessDetails _read_process_details(pid_t pid)
+    {
+        // Keep frames small even for processes with huge argument lists.
+        constexpr size_t MAX_CMDLINE_LENGTH = 4096;
+
+        auto base = "/proc/" + std::to_string(pid);
+        procmon::ProcessDetails details = {};
+
+        std::ifstream cmdline(base + "/cmdline", std::ios::binary);
+        if (cmdline.is_open())
+        {
+            details.cmdline.resize(MAX_CMDLINE_LENGTH);
+            cmdline.read(details.cmdline.data(), MAX_CMDLINE_LENGTH);
+            details.cmdline.resize(cmdline.gcount());
+
+            while (!details.cmdline.empty() && details.cmdline.back() == '\0')
+            {
+                details.cmdline.pop_back();
+            }
+
+            std::replace(details.cmdline.begin(), details.cmdline.end(), '\0', ' ');
+        }
+
+        std::error_code error;
+        auto exe = std::filesystem::read_symlink(base + "/exe", error);
+        if (!error)
+        {
+            details.exe = exe.string();
+        }
+
+        std::ifstream status(base + "/status");
+        std::string line;
+        while (std::getline(status, line))
+        {
+            if (line.rfind("Uid:", 0) == 0)
+            {
+                details.uid = static_cast<uint32_t>(std::strtoul(line.c_str() + 4, nullptr, 10));
+                break;
+            }
+        }
+
+        // Lines are "hierarchy-ID:controllers:path". The unified (v2) hierarchy has ID 0.
+        std::ifstream cgroup(base + "/cgroup");
+        while (std::getline(cgroup, line))
+        {
+            auto separator = line.find(':', line.find(':') + 1);
+            if (separator == std::string::npos)
+            {
+                continue;
+            }
+
+            if (details.cgroup.empty() || line.rfind("0::", 0) == 0)
+            {
+                details.cgroup = line.substr(separator + 1);
+            }
+        }
+
+        return details;
+    }
+
     class _CPUMetric
     {
     private:
@@ -237,6 +323,101 @@ namespace
         }
     };
 
+    /**
+     * @brief CPU time consumed by the agent (all threads, user and system), in microseconds.
+     */
+    uint64_t _self_cpu_time_us()
+    {
+        rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+
+        auto to_us = [](const timeval &time)
+        { return static_cast<uint64_t>(time.tv_sec) * 1000000 + static_cast<uint64_t>(time.tv_usec); };
+        return to_us(usage.ru_utime) + to_us(usage.ru_stime);
+    }
+
+    /**
+     * @brief Keeps the agent's own CPU usage within a budget by adapting the sampling interval.
+     *
+     * Usage is measured with `getrusage` over each sampling round, so it covers everything the
+     * agent does (sampling, tracer events, network I/O). Above the budget the interval is doubled,
+     * and it is halved back towards the base interval once usage falls below half of the budget.
+     */
+    class _CPUGovernor
+    {
+    private:
+        double _budget;
+        std::chrono::milliseconds _base_interval;
+        std::chrono::milliseconds _max_interval;
+        std::chrono::milliseconds _interval;
+        uint64_t _last_cpu_us;
+        uint64_t _last_wall_us;
+
+        static uint64_t _wall_time_us()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+    public:
+        /**
+         * @param budget Maximum CPU usage of the agent, in percent of one CPU.
+         */
+        _CPUGovernor(double budget, std::chrono::milliseconds base_interval, std::chrono::milliseconds max_interval)
+            : _budget(budget),
+              _base_interval(base_interval),
+              _max_interval(max_interval),
+              _interval(base_interval),
+              _last_cpu_us(_self_cpu_time_us()),
+              _last_wall_us(_wall_time_us()) {}
+
+        std::chrono::milliseconds interval() const
+        {
+            return _interval;
+        }
+
+        /**
+         * @brief Measure the CPU usage since the previous call and adapt the sampling interval.
+         *
+         * @return The new interval if it changed.
+         */
+        std::optional<std::chrono::milliseconds> update()
+        {
+            auto cpu_us = _self_cpu_time_us();
+            auto wall_us = _wall_time_us();
+            if (wall_us <= _last_wall_us)
+            {
+                return std::nullopt;
+            }
+
+            double usage = 100.0 * static_cast<double>(cpu_us - _last_cpu_us) / static_cast<double>(wall_us - _last_wall_us);
+            _last_cpu_us = cpu_us;
+            _last_wall_us = wall_us;
+
+            auto previous = _interval;
+            if (usage > _budget)
+            {
+                _interval = std::min(_interval * 2, _max_interval);
+            }
+            else if (usage < _budget / 2)
+            {
+                _interval = std::max(_interval / 2, _base_interval);
+            }
+
+            if (_interval == previous)
+            {
+                return std::nullopt;
+            }
+
+            std::cerr << std::format(
+                             "CPU usage {:.2f}% {} budget of {:.2f}%: sampling every {}ms instead of {}ms",
+                             usage, usage > _budget ? "exceeds" : "is well under", _budget, _interval.count(), previous.count())
+                      << std::endl;
+            return _interval;
+        }
+    };
+
     struct ProcessMetric
     {
         pid_t pid;
@@ -245,53 +426,95 @@ namespace
         _CPUMetric cpu;
         _MemoryMetric memory;
         _DiskMetric disk;
+        /** @brief Captured once when the process is admitted, if violations are enriched. Shared by its pending reports. */
+        std::shared_ptr<const procmon::ProcessDetails> details;
+        /** @brief Whether the enforcement action of the rule is applied, and since when (or when it was last released). */
+        bool enforced = false;
+        std::chrono::steady_clock::time_point enforcement_changed{};
 
         ProcessMetric(pid_t pid, std::string command, const Threshold &threshold)
             : pid(pid), command(std::move(command)), threshold(threshold), cpu(pid), memory(), disk(pid) {}
     };
-
-    void _ctrl_handler(int signal)
-    {
-        if (signal == SIGINT || signal == SIGTERM)
-        {
-            std::cout << "\nShutting down..." << std::endl;
-            stopped.store(true);
-        }
-    }
 }
 
 class _CTAContext
 {
 private:
-    KernelTracerHandle *_tracer;
-    uint16_t _port;
-    std::unique_ptr<net::TcpStream> _stream;
-    std::thread _resource_thread;
-    std::thread _event_thread;
-    std::thread _update_thread;
-
-    std::mutex _reconnecting_mutex;
-    std::condition_variable _reconnecting_cv;
-    bool _reconnecting;
+    enum _Token : uint64_t
+    {
+        Signal,
+        SampleTimer,
+        ReconnectTimer,
+        ConnectDeadline,
+        TracerEvents,
+        Stream,
+        TelemetryTimer,
+    };
 
-    std::mutex _queue_mutex;
-    std::condition_variable _queue_cv;
-    std::deque<procmon::ViolationInfo> _queue;
+    /**
+     * @brief State of the link to CTB. `_stream` is non-null in the `Connecting` and `Connected` states.
+     */
+    enum class _LinkState
+    {
+        Disconnected,
+        Connecting,
+        Connected,
+    };
 
-    std::mutex _monitored_mutex;
+    // Reports are encoded only a little ahead of the socket, so that a critical one never waits
+    // behind a large buffer of minor ones.
+    static constexpr size_t MAX_OUTBOUND_BYTES = 16 * 1024;
+    static constexpr size_t MAX_UNACKED_VIOLATIONS = 16384;
+    // Reports written per round from each lane (indexed by severity) when several have a backlog.
+    static constexpr size_t LANE_WEIGHTS[procmon::SEVERITY_COUNT] = {1, 4, 16};
+    static constexpr size_t TRACER_BATCH_SIZE = 64;
+    static constexpr std::chrono::milliseconds RECONNECT_INITIAL_BACKOFF{500};
+    static constexpr std::chrono::milliseconds RECONNECT_MAX_BACKOFF{30000};
+    static constexpr std::chrono::milliseconds CONNECT_TIMEOUT{3000};
+    static constexpr std::chrono::milliseconds SAMPLE_INTERVAL{1000};
+    static constexpr std::chrono::milliseconds MAX_SAMPLE_INTERVAL{60000};
+    static constexpr double DEFAULT_CPU_BUDGET = 5.0;
+    static constexpr std::chrono::milliseconds TELEMETRY_INTERVAL{10000};
+
+    std::unique_ptr<procmon::Tracer> _tracer;
+    uint16_t _port;
+    std::unique_ptr<net::TcpStream> _stream;
+    _LinkState _state;
+    std::chrono::milliseconds _backoff;
+    std::minstd_rand _rng;
+    std::optional<uint64_t> _config_fingerprint;
+    std::optional<std::chrono::steady_clock::time_point> _startup;
+    bool _enrich_violations;
+    _CPUGovernor _governor;
+
+    procmon::Epoll _epoll;
+    procmon::SignalFd _signals;
+    procmon::TimerFd _sample_timer;
+    procmon::TimerFd _reconnect_timer;
+    procmon::TimerFd _connect_deadline;
+    procmon::TimerFd _telemetry_timer;
+
+    Event _tracer_batch[TRACER_BATCH_SIZE];
+
+    procmon::FrameDecoder _decoder;
+    std::vector<char> _outbound;
+    size_t _outbound_offset;
+    bool _want_writable;
+
+    // Violations not yet acknowledged by CTB, one lane per severity.
+    uint64_t _agent_id;
+    procmon::ViolationLane _lanes[procmon::SEVERITY_COUNT];
     std::unordered_map<uint64_t, ProcessMetric> _monitored_pids;
-
     std::unordered_map<std::string, Threshold> _target_thresholds;
+    // Full rules by command, for what is not programmed into the tracer (severities, actions).
+    std::unordered_map<std::string, procmon::ConfigEntry> _target_rules;
+    procmon::Enforcer _enforcer;
 
-    void _configure_stream_timeouts()
-    {
-        if (_stream != nullptr)
-        {
-            auto timeout = std::chrono::milliseconds(1000);
-            _stream->set_read_timeout(timeout);
-            _stream->set_write_timeout(timeout);
-        }
-    }
+    // Counters are cumulative; rates are computed over the time since the previous report.
+    procmon::AgentTelemetry _telemetry;
+    uint64_t _telemetry_last_events;
+    uint64_t _telemetry_last_cpu_us;
+    std::chrono::steady_clock::time_point _telemetry_last_time;
 
     static std::string _to_command(const procmon::ConfigEntry &entry)
     {
@@ -316,20 +539,75 @@ private:
             return;
         }
 
-        _monitored_pids.emplace(pid, ProcessMetric(static_cast<pid_t>(pid), command, threshold_it->second));
+        auto metric = _monitored_pids.emplace(pid, ProcessMetric(static_cast<pid_t>(pid), command, threshold_it->second)).first;
+        if (_enrich_violations)
+        {
+            // Read now, while the process is known to be alive, rather than when it violates a threshold.
+            metric->second.details = std::make_shared<const procmon::ProcessDetails>(_read_process_details(static_cast<pid_t>(pid)));
+        }
+    }
+
+    /**
+     * @brief Apply the enforcement action of the rule of `metric` while it violates a threshold, and
+     * release it once it does not anymore. Each change waits for the cooldown of the rule since the previous one.
+     */
+    void _enforce(ProcessMetric &metric, bool violating)
+    {
+        if (violating == metric.enforced)
+        {
+            return;
+        }
+
+        auto rule = _target_rules.find(metric.command);
+        if (rule == _target_rules.end() || rule->second.action.empty())
+        {
+            return;
+        }
+
+        const auto &action = rule->second.action;
+        auto now = std::chrono::steady_clock::now();
+        if (now - metric.enforcement_changed < std::chrono::seconds(action.cooldown))
+        {
+            return;
+        }
+
+        metric.enforced = violating;
+        metric.enforcement_changed = now;
+        if (violating)
+        {
+            std::cerr << "Enforcing rule on PID " << metric.pid << " (" << metric.command << "): cpu.max=" << action.cpu_max
+                      << "%, memory.high=" << action.memory_high << "MB, io.max=" << action.io_max << "MB/s, nice=" << action.nice
+                      << ", ionice=" << static_cast<int>(action.ionice) - 1 << std::endl;
+
+            auto apply = _enforcer.apply(metric.pid, action);
+            if (apply.is_err())
+            {
+                std::cerr << "Warning: Failed to enforce rule on PID " << metric.pid << ": " << apply.unwrap_err().message() << std::endl;
+            }
+        }
+        else
+        {
+            std::cerr << "Releasing PID " << metric.pid << " (" << metric.command << ")" << std::endl;
+            _enforcer.release(metric.pid);
+        }
     }
 
     void _sample_processes()
     {
-        std::lock_guard<std::mutex> guard(_monitored_mutex);
         for (auto it = _monitored_pids.begin(); it != _monitored_pids.end();)
         {
             auto pid = it->first;
             auto &metric = it->second;
 
             auto stat = _read_proc_stat(static_cast<pid_t>(pid));
+            if (!stat.has_value())
+            {
+                _telemetry.proc_read_failures.add();
+            }
+
             if (!stat.has_value() || stat->command != metric.command)
             {
+                _enforcer.release(static_cast<pid_t>(pid));
                 it = _monitored_pids.erase(it);
                 continue;
             }
@@ -338,6 +616,14 @@ private:
             auto memory = metric.memory.memory_usage(stat.value());
             auto disk = metric.disk.refresh();
 
+            // Unlike reports, actions are only driven by the thresholds which are set.
+            auto exceeds = [&metric](Metric kind, uint64_t value)
+            {
+                auto threshold = metric.threshold.values[static_cast<size_t>(kind)];
+                return threshold != 0 && value >= threshold;
+            };
+            _enforce(metric, exceeds(Metric::Cpu, cpu) || exceeds(Metric::Memory, memory) || exceeds(Metric::Disk, disk));
+
             auto cpu_threshold = metric.threshold.values[static_cast<size_t>(Metric::Cpu)];
             if (cpu >= cpu_threshold)
             {
@@ -345,7 +631,10 @@ private:
                 procmon::trim_command_name(metric.command.c_str(), &name);
 
                 Violation violation{Metric::Cpu, static_cast<uint32_t>(cpu), cpu_threshold};
-                push_violation(procmon::ViolationInfo(pid, std::move(name), std::move(violation)));
+                push_violation(
+                    procmon::ViolationInfo(pid, std::move(name), std::move(violation)),
+                    _severity_of(metric.command, Metric::Cpu),
+                    metric.details);
             }
 
             auto memory_threshold = metric.threshold.values[static_cast<size_t>(Metric::Memory)];
@@ -355,7 +644,10 @@ private:
                 procmon::trim_command_name(metric.command.c_str(), &name);
 
                 Violation violation{Metric::Memory, static_cast<uint32_t>(memory), memory_threshold};
-                push_violation(procmon::ViolationInfo(pid, std::move(name), std::move(violation)));
+                push_violation(
+                    procmon::ViolationInfo(pid, std::move(name), std::move(violation)),
+                    _severity_of(metric.command, Metric::Memory),
+                    metric.details);
             }
 
             auto disk_threshold = metric.threshold.values[static_cast<size_t>(Metric::Disk)];
@@ -365,411 +657,2036 @@ private:
                 procmon::trim_command_name(metric.command.c_str(), &name);
 
                 Violation violation{Metric::Disk, static_cast<uint32_t>(disk), disk_threshold};
-                push_violation(procmon::ViolationInfo(pid, std::move(name), std::move(violation)));
+                push_violation(
+                    procmon::ViolationInfo(pid, std::move(name), std::move(violation)),
+                    _severity_of(metric.command, Metric::Disk),
+                    metric.details);
             }
 
             ++it;
         }
     }
 
-    void _resource_loop()
+    /**
+     * @brief Drain every pending kernel event. Called when the tracer ring buffer is reported readable.
+     */
+    void _handle_tracer_events()
     {
-        while (!stopped.load())
+        size_t count = 0;
+        do
+        {
+            count = _tracer->drain(std::span<Event>(_tracer_batch, std::size(_tracer_batch)));
+            _telemetry.kernel_events.add(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                auto &event = _tracer_batch[i];
+                auto pid = event.pid;
+                if (event.variant == EventType::NewProcess)
+                {
+                    _add_monitored_process(pid, _to_command(event.name));
+                }
+                else if (event.variant == EventType::Violation)
+                {
+                    auto severity = _severity_of(_to_command(event.name), event.data.violation.metric);
+                    auto metric = _monitored_pids.find(pid);
+                    auto details = metric == _monitored_pids.end() ? nullptr : metric->second.details;
+                    push_violation(procmon::ViolationInfo(pid, event.name, std::move(event.data.violation)), severity, std::move(details));
+                }
+            }
+        } while (count == std::size(_tracer_batch));
+    }
+
+    void _handle_ack(const procmon::AckMessage &ack)
+    {
+        for (size_t lane = 0; lane < procmon::SEVERITY_COUNT; lane++)
         {
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-            _sample_processes();
+            _lanes[lane].acknowledge(ack.sequences[lane]);
         }
     }
 
-    void _event_loop()
+    size_t _unacked_count() const
     {
-        while (!stopped.load())
+        size_t count = 0;
+        for (const auto &lane : _lanes)
         {
-            auto event = next_event(tracer(), 250);
-            if (event == nullptr)
-            {
-                continue;
-            }
+            count += lane.unacked.size();
+        }
 
-            auto pid = event->pid;
-            if (event->variant == EventType::NewProcess)
-            {
-                auto name = _to_command(event->name);
-                std::lock_guard<std::mutex> guard(_monitored_mutex);
-                _add_monitored_process(pid, name);
-            }
-            else if (event->variant == EventType::Violation)
-            {
-                push_violation(procmon::ViolationInfo(pid, event->name, std::move(event->data.violation)));
-            }
+        return count;
+    }
 
-            drop_event(event);
-        }
+    procmon::Severity _severity_of(const std::string &command, Metric metric) const
+    {
+        auto it = _target_rules.find(command);
+        return it == _target_rules.end() ? procmon::Severity::Normal : it->second.severity[static_cast<size_t>(metric)];
     }
 
-    void _update_loop()
+    void _handle_message(std::span<const char> payload)
     {
-        while (!stopped.load())
+        auto message = procmon::decode_message(payload);
+        if (!message.has_value())
         {
-            while (!stopped.load())
-            {
-                auto message = read_message();
-                if (message.is_ok())
-                {
-                    auto &config = message.unwrap();
-                    auto parsed = json::parse(config, nullptr, false);
-                    if (!parsed.is_discarded() && parsed.is_array())
-                    {
-                        std::vector<procmon::ConfigEntry> entries;
-                        for (const auto &item : parsed)
-                        {
-                            procmon::ConfigEntry entry = {0};
-
-                            auto name = item.value("name", "");
-                            size_t len = std::min(name.size(), COMMAND_LENGTH - 1);
-                            std::memcpy(entry.name, name.data(), len);
-                            entry.name[len] = '\0';
-
-                            entry.threshold.values[static_cast<int>(Metric::Cpu)] = item.value("cpu", 0);
-                            entry.threshold.values[static_cast<int>(Metric::Memory)] = item.value("memory", 0);
-                            entry.threshold.values[static_cast<int>(Metric::Disk)] = item.value("disk", 0);
-                            entry.threshold.values[static_cast<int>(Metric::Network)] = item.value("network", 0);
-                            entries.push_back(entry);
-                        }
-
-                        set_monitor_targets(entries);
-                    }
-                    else
-                    {
-                        std::cerr << "Received corrupted data. Reconnecting." << std::endl;
-                        reconnect();
-                        break;
-                    }
-                }
-                else
-                {
-                    auto &err = message.unwrap_err();
-                    if (err.kind() == io::ErrorKind::WouldBlock || err.kind() == io::ErrorKind::TimedOut || err.kind() == io::ErrorKind::Interrupted)
-                    {
-                        if (stopped.load())
-                        {
-                            break;
-                        }
+            std::cerr << "Received corrupted data. Reconnecting." << std::endl;
+            _disconnect();
+            return;
+        }
 
-                        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-                        continue;
-                    }
+        auto [type, body] = message.value();
+        switch (type)
+        {
+        case procmon::MessageType::Config:
+            _handle_config(body);
+            break;
 
-                    std::cerr << "Unable to pull update: " << err.message() << std::endl;
-                    reconnect();
-                    break;
-                }
+        case procmon::MessageType::Ack:
+        {
+            auto ack = procmon::message_as<procmon::AckMessage>(body);
+            if (!ack.has_value())
+            {
+                std::cerr << "Received corrupted data. Reconnecting." << std::endl;
+                _disconnect();
+                return;
             }
 
-            std::this_thread::sleep_for(std::chrono::seconds(5));
+            _handle_ack(ack.value());
+            break;
+        }
+
+        default:
+            std::cerr << "Ignoring unexpected message of type " << static_cast<uint32_t>(type) << std::endl;
+            break;
         }
     }
 
-    void _populate_initial_processes(const std::vector<procmon::ConfigEntry> &entries)
+    void _handle_config(std::span<const char> config)
     {
-        (void)entries;
-        std::lock_guard<std::mutex> guard(_monitored_mutex);
+        auto parsed = json::parse(config, nullptr, false);
+        if (parsed.is_discarded() || !parsed.is_array())
+        {
+            std::cerr << "Received corrupted data. Reconnecting." << std::endl;
+            _disconnect();
+            return;
+        }
 
-        for (const auto &dir : std::filesystem::directory_iterator("/proc"))
+        std::vector<procmon::ConfigEntry> entries;
+        for (const auto &item : parsed)
         {
-            if (!dir.is_directory())
-            {
-                continue;
-            }
+            entries.push_back(procmon::parse_config_entry(item));
+        }
 
-            const auto &name = dir.path().filename().string();
-            if (!std::all_of(name.begin(), name.end(), ::isdigit))
+        set_monitor_targets(entries);
+        procmon::encode_message(
+            _outbound,
+            procmon::MessageType::ConfigApplied,
+            procmon::ConfigAppliedMessage{_config_fingerprint.value()});
+    }
+
+    void _handle_readable()
+    {
+        while (_state == _LinkState::Connected)
+        {
+            auto read = _decoder.fill(*_stream);
+            if (read.is_err())
             {
-                continue;
+                auto &err = read.unwrap_err();
+                if (err.kind() == io::ErrorKind::WouldBlock)
+                {
+                    return;
+                }
+
+                if (err.kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
+
+                std::cerr << "Unable to pull update: " << err.message() << std::endl;
+                _disconnect();
+                return;
             }
 
-            pid_t pid = static_cast<pid_t>(std::strtol(name.c_str(), nullptr, 10));
-            auto stat = _read_proc_stat(pid);
-            if (!stat.has_value())
+            if (read.unwrap() == 0)
             {
-                continue;
+                std::cerr << "Unable to pull update: connection closed by server" << std::endl;
+                _disconnect();
+                return;
             }
 
-            auto threshold_it = _target_thresholds.find(stat->command);
-            if (threshold_it == _target_thresholds.end())
+            while (_state == _LinkState::Connected)
             {
-                continue;
-            }
+                auto frame = _decoder.next();
+                if (frame.is_err())
+                {
+                    std::cerr << "Received corrupted data: " << frame.unwrap_err().message() << std::endl;
+                    _disconnect();
+                    return;
+                }
+
+                if (!frame.unwrap().has_value())
+                {
+                    break;
+                }
 
-            _add_monitored_process(static_cast<uint32_t>(pid), stat->command);
+                _handle_message(frame.unwrap().value());
+            }
         }
     }
 
-public:
-    explicit _CTAContext(KernelTracerHandle *tracer, uint16_t port, std::unique_ptr<net::TcpStream> stream)
-        : _tracer(tracer), _port(port), _stream(std::move(stream)), _reconnecting(false)
+    void _set_writable_interest(bool writable)
     {
-        _configure_stream_timeouts();
-        _resource_thread = std::thread(&_CTAContext::_resource_loop, this);
-        _event_thread = std::thread(&_CTAContext::_event_loop, this);
-        _update_thread = std::thread(&_CTAContext::_update_loop, this);
-    }
+        if (_state != _LinkState::Connected || writable == _want_writable)
+        {
+            return;
+        }
 
-    static io::Result<std::unique_ptr<_CTAContext>> connect(uint16_t port)
-    {
-        auto tracer = new_tracer();
-        if (tracer == nullptr)
+        auto events = EPOLLIN | EPOLLRDHUP | (writable ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        if (_epoll.modify(_stream->as_raw_fd(), events, _Token::Stream).is_ok())
         {
-            return io::Result<std::unique_ptr<_CTAContext>>::err(io::Error::other("Failed to create kernel tracer"));
+            _want_writable = writable;
         }
+    }
 
-        auto connect = net::TcpStream::connect(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, port));
-        auto stream = connect.is_ok()
-                          ? std::make_unique<net::TcpStream>(std::move(connect).into_ok())
-                          : nullptr;
-        auto context = std::make_unique<_CTAContext>(tracer, port, std::move(stream));
-        if (context->_stream == nullptr)
+    /**
+     * @brief Serialize unsent violations into the outbound buffer and write as much as the socket accepts.
+     *
+     * Written reports stay in their lane until CTB acknowledges them, so that they can be resent
+     * on the next connection if this one breaks.
+     */
+    void _flush()
+    {
+        while (_state == _LinkState::Connected)
         {
-            std::cerr << "Loading configuration from local machine." << std::endl;
-            auto load_from_local = procmon::load_config();
-            if (load_from_local.is_ok())
+            // Weighted round robin over the lanes, most severe first: critical reports overtake a
+            // backlog of minor ones, which still make progress.
+            bool pending = true;
+            while (pending && _outbound.size() - _outbound_offset < MAX_OUTBOUND_BYTES)
             {
-                std::cerr << "Loaded " << load_from_local.unwrap().size() << " configuration entries" << std::endl;
-                context->set_monitor_targets(load_from_local.unwrap());
+                pending = false;
+                for (size_t index = procmon::SEVERITY_COUNT; index-- > 0;)
+                {
+                    auto &lane = _lanes[index];
+                    for (size_t i = 0; i < LANE_WEIGHTS[index] && lane.has_unsent(); i++)
+                    {
+                        const auto &entry = lane.unsent();
+                        procmon::encode_violation(_outbound, entry.message, entry.details.get());
+                        lane.send_sequence++;
+                        _telemetry.violations_sent.add();
+                    }
+
+                    pending |= lane.has_unsent();
+                }
             }
-            else
+
+            if (_outbound_offset == _outbound.size())
             {
-                std::cerr << "Warning: Failed to load configuration from local machine: " << load_from_local.unwrap_err().message() << std::endl;
+                _outbound.clear();
+                _outbound_offset = 0;
+                _set_writable_interest(false);
+                return;
             }
-        }
-        else
-        {
-            context->_configure_stream_timeouts();
-        }
 
-        return io::Result<std::unique_ptr<_CTAContext>>::ok(std::move(context));
-    }
+            auto written = _stream->write(std::span<const char>(_outbound.data() + _outbound_offset, _outbound.size() - _outbound_offset));
+            if (written.is_err())
+            {
+                auto &err = written.unwrap_err();
+                if (err.kind() == io::ErrorKind::WouldBlock)
+                {
+                    _set_writable_interest(true);
+                    return;
+                }
 
-    ~_CTAContext()
-    {
-        stopped.store(true);
+                if (err.kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
 
-        if (_resource_thread.joinable())
-        {
-            _resource_thread.join();
-        }
-        if (_event_thread.joinable())
-        {
-            _event_thread.join();
+                std::cerr << "Unable to send violations: " << err.message() << std::endl;
+                _disconnect();
+                return;
+            }
+
+            _outbound_offset += written.unwrap();
         }
-        if (_update_thread.joinable())
+    }
+
+    /**
+     * @brief Queue a report on the agent itself for CTB. Nothing is queued while disconnected.
+     */
+    void _send_telemetry()
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto period_ms = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - _telemetry_last_time).count());
+        auto events = _telemetry.kernel_events.load();
+        auto cpu_us = _self_cpu_time_us();
+
+        procmon::TelemetryMessage message = {};
+        message.period_ms = period_ms;
+        message.queue_depth = _unacked_count();
+        message.violations_produced = _telemetry.violations_produced.load();
+        message.violations_sent = _telemetry.violations_sent.load();
+        message.violations_dropped = _telemetry.violations_dropped.load();
+        message.kernel_events_per_sec = period_ms == 0 ? 0 : (events - _telemetry_last_events) * 1000 / period_ms;
+        message.sample_round_us = _telemetry.sample_round_us.load();
+        message.sample_interval_ms = static_cast<uint64_t>(_governor.interval().count());
+        message.proc_read_failures = _telemetry.proc_read_failures.load();
+        message.reconnects = _telemetry.reconnects.load();
+        message.cpu_usage = period_ms == 0 ? 0 : (cpu_us - _telemetry_last_cpu_us) * 100 / period_ms;
+
+        auto stat = _read_proc_stat(getpid());
+        if (stat.has_value())
         {
-            _update_thread.join();
+            message.rss_bytes = _MemoryMetric().memory_usage(stat.value());
         }
 
-        free_tracer(_tracer);
-    }
+        _telemetry_last_time = now;
+        _telemetry_last_events = events;
+        _telemetry_last_cpu_us = cpu_us;
 
-    KernelTracerHandle *tracer() const
-    {
-        return _tracer;
+        if (_state == _LinkState::Connected)
+        {
+            procmon::encode_message(_outbound, procmon::MessageType::Telemetry, message);
+        }
     }
 
-    io::Result<std::vector<char>> read_message()
+    /**
+     * @brief Arm the reconnection timer with a jittered delay, then double the backoff for the next failure.
+     *
+     * The delay is drawn uniformly from `[backoff / 2, backoff]` so that agents restarted together do
+     * not hammer CTB in lockstep.
+     */
+    void _schedule_reconnect()
     {
-        if (_stream == nullptr)
-        {
-            return io::Result<std::vector<char>>::err(io::Error::other("Not connected to server"));
-        }
+        std::uniform_int_distribution<int64_t> jitter(_backoff.count() / 2, _backoff.count());
+        auto delay = std::chrono::milliseconds(jitter(_rng));
+        _backoff = std::min(_backoff * 2, RECONNECT_MAX_BACKOFF);
 
-        return procmon::read_message(*_stream);
+        _reconnect_timer.arm(delay, std::chrono::milliseconds(0));
     }
 
-    io::Result<std::monostate> write_message(const std::span<const char> &buffer)
+    /**
+     * @brief Drop the current connection (if any) and schedule a reconnection attempt.
+     */
+    void _disconnect()
     {
-        if (_stream == nullptr)
+        if (_stream != nullptr)
         {
-            return io::Result<std::monostate>::err(io::Error::other("Not connected to server"));
+            _epoll.remove(_stream->as_raw_fd());
+            _stream = nullptr;
         }
 
-        uint32_t length = static_cast<uint32_t>(buffer.size());
-        auto size = SHORT_CIRCUIT(std::monostate, _stream->write(std::span<const char>(reinterpret_cast<const char *>(&length), sizeof(length))));
-
-        const char *ptr = buffer.data();
-        auto remaining = buffer.size();
-        while (remaining > 0)
-        {
-            size = SHORT_CIRCUIT(std::monostate, _stream->write(std::span<const char>(ptr, remaining)));
-            ptr += size;
-            remaining -= size;
-        }
+        // A partially written frame cannot be resumed on a new connection.
+        _decoder.reset();
+        _outbound.clear();
+        _outbound_offset = 0;
+        _want_writable = false;
 
-        return io::Result<std::monostate>::ok(std::monostate{});
+        _state = _LinkState::Disconnected;
+        _connect_deadline.disarm();
+        _schedule_reconnect();
     }
 
-    void push_violation(procmon::ViolationInfo &&info)
+    /**
+     * @brief Handle a failed connection attempt. The local configuration is already in effect.
+     */
+    void _connect_failed(const std::string &reason)
     {
-        {
-            std::lock_guard<std::mutex> guard(_queue_mutex);
-            _queue.push_back(std::move(info));
-        }
-        _queue_cv.notify_one();
+        std::cerr << "Unable to connect to server: " << reason << std::endl;
+        _disconnect();
     }
 
-    void reconnect()
+    /**
+     * @brief Start a nonblocking connection to CTB. Completion is reported by `EPOLLOUT` on the stream.
+     */
+    void _start_connect()
     {
-        std::unique_lock<std::mutex> lock(_reconnecting_mutex);
-        while (!stopped.load() && _reconnecting)
+        if (_state != _LinkState::Disconnected)
         {
-            _reconnecting_cv.wait_for(lock, std::chrono::seconds(1));
+            return;
         }
 
-        if (stopped.load())
+        auto connect = net::TcpStream::connect_nonblocking(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, _port));
+        if (connect.is_err())
         {
+            _connect_failed(connect.unwrap_err().message());
             return;
         }
 
-        _reconnecting = true;
-        _stream = nullptr;
-
-        auto connect = net::TcpStream::connect(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, _port));
-        if (connect.is_ok())
+        auto stream = std::make_unique<net::TcpStream>(std::move(connect).into_ok());
+        auto add = _epoll.add(stream->as_raw_fd(), EPOLLOUT | EPOLLRDHUP, _Token::Stream);
+        if (add.is_err())
         {
-            _stream = std::make_unique<net::TcpStream>(std::move(connect).into_ok());
-            _configure_stream_timeouts();
+            _connect_failed(add.unwrap_err().message());
+            return;
         }
 
-        _reconnecting = false;
-        _reconnecting_cv.notify_all();
+        _stream = std::move(stream);
+        _state = _LinkState::Connecting;
+        _connect_deadline.arm(CONNECT_TIMEOUT, std::chrono::milliseconds(0));
+    }
+
+    /**
+     * @brief Complete a pending connection once the socket is reported writable (or failed).
+     */
+    void _finish_connect()
+    {
+        auto error = _stream->take_error();
+        if (error.is_err())
+        {
+            _connect_failed(error.unwrap_err().message());
+            return;
+        }
+
+        if (error.unwrap().has_value())
+        {
+            _connect_failed(error.unwrap()->message());
+            return;
+        }
+
+        auto modify = _epoll.modify(_stream->as_raw_fd(), EPOLLIN | EPOLLRDHUP, _Token::Stream);
+        if (modify.is_err())
+        {
+            _connect_failed(modify.unwrap_err().message());
+            return;
+        }
+
+        _stream->set_nodelay(true);
+        _state = _LinkState::Connected;
+        _want_writable = false;
+        _backoff = RECONNECT_INITIAL_BACKOFF;
+        _connect_deadline.disarm();
+
+        // Identify ourselves, then resend everything CTB has not acknowledged yet: CTB drops the
+        // reports it already logged.
+        procmon::encode_message(_outbound, procmon::MessageType::Hello, procmon::HelloMessage{_agent_id});
+        for (auto &lane : _lanes)
+        {
+            lane.rewind();
+        }
+
+        if (_startup.has_value())
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _startup.value());
+            std::cerr << "Connected to server " << elapsed.count() << "ms after startup" << std::endl;
+            _startup.reset();
+        }
+        else
+        {
+            std::cerr << "Connected to server" << std::endl;
+        }
+    }
+
+    void _handle_connect_deadline()
+    {
+        _connect_deadline.read();
+        if (_state == _LinkState::Connecting)
+        {
+            _connect_failed("connection timed out");
+        }
+    }
+
+    /**
+     * @brief Scan /proc for running processes whose command is one of `commands`.
+     *
+     * PIDs in `skip` (if any) are not examined, and every examined PID is recorded in `seen` (if any).
+     * This does not touch the context, so that it can run before the tracer is ready.
+     */
+    static std::vector<std::pair<uint32_t, std::string>> _scan_processes(
+        const std::unordered_set<std::string> &commands,
+        const std::unordered_set<pid_t> *skip,
+        std::unordered_set<pid_t> *seen)
+    {
+        std::vector<std::pair<uint32_t, std::string>> result;
+        if (commands.empty())
+        {
+            return result;
+        }
+
+        for (const auto &dir : std::filesystem::directory_iterator("/proc"))
+        {
+            if (!dir.is_directory())
+            {
+                continue;
+            }
+
+            const auto &name = dir.path().filename().string();
+            if (!std::all_of(name.begin(), name.end(), ::isdigit))
+            {
+                continue;
+            }
+
+            pid_t pid = static_cast<pid_t>(std::strtol(name.c_str(), nullptr, 10));
+            if (skip != nullptr && skip->find(pid) != skip->end())
+            {
+                continue;
+            }
+
+            if (seen != nullptr)
+            {
+                seen->insert(pid);
+            }
+
+            auto stat = _read_proc_stat(pid);
+            if (!stat.has_value())
+            {
+                continue;
+            }
+
+            if (commands.find(stat->command) == commands.end())
+            {
+                continue;
+            }
+
+            result.emplace_back(static_cast<uint32_t>(pid), std::move(stat->command));
+        }
+
+        return result;
+    }
+
+    /**
+     * @brief Start sampling the already running processes whose command is one of `commands`.
+     */
+    void _populate_initial_processes(const std::unordered_set<std::string> &commands)
+    {
+        for (const auto &[pid, command] : _scan_processes(commands, nullptr, nullptr))
+        {
+            _add_monitored_process(pid, command);
+        }
+    }
+
+    /**
+     * @brief Put the rules in `entries` into effect, applying only the difference with the current ones.
+     *
+     * @return The commands which were not monitored before.
+     */
+    std::unordered_set<std::string> _apply_targets(const std::vector<procmon::ConfigEntry> &entries, uint64_t fingerprint)
+    {
+        // Later entries override earlier ones with the same name.
+        std::unordered_map<std::string, const procmon::ConfigEntry *> targets;
+        for (const auto &entry : entries)
+        {
+            targets[_to_command(entry)] = &entry;
+        }
+
+        // Apply only the difference with the current rules, so that processes matched by an
+        // unchanged rule keep their sampling state and the kernel keeps its accounting.
+        for (auto it = _target_thresholds.begin(); it != _target_thresholds.end();)
+        {
+            if (targets.find(it->first) == targets.end())
+            {
+                _tracer->remove_monitor(it->first);
+                _target_rules.erase(it->first);
+                it = _target_thresholds.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        std::unordered_set<std::string> added;
+        std::unordered_set<std::string> changed_actions;
+        for (const auto &[command, entry] : targets)
+        {
+            // Severities and actions only matter to the agent: they never require reprogramming the kernel.
+            auto &rule = _target_rules[command];
+            if (std::memcmp(&rule.action, &entry->action, sizeof(procmon::EnforcementAction)) != 0)
+            {
+                changed_actions.insert(command);
+            }
+
+            rule = *entry;
+
+            auto current = _target_thresholds.find(command);
+            if (current == _target_thresholds.end())
+            {
+                added.insert(command);
+            }
+            else if (std::memcmp(&current->second, &entry->threshold, sizeof(Threshold)) == 0)
+            {
+                continue;
+            }
+
+            _tracer->set_monitor(command, entry->threshold);
+            _target_thresholds[command] = entry->threshold;
+        }
+
+        for (auto it = _monitored_pids.begin(); it != _monitored_pids.end();)
+        {
+            auto &metric = it->second;
+            auto threshold_it = _target_thresholds.find(metric.command);
+            if (threshold_it == _target_thresholds.end())
+            {
+                _enforcer.release(metric.pid);
+                it = _monitored_pids.erase(it);
+            }
+            else
+            {
+                // An action which changed is released now, and applied again (with the new settings) by the next sampling round.
+                if (metric.enforced && changed_actions.find(metric.command) != changed_actions.end())
+                {
+                    _enforcer.release(metric.pid);
+                    metric.enforced = false;
+                    metric.enforcement_changed = {};
+                }
+
+                metric.threshold = threshold_it->second;
+                ++it;
+            }
+        }
+
+        _config_fingerprint = fingerprint;
+        return added;
+    }
+
+    /**
+     * @brief Put the configuration saved by a previous run into effect, before CTB is contacted.
+     *
+     * `running` and `seen` are the result of a /proc scan made while the tracer was loading. The
+     * tracer only reports processes started after their rule is set, so the PIDs which appeared
+     * since that scan are examined again.
+     */
+    void _apply_local_config(
+        const io::Result<std::vector<procmon::ConfigEntry>> &config,
+        const std::vector<std::pair<uint32_t, std::string>> &running,
+        const std::unordered_set<pid_t> &seen)
+    {
+        if (config.is_err())
+        {
+            std::cerr << "Warning: Failed to load configuration from local machine: " << config.unwrap_err().message() << std::endl;
+            return;
+        }
+
+        const auto &entries = config.unwrap();
+        std::cerr << "Loaded " << entries.size() << " configuration entries from local machine" << std::endl;
+
+        // The entries come from the configuration file: there is no need to write them back.
+        auto added = _apply_targets(entries, procmon::config_fingerprint(entries));
+        for (const auto &[pid, command] : running)
+        {
+            _add_monitored_process(pid, command);
+        }
+
+        for (const auto &[pid, command] : _scan_processes(added, &seen, nullptr))
+        {
+            _add_monitored_process(pid, command);
+        }
+    }
+
+    /**
+     * @brief Create the eBPF tracer, or a synthetic one if `PROCMON_SYNTHETIC_TRACER` is set.
+     *
+     * The variable holds `new_process_rate,violation_rate[,pid_count]`, allowing the whole agent
+     * pipeline to be load-tested without root privileges.
+     */
+    static io::Result<std::unique_ptr<procmon::Tracer>> _create_tracer()
+    {
+        auto spec = std::getenv("PROCMON_SYNTHETIC_TRACER");
+        if (spec == nullptr)
+        {
+            return procmon::EbpfTracer::create();
+        }
+
+        auto options = procmon::SyntheticTracerOptions::parse(spec);
+        if (!options.has_value())
+        {
+            return io::Result<std::unique_ptr<procmon::Tracer>>::err(
+                io::Error(io::ErrorKind::InvalidInput, "PROCMON_SYNTHETIC_TRACER must be new_process_rate,violation_rate[,pid_count]"));
+        }
+
+        std::cerr << "Using synthetic tracer: " << options->new_process_rate << " new processes/s, "
+                  << options->violation_rate << " violations/s over " << options->pid_count << " PIDs" << std::endl;
+        return procmon::SyntheticTracer::create(options.value());
+    }
+
+    /**
+     * @brief Whether `PROCMON_ENRICH_VIOLATIONS` asks for the details of the process to be attached to violations.
+     */
+    static bool _enrichment_enabled()
+    {
+        auto value = std::getenv("PROCMON_ENRICH_VIOLATIONS");
+        return value != nullptr && value[0] != '\0' && std::strcmp(value, "0") != 0;
+    }
+
+    /**
+     * @brief Read the CPU budget of the agent (in percent of one CPU) from `PROCMON_CPU_BUDGET`.
+     */
+    static io::Result<double> _cpu_budget()
+    {
+        auto spec = std::getenv("PROCMON_CPU_BUDGET");
+        if (spec == nullptr)
+        {
+            return io::Result<double>::ok(double(DEFAULT_CPU_BUDGET));
+        }
+
+        char *end = nullptr;
+        double budget = std::strtod(spec, &end);
+        if (end == spec || *end != '\0' || !(budget > 0.0))
+        {
+            return io::Result<double>::err(io::Error(io::ErrorKind::InvalidInput, "PROCMON_CPU_BUDGET must be a positive percentage"));
+        }
+
+        return io::Result<double>::ok(std::move(budget));
+    }
+
+    io::Result<std::monostate> _register_sources()
+    {
+        SHORT_CIRCUIT(std::monostate, _epoll.add(_signals.as_raw_fd(), EPOLLIN, _Token::Signal));
+        SHORT_CIRCUIT(std::monostate, _epoll.add(_sample_timer.as_raw_fd(), EPOLLIN, _Token::SampleTimer));
+        SHORT_CIRCUIT(std::monostate, _epoll.add(_reconnect_timer.as_raw_fd(), EPOLLIN, _Token::ReconnectTimer));
+        SHORT_CIRCUIT(std::monostate, _epoll.add(_connect_deadline.as_raw_fd(), EPOLLIN, _Token::ConnectDeadline));
+        SHORT_CIRCUIT(std::monostate, _epoll.add(_telemetry_timer.as_raw_fd(), EPOLLIN, _Token::TelemetryTimer));
+
+        int tracer_fd = _tracer->event_fd();
+        if (tracer_fd == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::other("Failed to obtain kernel tracer event descriptor"));
+        }
+
+        SHORT_CIRCUIT(std::monostate, _epoll.add(tracer_fd, EPOLLIN, _Token::TracerEvents));
+        SHORT_CIRCUIT(std::monostate, _sample_timer.arm(_governor.interval(), _governor.interval()));
+        SHORT_CIRCUIT(std::monostate, _telemetry_timer.arm(TELEMETRY_INTERVAL, TELEMETRY_INTERVAL));
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+public:
+    explicit _CTAContext(
+        std::unique_ptr<procmon::Tracer> tracer,
+        uint16_t port,
+        double cpu_budget,
+        procmon::Epoll &&epoll,
+        procmon::SignalFd &&signals,
+        procmon::TimerFd &&sample_timer,
+        procmon::TimerFd &&reconnect_timer,
+        procmon::TimerFd &&connect_deadline,
+        procmon::TimerFd &&telemetry_timer)
+        : _tracer(std::move(tracer)),
+          _port(port),
+          _stream(nullptr),
+          _state(_LinkState::Disconnected),
+          _backoff(RECONNECT_INITIAL_BACKOFF),
+          _rng(std::random_device{}()),
+          _enrich_violations(_enrichment_enabled()),
+          _governor(cpu_budget, SAMPLE_INTERVAL, MAX_SAMPLE_INTERVAL),
+          _epoll(std::move(epoll)),
+          _signals(std::move(signals)),
+          _sample_timer(std::move(sample_timer)),
+          _reconnect_timer(std::move(reconnect_timer)),
+          _connect_deadline(std::move(connect_deadline)),
+          _telemetry_timer(std::move(telemetry_timer)),
+          _outbound_offset(0),
+          _want_writable(false),
+          _agent_id(0),
+          _telemetry_last_events(0),
+          _telemetry_last_cpu_us(_self_cpu_time_us()),
+          _telemetry_last_time(std::chrono::steady_clock::now())
+    {
+        std::random_device device;
+        _agent_id = (static_cast<uint64_t>(device()) << 32) | device();
+    }
+
+    static io::Result<std::unique_ptr<_CTAContext>> connect(uint16_t port)
+    {
+        using clock = std::chrono::steady_clock;
+        auto started = clock::now();
+
+        // Route termination signals to the event loop before any thread (including the tracer's own) is spawned.
+        auto signals = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, procmon::SignalFd::create({SIGINT, SIGTERM}));
+        auto epoll = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, procmon::Epoll::create());
+        auto sample_timer = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, procmon::TimerFd::create());
+        auto reconnect_timer = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, procmon::TimerFd::create());
+        auto connect_deadline = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, procmon::TimerFd::create());
+        auto telemetry_timer = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, procmon::TimerFd::create());
+        auto cpu_budget = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, _cpu_budget());
+
+        // Loading and attaching the eBPF programs is by far the slowest step: do it in the background
+        // while the local configuration is read and /proc is scanned for the processes it targets.
+        clock::duration tracer_time{};
+        auto tracer_task = std::async(
+            std::launch::async,
+            [&tracer_time]()
+            {
+                auto begin = clock::now();
+                auto result = _create_tracer();
+                tracer_time = clock::now() - begin;
+                return result;
+            });
+
+        auto config_begin = clock::now();
+        auto local_config = procmon::load_config();
+        auto config_time = clock::now() - config_begin;
+
+        auto scan_begin = clock::now();
+        std::unordered_set<pid_t> seen;
+        std::vector<std::pair<uint32_t, std::string>> running;
+        if (local_config.is_ok())
+        {
+            std::unordered_set<std::string> commands;
+            for (const auto &entry : local_config.unwrap())
+            {
+                commands.insert(_to_command(entry));
+            }
+
+            running = _scan_processes(commands, nullptr, &seen);
+        }
+        auto scan_time = clock::now() - scan_begin;
+
+        auto tracer = SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, tracer_task.get());
+
+        auto context = std::make_unique<_CTAContext>(
+            std::move(tracer),
+            port,
+            cpu_budget,
+            std::move(epoll),
+            std::move(signals),
+            std::move(sample_timer),
+            std::move(reconnect_timer),
+            std::move(connect_deadline),
+            std::move(telemetry_timer));
+        SHORT_CIRCUIT(std::unique_ptr<_CTAContext>, context->_register_sources());
+
+        auto apply_begin = clock::now();
+        context->_apply_local_config(local_config, running, seen);
+        auto apply_time = clock::now() - apply_begin;
+
+        // The connection is established in the background: sampling and tracing start right away
+        // whether CTB is reachable or not.
+        context->_startup = started;
+        context->_start_connect();
+
+        auto ms = [](clock::duration d)
+        { return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); };
+        std::cerr << "Startup completed in " << ms(clock::now() - started) << "ms (tracer " << ms(tracer_time)
+                  << "ms, in parallel with local configuration " << ms(config_time) << "ms and /proc scan " << ms(scan_time)
+                  << "ms; applying rules " << ms(apply_time) << "ms)" << std::endl;
+
+        return io::Result<std::unique_ptr<_CTAContext>>::ok(std::move(context));
+    }
+
+    void push_violation(
+        procmon::ViolationInfo &&info,
+        procmon::Severity severity,
+        std::shared_ptr<const procmon::ProcessDetails> details = nullptr)
+    {
+        _telemetry.violations_produced.add();
+
+        auto lane = static_cast<size_t>(severity);
+        if (_unacked_count() >= MAX_UNACKED_VIOLATIONS)
+        {
+            // Keep memory bounded while CTB is unreachable: the oldest reports of the least severe
+            // lane are given up first, and a report never displaces a more severe one.
+            size_t victim = 0;
+            while (victim < lane && _lanes[victim].unacked.empty())
+            {
+                victim++;
+            }
+
+            _telemetry.violations_dropped.add();
+            if (auto dropped = _telemetry.violations_dropped.load(); dropped % 1024 == 1)
+            {
+                std::cerr << "Resend window full, dropped " << dropped << " violation(s)" << std::endl;
+            }
+
+            if (_lanes[victim].unacked.empty())
+            {
+                return;
+            }
+
+            _lanes[victim].drop_oldest();
+        }
+
+        _lanes[lane].push(severity, std::move(info), std::move(details));
     }
 
     void set_monitor_targets(const std::vector<procmon::ConfigEntry> &entries)
     {
-        clear_monitor(_tracer);
+        // CTB pushes its configuration on every connection, which is usually the one already in effect.
+        auto fingerprint = procmon::config_fingerprint(entries);
+        if (_config_fingerprint == fingerprint)
+        {
+            std::cerr << "Configuration unchanged (" << std::hex << fingerprint << std::dec << "), skipping" << std::endl;
+            return;
+        }
+
+        auto added = _apply_targets(entries, fingerprint);
+        procmon::save_config(entries);
+        _populate_initial_processes(added);
+    }
+
+    /**
+     * @brief Run the event loop until a termination signal is received.
+     *
+     * Every event source (sampling timer, tracer events, CTB connection, reconnection and connect
+     * deadline timers and signals) is multiplexed in a single `epoll_wait`, so the agent only wakes up when there is work.
+     */
+    int run()
+    {
+        epoll_event events[16];
+        while (!stopped.load())
+        {
+            _flush();
+
+            auto wait = _epoll.wait(std::span<epoll_event>(events, std::size(events)), std::nullopt);
+            if (wait.is_err())
+            {
+                std::cerr << "Event loop failure: " << wait.unwrap_err().message() << std::endl;
+                return 1;
+            }
+
+            for (size_t i = 0; i < wait.unwrap(); i++)
+            {
+                switch (events[i].data.u64)
+                {
+                case _Token::Signal:
+                    _signals.read();
+                    std::cout << "\nShutting down..." << std::endl;
+                    stopped.store(true);
+                    break;
+
+                case _Token::SampleTimer:
+                {
+                    _sample_timer.read();
+
+                    auto begin = std::chrono::steady_clock::now();
+                    _sample_processes();
+                    _telemetry.sample_round_us.set(
+                        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+
+                    if (auto interval = _governor.update())
+                    {
+                        _sample_timer.arm(interval.value(), interval.value());
+                    }
+                    break;
+                }
+
+                case _Token::ReconnectTimer:
+                    _reconnect_timer.read();
+                    _telemetry.reconnects.add();
+                    _start_connect();
+                    break;
+
+                case _Token::TelemetryTimer:
+                    _telemetry_timer.read();
+                    _send_telemetry();
+                    break;
+
+                case _Token::ConnectDeadline:
+                    _handle_connect_deadline();
+                    break;
+
+                case _Token::TracerEvents:
+                    _handle_tracer_events();
+                    break;
+
+                case _Token::Stream:
+                    if (_state == _LinkState::Connecting)
+                    {
+                        _finish_connect();
+                    }
+                    else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    {
+                        _handle_readable();
+                    }
+                    break;
+                }
+            }
+        }
+
+        return 0;
+    }
+};
+
+// Shared by every connection, so that a report resent on a new connection is logged only once.
+static procmon::DeliveryLedger ctb_ledger;
+
+// Heaviest violators of the whole fleet, reported to any connection sending a `TopRequest`.
+static procmon::HeavyHitters ctb_heavy_hitters;
+
+// Live stream of the logged violations, read by the subscribers of every worker.
+static procmon::ViolationFeed ctb_feed;
+
+/**
+ * @brief The configuration served to agents, whose `Config` frame is built once per version and
+ * shared by every connection.
+ */
+class _CTBConfig
+{
+private:
+    std::mutex _mutex;
+    std::shared_ptr<const std::vector<char>> _frame;
+    uint64_t _fingerprint;
+    std::atomic<uint64_t> _version;
+
+public:
+    _CTBConfig() : _fingerprint(0), _version(0) {}
+
+    /**
+     * @brief Serve the validated configuration `content`, whose rules have fingerprint `fingerprint`.
+     *
+     * @return `false` if the rules are the ones already served, which are then kept.
+     */
+    bool update(const std::string &content, uint64_t fingerprint)
+    {
+        auto frame = std::make_shared<std::vector<char>>();
+        procmon::encode_message(*frame, procmon::MessageType::Config, std::span<const char>(content.data(), content.size()));
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_frame != nullptr && _fingerprint == fingerprint)
+        {
+            return false;
+        }
+
+        _frame = std::move(frame);
+        _fingerprint = fingerprint;
+        _version++;
+        return true;
+    }
+
+    /** @brief Version of the configuration, incremented by every `update` which changed it. */
+    uint64_t version() const
+    {
+        return _version.load();
+    }
+
+    std::pair<uint64_t, std::shared_ptr<const std::vector<char>>> current()
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return std::make_pair(_version.load(), _frame);
+    }
+};
+
+static _CTBConfig ctb_config;
+
+/**
+ * @brief Validate `content` and serve it to the agents if its rules changed.
+ *
+ * @return `false` if `content` is invalid.
+ */
+static bool _update_config(const path::PathBuf &config_path, const std::string &content)
+{
+    auto entries = procmon::parse_config(content);
+    if (entries.is_err())
+    {
+        std::cerr << "Invalid configuration in " << config_path << ": " << entries.unwrap_err().message() << std::endl;
+        return false;
+    }
+
+    auto fingerprint = procmon::config_fingerprint(entries.unwrap());
+    if (ctb_config.update(content, fingerprint))
+    {
+        std::cerr << "Serving configuration " << std::hex << fingerprint << std::dec << " (" << entries.unwrap().size() << " rules) from " << config_path << std::endl;
+    }
+    else
+    {
+        std::cerr << "Configuration in " << config_path << " is unchanged" << std::endl;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Reload the configuration whenever its file is written or replaced, until `shutdown` is notified.
+ *
+ * The directory is watched rather than the file, so that editors and tools which replace the file
+ * by renaming a new one over it are followed. Reloads wait for `CONFIG_SETTLE` after the last
+ * change, since a file is often written in several steps.
+ */
+static void _watch_config(const path::PathBuf &config_path, const procmon::EventFd &shutdown)
+{
+    static constexpr uint64_t INOTIFY_TOKEN = 0;
+    static constexpr uint64_t SHUTDOWN_TOKEN = 1;
+    static constexpr std::chrono::milliseconds CONFIG_SETTLE = std::chrono::milliseconds(200);
+
+    auto inotify = procmon::InotifyFd::create();
+    auto epoll = procmon::Epoll::create();
+    if (inotify.is_err() || epoll.is_err())
+    {
+        std::cerr << "Unable to watch the configuration: " << (inotify.is_err() ? inotify.unwrap_err() : epoll.unwrap_err()).message() << std::endl;
+        return;
+    }
+
+    auto directory = config_path.has_parent_path() ? config_path.parent_path() : path::PathBuf(".");
+    auto watch = inotify.unwrap().add_watch(directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    auto add = epoll.unwrap().add(inotify.unwrap().as_raw_fd(), EPOLLIN, INOTIFY_TOKEN);
+    if (watch.is_err() || add.is_err())
+    {
+        std::cerr << "Unable to watch " << directory << ": " << (watch.is_err() ? watch.unwrap_err() : add.unwrap_err()).message() << std::endl;
+        return;
+    }
+
+    // Never read: it stays readable once notified, and wakes up every loop watching it.
+    auto add_shutdown = epoll.unwrap().add(shutdown.as_raw_fd(), EPOLLIN, SHUTDOWN_TOKEN);
+    if (add_shutdown.is_err())
+    {
+        std::cerr << "Unable to watch for shutdown: " << add_shutdown.unwrap_err().message() << std::endl;
+        return;
+    }
+
+    auto filename = config_path.filename().string();
+    // Time of the pending reload, if `reload_pending`.
+    auto due = std::chrono::steady_clock::time_point();
+    bool reload_pending = false;
+    epoll_event event;
+    while (!stopped.load())
+    {
+        std::optional<std::chrono::milliseconds> timeout;
+        if (reload_pending)
+        {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(due - std::chrono::steady_clock::now());
+            timeout = std::max(left, std::chrono::milliseconds(0));
+        }
+
+        auto wait = epoll.unwrap().wait(std::span<epoll_event>(&event, 1), timeout);
+        if (wait.is_err())
+        {
+            std::cerr << "Failed to wait for configuration changes: " << wait.unwrap_err().message() << std::endl;
+            return;
+        }
+
+        if (wait.unwrap() > 0 && event.data.u64 == SHUTDOWN_TOKEN)
+        {
+            return;
+        }
+
+        if (wait.unwrap() > 0)
+        {
+            auto names = inotify.unwrap().read();
+            if (names.is_ok())
+            {
+                // An empty name is a queue overflow: any file may have changed.
+                for (const auto &name : names.unwrap())
+                {
+                    if (name == filename || name.empty())
+                    {
+                        due = std::chrono::steady_clock::now() + CONFIG_SETTLE;
+                        reload_pending = true;
+                    }
+                }
+            }
+        }
+
+        if (reload_pending && std::chrono::steady_clock::now() >= due)
+        {
+            reload_pending = false;
+            auto content = procmon::read_config_file(config_path);
+            if (content.is_err())
+            {
+                std::cerr << "Unable to reload " << config_path << ": " << content.unwrap_err().message() << std::endl;
+                continue;
+            }
+
+            _update_config(config_path, content.unwrap());
+        }
+    }
+}
+
+/**
+ * @brief A connection from an agent or a subscriber, owned by the CTB worker which accepted it.
+ *
+ * The socket is nonblocking and registered edge-triggered, so every readiness notification must be
+ * handled until the socket reports `WouldBlock`, over as many rounds of the worker as it takes.
+ */
+class _CTBConnection
+{
+private:
+    // Acknowledgements are cumulative and only cover the reports synced to disk: send one every
+    // ACK_INTERVAL reports, whenever the socket has been drained, and when the event log syncs.
+    static constexpr size_t ACK_INTERVAL = 64;
+
+    // An agent which stopped reading its acknowledgements is disconnected instead of buffering them forever.
+    static constexpr size_t MAX_OUTBOUND_BYTES = 1024 * 1024;
+
+    // Receive buffers are per connection: keep them small so that thousands of idle agents stay cheap.
+    static constexpr size_t RECEIVE_CHUNK_SIZE = 8 * 1024;
+
+    // Bound on the reads per wakeup, so that an agent which never lets its socket drain does not
+    // starve the other connections (and the subscribers) of its worker.
+    static constexpr size_t READ_BATCH = 32;
+
+    // Violations are copied out of the feed only as fast as a subscriber reads them: the rest waits
+    // in the feed, where a subscriber which is too slow finds them overwritten. Stays well below
+    // `MAX_OUTBOUND_BYTES`.
+    static constexpr size_t SUBSCRIBER_BUFFER_BYTES = 256 * 1024;
+
+    procmon::EventLog &_log;
+    std::string _peer;
+    procmon::FrameDecoder _decoder;
+    std::optional<uint64_t> _agent_id;
+    size_t _unacked;
+    // Highest sequence number received (logged or not) and last acknowledged, in every lane.
+    procmon::AckMessage _received;
+    procmon::AckMessage _acked;
+    std::vector<char> _outbound;
+    size_t _outbound_offset;
+    size_t _feed_listener;
+    std::optional<procmon::SubscribeMessage> _subscription;
+    uint64_t _cursor;
+    bool _backlogged;
+    uint64_t _config_version;
+
+    static std::string _format_addr(const net::SocketAddr &addr)
+    {
+        std::ostringstream text;
+        text << addr;
+        return text.str();
+    }
+
+    /** @brief Queue an acknowledgement of what is durable, unless the agent already has it and `force` is `false`. */
+    void _queue_ack(bool force = false)
+    {
+        _unacked = 0;
+        auto durable = ctb_ledger.durable(_agent_id.value());
+        if (!force && std::memcmp(&durable, &_acked, sizeof(durable)) == 0)
+        {
+            return;
+        }
+
+        procmon::encode_message(_outbound, procmon::MessageType::Ack, durable);
+        _acked = durable;
+    }
+
+    /**
+     * @brief Handle a single frame.
+     *
+     * @return `false` if the connection must be closed.
+     */
+    bool _handle_frame(std::span<const char> payload)
+    {
+        auto decoded = procmon::decode_message(payload);
+        if (!decoded.has_value())
+        {
+            std::cerr << "Received malformed payload from " << addr << " (" << payload.size() << " bytes)" << std::endl;
+            return false;
+        }
+
+        auto [type, body] = decoded.value();
+        if (type == procmon::MessageType::Hello)
+        {
+            auto hello = procmon::message_as<procmon::HelloMessage>(body);
+            if (!hello.has_value())
+            {
+                std::cerr << "Received malformed handshake from " << addr << std::endl;
+                return false;
+            }
+
+            if (_agent_id.has_value())
+            {
+                ctb_ledger.disconnect(_agent_id.value());
+            }
+
+            _agent_id = hello->agent_id;
+            ctb_ledger.connect(_agent_id.value());
+            _received = {};
+            _queue_ack(true);
+            return true;
+        }
+
+        if (type == procmon::MessageType::ConfigApplied)
+        {
+            auto applied = procmon::message_as<procmon::ConfigAppliedMessage>(body);
+            if (!applied.has_value())
+            {
+                std::cerr << "Received malformed configuration report from " << addr << std::endl;
+                return false;
+            }
+
+            std::cerr << addr << " is running configuration " << std::hex << applied->fingerprint << std::dec << std::endl;
+            return true;
+        }
+
+        if (type == procmon::MessageType::Telemetry)
+        {
+            auto telemetry = procmon::message_as<procmon::TelemetryMessage>(body);
+            if (!telemetry.has_value())
+            {
+                std::cerr << "Received malformed telemetry from " << addr << std::endl;
+                return false;
+            }
+
+            _log.append(
+                [&](procmon::EventRecord &record)
+                { procmon::format_telemetry(record, _peer, telemetry.value()); });
+            return true;
+        }
+
+        if (type == procmon::MessageType::Subscribe)
+        {
+            auto subscription = procmon::message_as<procmon::SubscribeMessage>(body);
+            if (!subscription.has_value())
+            {
+                std::cerr << "Received malformed subscription from " << addr << std::endl;
+                return false;
+            }
+
+            // A new filter applies from the next violation on.
+            if (!_subscription.has_value())
+            {
+                ctb_feed.subscribe(_feed_listener);
+                std::cerr << addr << " subscribed to the violation stream" << std::endl;
+            }
+
+            _subscription = subscription.value();
+            _cursor = ctb_feed.head();
+            return true;
+        }
+
+        if (type == procmon::MessageType::TopRequest)
+        {
+            auto request = procmon::message_as<procmon::TopRequestMessage>(body);
+            if (!request.has_value() ||
+                static_cast<size_t>(request->key) >= procmon::HEAVY_HITTER_KEY_COUNT ||
+                static_cast<size_t>(request->window) >= procmon::HEAVY_HITTER_WINDOW_COUNT)
+            {
+                std::cerr << "Received malformed top request from " << addr << std::endl;
+                return false;
+            }
+
+            auto top = ctb_heavy_hitters.top(request->key, request->window, request->count, _epoch_ms());
+            request->count = static_cast<uint32_t>(top.size());
+
+            std::vector<char> report(reinterpret_cast<const char *>(&request.value()), reinterpret_cast<const char *>(&request.value()) + sizeof(request.value()));
+            report.insert(report.end(), reinterpret_cast<const char *>(top.data()), reinterpret_cast<const char *>(top.data() + top.size()));
+            procmon::encode_message(_outbound, procmon::MessageType::TopReport, std::span<const char>(report.data(), report.size()));
+            return true;
+        }
+
+        auto decoded_violation = type == procmon::MessageType::Violation ? procmon::decode_violation(body) : std::nullopt;
+        if (!decoded_violation.has_value() || !_agent_id.has_value())
+        {
+            std::cerr << "Received malformed payload from " << addr << " (" << payload.size() << " bytes)" << std::endl;
+            return false;
+        }
+
+        const auto &[violation, details] = decoded_violation.value();
+        auto lane = static_cast<size_t>(violation.severity);
+        if (lane < procmon::SEVERITY_COUNT)
+        {
+            _received.sequences[lane] = std::max(_received.sequences[lane], violation.sequence);
+        }
+
+        if (ctb_ledger.record(_agent_id.value(), violation.severity, violation.sequence))
+        {
+            auto now = _epoch_ms();
+            ctb_heavy_hitters.record(_agent_id.value(), violation, now);
+            ctb_feed.publish(now, _agent_id.value(), violation, body);
+            _log.append(
+                [&](procmon::EventRecord &record)
+                {
+                    procmon::format_violation(record, _peer, violation, details);
+                    record.deliver(ctb_ledger, _agent_id.value(), violation.severity, violation.sequence);
+                    record.store(
+                        [&](std::string &stored)
+                        { procmon::EventSegment::encode(stored, now, _agent_id.value(), body); });
+                });
+        }
+
+        if (++_unacked >= ACK_INTERVAL)
+        {
+            _queue_ack();
+        }
+
+        return true;
+    }
+
+public:
+    net::TcpStream stream;
+    net::SocketAddr addr;
+
+    explicit _CTBConnection(
+        net::TcpStream &&stream,
+        net::SocketAddr &&addr,
+        uint64_t config_version,
+        const std::vector<char> &config_frame,
+        procmon::EventLog &log,
+        size_t feed_listener)
+        : _log(log),
+          _peer(_format_addr(addr)),
+          _decoder(procmon::FrameDecoder::DEFAULT_MAX_FRAME_SIZE, RECEIVE_CHUNK_SIZE),
+          _unacked(0),
+          _received{},
+          _acked{},
+          _outbound(config_frame),
+          _outbound_offset(0),
+          _feed_listener(feed_listener),
+          _cursor(0),
+          _backlogged(false),
+          _config_version(config_version),
+          stream(std::move(stream)),
+          addr(std::move(addr))
+    {
+    }
+
+    ~_CTBConnection()
+    {
+        if (_subscription.has_value())
+        {
+            ctb_feed.unsubscribe(_feed_listener);
+        }
+
+        if (_agent_id.has_value())
+        {
+            ctb_ledger.disconnect(_agent_id.value());
+        }
+    }
+
+    bool subscribed() const
+    {
+        return _subscription.has_value();
+    }
+
+    /** @brief Whether the last `on_readable` stopped before the socket reported `WouldBlock`. */
+    bool backlogged() const
+    {
+        return _backlogged;
+    }
+
+    /** @brief Whether some reports received were not acknowledged yet, waiting for the event log to sync them. */
+    bool awaiting_ack() const
+    {
+        for (size_t lane = 0; lane < procmon::SEVERITY_COUNT; lane++)
+        {
+            if (_acked.sequences[lane] < _received.sequences[lane])
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Acknowledge the reports which became durable since the last acknowledgement.
+     *
+     * @return `false` if the connection must be closed.
+     */
+    bool ack_durable()
+    {
+        _queue_ack();
+        return flush();
+    }
+
+    /**
+     * @brief Send configuration `version`, whose `Config` frame is `frame`, unless the connection
+     * already got it. Subscribers do not need it.
+     *
+     * @return `false` if the connection must be closed.
+     */
+    bool push_config(uint64_t version, const std::vector<char> &frame)
+    {
+        if (_config_version >= version || _subscription.has_value())
+        {
+            return true;
+        }
+
+        _config_version = version;
+        _outbound.insert(_outbound.end(), frame.begin(), frame.end());
+        return flush();
+    }
+
+    /**
+     * @brief Read and handle every frame available on the socket, up to `READ_BATCH` reads, then
+     * acknowledge what was received.
+     *
+     * @return `false` if the connection must be closed.
+     */
+    bool on_readable()
+    {
+        _backlogged = true;
+        for (size_t i = 0; i < READ_BATCH; i++)
+        {
+            auto read = _decoder.fill(stream);
+            if (read.is_err())
+            {
+                auto &err = read.unwrap_err();
+                if (err.kind() == io::ErrorKind::WouldBlock)
+                {
+                    _backlogged = false;
+                    break;
+                }
+
+                if (err.kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
+
+                std::cerr << "Unable to receive messages from " << addr << ": " << err.message() << std::endl;
+                return false;
+            }
+
+            if (read.unwrap() == 0)
+            {
+                std::cerr << "Connection closed by " << addr << std::endl;
+                return false;
+            }
+
+            while (true)
+            {
+                auto frame = _decoder.next();
+                if (frame.is_err())
+                {
+                    std::cerr << "Unable to receive messages from " << addr << ": " << frame.unwrap_err().message() << std::endl;
+                    return false;
+                }
+
+                auto payload = frame.unwrap();
+                if (!payload.has_value())
+                {
+                    break;
+                }
+
+                if (!_handle_frame(payload.value()))
+                {
+                    return false;
+                }
+            }
+        }
+
+        // The agent is waiting for the rest of its window to be acknowledged.
+        if (_unacked > 0)
+        {
+            _queue_ack();
+        }
+
+        return pump();
+    }
+
+    /**
+     * @brief Write queued frames until the socket would block, then for a subscriber, queue and write
+     * the violations published since the last call as long as the socket takes them.
+     *
+     * @return `false` if the connection must be closed.
+     */
+    bool pump()
+    {
+        if (!flush())
+        {
+            return false;
+        }
 
+        // A subscriber is refilled only once its previous batch is written, at the next EPOLLOUT edge.
+        while (_subscription.has_value() && _outbound.empty())
         {
-            std::lock_guard<std::mutex> guard(_monitored_mutex);
-            _target_thresholds.clear();
-            _monitored_pids.clear();
-            for (const auto &entry : entries)
+            if (!ctb_feed.read(_cursor, _subscription.value(), _outbound, SUBSCRIBER_BUFFER_BYTES))
+            {
+                if (!(_subscription->flags & procmon::SUBSCRIBE_SKIP_AHEAD))
+                {
+                    std::cerr << addr << " fell behind the violation stream, disconnecting" << std::endl;
+                    return false;
+                }
+
+                auto head = ctb_feed.head();
+                std::cerr << addr << " fell behind the violation stream, skipping " << head - _cursor << " violations" << std::endl;
+                procmon::encode_message(_outbound, procmon::MessageType::StreamGap, procmon::StreamGapMessage{head - _cursor});
+                _cursor = head;
+                continue;
+            }
+
+            if (_outbound.empty())
+            {
+                break;
+            }
+
+            auto caught_up = _outbound.size() < SUBSCRIBER_BUFFER_BYTES;
+            if (!flush())
+            {
+                return false;
+            }
+
+            if (caught_up)
             {
-                auto target = reinterpret_cast<const char *>(entry.name);
-                set_monitor(_tracer, target, &entry.threshold);
-                _target_thresholds[_to_command(entry)] = entry.threshold;
+                break;
             }
         }
 
-        procmon::save_config(entries);
-        _populate_initial_processes(entries);
+        return true;
     }
 
-    std::optional<procmon::ViolationInfo> next_violation()
+    /**
+     * @brief Write queued frames until the socket would block.
+     *
+     * @return `false` if the connection must be closed.
+     */
+    bool flush()
     {
-        std::unique_lock<std::mutex> lock(_queue_mutex);
-        while (!stopped.load() && _queue.empty())
+        while (_outbound_offset < _outbound.size())
         {
-            _queue_cv.wait_for(lock, std::chrono::seconds(1));
-        }
+            auto written = stream.write(std::span<const char>(_outbound.data() + _outbound_offset, _outbound.size() - _outbound_offset));
+            if (written.is_err())
+            {
+                auto &err = written.unwrap_err();
+                if (err.kind() == io::ErrorKind::WouldBlock)
+                {
+                    // The rest is written on the next EPOLLOUT edge.
+                    if (_outbound.size() - _outbound_offset > MAX_OUTBOUND_BYTES)
+                    {
+                        std::cerr << addr << " is not reading its acknowledgements, disconnecting" << std::endl;
+                        return false;
+                    }
 
-        if (stopped.load())
-        {
-            return std::nullopt;
+                    return true;
+                }
+
+                if (err.kind() == io::ErrorKind::Interrupted)
+                {
+                    continue;
+                }
+
+                std::cerr << "Unable to send messages to " << addr << ": " << err.message() << std::endl;
+                return false;
+            }
+
+            _outbound_offset += written.unwrap();
         }
 
-        auto info = _queue.front();
-        _queue.pop_front();
-        return info;
+        _outbound.clear();
+        _outbound_offset = 0;
+        return true;
     }
 };
 
-class _CTBContext
+/**
+ * @brief An event loop serving a share of the CTB connections.
+ *
+ * Every worker accepts from its own listener, all of them bound to the CTB port with `SO_REUSEPORT`:
+ * the kernel spreads new connections (and their accept backlog) over the workers, and a connection is
+ * owned by the worker which accepted it until it is closed.
+ */
+class _CTBWorker : public procmon::DeliveryListener
 {
-public:
-    std::unique_ptr<net::TcpStream> stream;
-    net::SocketAddr addr;
+private:
+    static constexpr uint64_t LISTENER_TOKEN = 0;
+    static constexpr uint64_t FEED_TOKEN = 1;
+    static constexpr uint64_t ACK_TOKEN = 2;
+    static constexpr uint64_t SIGNAL_TOKEN = 3;
+    static constexpr uint64_t SHUTDOWN_TOKEN = 4;
+
+    // Bound on the accepts per wakeup, so that a connection storm does not starve established agents.
+    static constexpr size_t ACCEPT_BATCH = 64;
+
+    // Delay before a listener paused for lack of descriptors is watched again, unless one of its connections closes first.
+    static constexpr std::chrono::milliseconds ACCEPT_RETRY_INTERVAL = std::chrono::milliseconds(500);
+
+    // A new configuration is pushed to `CONFIG_PUSH_BATCH` connections every `CONFIG_PUSH_INTERVAL`
+    // (800 per second and per worker), so that a large fleet does not reapply it all at once.
+    static constexpr size_t CONFIG_PUSH_BATCH = 16;
+    static constexpr std::chrono::milliseconds CONFIG_PUSH_INTERVAL = std::chrono::milliseconds(20);
+
+    const net::TcpListener &_listener;
+    procmon::EventLog &_log;
+    procmon::Epoll _epoll;
+    procmon::EventFd _feed_event;
+    size_t _feed_listener;
+    // Notified by the event log writer whenever it synced reports.
+    procmon::EventFd _ack_event;
+    // Shared by all the workers: the first one to read a termination signal notifies `_shutdown`,
+    // which wakes up the others.
+    const procmon::SignalFd &_signals;
+    const procmon::EventFd &_shutdown;
+    uint64_t _next_token;
+    std::unordered_map<uint64_t, std::unique_ptr<_CTBConnection>> _connections;
+    std::unordered_set<uint64_t> _subscribers;
+    // Connections which still had data to read when their last `READ_BATCH` ran out.
+    std::unordered_set<uint64_t> _backlog;
+    uint64_t _config_version;
+    // Connections which may still run an older configuration than `_config_version`.
+    std::deque<uint64_t> _config_pending;
+    // Connections with reports waiting to be synced before they are acknowledged.
+    std::unordered_set<uint64_t> _awaiting_ack;
+    std::chrono::steady_clock::time_point _next_config_push;
+    // Set while the listener is out of the epoll set after an accept failure (e.g. `EMFILE`): the level-triggered
+    // listener would otherwise be reported again immediately, spinning until a descriptor is freed.
+    std::optional<std::chrono::steady_clock::time_point> _accept_resume;
+
+    explicit _CTBWorker(
+        const net::TcpListener &listener,
+        procmon::EventLog &log,
+        procmon::Epoll &&epoll,
+        procmon::EventFd &&feed_event,
+        procmon::EventFd &&ack_event,
+        const procmon::SignalFd &signals,
+        const procmon::EventFd &shutdown)
+        : _listener(listener),
+          _log(log),
+          _epoll(std::move(epoll)),
+          _feed_event(std::move(feed_event)),
+          _feed_listener(ctb_feed.add_listener(_feed_event)),
+          _ack_event(std::move(ack_event)),
+          _signals(signals),
+          _shutdown(shutdown),
+          _next_token(SHUTDOWN_TOKEN + 1),
+          _config_version(ctb_config.version())
+    {
+        ctb_ledger.add_listener(*this);
+    }
 
-    explicit _CTBContext(
-        std::unique_ptr<net::TcpStream> stream,
-        net::SocketAddr &&addr,
-        const std::string &json_config)
-        : stream(std::move(stream)), addr(std::move(addr))
+    void _accept()
+    {
+        for (size_t i = 0; i < ACCEPT_BATCH; i++)
+        {
+            auto client = _listener.accept();
+            if (client.is_err())
+            {
+                auto &err = client.unwrap_err();
+                if (err.kind() == io::ErrorKind::Interrupted || err.kind() == io::ErrorKind::ConnectionAborted)
+                {
+                    continue;
+                }
+
+                if (err.kind() != io::ErrorKind::WouldBlock)
+                {
+                    std::cerr << "Listener accept error, pausing accepts: " << err.message() << std::endl;
+                    _pause_accept();
+                }
+
+                return;
+            }
+
+            auto pair = std::move(client).into_ok();
+            std::cerr << "Accepted new client connection from " << pair.second << std::endl;
+
+            auto [config_version, config_frame] = ctb_config.current();
+            auto connection = std::make_unique<_CTBConnection>(std::move(pair.first), std::move(pair.second), config_version, *config_frame, _log, _feed_listener);
+            connection->stream.set_nonblocking(true);
+            connection->stream.set_nodelay(true);
+
+            auto token = _next_token++;
+            auto add = _epoll.add(connection->stream.as_raw_fd(), EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, token);
+            if (add.is_err())
+            {
+                std::cerr << "Unable to watch connection from " << connection->addr << ": " << add.unwrap_err().message() << std::endl;
+                continue;
+            }
+
+            std::cerr << "Sending initial configuration to " << connection->addr << std::endl;
+            if (!connection->flush())
+            {
+                _epoll.remove(connection->stream.as_raw_fd());
+                continue;
+            }
+
+            _connections.emplace(token, std::move(connection));
+        }
+    }
+
+    void _pause_accept()
     {
-        std::cerr << "Sending initial configuration to " << this->addr << std::endl;
+        auto removed = _epoll.remove(_listener.as_raw_fd());
+        if (removed.is_err())
+        {
+            std::cerr << "Unable to pause the listener: " << removed.unwrap_err().message() << std::endl;
+        }
 
-        auto timeout = std::chrono::milliseconds(1000);
-        this->stream->set_read_timeout(timeout);
-        this->stream->set_write_timeout(timeout);
+        _accept_resume = std::chrono::steady_clock::now() + ACCEPT_RETRY_INTERVAL;
+    }
 
-        uint32_t length = static_cast<uint32_t>(json_config.size());
-        auto send1 = this->stream->write(std::span<const char>(reinterpret_cast<const char *>(&length), sizeof(length)));
-        if (send1.is_err())
+    void _resume_accept()
+    {
+        if (!_accept_resume.has_value())
         {
-            std::cerr << "Failed to send initial configuration to " << this->addr << ": " << send1.unwrap_err().message() << std::endl;
+            return;
         }
-        else
+
+        auto added = _epoll.add(_listener.as_raw_fd(), EPOLLIN, LISTENER_TOKEN);
+        if (added.is_err())
+        {
+            std::cerr << "Unable to resume the listener: " << added.unwrap_err().message() << std::endl;
+            _accept_resume = std::chrono::steady_clock::now() + ACCEPT_RETRY_INTERVAL;
+            return;
+        }
+
+        _accept_resume.reset();
+    }
+
+    void _close(std::unordered_map<uint64_t, std::unique_ptr<_CTBConnection>>::iterator it)
+    {
+        _epoll.remove(it->second->stream.as_raw_fd());
+        _subscribers.erase(it->first);
+        _backlog.erase(it->first);
+        _awaiting_ack.erase(it->first);
+        _connections.erase(it);
+
+        // A descriptor was freed: try accepting again.
+        _resume_accept();
+    }
+
+    /** @return `false` if the connection must be closed. */
+    bool _on_readable(std::unordered_map<uint64_t, std::unique_ptr<_CTBConnection>>::iterator it)
+    {
+        if (!it->second->on_readable())
+        {
+            return false;
+        }
+
+        if (it->second->subscribed())
+        {
+            _subscribers.insert(it->first);
+        }
+
+        if (it->second->backlogged())
+        {
+            _backlog.insert(it->first);
+        }
+
+        if (it->second->awaiting_ack())
         {
-            auto send2 = this->stream->write(std::span<const char>(json_config.data(), json_config.size()));
-            if (send2.is_err())
+            _awaiting_ack.insert(it->first);
+        }
+
+        return true;
+    }
+
+    /** @brief Acknowledge the reports which the event log synced since the last notification. */
+    void _on_durable()
+    {
+        _ack_event.read();
+        for (auto token = _awaiting_ack.begin(); token != _awaiting_ack.end();)
+        {
+            auto it = _connections.find(*token);
+            if (it == _connections.end())
+            {
+                token = _awaiting_ack.erase(token);
+                continue;
+            }
+
+            ++token;
+            auto alive = it->second->ack_durable();
+            auto awaiting = alive && it->second->awaiting_ack();
+            if (!alive)
+            {
+                _close(it);
+            }
+            else if (!awaiting)
             {
-                std::cerr << "Failed to send initial configuration to " << this->addr << ": " << send2.unwrap_err().message() << std::endl;
+                _awaiting_ack.erase(it->first);
             }
         }
     }
-};
 
-static void ctb_serve(std::unique_ptr<_CTBContext> ctx)
-{
-    while (!stopped.load())
+    /** @brief Stop every worker and the configuration watcher on a termination signal. */
+    void _on_signal()
+    {
+        // Every worker is woken up by the signal, but only one of them reads it.
+        if (_signals.read().is_err())
+        {
+            return;
+        }
+
+        std::cout << "\nShutting down..." << std::endl;
+        stopped.store(true);
+        auto notified = _shutdown.notify();
+        if (notified.is_err())
+        {
+            std::cerr << "Unable to wake up the workers for the shutdown: " << notified.unwrap_err().message() << std::endl;
+        }
+    }
+
+    /** @brief Queue every connection for the configuration pushes if a new one is served. */
+    void _poll_config()
+    {
+        auto version = ctb_config.version();
+        if (version == _config_version)
+        {
+            return;
+        }
+
+        // Connections still waiting for the previous version skip it and get this one.
+        _config_version = version;
+        _config_pending.clear();
+        for (const auto &[token, connection] : _connections)
+        {
+            _config_pending.push_back(token);
+        }
+    }
+
+    void _push_config()
     {
-        auto message = procmon::read_message(*ctx->stream);
-        if (message.is_ok())
+        auto now = std::chrono::steady_clock::now();
+        if (_config_pending.empty() || now < _next_config_push)
+        {
+            return;
+        }
+
+        _next_config_push = now + CONFIG_PUSH_INTERVAL;
+        auto [version, frame] = ctb_config.current();
+        for (size_t i = 0; i < CONFIG_PUSH_BATCH && !_config_pending.empty(); i++)
         {
-            auto payload = std::move(message).into_ok();
-            if (payload.size() != sizeof(procmon::ViolationInfo))
+            auto it = _connections.find(_config_pending.front());
+            _config_pending.pop_front();
+            if (it != _connections.end() && !it->second->push_config(version, *frame))
             {
-                std::cerr << "Received malformed payload from " << ctx->addr << " (" << payload.size() << " bytes)" << std::endl;
-                break;
+                _close(it);
             }
+        }
+    }
 
-            auto info = reinterpret_cast<procmon::ViolationInfo *>(payload.data());
-            std::cout << "Received violation from " << ctx->addr << ": PID=" << info->pid
-                      << ", Process=" << info->name
-                      << ", Metric=" << static_cast<int>(info->violation.metric)
-                      << ", Value=" << info->violation.value
-                      << ", Threshold=" << info->violation.threshold
-                      << std::endl;
+    /** @brief Hand the newly published violations to the subscribers of this worker. */
+    void _on_feed()
+    {
+        _feed_event.read();
+        ctb_feed.rearm(_feed_listener);
+
+        for (auto token = _subscribers.begin(); token != _subscribers.end();)
+        {
+            auto it = _connections.find(*token++);
+            if (it != _connections.end() && !it->second->pump())
+            {
+                _close(it);
+            }
         }
-        else
+    }
+
+public:
+    static io::Result<std::unique_ptr<_CTBWorker>> create(
+        const net::TcpListener &listener,
+        procmon::EventLog &log,
+        const procmon::SignalFd &signals,
+        const procmon::EventFd &shutdown)
+    {
+        auto epoll = SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, procmon::Epoll::create());
+        SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, epoll.add(listener.as_raw_fd(), EPOLLIN, LISTENER_TOKEN));
+
+        auto feed_event = SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, procmon::EventFd::create());
+        SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, epoll.add(feed_event.as_raw_fd(), EPOLLIN, FEED_TOKEN));
+
+        auto ack_event = SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, procmon::EventFd::create());
+        SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, epoll.add(ack_event.as_raw_fd(), EPOLLIN, ACK_TOKEN));
+        SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, epoll.add(signals.as_raw_fd(), EPOLLIN, SIGNAL_TOKEN));
+        SHORT_CIRCUIT(std::unique_ptr<_CTBWorker>, epoll.add(shutdown.as_raw_fd(), EPOLLIN, SHUTDOWN_TOKEN));
+        return io::Result<std::unique_ptr<_CTBWorker>>::ok(std::unique_ptr<_CTBWorker>(
+            new _CTBWorker(listener, log, std::move(epoll), std::move(feed_event), std::move(ack_event), signals, shutdown)));
+    }
+
+    ~_CTBWorker()
+    {
+        // The event log writer outlives the workers.
+        ctb_ledger.remove_listener(*this);
+    }
+
+    void on_durable() override
+    {
+        auto notified = _ack_event.notify();
+        if (notified.is_err())
+        {
+            std::cerr << "Unable to wake up a worker for acknowledgements: " << notified.unwrap_err().message() << std::endl;
+        }
+    }
+
+    void run()
+    {
+        epoll_event events[64];
+        while (!stopped.load())
         {
-            auto &err = message.unwrap_err();
-            if (err.kind() == io::ErrorKind::WouldBlock || err.kind() == io::ErrorKind::TimedOut || err.kind() == io::ErrorKind::Interrupted)
+            _poll_config();
+
+            // Edge-triggered sockets with a backlog are not reported again: only poll for other events.
+            // Otherwise, sleep until an event or the next deadline.
+            std::optional<std::chrono::milliseconds> timeout;
+            if (!_backlog.empty())
+            {
+                timeout = std::chrono::milliseconds(0);
+            }
+            auto wake_by = [&timeout](std::chrono::steady_clock::time_point deadline)
+            {
+                auto left = std::max(std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()), std::chrono::milliseconds(0));
+                timeout = std::min(left, timeout.value_or(left));
+            };
+            if (!_config_pending.empty())
+            {
+                wake_by(_next_config_push);
+            }
+            if (_accept_resume.has_value())
+            {
+                wake_by(*_accept_resume);
+            }
+            auto wait = _epoll.wait(std::span<epoll_event>(events, std::size(events)), timeout);
+            if (wait.is_err())
             {
-                if (stopped.load())
+                std::cerr << "Failed to wait for events: " << wait.unwrap_err().message() << std::endl;
+                return;
+            }
+
+            auto count = wait.unwrap();
+            for (size_t i = 0; i < count; i++)
+            {
+                if (events[i].data.u64 == LISTENER_TOKEN)
                 {
-                    break;
+                    _accept();
+                    continue;
+                }
+
+                if (events[i].data.u64 == FEED_TOKEN)
+                {
+                    _on_feed();
+                    continue;
+                }
+
+                if (events[i].data.u64 == ACK_TOKEN)
+                {
+                    _on_durable();
+                    continue;
+                }
+
+                if (events[i].data.u64 == SIGNAL_TOKEN)
+                {
+                    _on_signal();
+                    continue;
+                }
+
+                // Handled by the check of `stopped`, which is set before `_shutdown` is notified.
+                if (events[i].data.u64 == SHUTDOWN_TOKEN)
+                {
+                    continue;
+                }
+
+                auto it = _connections.find(events[i].data.u64);
+                if (it == _connections.end())
+                {
+                    continue;
+                }
+
+                bool alive = true;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    _backlog.erase(it->first);
+                    alive = _on_readable(it);
+                }
+
+                if (alive && (events[i].events & EPOLLOUT))
+                {
+                    alive = it->second->pump();
+                }
+
+                if (!alive)
+                {
+                    _close(it);
                 }
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
             }
 
-            std::cerr << "Unable to receive messages from " << ctx->addr << ": " << err.message() << std::endl;
-            break;
+            // One more batch for every connection left with a backlog, after the other events had their turn.
+            auto backlog = std::move(_backlog);
+            _backlog.clear();
+            for (auto token : backlog)
+            {
+                auto it = _connections.find(token);
+                if (it != _connections.end() && !_on_readable(it))
+                {
+                    _close(it);
+                }
+            }
+
+            _push_config();
+
+            if (_accept_resume.has_value() && std::chrono::steady_clock::now() >= *_accept_resume)
+            {
+                _resume_accept();
+            }
         }
     }
-}
-
-void initialize()
-{
-    signal(SIGINT, _ctrl_handler);
-    signal(SIGTERM, _ctrl_handler);
-}
+};
 
 namespace procmon
 {
     int cta_loop(uint16_t port)
     {
         initialize_logger(3);
-        initialize();
 
         auto context_result = _CTAContext::connect(port);
         if (context_result.is_err())
@@ -779,50 +2696,93 @@ namespace procmon
         }
 
         auto context = std::move(context_result).into_ok();
+        return context->run();
+    }
 
-        while (!stopped.load())
+    int ctb_loop(net::TcpListener &listener, const path::PathBuf &config_path, const std::string &json_config, EventLog &log)
+    {
+        // The signals were blocked in every thread by `main`, before the event log was opened.
+        auto signals = procmon::SignalFd::create({SIGINT, SIGTERM});
+        auto shutdown = procmon::EventFd::create();
+        if (signals.is_err() || shutdown.is_err())
+        {
+            std::cerr << "Failed to set up the shutdown: " << (signals.is_err() ? signals.unwrap_err() : shutdown.unwrap_err()).message() << std::endl;
+            return 1;
+        }
+
+        // Every agent connection needs a descriptor: the default soft limit (often 1024) is far below the hard one.
+        struct rlimit limit = {};
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
         {
-            auto event = context->next_violation();
-            if (event.has_value())
+            limit.rlim_cur = limit.rlim_max;
+            if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
             {
-                auto &violation = event.value();
-                if (context->write_message(std::span<const char>(reinterpret_cast<const char *>(&violation), sizeof(violation))).is_err())
-                {
-                    context->reconnect();
-                }
+                std::cerr << "Unable to raise the open file limit: " << io::Error::last_os_error().message() << std::endl;
             }
         }
+        if (!_update_config(config_path, json_config))
+        {
+            return 1;
+        }
 
-        return 0;
-    }
+        auto address = listener.local_addr();
+        if (address.is_err())
+        {
+            std::cerr << "Failed to query listener address: " << address.unwrap_err().message() << std::endl;
+            return 1;
+        }
 
-    int ctb_loop(net::TcpListener &listener, const std::string &json_config)
-    {
-        initialize();
-        listener.set_nonblocking(true);
-        while (!stopped.load())
+        // One event loop per core, each with its own listener in the SO_REUSEPORT group of `listener`.
+        // The calling thread runs the first one.
+        auto count = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<net::TcpListener> listeners;
+        listeners.reserve(count - 1);
+        for (unsigned i = 1; i < count; i++)
         {
-            auto client = listener.accept();
-            if (client.is_ok())
+            auto extra = net::TcpListener::bind_reuse_port(address.unwrap());
+            if (extra.is_err())
             {
-                std::cerr << "Accepted new client connection" << std::endl;
-                auto pair = std::move(client).into_ok();
-                auto stream = std::make_unique<net::TcpStream>(std::move(pair.first));
-                auto ctx = std::make_unique<_CTBContext>(std::move(stream), std::move(pair.second), json_config);
-                std::thread(ctb_serve, std::move(ctx)).detach();
+                std::cerr << "Failed to bind worker listener: " << extra.unwrap_err().message() << std::endl;
+                return 1;
             }
-            else
+
+            listeners.push_back(std::move(extra).into_ok());
+        }
+
+        std::vector<std::unique_ptr<_CTBWorker>> workers;
+        for (unsigned i = 0; i < count; i++)
+        {
+            const auto &worker_listener = i == 0 ? listener : listeners[i - 1];
+            auto nonblocking = worker_listener.set_nonblocking(true);
+            if (nonblocking.is_err())
             {
-                auto &err = client.unwrap_err();
-                if (err.kind() == io::ErrorKind::WouldBlock)
-                {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-                    continue;
-                }
+                std::cerr << "Failed to configure listener: " << nonblocking.unwrap_err().message() << std::endl;
+                return 1;
+            }
 
-                std::cerr << "Listener accept error: " << err.message() << std::endl;
-                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            auto worker = _CTBWorker::create(worker_listener, log, signals.unwrap(), shutdown.unwrap());
+            if (worker.is_err())
+            {
+                std::cerr << "Failed to initialize worker: " << worker.unwrap_err().message() << std::endl;
+                return 1;
             }
+
+            workers.push_back(std::move(worker).into_ok());
+        }
+
+        std::cerr << "Serving agents with " << workers.size() << " worker(s)" << std::endl;
+
+        std::vector<std::thread> threads;
+        threads.emplace_back(_watch_config, config_path, std::cref(shutdown.unwrap()));
+        for (size_t i = 1; i < workers.size(); i++)
+        {
+            threads.emplace_back(&_CTBWorker::run, workers[i].get());
+        }
+
+        workers[0]->run();
+        for (auto &thread : threads)
+        {
+            thread.join();
         }
 
         return 0;
@@ -0,0 +1,172 @@
+#include "violation_feed.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace procmon
+{
+    ViolationFeed::ViolationFeed(size_t capacity, size_t capacity_bytes)
+        : _slots(capacity), _bytes(capacity_bytes), _head(0), _bytes_head(0), _subscribers(0)
+    {
+    }
+
+    bool ViolationFeed::_matches(const _Entry &entry, const SubscribeMessage &filter)
+    {
+        return (filter.agent_id == 0 || filter.agent_id == entry.agent_id) &&
+               (filter.name[0] == 0 || std::memcmp(filter.name, entry.name, sizeof(entry.name)) == 0) &&
+               (filter.metrics == 0 || (entry.metric < 32 && (filter.metrics & (1u << entry.metric))));
+    }
+
+    size_t ViolationFeed::add_listener(const EventFd &event)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        auto listener = std::make_unique<_Listener>();
+        listener->event = &event;
+        _listeners.push_back(std::move(listener));
+        return _listeners.size() - 1;
+    }
+
+    void ViolationFeed::subscribe(size_t listener)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _listeners[listener]->subscribers++;
+        _subscribers++;
+    }
+
+    void ViolationFeed::unsubscribe(size_t listener)
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _listeners[listener]->subscribers--;
+        _subscribers--;
+    }
+
+    void ViolationFeed::rearm(size_t listener)
+    {
+        _listeners[listener]->pending.store(false);
+    }
+
+    void ViolationFeed::publish(uint64_t timestamp_ms, uint64_t agent_id, const ViolationMessage &violation, std::span<const char> body)
+    {
+        if (_subscribers.load(std::memory_order_relaxed) == 0)
+        {
+            return;
+        }
+
+        auto type = MessageType::StreamViolation;
+        auto length = static_cast<uint32_t>(sizeof(type) + sizeof(timestamp_ms) + sizeof(agent_id) + body.size());
+        auto size = sizeof(length) + length;
+        if (size > _bytes.size() / 2)
+        {
+            std::cerr << "Violation frame of " << size << " bytes is too large for the violation stream" << std::endl;
+            return;
+        }
+
+        auto sequence = _head.fetch_add(1);
+        auto &slot = _slots[sequence % _slots.size()];
+
+        // Wait for the publisher of the previous lap, in the unlikely case it is still writing this slot.
+        auto previous = sequence >= _slots.size() ? 2 * (sequence - _slots.size()) + 2 : 0;
+        while (!slot.version.compare_exchange_weak(previous, 2 * sequence + 1, std::memory_order_acquire))
+        {
+            previous = sequence >= _slots.size() ? 2 * (sequence - _slots.size()) + 2 : 0;
+            std::this_thread::yield();
+        }
+
+        auto offset = _bytes_head.fetch_add(size);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (auto [data, part] : {std::make_pair(static_cast<const void *>(&length), sizeof(length)),
+                                  std::make_pair(static_cast<const void *>(&type), sizeof(type)),
+                                  std::make_pair(static_cast<const void *>(&timestamp_ms), sizeof(timestamp_ms)),
+                                  std::make_pair(static_cast<const void *>(&agent_id), sizeof(agent_id)),
+                                  std::make_pair(static_cast<const void *>(body.data()), body.size())})
+        {
+            _copy_in(offset, static_cast<const char *>(data), part);
+            offset += part;
+        }
+
+        slot.entry.agent_id = agent_id;
+        slot.entry.metric = static_cast<uint32_t>(violation.info.violation.metric);
+        std::memcpy(slot.entry.name, violation.info.name, sizeof(slot.entry.name));
+        slot.entry.offset = offset - size;
+        slot.entry.size = static_cast<uint32_t>(size);
+        slot.version.store(2 * sequence + 2);
+
+        // One notification per wakeup of each loop, however many violations arrive in between.
+        for (const auto &listener : _listeners)
+        {
+            if (listener->subscribers.load(std::memory_order_relaxed) > 0 && !listener->pending.exchange(true))
+            {
+                auto notified = listener->event->notify();
+                if (notified.is_err())
+                {
+                    std::cerr << "Unable to wake up subscribers: " << notified.unwrap_err().message() << std::endl;
+                }
+            }
+        }
+    }
+
+    uint64_t ViolationFeed::head()
+    {
+        return _head.load();
+    }
+
+    bool ViolationFeed::read(uint64_t &cursor, const SubscribeMessage &filter, std::vector<char> &out, size_t max_bytes)
+    {
+        auto head = _head.load();
+        if (head - cursor > _slots.size())
+        {
+            return false;
+        }
+
+        for (auto first = cursor; cursor < head && out.size() < max_bytes; cursor++)
+        {
+            const auto &slot = _slots[cursor % _slots.size()];
+            auto version = slot.version.load(std::memory_order_acquire);
+            if (version < 2 * cursor + 2)
+            {
+                break;
+            }
+
+            auto entry = slot.entry;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (version > 2 * cursor + 2 || slot.version.load(std::memory_order_relaxed) != version)
+            {
+                // Overwritten: report it now, or on the next call when violations were already read.
+                return cursor != first;
+            }
+
+            if (!_matches(entry, filter))
+            {
+                continue;
+            }
+
+            auto start = out.size();
+            out.resize(start + entry.size);
+            _copy_out(entry.offset, out.data() + start, entry.size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_bytes_head.load(std::memory_order_relaxed) - entry.offset > _bytes.size())
+            {
+                out.resize(start);
+                return cursor != first;
+            }
+        }
+
+        return true;
+    }
+
+    void ViolationFeed::_copy_in(uint64_t offset, const char *data, size_t size)
+    {
+        auto position = offset % _bytes.size();
+        auto first = std::min(size, _bytes.size() - position);
+        std::memcpy(_bytes.data() + position, data, first);
+        std::memcpy(_bytes.data(), data + first, size - first);
+    }
+
+    void ViolationFeed::_copy_out(uint64_t offset, char *data, size_t size) const
+    {
+        auto position = offset % _bytes.size();
+        auto first = std::min(size, _bytes.size() - position);
+        std::memcpy(data, _bytes.data() + position, first);
+        std::memcpy(data + first, _bytes.data(), size - first);
+    }
+}
@@ -1,7 +1,10 @@
-#include <deque>
+#include <random>
 
 #include <nlohmann/json.hpp>
 
+#include "event_log.hpp"
+#include "frame.hpp"
+#include "protocol.hpp"
 #include "utils.hpp"
 #include "generated/listener.hpp"
 
@@ -163,9 +166,14 @@ struct ProcessMetric
 class _CTAContext
 {
 private:
+    static constexpr size_t MAX_UNACKED_VIOLATIONS = 16384;
+
     KernelTracerHandle *_tracer;
     uint16_t _port;
     std::unique_ptr<net::TcpStream> _stream;
+    procmon::FrameDecoder _decoder;
+    uint64_t _agent_id;
+    std::optional<uint64_t> _config_fingerprint;
     HANDLE _cpu_mem_thread;
     HANDLE _disk_network_thread;
     HANDLE _update_thread;
@@ -174,9 +182,15 @@ private:
     CONDITION_VARIABLE _reconnecting_cv;
     volatile LONG _reconnecting;
 
+    // Frames are written by `cta_loop`, the update thread and `reconnect`: each one is written
+    // whole, and never to a stream being replaced.
+    CRITICAL_SECTION _write_cs;
+
+    // Violations not yet acknowledged by CTB. Every report of this agent has the `Normal` severity.
     CRITICAL_SECTION _queue_cs;
     CONDITION_VARIABLE _queue_cv;
-    std::deque<procmon::ViolationInfo> _queue;
+    procmon::ViolationLane _lane;
+    uint64_t _dropped;
 
     CRITICAL_SECTION _monitored_pids_cs;
     std::unordered_map<uint64_t, ProcessMetric> _monitored_pids;
@@ -283,31 +297,38 @@ private:
         {
             while (!stopped)
             {
-                auto message = context->read_message();
+                auto message = context->read_frame();
                 if (message.is_ok())
                 {
-                    auto &config = message.unwrap();
-                    auto parsed = json::parse(config, nullptr, false);
+                    auto decoded = procmon::decode_message(message.unwrap());
+                    auto ack = decoded.has_value() && decoded->first == procmon::MessageType::Ack
+                                   ? procmon::message_as<procmon::AckMessage>(decoded->second)
+                                   : std::nullopt;
+                    if (ack.has_value())
+                    {
+                        context->acknowledge(ack.value());
+                        continue;
+                    }
+
+                    auto parsed = decoded.has_value() && decoded->first == procmon::MessageType::Config
+                                      ? json::parse(decoded->second, nullptr, false)
+                                      : json(json::value_t::discarded);
                     if (!parsed.is_discarded() && parsed.is_array())
                     {
                         std::vector<procmon::ConfigEntry> entries;
                         for (const auto &item : parsed)
                         {
-                            procmon::ConfigEntry entry = {0};
-
-                            auto name = item.value("name", "");
-                            size_t len = std::min(name.size(), COMMAND_LENGTH - 1);
-                            std::memcpy(entry.name, name.data(), len);
-                            entry.name[len] = '\0';
-
-                            entry.threshold.values[static_cast<int>(Metric::Cpu)] = item.value("cpu", 0);
-                            entry.threshold.values[static_cast<int>(Metric::Memory)] = item.value("memory", 0);
-                            entry.threshold.values[static_cast<int>(Metric::Disk)] = item.value("disk", 0);
-                            entry.threshold.values[static_cast<int>(Metric::Network)] = item.value("network", 0);
-                            entries.push_back(entry);
+                            entries.push_back(procmon::parse_config_entry(item));
                         }
 
                         context->set_monitor_targets(entries);
+
+                        std::vector<char> frame;
+                        procmon::encode_message(
+                            frame,
+                            procmon::MessageType::ConfigApplied,
+                            procmon::ConfigAppliedMessage{context->_config_fingerprint.value()});
+                        context->write_frame(frame);
                     }
                     else
                     {
@@ -332,6 +353,13 @@ private:
         return ERROR_SUCCESS;
     }
 
+    void _send_hello()
+    {
+        std::vector<char> frame;
+        procmon::encode_message(frame, procmon::MessageType::Hello, procmon::HelloMessage{_agent_id});
+        write_frame(frame);
+    }
+
     void _populate_initial_processes(const std::vector<const char *> &targets)
     {
         // std::cerr << "Populating initial processes" << std::endl;
@@ -381,8 +409,17 @@ private:
 
 public:
     explicit _CTAContext(KernelTracerHandle *tracer, uint16_t port, std::unique_ptr<net::TcpStream> stream)
-        : _tracer(tracer), _port(port), _stream(std::move(stream)), _reconnecting(0)
+        : _tracer(tracer), _port(port), _stream(std::move(stream)), _agent_id(0), _dropped(0), _reconnecting(0)
     {
+        std::random_device device;
+        _agent_id = (static_cast<uint64_t>(device()) << 32) | device();
+
+        InitializeCriticalSection(&_write_cs);
+        if (_stream != nullptr)
+        {
+            _send_hello();
+        }
+
         InitializeCriticalSection(&_reconnecting_cs);
         InitializeConditionVariable(&_reconnecting_cv);
         InitializeCriticalSection(&_queue_cs);
@@ -440,6 +477,7 @@ public:
         DeleteCriticalSection(&_monitored_pids_cs);
         DeleteCriticalSection(&_queue_cs);
         DeleteCriticalSection(&_reconnecting_cs);
+        DeleteCriticalSection(&_write_cs);
         free_tracer(_tracer);
     }
 
@@ -448,31 +486,29 @@ public:
         return _tracer;
     }
 
-    io::Result<std::vector<char>> read_message()
+    io::Result<std::span<const char>> read_frame()
     {
         if (_stream == nullptr)
         {
-            return io::Result<std::vector<char>>::err(io::Error::other("Not connected to server"));
+            return io::Result<std::span<const char>>::err(io::Error::other("Not connected to server"));
         }
 
-        return procmon::read_message(*_stream);
+        return _decoder.read_frame(*_stream);
     }
 
-    io::Result<std::monostate> write_message(const std::span<const char> &buffer)
+    io::Result<std::monostate> write_frame(const std::vector<char> &frame)
     {
+        _CriticalSectionGuard guard(&_write_cs);
         if (_stream == nullptr)
         {
             return io::Result<std::monostate>::err(io::Error::other("Not connected to server"));
         }
 
-        uint32_t length = static_cast<uint32_t>(buffer.size());
-        auto size = SHORT_CIRCUIT(std::monostate, _stream->write(std::span<const char>(reinterpret_cast<const char *>(&length), sizeof(length))));
-
-        const char *ptr = buffer.data();
-        auto remaining = buffer.size();
+        const char *ptr = frame.data();
+        auto remaining = frame.size();
         while (remaining > 0)
         {
-            size = SHORT_CIRCUIT(std::monostate, _stream->write(std::span<const char>(ptr, remaining)));
+            auto size = SHORT_CIRCUIT(std::monostate, _stream->write(std::span<const char>(ptr, remaining)));
             ptr += size;
             remaining -= size;
         }
@@ -480,11 +516,61 @@ public:
         return io::Result<std::monostate>::ok(std::monostate{});
     }
 
+    /**
+     * @brief Write the next report not written on the current connection yet, if any.
+     *
+     * Written reports stay in the lane until CTB acknowledges them, so that they can be resent
+     * after a reconnection.
+     */
+    io::Result<std::monostate> send_unsent()
+    {
+        // Held across the lane and the write, so that `reconnect` cannot rewind the lane in between:
+        // every connection carries the reports in sequence order.
+        _CriticalSectionGuard write_guard(&_write_cs);
+
+        std::vector<char> frame;
+        uint64_t sequence = 0;
+        {
+            _CriticalSectionGuard guard(&_queue_cs);
+            if (!_lane.has_unsent())
+            {
+                return io::Result<std::monostate>::ok(std::monostate{});
+            }
+
+            const auto &entry = _lane.unsent();
+            sequence = entry.message.sequence;
+            procmon::encode_message(frame, procmon::MessageType::Violation, entry.message);
+        }
+
+        SHORT_CIRCUIT(std::monostate, write_frame(frame));
+
+        _CriticalSectionGuard guard(&_queue_cs);
+        _lane.send_sequence = std::max(_lane.send_sequence, sequence + 1);
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    void acknowledge(const procmon::AckMessage &ack)
+    {
+        _CriticalSectionGuard guard(&_queue_cs);
+        _lane.acknowledge(ack.sequences[static_cast<size_t>(procmon::Severity::Normal)]);
+    }
+
     void push_violation(procmon::ViolationInfo &&info)
     {
         _CriticalSectionGuard guard(&_queue_cs);
         // std::cerr << "Pushing violation for PID " << info.pid << std::endl;
-        _queue.push_back(std::move(info));
+        if (_lane.unacked.size() >= MAX_UNACKED_VIOLATIONS)
+        {
+            // Keep memory bounded while CTB is unreachable: the oldest reports are given up first.
+            if (++_dropped % 1024 == 1)
+            {
+                std::cerr << "Resend window full, dropped " << _dropped << " violation(s)" << std::endl;
+            }
+
+            _lane.drop_oldest();
+        }
+
+        _lane.push(procmon::Severity::Normal, std::move(info), nullptr);
         WakeConditionVariable(&_queue_cv);
     }
 
@@ -498,12 +584,23 @@ public:
 
         if (!stopped)
         {
-            _stream = nullptr;
+            {
+                _CriticalSectionGuard write_guard(&_write_cs);
+                _stream = nullptr;
+            }
 
             auto connect = net::TcpStream::connect(net::SocketAddrV4(net::Ipv4Addr::LOCALHOST, _port));
             if (connect.is_ok())
             {
+                // Critical sections are reentrant: the Hello is the first frame on the new stream.
+                _CriticalSectionGuard write_guard(&_write_cs);
                 _stream = std::make_unique<net::TcpStream>(std::move(connect).into_ok());
+                _decoder.reset();
+                _send_hello();
+
+                // Then resend everything CTB has not acknowledged yet: it drops what it already logged.
+                _CriticalSectionGuard queue_guard(&_queue_cs);
+                _lane.rewind();
             }
 
             InterlockedExchange(&_reconnecting, 0);
@@ -513,6 +610,14 @@ public:
 
     void set_monitor_targets(const std::vector<procmon::ConfigEntry> &entries)
     {
+        // CTB pushes its configuration on every connection, which is usually the one already in effect.
+        auto fingerprint = procmon::config_fingerprint(entries);
+        if (_config_fingerprint == fingerprint)
+        {
+            std::cerr << "Configuration unchanged (" << std::hex << fingerprint << std::dec << "), skipping" << std::endl;
+            return;
+        }
+
         clear_monitor(_tracer);
 
         std::vector<const char *> targets;
@@ -526,24 +631,17 @@ public:
 
         procmon::save_config(entries);
         _populate_initial_processes(targets);
+        _config_fingerprint = fingerprint;
     }
 
-    std::optional<procmon::ViolationInfo> next_violation()
+    /** @brief Wait until a report is waiting to be written, or for at most a second. */
+    void wait_unsent()
     {
         _CriticalSectionGuard guard(&_queue_cs);
-        while (!stopped && _queue.empty())
+        if (!stopped && !_lane.has_unsent())
         {
             SleepConditionVariableCS(&_queue_cv, &_queue_cs, 1000);
         }
-
-        if (!stopped)
-        {
-            auto info = _queue.front();
-            _queue.pop_front();
-            return info;
-        }
-
-        return std::nullopt;
     }
 };
 
@@ -552,47 +650,192 @@ class _CTBContext
 public:
     std::unique_ptr<net::TcpStream> stream;
     net::SocketAddr addr;
+    std::string peer;
+    procmon::EventLog &log;
 
     explicit _CTBContext(
         std::unique_ptr<net::TcpStream> stream,
         net::SocketAddr &&addr,
-        const std::string &json_config)
-        : stream(std::move(stream)), addr(std::move(addr))
+        const std::string &json_config,
+        procmon::EventLog &log)
+        : stream(std::move(stream)), addr(std::move(addr)), log(log)
     {
-        std::cerr << "Sending initial configuration to " << addr << std::endl;
+        std::ostringstream text;
+        text << this->addr;
+        peer = text.str();
+
+        std::cerr << "Sending initial configuration to " << this->addr << std::endl;
 
-        uint32_t length = static_cast<uint32_t>(json_config.size());
-        auto send1 = this->stream->write(std::span<const char>(reinterpret_cast<const char *>(&length), sizeof(length)));
-        if (send1.is_err())
+        std::vector<char> frame;
+        procmon::encode_message(frame, procmon::MessageType::Config, std::span<const char>(json_config.data(), json_config.size()));
+
+        auto send = send_frame(frame);
+        if (send.is_err())
         {
-            std::cerr << "Failed to send initial configuration to " << addr << ": " << send1.unwrap_err().message() << std::endl;
+            std::cerr << "Failed to send initial configuration to " << this->addr << ": " << send.unwrap_err().message() << std::endl;
         }
-        else
+    }
+
+    io::Result<std::monostate> send_frame(const std::vector<char> &frame)
+    {
+        const char *ptr = frame.data();
+        auto remaining = frame.size();
+        while (remaining > 0)
         {
-            auto send2 = this->stream->write(std::span<const char>(json_config.data(), json_config.size()));
-            if (send2.is_err())
-            {
-                std::cerr << "Failed to send initial configuration to " << addr << ": " << send2.unwrap_err().message() << std::endl;
-            }
+            auto size = SHORT_CIRCUIT(std::monostate, stream->write(std::span<const char>(ptr, remaining)));
+            ptr += size;
+            remaining -= size;
         }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::monostate> send_ack(const procmon::AckMessage &ack)
+    {
+        std::vector<char> frame;
+        procmon::encode_message(frame, procmon::MessageType::Ack, ack);
+        return send_frame(frame);
     }
 };
 
+// Shared by every connection, so that a report resent on a new connection is logged only once.
+static procmon::DeliveryLedger ctb_ledger;
+
 DWORD ctb_serve(LPVOID param)
 {
+    // Acknowledgements are cumulative and only cover the reports synced to disk: send one every ACK_INTERVAL
+    // reports, and whenever the connection stays idle for ACK_IDLE_INTERVAL, so that the last reports of a
+    // burst are acknowledged once the event log synced them.
+    constexpr size_t ACK_INTERVAL = 64;
+    constexpr std::chrono::milliseconds ACK_IDLE_INTERVAL = std::chrono::milliseconds(200);
+
     auto ctx = reinterpret_cast<_CTBContext *>(param);
+    procmon::FrameDecoder decoder;
+    std::optional<uint64_t> agent_id;
+    size_t unacked = 0;
+    procmon::AckMessage acked = {};
+
+    auto timeout = ctx->stream->set_read_timeout(ACK_IDLE_INTERVAL);
+    if (timeout.is_err())
+    {
+        std::cerr << "Unable to set the read timeout of " << ctx->addr << ": " << timeout.unwrap_err().message() << std::endl;
+    }
+
     while (true)
     {
-        auto message = procmon::read_message(*ctx->stream);
+        auto message = decoder.read_frame(*ctx->stream);
+        if (message.is_err() &&
+            (message.unwrap_err().kind() == io::ErrorKind::TimedOut || message.unwrap_err().kind() == io::ErrorKind::WouldBlock))
+        {
+            // The decoder keeps a partially received frame: acknowledge what became durable, then read on.
+            if (agent_id.has_value())
+            {
+                auto durable = ctb_ledger.durable(agent_id.value());
+                if (std::memcmp(&durable, &acked, sizeof(durable)) != 0)
+                {
+                    acked = durable;
+                    unacked = 0;
+                    if (ctx->send_ack(durable).is_err())
+                    {
+                        break;
+                    }
+                }
+            }
+
+            continue;
+        }
+
         if (message.is_ok())
         {
-            auto info = reinterpret_cast<procmon::ViolationInfo *>(message.unwrap().data());
-            std::cout << "Received violation from " << ctx->addr << ": PID=" << info->pid
-                      << ", Process=" << info->name
-                      << ", Metric=" << static_cast<int>(info->violation.metric)
-                      << ", Value=" << info->violation.value
-                      << ", Threshold=" << info->violation.threshold
-                      << std::endl;
+            auto payload = message.unwrap();
+            auto decoded = procmon::decode_message(payload);
+            if (!decoded.has_value())
+            {
+                std::cerr << "Received malformed payload from " << ctx->addr << " (" << payload.size() << " bytes)" << std::endl;
+                break;
+            }
+
+            auto [type, body] = decoded.value();
+            if (type == procmon::MessageType::Hello)
+            {
+                auto hello = procmon::message_as<procmon::HelloMessage>(body);
+                if (!hello.has_value())
+                {
+                    std::cerr << "Received malformed handshake from " << ctx->addr << std::endl;
+                    break;
+                }
+
+                if (agent_id.has_value())
+                {
+                    ctb_ledger.disconnect(agent_id.value());
+                }
+
+                agent_id = hello->agent_id;
+                ctb_ledger.connect(agent_id.value());
+                acked = ctb_ledger.durable(agent_id.value());
+                if (ctx->send_ack(acked).is_err())
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            if (type == procmon::MessageType::ConfigApplied)
+            {
+                auto applied = procmon::message_as<procmon::ConfigAppliedMessage>(body);
+                if (!applied.has_value())
+                {
+                    std::cerr << "Received malformed configuration report from " << ctx->addr << std::endl;
+                    break;
+                }
+
+                std::cerr << ctx->addr << " is running configuration " << std::hex << applied->fingerprint << std::dec << std::endl;
+                continue;
+            }
+
+            if (type == procmon::MessageType::Telemetry)
+            {
+                auto telemetry = procmon::message_as<procmon::TelemetryMessage>(body);
+                if (!telemetry.has_value())
+                {
+                    std::cerr << "Received malformed telemetry from " << ctx->addr << std::endl;
+                    break;
+                }
+
+                ctx->log.append(
+                    [&](procmon::EventRecord &record)
+                    { procmon::format_telemetry(record, ctx->peer, telemetry.value()); });
+                continue;
+            }
+
+            auto decoded_violation = type == procmon::MessageType::Violation ? procmon::decode_violation(body) : std::nullopt;
+            if (!decoded_violation.has_value() || !agent_id.has_value())
+            {
+                std::cerr << "Received malformed payload from " << ctx->addr << " (" << payload.size() << " bytes)" << std::endl;
+                break;
+            }
+
+            const auto &[violation, details] = decoded_violation.value();
+            if (ctb_ledger.record(agent_id.value(), violation.severity, violation.sequence))
+            {
+                ctx->log.append(
+                    [&](procmon::EventRecord &record)
+                    {
+                        procmon::format_violation(record, ctx->peer, violation, details);
+                        record.deliver(ctb_ledger, agent_id.value(), violation.severity, violation.sequence);
+                    });
+            }
+
+            if (++unacked >= ACK_INTERVAL)
+            {
+                unacked = 0;
+                acked = ctb_ledger.durable(agent_id.value());
+                if (ctx->send_ack(acked).is_err())
+                {
+                    break;
+                }
+            }
         }
         else
         {
@@ -601,6 +844,11 @@ DWORD ctb_serve(LPVOID param)
         }
     }
 
+    if (agent_id.has_value())
+    {
+        ctb_ledger.disconnect(agent_id.value());
+    }
+
     delete ctx;
     return ERROR_SUCCESS;
 }
@@ -631,21 +879,17 @@ namespace procmon
 
         while (!stopped)
         {
-            auto event = context->next_violation();
-            if (event.has_value())
+            context->wait_unsent();
+            if (context->send_unsent().is_err())
             {
-                auto &violation = event.value();
-                while (context->write_message(std::span<const char>(reinterpret_cast<const char *>(&violation), sizeof(violation))).is_err())
-                {
-                    context->reconnect();
-                }
+                context->reconnect();
             }
         }
 
         return 0;
     }
 
-    int ctb_loop(net::TcpListener &listener, const std::string &json_config)
+    int ctb_loop(net::TcpListener &listener, const path::PathBuf &config_path, const std::string &json_config, EventLog &log)
     {
         initialize();
         while (!stopped)
@@ -657,7 +901,7 @@ namespace procmon
             {
                 auto pair = std::move(client).into_ok();
                 auto stream = std::make_unique<net::TcpStream>(std::move(pair.first));
-                auto ctx = new _CTBContext(std::move(stream), std::move(pair.second), json_config);
+                auto ctx = new _CTBContext(std::move(stream), std::move(pair.second), json_config, log);
                 CreateThread(nullptr, 0, ctb_serve, ctx, 0, nullptr);
             }
         }
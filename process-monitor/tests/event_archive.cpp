@@ -0,0 +1,316 @@
+#include <limits>
+
+#include "event_archive.hpp"
+#include "records.hpp"
+
+using Column = procmon::EventArchive::Column;
+
+constexpr uint64_t ARCHIVE_SEGMENT_ID = 1;
+
+/** @brief Append `records` to a new segment in `directory`, seal it, and archive it. */
+std::unique_ptr<procmon::EventArchive> archive_records(const path::PathBuf &directory, const std::vector<std::string> &records)
+{
+    auto segment = procmon::EventSegment::open(directory, ARCHIVE_SEGMENT_ID);
+    EXPECT_TRUE(segment.is_ok());
+    if (segment.is_err())
+    {
+        return nullptr;
+    }
+
+    for (const auto &record : records)
+    {
+        segment.unwrap()->append(std::span<const char>(record.data(), record.size()));
+    }
+
+    EXPECT_TRUE(segment.unwrap()->seal().is_ok());
+    EXPECT_TRUE(procmon::EventArchive::write(*segment.unwrap(), directory).is_ok());
+
+    auto archive = procmon::EventArchive::open(directory, ARCHIVE_SEGMENT_ID);
+    EXPECT_TRUE(archive.is_ok());
+    return archive.is_ok() ? std::move(archive).into_ok() : nullptr;
+}
+
+/** @brief The events of `source` (a segment or an archive) matching `query`, in storage order. */
+template <typename Source>
+std::vector<procmon::StoredEvent> query_events(Source &source, const procmon::EventQuery &query)
+{
+    std::vector<procmon::StoredEvent> events;
+    auto visited = source.query(
+        query,
+        [&events](const procmon::StoredEvent &event)
+        {
+            events.push_back(event);
+            return true;
+        });
+
+    EXPECT_TRUE(visited.is_ok());
+    return events;
+}
+
+/** @brief Check that every field of the events of `actual` matches the one of `expected`. */
+void expect_same_events(const std::vector<procmon::StoredEvent> &expected, const std::vector<procmon::StoredEvent> &actual)
+{
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size() && !testing::Test::HasFailure(); i++)
+    {
+        const auto &e = expected[i], &a = actual[i];
+        EXPECT_EQ(e.timestamp_ms, a.timestamp_ms) << "event " << i;
+        EXPECT_EQ(e.agent_id, a.agent_id) << "event " << i;
+        EXPECT_EQ(e.violation.sequence, a.violation.sequence) << "event " << i;
+        EXPECT_EQ(e.violation.severity, a.violation.severity) << "event " << i;
+        EXPECT_EQ(e.violation.info.pid, a.violation.info.pid) << "event " << i;
+        EXPECT_EQ(0, std::memcmp(e.violation.info.name, a.violation.info.name, sizeof(StaticCommandName))) << "event " << i;
+        EXPECT_EQ(e.violation.info.violation.metric, a.violation.info.violation.metric) << "event " << i;
+        EXPECT_EQ(e.violation.info.violation.value, a.violation.info.violation.value) << "event " << i;
+        EXPECT_EQ(e.violation.info.violation.threshold, a.violation.info.violation.threshold) << "event " << i;
+
+        ASSERT_EQ(e.details.has_value(), a.details.has_value()) << "event " << i;
+        if (e.details.has_value())
+        {
+            EXPECT_EQ(e.details->uid, a.details->uid) << "event " << i;
+            EXPECT_EQ(e.details->cmdline, a.details->cmdline) << "event " << i;
+            EXPECT_EQ(e.details->exe, a.details->exe) << "event " << i;
+            EXPECT_EQ(e.details->cgroup, a.details->cgroup) << "event " << i;
+        }
+    }
+}
+
+procmon::ViolationMessage make_message(uint64_t sequence, uint32_t pid, const char *name, Metric metric, uint32_t value)
+{
+    StaticCommandName command;
+    procmon::trim_command_name(name, &command);
+    return procmon::ViolationMessage{sequence, procmon::Severity::Normal, procmon::ViolationInfo(pid, command, Violation{metric, value, 80})};
+}
+
+TEST(EventArchiveTest, BitPackingWidths)
+{
+    constexpr uint64_t MAX = std::numeric_limits<uint64_t>::max();
+    const std::vector<std::pair<std::vector<uint64_t>, unsigned>> cases = {
+        {std::vector<uint64_t>(100, 0), 0},
+        {{1, 0, 1, 1, 0, 1, 0}, 1},
+        {{0, uint64_t(1) << 32, 5, 0xffffffff}, 33},
+        {{MAX, 0, uint64_t(1) << 63, 12345, MAX - 1, 1}, 64},
+    };
+
+    for (const auto &[values, width] : cases)
+    {
+        // Values are appended after whatever is already in the buffer.
+        std::vector<char> packed = {'x'};
+        procmon::pack_bits(packed, values);
+        ASSERT_GT(packed.size(), 1u);
+        EXPECT_EQ(static_cast<uint8_t>(packed[1]), width);
+
+        // A second array right after the first one.
+        const uint64_t trailer[] = {7, 3};
+        auto first_bytes = packed.size() - 1;
+        procmon::pack_bits(packed, trailer);
+
+        std::vector<uint64_t> unpacked;
+        auto data = std::span<const char>(packed).subspan(1);
+        auto read = procmon::unpack_bits(data, values.size(), unpacked);
+        ASSERT_TRUE(read.has_value());
+        EXPECT_EQ(read.value(), first_bytes);
+        EXPECT_EQ(unpacked, values);
+
+        auto read_trailer = procmon::unpack_bits(data.subspan(read.value()), 2, unpacked);
+        ASSERT_TRUE(read_trailer.has_value());
+        EXPECT_EQ(unpacked, std::vector<uint64_t>(std::begin(trailer), std::end(trailer)));
+
+        // Truncated data is rejected rather than read past its end.
+        EXPECT_FALSE(procmon::unpack_bits(data.first(first_bytes - 1), values.size(), unpacked).has_value());
+    }
+
+    // No width is larger than 64 bits.
+    std::vector<char> malformed(64, '\0');
+    malformed[0] = 65;
+    std::vector<uint64_t> unpacked;
+    EXPECT_FALSE(procmon::unpack_bits(malformed, 1, unpacked).has_value());
+    EXPECT_FALSE(procmon::unpack_bits(std::span<const char>(), 0, unpacked).has_value());
+}
+
+TEST(EventArchiveTest, NegativeDeltas)
+{
+    auto directory = test_directory("event_archive");
+
+    // Clock steps back, PIDs are recycled, and the sequences of interleaved agents go back and forth,
+    // down to the extremes of each column.
+    const uint64_t timestamps[] = {1700000000000, 1700000000500, 1699999999000, 5, 0, std::numeric_limits<uint64_t>::max(), 1700000001000, 1};
+    const uint32_t pids[] = {4194304, 17, 4194303, 1, std::numeric_limits<uint32_t>::max(), 0, 300, 299};
+    const uint64_t agents[] = {1, 2, 1, 3, 2, 1, 3, 2};
+    const uint64_t sequences[] = {1000000, 1, 1000001, 50, 2, 1000002, 51, std::numeric_limits<uint64_t>::max()};
+
+    std::vector<std::string> records;
+    for (size_t i = 0; i < std::size(timestamps); i++)
+    {
+        auto message = make_message(sequences[i], pids[i], "worker", Metric::Memory, static_cast<uint32_t>(i));
+        records.push_back(make_record(timestamps[i], agents[i], message, nullptr));
+    }
+
+    auto archive = archive_records(directory, records);
+    ASSERT_NE(archive, nullptr);
+    ASSERT_EQ(archive->size(), std::size(timestamps));
+
+    auto decoded = archive->column(0, Column::Timestamp);
+    ASSERT_TRUE(decoded.is_ok());
+    EXPECT_EQ(decoded.unwrap(), std::vector<uint64_t>(std::begin(timestamps), std::end(timestamps)));
+
+    decoded = archive->column(0, Column::Pid);
+    ASSERT_TRUE(decoded.is_ok());
+    EXPECT_EQ(decoded.unwrap(), std::vector<uint64_t>(std::begin(pids), std::end(pids)));
+
+    decoded = archive->column(0, Column::Sequence);
+    ASSERT_TRUE(decoded.is_ok());
+    EXPECT_EQ(decoded.unwrap(), std::vector<uint64_t>(std::begin(sequences), std::end(sequences)));
+
+    auto segment = procmon::EventSegment::open(directory, ARCHIVE_SEGMENT_ID);
+    ASSERT_TRUE(segment.is_ok());
+    expect_same_events(query_events(*segment.unwrap(), procmon::EventQuery()), query_events(*archive, procmon::EventQuery()));
+}
+
+TEST(EventArchiveTest, StringsAndDetails)
+{
+    auto directory = test_directory("event_archive");
+
+    const procmon::ProcessDetails empty = {0, "", "", ""};
+    const procmon::ProcessDetails full = {1000, "/usr/bin/python3 -m http.server 8080", "/usr/bin/python3.12", "/user.slice/user-1000.slice"};
+    const procmon::ProcessDetails partial = {65534, "", "/opt/app/bin/app", ""};
+    const procmon::ProcessDetails *details[] = {nullptr, &empty, &full, nullptr, &partial, &full, &empty, nullptr};
+    const char *names[] = {"", "python3", "python3", "", "app", "python3", "", "kworker/0:1"};
+
+    std::vector<std::string> records;
+    for (size_t i = 0; i < std::size(details); i++)
+    {
+        auto message = make_message(i + 1, 100 + static_cast<uint32_t>(i), names[i], Metric::Cpu, 95);
+        records.push_back(make_record(1000 + i, 1, message, details[i]));
+    }
+
+    auto archive = archive_records(directory, records);
+    ASSERT_NE(archive, nullptr);
+
+    auto events = query_events(*archive, procmon::EventQuery());
+    ASSERT_EQ(events.size(), std::size(details));
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        // Details reported with only empty strings are not mistaken for missing ones.
+        ASSERT_EQ(events[i].details.has_value(), details[i] != nullptr) << "event " << i;
+        EXPECT_STREQ(reinterpret_cast<const char *>(events[i].violation.info.name), names[i]) << "event " << i;
+        if (details[i] != nullptr)
+        {
+            EXPECT_EQ(events[i].details->uid, details[i]->uid) << "event " << i;
+            EXPECT_EQ(events[i].details->cmdline, details[i]->cmdline) << "event " << i;
+            EXPECT_EQ(events[i].details->exe, details[i]->exe) << "event " << i;
+            EXPECT_EQ(events[i].details->cgroup, details[i]->cgroup) << "event " << i;
+        }
+    }
+
+    // Each distinct string is stored once, the empty one included.
+    auto dictionary = archive->dictionary(0, Column::Exe);
+    ASSERT_TRUE(dictionary.is_ok());
+    EXPECT_EQ(dictionary.unwrap(), (std::vector<std::string>{"", "/usr/bin/python3.12", "/opt/app/bin/app"}));
+
+    auto has_details = archive->column(0, Column::HasDetails);
+    ASSERT_TRUE(has_details.is_ok());
+    EXPECT_EQ(has_details.unwrap(), (std::vector<uint64_t>{0, 1, 1, 0, 1, 1, 1, 0}));
+
+    procmon::EventQuery query;
+    query.name = "";
+    EXPECT_EQ(query_events(*archive, query).size(), 3u);
+}
+
+TEST(EventArchiveTest, ColumnsWithoutDetails)
+{
+    auto directory = test_directory("event_archive");
+
+    std::vector<std::string> records;
+    for (uint64_t i = 0; i < 1000; i++)
+    {
+        records.push_back(make_record(1000 + i, 1, i + 1, "worker", Metric::Cpu));
+    }
+
+    auto archive = archive_records(directory, records);
+    ASSERT_NE(archive, nullptr);
+
+    // Columns of zeros are packed to a width of 0, and decode to zeros.
+    for (auto column : {Column::HasDetails, Column::Uid, Column::Cmdline, Column::Exe, Column::Cgroup})
+    {
+        auto values = archive->column(0, column);
+        ASSERT_TRUE(values.is_ok());
+        EXPECT_EQ(values.unwrap(), std::vector<uint64_t>(1000, 0));
+    }
+
+    auto dictionary = archive->dictionary(0, Column::Cmdline);
+    ASSERT_TRUE(dictionary.is_ok());
+    EXPECT_EQ(dictionary.unwrap(), std::vector<std::string>{""});
+
+    auto events = query_events(*archive, procmon::EventQuery());
+    ASSERT_EQ(events.size(), 1000u);
+    EXPECT_FALSE(events.front().details.has_value());
+    EXPECT_FALSE(events.back().details.has_value());
+}
+
+TEST(EventArchiveTest, QueryMatchesSomeRowGroups)
+{
+    constexpr uint64_t GROUP_ROWS = procmon::EventArchive::GROUP_ROWS;
+    constexpr uint64_t COUNT = 2 * GROUP_ROWS + GROUP_ROWS / 2;
+
+    auto directory = test_directory("event_archive");
+
+    // Agent 7 only reports in the second row group, and "rare" only runs in the third one.
+    std::vector<std::string> records;
+    size_t agent_events = 0, rare_events = 0;
+    for (uint64_t i = 0; i < COUNT; i++)
+    {
+        auto agent_id = i / GROUP_ROWS == 1 && i % 100 == 0 ? 7 : 1 + i % 3;
+        auto name = i / GROUP_ROWS == 2 && i % 1000 == 0 ? "rare" : "worker";
+        agent_events += agent_id == 7;
+        rare_events += name[0] == 'r';
+        records.push_back(make_record(1000 + i, agent_id, i + 1, name, i % 2 == 0 ? Metric::Cpu : Metric::Disk));
+    }
+
+    auto archive = archive_records(directory, records);
+    ASSERT_NE(archive, nullptr);
+    ASSERT_EQ(archive->groups(), 3u);
+    EXPECT_EQ(archive->rows(0), GROUP_ROWS);
+    EXPECT_EQ(archive->rows(2), GROUP_ROWS / 2);
+
+    auto segment = procmon::EventSegment::open(directory, ARCHIVE_SEGMENT_ID);
+    ASSERT_TRUE(segment.is_ok());
+
+    auto check = [&](const procmon::EventQuery &query, size_t count)
+    {
+        auto events = query_events(*archive, query);
+        EXPECT_EQ(events.size(), count);
+        expect_same_events(query_events(*segment.unwrap(), query), events);
+    };
+
+    procmon::EventQuery query;
+    query.agent_id = 7;
+    check(query, agent_events);
+
+    query.metric = Metric::Cpu;
+    check(query, agent_events);
+
+    query.metric = Metric::Disk;
+    check(query, 0);
+
+    query = procmon::EventQuery();
+    query.name = "rare";
+    check(query, rare_events);
+
+    query.to_ms = 1000 + 2 * GROUP_ROWS - 1;
+    check(query, 0);
+
+    // From the end of the first row group to the start of the second one.
+    query = procmon::EventQuery();
+    query.from_ms = 1000 + GROUP_ROWS - 10;
+    query.to_ms = 1000 + GROUP_ROWS + 9;
+    check(query, 20);
+
+    query.metric = Metric::Disk;
+    check(query, 10);
+
+    // Past the last row group.
+    query = procmon::EventQuery();
+    query.from_ms = 1000 + COUNT;
+    check(query, 0);
+}
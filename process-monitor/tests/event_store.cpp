@@ -0,0 +1,223 @@
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "records.hpp"
+
+constexpr uint64_t SEGMENT_ID = 1;
+
+path::PathBuf segment_file(const path::PathBuf &directory, const char *extension)
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << SEGMENT_ID << extension;
+    return directory / name.str();
+}
+
+std::vector<char> read_file(const path::PathBuf &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void write_file(const path::PathBuf &path, const std::vector<char> &data)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+/** @brief Write `count` events of `agent_id` to a new segment in `directory`, one per millisecond from `start_ms`. */
+void write_segment(const path::PathBuf &directory, uint64_t agent_id, uint64_t count, uint64_t start_ms)
+{
+    auto segment = procmon::EventSegment::open(directory, SEGMENT_ID);
+    ASSERT_TRUE(segment.is_ok());
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        auto record = make_record(start_ms + i, agent_id, i + 1, "worker", Metric::Cpu);
+        segment.unwrap()->append(std::span<const char>(record.data(), record.size()));
+    }
+
+    segment.unwrap()->sync();
+}
+
+/** @brief Sequence numbers of the events of `segment` matching `query`, in storage order. */
+std::vector<uint64_t> query_sequences(procmon::EventSegment &segment, const procmon::EventQuery &query)
+{
+    std::vector<uint64_t> sequences;
+    auto visited = segment.query(
+        query,
+        [&sequences](const procmon::StoredEvent &event)
+        {
+            sequences.push_back(event.violation.sequence);
+            return true;
+        });
+
+    EXPECT_TRUE(visited.is_ok());
+    return sequences;
+}
+
+TEST(EventStoreTest, AppendReopenQuery)
+{
+    constexpr uint64_t COUNT = 10000;
+    constexpr uint64_t START_MS = 1700000000000;
+    const char *names[] = {"nginx", "postgres", "redis"};
+    const Metric metrics[] = {Metric::Cpu, Metric::Memory, Metric::Disk, Metric::Network};
+
+    auto directory = test_directory("event_store");
+    {
+        auto store = procmon::EventStore::open(directory, procmon::EventStoreOptions());
+        ASSERT_TRUE(store.is_ok());
+
+        for (uint64_t i = 0; i < COUNT; i++)
+        {
+            auto record = make_record(START_MS + i * 1000, 1 + i % 4, i + 1, names[i % 3], metrics[i % 4]);
+            store.unwrap()->append(std::span<const char>(record.data(), record.size()));
+        }
+
+        store.unwrap()->sync();
+    }
+
+    auto store = procmon::EventStore::open(directory, procmon::EventStoreOptions());
+    ASSERT_TRUE(store.is_ok());
+    EXPECT_EQ(store.unwrap()->size(), COUNT);
+
+    auto count = [&store](const procmon::EventQuery &query)
+    {
+        uint64_t previous = 0;
+        bool ordered = true;
+        auto visited = store.unwrap()->query(
+            query,
+            [&](const procmon::StoredEvent &event)
+            {
+                ordered = ordered && event.violation.sequence > previous;
+                previous = event.violation.sequence;
+                return true;
+            });
+
+        EXPECT_TRUE(visited.is_ok());
+        EXPECT_TRUE(ordered);
+        return visited.is_ok() ? visited.unwrap() : 0;
+    };
+
+    procmon::EventQuery query;
+    EXPECT_EQ(count(query), COUNT);
+
+    query.agent_id = 2;
+    EXPECT_EQ(count(query), COUNT / 4);
+
+    query = procmon::EventQuery();
+    query.name = "postgres";
+    EXPECT_EQ(count(query), COUNT / 3);
+
+    query = procmon::EventQuery();
+    query.metric = Metric::Network;
+    EXPECT_EQ(count(query), COUNT / 4);
+
+    query.agent_id = 4;
+    EXPECT_EQ(count(query), COUNT / 4);
+
+    query.agent_id = 3;
+    EXPECT_EQ(count(query), 0u);
+
+    query = procmon::EventQuery();
+    query.from_ms = START_MS + 1000 * 1000;
+    query.to_ms = START_MS + 1999 * 1000;
+    EXPECT_EQ(count(query), 1000u);
+
+    // The visitor stops the query.
+    size_t visited = 0;
+    store.unwrap()->query(procmon::EventQuery(), [&visited](const procmon::StoredEvent &) { return ++visited < 10; });
+    EXPECT_EQ(visited, 10u);
+}
+
+TEST(EventStoreTest, TruncatedTailRecord)
+{
+    constexpr uint64_t COUNT = 5000;
+
+    auto directory = test_directory("event_store");
+    write_segment(directory, 1, COUNT, 1000);
+
+    // A crash in the middle of the last record.
+    auto data_path = segment_file(directory, ".dat");
+    std::filesystem::resize_file(data_path, std::filesystem::file_size(data_path) - 7);
+
+    {
+        auto segment = procmon::EventSegment::open(directory, SEGMENT_ID);
+        ASSERT_TRUE(segment.is_ok());
+        EXPECT_EQ(segment.unwrap()->size(), COUNT - 1);
+        EXPECT_EQ(std::filesystem::file_size(data_path), segment.unwrap()->bytes());
+
+        // Appending resumes right after the last complete record.
+        auto record = make_record(1000 + COUNT, 1, COUNT + 1, "worker", Metric::Cpu);
+        segment.unwrap()->append(std::span<const char>(record.data(), record.size()));
+        segment.unwrap()->sync();
+    }
+
+    auto segment = procmon::EventSegment::open(directory, SEGMENT_ID);
+    ASSERT_TRUE(segment.is_ok());
+    auto sequences = query_sequences(*segment.unwrap(), procmon::EventQuery());
+    ASSERT_EQ(sequences.size(), COUNT);
+    EXPECT_EQ(sequences[COUNT - 2], COUNT - 1);
+    EXPECT_EQ(sequences.back(), COUNT + 1);
+}
+
+TEST(EventStoreTest, CorruptIndexEntry)
+{
+    // Three blocks, hence two index entries and a block replayed from the data.
+    constexpr uint64_t COUNT = 2 * procmon::EventSegment::BLOCK_EVENTS + 100;
+
+    auto directory = test_directory("event_store");
+    write_segment(directory, 1, COUNT, 1000);
+
+    auto index_path = segment_file(directory, ".idx");
+    auto index = read_file(index_path);
+    ASSERT_FALSE(index.empty());
+
+    auto corrupt = index;
+    corrupt.back() ^= 0x01;
+    write_file(index_path, corrupt);
+
+    auto segment = procmon::EventSegment::open(directory, SEGMENT_ID);
+    ASSERT_TRUE(segment.is_ok());
+    EXPECT_EQ(segment.unwrap()->size(), COUNT);
+    EXPECT_EQ(query_sequences(*segment.unwrap(), procmon::EventQuery()).size(), COUNT);
+
+    procmon::EventQuery query;
+    query.from_ms = 1000 + COUNT - 10;
+    EXPECT_EQ(query_sequences(*segment.unwrap(), query).size(), 10u);
+
+    // The entry was rebuilt from the data.
+    EXPECT_EQ(read_file(index_path), index);
+}
+
+TEST(EventStoreTest, IndexOfReplacedDataFile)
+{
+    constexpr uint64_t COUNT = procmon::EventSegment::BLOCK_EVENTS + 100;
+
+    auto directory = test_directory("event_store");
+    write_segment(directory, 1, COUNT, 1000);
+    auto stale_index = read_file(segment_file(directory, ".idx"));
+    ASSERT_FALSE(stale_index.empty());
+
+    // The data file is replaced by one with records of the same sizes, but the old index is left behind.
+    std::filesystem::remove(segment_file(directory, ".dat"));
+    std::filesystem::remove(segment_file(directory, ".idx"));
+    write_segment(directory, 2, COUNT, 5000000);
+    write_file(segment_file(directory, ".idx"), stale_index);
+
+    auto segment = procmon::EventSegment::open(directory, SEGMENT_ID);
+    ASSERT_TRUE(segment.is_ok());
+    EXPECT_EQ(segment.unwrap()->size(), COUNT);
+
+    // None of the events of the stale index are found.
+    procmon::EventQuery query;
+    query.agent_id = 1;
+    EXPECT_EQ(query_sequences(*segment.unwrap(), query).size(), 0u);
+
+    query.agent_id = 2;
+    EXPECT_EQ(query_sequences(*segment.unwrap(), query).size(), COUNT);
+
+    query = procmon::EventQuery();
+    query.to_ms = 4999999;
+    EXPECT_EQ(query_sequences(*segment.unwrap(), query).size(), 0u);
+}
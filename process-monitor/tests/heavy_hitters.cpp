@@ -0,0 +1,236 @@
+#include <map>
+#include <random>
+
+#include <gtest/gtest.h>
+
+#include "heavy_hitters.hpp"
+
+using Key = procmon::SpaceSaving::Key;
+
+struct Tally
+{
+    uint64_t count;
+    uint64_t error;
+};
+
+Key agent_key(uint64_t agent_id)
+{
+    Key key = {};
+    key.agent_id = agent_id;
+    return key;
+}
+
+/** @brief The counters of `summary` by agent, failing the test if a key has more than one counter. */
+std::map<uint64_t, Tally> tallies(const procmon::SpaceSaving &summary)
+{
+    std::map<uint64_t, Tally> result;
+    summary.for_each(
+        [&result](const Key &key, uint64_t count, uint64_t error)
+        {
+            auto inserted = result.emplace(key.agent_id, Tally{count, error}).second;
+            EXPECT_TRUE(inserted) << "two counters for agent " << key.agent_id;
+        });
+
+    return result;
+}
+
+/** @brief Check the guarantees of Space-Saving on `summary`, given the exact counts of its stream. */
+void expect_bounded(const procmon::SpaceSaving &summary, const std::map<uint64_t, uint64_t> &exact, uint64_t total)
+{
+    auto counters = tallies(summary);
+    uint64_t sum = 0;
+    for (const auto &[agent_id, tally] : counters)
+    {
+        auto it = exact.find(agent_id);
+        auto occurrences = it == exact.end() ? 0 : it->second;
+
+        // Never underestimated, and overestimated by at most the error.
+        EXPECT_GE(tally.count, occurrences) << "agent " << agent_id;
+        EXPECT_LE(tally.count - tally.error, occurrences) << "agent " << agent_id;
+        sum += tally.count;
+    }
+
+    // Every occurrence is counted once, by the key which took it or by the one which took over its counter.
+    EXPECT_EQ(sum, total);
+
+    // A key without a counter occurred at most `floor` times.
+    for (const auto &[agent_id, occurrences] : exact)
+    {
+        if (!counters.contains(agent_id))
+        {
+            EXPECT_LE(occurrences, summary.floor()) << "agent " << agent_id;
+        }
+    }
+}
+
+procmon::ViolationMessage make_message(const char *name)
+{
+    StaticCommandName command;
+    procmon::trim_command_name(name, &command);
+    return procmon::ViolationMessage{1, procmon::Severity::Normal, procmon::ViolationInfo(1000, command, Violation{Metric::Cpu, 90, 80})};
+}
+
+/** @brief Counts of the heaviest processes of `window` at `now_ms`, by name. */
+std::map<std::string, uint64_t> top_processes(procmon::HeavyHitters &hitters, procmon::HeavyHitterWindow window, uint64_t now_ms)
+{
+    std::map<std::string, uint64_t> result;
+    for (const auto &hitter : hitters.top(procmon::HeavyHitterKey::Process, window, 10, now_ms))
+    {
+        EXPECT_EQ(hitter.error, 0u);
+        result[reinterpret_cast<const char *>(hitter.name)] = hitter.count;
+    }
+
+    return result;
+}
+
+TEST(HeavyHittersTest, ExactCountsBelowCapacity)
+{
+    // One counter short of taking them all.
+    procmon::SpaceSaving summary(8);
+    for (uint64_t agent_id = 1; agent_id <= 7; agent_id++)
+    {
+        for (uint64_t i = 0; i < agent_id * 3; i++)
+        {
+            summary.add(agent_key(agent_id));
+        }
+    }
+
+    auto counters = tallies(summary);
+    ASSERT_EQ(counters.size(), 7u);
+    for (const auto &[agent_id, tally] : counters)
+    {
+        EXPECT_EQ(tally.count, agent_id * 3) << "agent " << agent_id;
+        EXPECT_EQ(tally.error, 0u) << "agent " << agent_id;
+    }
+
+    EXPECT_EQ(summary.floor(), 0u);
+
+    // Taking the last counter does not evict anything either.
+    summary.add(agent_key(8));
+    EXPECT_EQ(tallies(summary).size(), 8u);
+    EXPECT_EQ(summary.floor(), 1u);
+
+    summary.clear();
+    EXPECT_TRUE(tallies(summary).empty());
+    summary.add(agent_key(42));
+    EXPECT_EQ(tallies(summary)[42].count, 1u);
+}
+
+TEST(HeavyHittersTest, EvictionErrorBound)
+{
+    constexpr size_t CAPACITY = 16;
+    constexpr uint64_t TOTAL = 100000;
+
+    // A few heavy keys over a long tail of keys seen a handful of times.
+    std::mt19937_64 random(7);
+    std::map<uint64_t, uint64_t> exact;
+    procmon::SpaceSaving summary(CAPACITY);
+    for (uint64_t i = 0; i < TOTAL && !testing::Test::HasFailure(); i++)
+    {
+        auto agent_id = random() % 2 == 0 ? 1 + random() % 4 : 100 + random() % 5000;
+        exact[agent_id]++;
+        summary.add(agent_key(agent_id));
+
+        if (i % 10000 == 0)
+        {
+            expect_bounded(summary, exact, i + 1);
+        }
+    }
+
+    expect_bounded(summary, exact, TOTAL);
+
+    // The error of any key is at most `total / capacity`, so every heavy key keeps its counter.
+    EXPECT_LE(summary.floor(), TOTAL / CAPACITY);
+    auto counters = tallies(summary);
+    for (uint64_t agent_id = 1; agent_id <= 4; agent_id++)
+    {
+        ASSERT_TRUE(counters.contains(agent_id)) << "agent " << agent_id;
+        EXPECT_LE(counters[agent_id].error, TOTAL / CAPACITY);
+    }
+}
+
+TEST(HeavyHittersTest, DeletionWithCollidingProbeChains)
+{
+    constexpr size_t CAPACITY = 4;
+    // Slots of the index of a summary of `CAPACITY` counters.
+    constexpr size_t SLOTS = 2 * CAPACITY;
+
+    // Keys which all hash to the last two slots or the first one, so that every eviction removes a
+    // key from the middle of a probe chain wrapping around the end of the index.
+    std::vector<uint64_t> agents;
+    for (uint64_t agent_id = 1; agents.size() < 12; agent_id++)
+    {
+        auto home = procmon::SpaceSaving::KeyHash()(agent_key(agent_id)) % SLOTS;
+        if (home == SLOTS - 2 || home == SLOTS - 1 || home == 0)
+        {
+            agents.push_back(agent_id);
+        }
+    }
+
+    std::mt19937_64 random(11);
+    std::map<uint64_t, uint64_t> exact;
+    procmon::SpaceSaving summary(CAPACITY);
+    for (uint64_t i = 0; i < 20000 && !testing::Test::HasFailure(); i++)
+    {
+        // Skewed, so that some keys keep their counter while the others are evicted around them.
+        auto agent_id = agents[std::min(random() % agents.size(), random() % agents.size())];
+        exact[agent_id]++;
+        summary.add(agent_key(agent_id));
+
+        // A key lost from its probe chain would get a second counter.
+        expect_bounded(summary, exact, i + 1);
+    }
+
+    EXPECT_EQ(tallies(summary).size(), CAPACITY);
+}
+
+TEST(HeavyHittersTest, PaneExpiry)
+{
+    // Start of a pane of the minute window (5 seconds), and of the hour window (5 minutes).
+    constexpr uint64_t START_MS = 1700000100000;
+    constexpr uint64_t MINUTE_MS = 60 * 1000;
+    static_assert(START_MS % (5 * MINUTE_MS) == 0);
+
+    using procmon::HeavyHitterWindow;
+
+    procmon::HeavyHitters hitters(1);
+    for (int i = 0; i < 3; i++)
+    {
+        hitters.record(1, make_message("early"), START_MS);
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        hitters.record(1, make_message("late"), START_MS + 30 * 1000);
+    }
+
+    // The first pane is still in the window during its last pane...
+    auto top = top_processes(hitters, HeavyHitterWindow::Minute, START_MS + MINUTE_MS - 1);
+    EXPECT_EQ(top, (std::map<std::string, uint64_t>{{"early", 3}, {"late", 2}}));
+
+    // ...and leaves it when the window has moved by its length.
+    top = top_processes(hitters, HeavyHitterWindow::Minute, START_MS + MINUTE_MS);
+    EXPECT_EQ(top, (std::map<std::string, uint64_t>{{"late", 2}}));
+
+    // Panes from the future of the query are left out.
+    top = top_processes(hitters, HeavyHitterWindow::Minute, START_MS + 10 * 1000);
+    EXPECT_EQ(top, (std::map<std::string, uint64_t>{{"early", 3}}));
+
+    // The pane of the next lap of the ring starts from empty summaries.
+    hitters.record(1, make_message("next"), START_MS + MINUTE_MS + 1000);
+    top = top_processes(hitters, HeavyHitterWindow::Minute, START_MS + MINUTE_MS + 1000);
+    EXPECT_EQ(top, (std::map<std::string, uint64_t>{{"late", 2}, {"next", 1}}));
+
+    top = top_processes(hitters, HeavyHitterWindow::Minute, START_MS + 2 * MINUTE_MS + 1000);
+    EXPECT_TRUE(top.empty());
+
+    // The longer windows still cover everything.
+    top = top_processes(hitters, HeavyHitterWindow::Hour, START_MS + 2 * MINUTE_MS + 1000);
+    EXPECT_EQ(top, (std::map<std::string, uint64_t>{{"early", 3}, {"late", 2}, {"next", 1}}));
+
+    top = top_processes(hitters, HeavyHitterWindow::Day, START_MS + 23 * 60 * MINUTE_MS);
+    EXPECT_EQ(top, (std::map<std::string, uint64_t>{{"early", 3}, {"late", 2}, {"next", 1}}));
+
+    top = top_processes(hitters, HeavyHitterWindow::Day, START_MS + 24 * 60 * MINUTE_MS);
+    EXPECT_TRUE(top.empty());
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include "event_store.hpp"
+#include "process.hpp"
+
+/** @brief A fresh, empty directory for the test being run, under the directory of `suite`. */
+inline path::PathBuf test_directory(const char *suite)
+{
+    auto directory = path::PathBuf(std::format("{}/{}/{}", TEST_DIR, process::id(), suite)) /
+                     testing::UnitTest::GetInstance()->current_test_info()->name();
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    return directory;
+}
+
+/** @brief The record of `message` received from `agent_id`, as CTB stores it. */
+inline std::string make_record(uint64_t timestamp_ms, uint64_t agent_id, const procmon::ViolationMessage &message, const procmon::ProcessDetails *details)
+{
+    std::vector<char> frame;
+    procmon::encode_violation(frame, message, details);
+
+    // Only the body of the frame is stored, after its length and type.
+    std::string record;
+    procmon::EventSegment::encode(record, timestamp_ms, agent_id, std::span<const char>(frame).subspan(sizeof(uint32_t) + sizeof(procmon::MessageType)));
+    return record;
+}
+
+/** @brief The record of violation `sequence` of `agent_id`, as CTB stores it. */
+inline std::string make_record(uint64_t timestamp_ms, uint64_t agent_id, uint64_t sequence, const char *name, Metric metric)
+{
+    StaticCommandName command;
+    procmon::trim_command_name(name, &command);
+
+    procmon::ViolationMessage message{sequence, procmon::Severity::Normal, procmon::ViolationInfo(1000, command, Violation{metric, 90, 80})};
+    return make_record(timestamp_ms, agent_id, message, nullptr);
+}
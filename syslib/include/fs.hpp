@@ -49,6 +49,29 @@ namespace fs
         io::Result<size_t> write(std::span<const char> buffer) override;
         io::Result<std::monostate> flush() override;
         io::Result<uint64_t> seek(io::SeekFrom position) override;
+
+        /**
+         * @brief Attempts to sync the contents of this file to disk, without necessarily syncing its metadata.
+         *
+         * @see https://doc.rust-lang.org/std/fs/struct.File.html#method.sync_data
+         */
+        io::Result<std::monostate> sync_data();
+
+        /**
+         * @brief Truncates or extends the underlying file, updating the size of this file to become `size`.
+         *
+         * @see https://doc.rust-lang.org/std/fs/struct.File.html#method.set_len
+         */
+        io::Result<std::monostate> set_len(uint64_t size);
+
+        /**
+         * @brief Reads a number of bytes starting from a given offset, without moving the cursor of the file.
+         *
+         * Unlike `read`, several threads can read from the same file concurrently.
+         *
+         * @see https://doc.rust-lang.org/std/os/unix/fs/trait.FileExt.html#tymethod.read_at
+         */
+        io::Result<size_t> read_at(std::span<char> buffer, uint64_t offset);
     };
 
     /**
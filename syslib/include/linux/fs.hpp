@@ -98,6 +98,15 @@ namespace _fs_impl
         io::Result<size_t> write(std::span<const char> buffer);
         io::Result<std::monostate> flush();
 
+        /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/fs/unix.rs#L1480-L1500 */
+        io::Result<std::monostate> sync_data();
+
+        /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/fs/unix.rs#L1507-L1512 */
+        io::Result<std::monostate> set_len(uint64_t size);
+
+        /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/fd/unix.rs#L148-L161 */
+        io::Result<size_t> read_at(std::span<char> buffer, uint64_t offset);
+
         /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/fs/unix.rs#L1572-L1582 */
         io::Result<uint64_t> seek(io::SeekFrom position);
     };
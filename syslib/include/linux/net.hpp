@@ -130,6 +130,15 @@ namespace _net_impl
         /** @brief Connect to a remote address. */
         static io::Result<NativeTcpStream> connect(const NativeSocketAddr &addr);
 
+        /** @brief Start a nonblocking connection to a remote address (IPv4). */
+        static io::Result<NativeTcpStream> connect_nonblocking_v4(const NativeSocketAddrV4 &addr);
+
+        /** @brief Start a nonblocking connection to a remote address (IPv6). */
+        static io::Result<NativeTcpStream> connect_nonblocking_v6(const NativeSocketAddrV6 &addr);
+
+        /** @brief Start a nonblocking connection to a remote address. */
+        static io::Result<NativeTcpStream> connect_nonblocking(const NativeSocketAddr &addr);
+
         /** @brief Returns the socket address of the remote peer. */
         io::Result<NativeSocketAddr> peer_addr() const;
 
@@ -183,6 +192,9 @@ namespace _net_impl
 
         /** @brief Flush the stream (no-op for TCP). */
         io::Result<std::monostate> flush() const;
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
     };
 
     /**
@@ -202,14 +214,14 @@ namespace _net_impl
         NativeTcpListener &operator=(NativeTcpListener &&other) noexcept;
         ~NativeTcpListener();
 
-        /** @brief Creates a new TcpListener bound to the specified IPv4 address. */
-        static io::Result<NativeTcpListener> bind_v4(const NativeSocketAddrV4 &addr);
+        /** @brief Creates a new TcpListener bound to the specified IPv4 address, optionally with SO_REUSEPORT set. */
+        static io::Result<NativeTcpListener> bind_v4(const NativeSocketAddrV4 &addr, bool reuse_port = false);
 
-        /** @brief Creates a new TcpListener bound to the specified IPv6 address. */
-        static io::Result<NativeTcpListener> bind_v6(const NativeSocketAddrV6 &addr);
+        /** @brief Creates a new TcpListener bound to the specified IPv6 address, optionally with SO_REUSEPORT set. */
+        static io::Result<NativeTcpListener> bind_v6(const NativeSocketAddrV6 &addr, bool reuse_port = false);
 
-        /** @brief Creates a new TcpListener bound to the specified address. */
-        static io::Result<NativeTcpListener> bind(const NativeSocketAddr &addr);
+        /** @brief Creates a new TcpListener bound to the specified address, optionally with SO_REUSEPORT set. */
+        static io::Result<NativeTcpListener> bind(const NativeSocketAddr &addr, bool reuse_port = false);
 
         /** @brief Returns the local socket address of this listener. */
         io::Result<NativeSocketAddr> local_addr() const;
@@ -238,7 +250,13 @@ namespace _net_impl
         /** @brief Gets the value of the SO_ERROR option on this socket. */
         io::Result<std::optional<io::Error>> take_error() const;
 
+        /** @brief Gets the value of the SO_REUSEPORT option for this socket. */
+        io::Result<bool> reuse_port() const;
+
         /** @brief Moves this TCP listener into or out of nonblocking mode. */
         io::Result<std::monostate> set_nonblocking(bool nonblocking) const;
+
+        /** @brief Returns the underlying file descriptor without transferring ownership. */
+        int as_raw_fd() const noexcept;
     };
 }
@@ -264,6 +264,27 @@ namespace net
          */
         static io::Result<TcpStream> connect(const SocketAddrV6 &addr);
 
+        /**
+         * @brief Starts a TCP connection to a remote host without blocking the calling thread.
+         *
+         * The returned stream is already in nonblocking mode and the handshake may still be in
+         * progress. Wait until the socket becomes writable, then call `take_error` to find out
+         * whether the connection succeeded.
+         *
+         * @see https://docs.rs/mio/latest/mio/net/struct.TcpStream.html#method.connect
+         */
+        static io::Result<TcpStream> connect_nonblocking(const SocketAddr &addr);
+
+        /**
+         * @brief Starts a nonblocking TCP connection to the specified IPv4 socket address.
+         */
+        static io::Result<TcpStream> connect_nonblocking(const SocketAddrV4 &addr);
+
+        /**
+         * @brief Starts a nonblocking TCP connection to the specified IPv6 socket address.
+         */
+        static io::Result<TcpStream> connect_nonblocking(const SocketAddrV6 &addr);
+
         /**
          * @brief Returns the socket address of the remote peer of this TCP connection.
          *
@@ -410,6 +431,22 @@ namespace net
          * @see https://doc.rust-lang.org/std/io/trait.Write.html#tymethod.flush
          */
         io::Result<std::monostate> flush() override;
+
+#ifdef _WIN32
+        /**
+         * @brief Extracts the raw socket without transferring ownership.
+         *
+         * @see https://doc.rust-lang.org/std/os/windows/io/trait.AsRawSocket.html
+         */
+        SOCKET as_raw_socket() const noexcept;
+#elif defined(__linux__)
+        /**
+         * @brief Extracts the raw file descriptor without transferring ownership.
+         *
+         * @see https://doc.rust-lang.org/std/os/fd/trait.AsRawFd.html
+         */
+        int as_raw_fd() const noexcept;
+#endif
     };
 
     /**
@@ -454,6 +491,29 @@ namespace net
          */
         static io::Result<TcpListener> bind(const SocketAddrV6 &addr);
 
+#ifdef __linux__
+        /**
+         * @brief Creates a new `TcpListener` bound to the specified address with `SO_REUSEPORT` set.
+         *
+         * Several listeners (owned by the same user) can be bound this way to the same address.
+         * Each of them has its own accept queue, and the kernel distributes incoming connections
+         * among them. A listener created by `bind` cannot share its address.
+         *
+         * @see https://man7.org/linux/man-pages/man7/socket.7.html
+         */
+        static io::Result<TcpListener> bind_reuse_port(const SocketAddr &addr);
+
+        /**
+         * @brief Creates a new `TcpListener` bound to the specified IPv4 address with `SO_REUSEPORT` set.
+         */
+        static io::Result<TcpListener> bind_reuse_port(const SocketAddrV4 &addr);
+
+        /**
+         * @brief Creates a new `TcpListener` bound to the specified IPv6 address with `SO_REUSEPORT` set.
+         */
+        static io::Result<TcpListener> bind_reuse_port(const SocketAddrV6 &addr);
+#endif
+
         /**
          * @brief Returns the local socket address of this listener.
          *
@@ -523,6 +583,13 @@ namespace net
          */
         io::Result<std::optional<io::Error>> take_error() const;
 
+#ifdef __linux__
+        /**
+         * @brief Gets the value of the `SO_REUSEPORT` option for this socket.
+         */
+        io::Result<bool> reuse_port() const;
+#endif
+
         /**
          * @brief Moves this TCP listener into or out of nonblocking mode.
          *
@@ -535,6 +602,22 @@ namespace net
          * @see https://doc.rust-lang.org/std/net/struct.TcpListener.html#method.set_nonblocking
          */
         io::Result<std::monostate> set_nonblocking(bool nonblocking) const;
+
+#ifdef _WIN32
+        /**
+         * @brief Extracts the raw socket without transferring ownership.
+         *
+         * @see https://doc.rust-lang.org/std/os/windows/io/trait.AsRawSocket.html
+         */
+        SOCKET as_raw_socket() const noexcept;
+#elif defined(__linux__)
+        /**
+         * @brief Extracts the raw file descriptor without transferring ownership.
+         *
+         * @see https://doc.rust-lang.org/std/os/fd/trait.AsRawFd.html
+         */
+        int as_raw_fd() const noexcept;
+#endif
     };
 }
 
@@ -118,6 +118,15 @@ namespace _fs_impl
         /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/fs/windows.rs#L633-L645 */
         io::Result<uint64_t> seek(io::SeekFrom position);
 
+        /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/fs/windows.rs#L575-L578 */
+        io::Result<std::monostate> sync_data();
+
+        /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/fs/windows.rs#L580-L590 */
+        io::Result<std::monostate> set_len(uint64_t size);
+
+        /** @see https://github.com/rust-lang/rust/blob/8182085617878610473f0b88f07fc9803f4b4960/library/std/src/sys/pal/windows/handle.rs#L109-L125 */
+        io::Result<size_t> read_at(std::span<char> buffer, uint64_t offset);
+
         io::Result<NativeMetadata> metadata();
     };
 
@@ -125,6 +125,15 @@ namespace _net_impl
         /** @brief Connect to a remote address. */
         static io::Result<NativeTcpStream> connect(const NativeSocketAddr &addr);
 
+        /** @brief Start a nonblocking connection to a remote address (IPv4). */
+        static io::Result<NativeTcpStream> connect_nonblocking_v4(const NativeSocketAddrV4 &addr);
+
+        /** @brief Start a nonblocking connection to a remote address (IPv6). */
+        static io::Result<NativeTcpStream> connect_nonblocking_v6(const NativeSocketAddrV6 &addr);
+
+        /** @brief Start a nonblocking connection to a remote address. */
+        static io::Result<NativeTcpStream> connect_nonblocking(const NativeSocketAddr &addr);
+
         /** @brief Returns the socket address of the remote peer. */
         io::Result<NativeSocketAddr> peer_addr() const;
 
@@ -178,6 +187,9 @@ namespace _net_impl
 
         /** @brief Flush the stream (no-op for TCP). */
         io::Result<std::monostate> flush() const;
+
+        /** @brief Returns the underlying socket without transferring ownership. */
+        SOCKET as_raw_socket() const noexcept;
     };
 
     /**
@@ -235,5 +247,8 @@ namespace _net_impl
 
         /** @brief Moves this TCP listener into or out of nonblocking mode. */
         io::Result<std::monostate> set_nonblocking(bool nonblocking) const;
+
+        /** @brief Returns the underlying socket without transferring ownership. */
+        SOCKET as_raw_socket() const noexcept;
     };
 }
@@ -86,6 +86,21 @@ namespace fs
         return _inner.seek(position);
     }
 
+    io::Result<std::monostate> File::sync_data()
+    {
+        return _inner.sync_data();
+    }
+
+    io::Result<std::monostate> File::set_len(uint64_t size)
+    {
+        return _inner.set_len(size);
+    }
+
+    io::Result<size_t> File::read_at(std::span<char> buffer, uint64_t offset)
+    {
+        return _inner.read_at(buffer, offset);
+    }
+
     io::Result<std::monostate> DirBuilder::_create(const path::PathBuf &path) const
     {
         return _recursive ? _create_dir_all(path) : _inner.mkdir(path);
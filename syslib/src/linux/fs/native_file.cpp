@@ -75,6 +75,37 @@ namespace _fs_impl
         return io::Result<std::monostate>::ok(std::monostate{});
     }
 
+    io::Result<std::monostate> NativeFile::sync_data()
+    {
+        if (fdatasync(_fd) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::monostate> NativeFile::set_len(uint64_t size)
+    {
+        if (ftruncate(_fd, static_cast<off_t>(size)) == -1)
+        {
+            return io::Result<std::monostate>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<size_t> NativeFile::read_at(std::span<char> buffer, uint64_t offset)
+    {
+        auto bytes = ::pread(_fd, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+        if (bytes == -1)
+        {
+            return io::Result<size_t>::err(io::Error::last_os_error());
+        }
+
+        return io::Result<size_t>::ok(static_cast<size_t>(bytes));
+    }
+
     io::Result<uint64_t> NativeFile::seek(io::SeekFrom position)
     {
         int whence;
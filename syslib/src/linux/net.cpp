@@ -256,6 +256,58 @@ namespace _net_impl
         }
     }
 
+    io::Result<NativeTcpStream> NativeTcpStream::connect_nonblocking_v4(const NativeSocketAddrV4 &addr)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+        if (sock == -1)
+        {
+            return io::Result<NativeTcpStream>::err(io::Error::last_os_error());
+        }
+
+        // EINPROGRESS means the handshake continues in the background
+        sockaddr_in sockaddr = addr.to_sockaddr();
+        if (::connect(sock, reinterpret_cast<struct sockaddr *>(&sockaddr), sizeof(sockaddr)) == -1 && errno != EINPROGRESS)
+        {
+            int error = errno;
+            close(sock);
+            return io::Result<NativeTcpStream>::err(io::Error::from_raw_os_error(error));
+        }
+
+        return io::Result<NativeTcpStream>::ok(NativeTcpStream(sock));
+    }
+
+    io::Result<NativeTcpStream> NativeTcpStream::connect_nonblocking_v6(const NativeSocketAddrV6 &addr)
+    {
+        int sock = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+        if (sock == -1)
+        {
+            return io::Result<NativeTcpStream>::err(io::Error::last_os_error());
+        }
+
+        // EINPROGRESS means the handshake continues in the background
+        sockaddr_in6 sockaddr = addr.to_sockaddr();
+        if (::connect(sock, reinterpret_cast<struct sockaddr *>(&sockaddr), sizeof(sockaddr)) == -1 && errno != EINPROGRESS)
+        {
+            int error = errno;
+            close(sock);
+            return io::Result<NativeTcpStream>::err(io::Error::from_raw_os_error(error));
+        }
+
+        return io::Result<NativeTcpStream>::ok(NativeTcpStream(sock));
+    }
+
+    io::Result<NativeTcpStream> NativeTcpStream::connect_nonblocking(const NativeSocketAddr &addr)
+    {
+        if (addr.is_v4())
+        {
+            return connect_nonblocking_v4(addr.as_v4());
+        }
+        else
+        {
+            return connect_nonblocking_v6(addr.as_v6());
+        }
+    }
+
     io::Result<NativeSocketAddr> NativeTcpStream::peer_addr() const
     {
         return sockname(_socket, getpeername);
@@ -468,6 +520,11 @@ namespace _net_impl
         return io::Result<std::monostate>::ok({});
     }
 
+    int NativeTcpStream::as_raw_fd() const noexcept
+    {
+        return _socket;
+    }
+
     // ========== NativeTcpListener ==========
 
     NativeTcpListener::NativeTcpListener(int socket)
@@ -503,7 +560,7 @@ namespace _net_impl
         }
     }
 
-    io::Result<NativeTcpListener> NativeTcpListener::bind_v4(const NativeSocketAddrV4 &addr)
+    io::Result<NativeTcpListener> NativeTcpListener::bind_v4(const NativeSocketAddrV4 &addr, bool reuse_port)
     {
         int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
         if (sock == -1)
@@ -520,6 +577,13 @@ namespace _net_impl
             return io::Result<NativeTcpListener>::err(io::Error::from_raw_os_error(error));
         }
 
+        if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1)
+        {
+            int error = errno;
+            close(sock);
+            return io::Result<NativeTcpListener>::err(io::Error::from_raw_os_error(error));
+        }
+
         sockaddr_in sockaddr = addr.to_sockaddr();
         if (::bind(sock, reinterpret_cast<struct sockaddr *>(&sockaddr), sizeof(sockaddr)) == -1)
         {
@@ -539,7 +603,7 @@ namespace _net_impl
         return io::Result<NativeTcpListener>::ok(NativeTcpListener(sock));
     }
 
-    io::Result<NativeTcpListener> NativeTcpListener::bind_v6(const NativeSocketAddrV6 &addr)
+    io::Result<NativeTcpListener> NativeTcpListener::bind_v6(const NativeSocketAddrV6 &addr, bool reuse_port)
     {
         int sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
         if (sock == -1)
@@ -556,6 +620,13 @@ namespace _net_impl
             return io::Result<NativeTcpListener>::err(io::Error::from_raw_os_error(error));
         }
 
+        if (reuse_port && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1)
+        {
+            int error = errno;
+            close(sock);
+            return io::Result<NativeTcpListener>::err(io::Error::from_raw_os_error(error));
+        }
+
         sockaddr_in6 sockaddr = addr.to_sockaddr();
         if (::bind(sock, reinterpret_cast<struct sockaddr *>(&sockaddr), sizeof(sockaddr)) == -1)
         {
@@ -575,15 +646,15 @@ namespace _net_impl
         return io::Result<NativeTcpListener>::ok(NativeTcpListener(sock));
     }
 
-    io::Result<NativeTcpListener> NativeTcpListener::bind(const NativeSocketAddr &addr)
+    io::Result<NativeTcpListener> NativeTcpListener::bind(const NativeSocketAddr &addr, bool reuse_port)
     {
         if (addr.is_v4())
         {
-            return bind_v4(addr.as_v4());
+            return bind_v4(addr.as_v4(), reuse_port);
         }
         else
         {
-            return bind_v6(addr.as_v6());
+            return bind_v6(addr.as_v6(), reuse_port);
         }
     }
 
@@ -666,6 +737,16 @@ namespace _net_impl
         return io::Result<bool>::ok(result.unwrap() != 0);
     }
 
+    io::Result<bool> NativeTcpListener::reuse_port() const
+    {
+        auto result = getsockopt_int(_socket, SOL_SOCKET, SO_REUSEPORT);
+        if (result.is_err())
+        {
+            return io::Result<bool>::err(std::move(result).into_err());
+        }
+        return io::Result<bool>::ok(result.unwrap() != 0);
+    }
+
     io::Result<std::optional<io::Error>> NativeTcpListener::take_error() const
     {
         auto result = getsockopt_int(_socket, SOL_SOCKET, SO_ERROR);
@@ -704,4 +785,9 @@ namespace _net_impl
         }
         return io::Result<std::monostate>::ok({});
     }
+
+    int NativeTcpListener::as_raw_fd() const noexcept
+    {
+        return _socket;
+    }
 }
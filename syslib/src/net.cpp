@@ -309,6 +309,36 @@ namespace net
         return io::Result<TcpStream>::ok(TcpStream(std::move(native_result).into_ok()));
     }
 
+    io::Result<TcpStream> TcpStream::connect_nonblocking(const SocketAddr &addr)
+    {
+        auto native_result = _net_impl::NativeTcpStream::connect_nonblocking(addr.to_native());
+        if (native_result.is_err())
+        {
+            return io::Result<TcpStream>::err(std::move(native_result).into_err());
+        }
+        return io::Result<TcpStream>::ok(TcpStream(std::move(native_result).into_ok()));
+    }
+
+    io::Result<TcpStream> TcpStream::connect_nonblocking(const SocketAddrV4 &addr)
+    {
+        auto native_result = _net_impl::NativeTcpStream::connect_nonblocking_v4(addr.to_native());
+        if (native_result.is_err())
+        {
+            return io::Result<TcpStream>::err(std::move(native_result).into_err());
+        }
+        return io::Result<TcpStream>::ok(TcpStream(std::move(native_result).into_ok()));
+    }
+
+    io::Result<TcpStream> TcpStream::connect_nonblocking(const SocketAddrV6 &addr)
+    {
+        auto native_result = _net_impl::NativeTcpStream::connect_nonblocking_v6(addr.to_native());
+        if (native_result.is_err())
+        {
+            return io::Result<TcpStream>::err(std::move(native_result).into_err());
+        }
+        return io::Result<TcpStream>::ok(TcpStream(std::move(native_result).into_ok()));
+    }
+
     io::Result<SocketAddr> TcpStream::peer_addr() const
     {
         auto native_result = _inner.peer_addr();
@@ -414,6 +444,18 @@ namespace net
         return _inner.flush();
     }
 
+#ifdef _WIN32
+    SOCKET TcpStream::as_raw_socket() const noexcept
+    {
+        return _inner.as_raw_socket();
+    }
+#elif defined(__linux__)
+    int TcpStream::as_raw_fd() const noexcept
+    {
+        return _inner.as_raw_fd();
+    }
+#endif
+
     // ========== TcpListener ==========
 
     TcpListener::TcpListener(_net_impl::NativeTcpListener &&inner)
@@ -451,6 +493,38 @@ namespace net
         return io::Result<TcpListener>::ok(TcpListener(std::move(result).into_ok()));
     }
 
+#ifdef __linux__
+    io::Result<TcpListener> TcpListener::bind_reuse_port(const SocketAddr &addr)
+    {
+        auto result = _net_impl::NativeTcpListener::bind(addr.to_native(), true);
+        if (result.is_err())
+        {
+            return io::Result<TcpListener>::err(std::move(result).into_err());
+        }
+        return io::Result<TcpListener>::ok(TcpListener(std::move(result).into_ok()));
+    }
+
+    io::Result<TcpListener> TcpListener::bind_reuse_port(const SocketAddrV4 &addr)
+    {
+        auto result = _net_impl::NativeTcpListener::bind_v4(addr.to_native(), true);
+        if (result.is_err())
+        {
+            return io::Result<TcpListener>::err(std::move(result).into_err());
+        }
+        return io::Result<TcpListener>::ok(TcpListener(std::move(result).into_ok()));
+    }
+
+    io::Result<TcpListener> TcpListener::bind_reuse_port(const SocketAddrV6 &addr)
+    {
+        auto result = _net_impl::NativeTcpListener::bind_v6(addr.to_native(), true);
+        if (result.is_err())
+        {
+            return io::Result<TcpListener>::err(std::move(result).into_err());
+        }
+        return io::Result<TcpListener>::ok(TcpListener(std::move(result).into_ok()));
+    }
+#endif
+
     io::Result<SocketAddr> TcpListener::local_addr() const
     {
         auto result = _inner.local_addr();
@@ -510,10 +584,29 @@ namespace net
         return _inner.take_error();
     }
 
+#ifdef __linux__
+    io::Result<bool> TcpListener::reuse_port() const
+    {
+        return _inner.reuse_port();
+    }
+#endif
+
     io::Result<std::monostate> TcpListener::set_nonblocking(bool nonblocking) const
     {
         return _inner.set_nonblocking(nonblocking);
     }
+
+#ifdef _WIN32
+    SOCKET TcpListener::as_raw_socket() const noexcept
+    {
+        return _inner.as_raw_socket();
+    }
+#elif defined(__linux__)
+    int TcpListener::as_raw_fd() const noexcept
+    {
+        return _inner.as_raw_fd();
+    }
+#endif
 }
 
 namespace std
@@ -154,6 +154,26 @@ namespace _fs_impl
         return io::Result<std::monostate>::ok(std::monostate{});
     }
 
+    io::Result<std::monostate> NativeFile::sync_data()
+    {
+        OS_CVT(std::monostate, FlushFileBuffers(_handle));
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<std::monostate> NativeFile::set_len(uint64_t size)
+    {
+        FILE_END_OF_FILE_INFO info = {};
+        info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+
+        OS_CVT(std::monostate, SetFileInformationByHandle(_handle, FileEndOfFileInfo, &info, sizeof(info)));
+        return io::Result<std::monostate>::ok(std::monostate{});
+    }
+
+    io::Result<size_t> NativeFile::read_at(std::span<char> buffer, uint64_t offset)
+    {
+        return _synchronous_read(buffer, offset);
+    }
+
     io::Result<uint64_t> NativeFile::seek(io::SeekFrom position)
     {
         int whence;
@@ -264,6 +264,84 @@ namespace _net_impl
         }
     }
 
+    io::Result<NativeTcpStream> NativeTcpStream::connect_nonblocking_v4(const NativeSocketAddrV4 &addr)
+    {
+        WinsockInit::ensure_initialized();
+
+        SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (sock == INVALID_SOCKET)
+        {
+            return io::Result<NativeTcpStream>::err(io::Error::last_os_error());
+        }
+
+        u_long mode = 1;
+        if (ioctlsocket(sock, FIONBIO, &mode) == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            closesocket(sock);
+            return io::Result<NativeTcpStream>::err(io::Error::from_raw_os_error(error));
+        }
+
+        // WSAEWOULDBLOCK means the handshake continues in the background
+        sockaddr_in sockaddr = addr.to_sockaddr();
+        if (::connect(sock, reinterpret_cast<struct sockaddr *>(&sockaddr), sizeof(sockaddr)) == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            if (error != WSAEWOULDBLOCK)
+            {
+                closesocket(sock);
+                return io::Result<NativeTcpStream>::err(io::Error::from_raw_os_error(error));
+            }
+        }
+
+        return io::Result<NativeTcpStream>::ok(NativeTcpStream(sock));
+    }
+
+    io::Result<NativeTcpStream> NativeTcpStream::connect_nonblocking_v6(const NativeSocketAddrV6 &addr)
+    {
+        WinsockInit::ensure_initialized();
+
+        SOCKET sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+        if (sock == INVALID_SOCKET)
+        {
+            return io::Result<NativeTcpStream>::err(io::Error::last_os_error());
+        }
+
+        u_long mode = 1;
+        if (ioctlsocket(sock, FIONBIO, &mode) == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            closesocket(sock);
+            return io::Result<NativeTcpStream>::err(io::Error::from_raw_os_error(error));
+        }
+
+        // WSAEWOULDBLOCK means the handshake continues in the background
+        sockaddr_in6 sockaddr = addr.to_sockaddr();
+        if (::connect(sock, reinterpret_cast<struct sockaddr *>(&sockaddr), sizeof(sockaddr)) == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            if (error != WSAEWOULDBLOCK)
+            {
+                closesocket(sock);
+                return io::Result<NativeTcpStream>::err(io::Error::from_raw_os_error(error));
+            }
+        }
+
+        return io::Result<NativeTcpStream>::ok(NativeTcpStream(sock));
+    }
+
+    io::Result<NativeTcpStream> NativeTcpStream::connect_nonblocking(const NativeSocketAddr &addr)
+    {
+        if (addr.is_v4())
+        {
+            return connect_nonblocking_v4(addr.as_v4());
+        }
+        else
+        {
+            return connect_nonblocking_v6(addr.as_v6());
+        }
+    }
+
     io::Result<NativeSocketAddr> NativeTcpStream::peer_addr() const
     {
         return sockname(_socket, getpeername);
@@ -461,6 +539,11 @@ namespace _net_impl
         return io::Result<std::monostate>::ok({});
     }
 
+    SOCKET NativeTcpStream::as_raw_socket() const noexcept
+    {
+        return _socket;
+    }
+
     // ========== NativeTcpListener ==========
 
     NativeTcpListener::NativeTcpListener(SOCKET socket)
@@ -713,4 +796,9 @@ namespace _net_impl
         }
         return io::Result<std::monostate>::ok({});
     }
+
+    SOCKET NativeTcpListener::as_raw_socket() const noexcept
+    {
+        return _socket;
+    }
 }
@@ -139,6 +139,65 @@ INSTANTIATE_TEST_SUITE_P(
 #endif
         FileReadWriteData{very_long_filepath(15, 200), "This is a very long filename."}));
 
+TEST(FileSyncData, AppendAndSync)
+{
+    auto path = BASE_TEST_DIR / "FileSyncData.log";
+    const std::string lines[] = {"first record\n", "second record\n"};
+
+    for (const auto &line : lines)
+    {
+        fs::OpenOptions options;
+        auto file = options.append(true).create(true).open(path);
+        ASSERT_TRUE(file.is_ok());
+
+        auto write_result = file.unwrap().write(std::span<const char>(line.data(), line.size()));
+        ASSERT_TRUE(write_result.is_ok());
+        ASSERT_EQ(write_result.unwrap(), line.size());
+
+        auto sync_result = file.unwrap().sync_data();
+        ASSERT_TRUE(sync_result.is_ok());
+    }
+
+    auto read_file = fs::File::open(path);
+    ASSERT_TRUE(read_file.is_ok());
+
+    std::vector<char> buffer(64);
+    auto read_result = read_file.unwrap().read(std::span<char>(buffer.data(), buffer.size()));
+    ASSERT_TRUE(read_result.is_ok());
+    ASSERT_EQ(std::string(buffer.data(), read_result.unwrap()), lines[0] + lines[1]);
+}
+
+TEST(FileSetLen, TruncateAndReadAt)
+{
+    auto path = BASE_TEST_DIR / "FileSetLen.bin";
+    const std::string data = "0123456789abcdef";
+
+    fs::OpenOptions options;
+    auto file_result = options.read(true).write(true).create(true).open(path);
+    ASSERT_TRUE(file_result.is_ok());
+
+    auto file = std::move(file_result).into_ok();
+    ASSERT_TRUE(file.write(std::span<const char>(data.data(), data.size())).is_ok());
+
+    char buffer[8] = {};
+    auto read_result = file.read_at(std::span<char>(buffer, 4), 10);
+    ASSERT_TRUE(read_result.is_ok());
+    ASSERT_EQ(read_result.unwrap(), 4);
+    ASSERT_EQ(std::string(buffer, 4), "abcd");
+
+    ASSERT_TRUE(file.set_len(6).is_ok());
+    ASSERT_EQ(file.seek(io::SeekFrom(io::SeekFrom::End, 0)).unwrap(), 6);
+
+    // Reading past the end returns nothing
+    read_result = file.read_at(std::span<char>(buffer, sizeof(buffer)), 6);
+    ASSERT_TRUE(read_result.is_ok());
+    ASSERT_EQ(read_result.unwrap(), 0);
+
+    read_result = file.read_at(std::span<char>(buffer, sizeof(buffer)), 0);
+    ASSERT_TRUE(read_result.is_ok());
+    ASSERT_EQ(std::string(buffer, read_result.unwrap()), "012345");
+}
+
 TEST(ListDirectory, CreateList)
 {
     auto dir_path = BASE_TEST_DIR / "ls" / "layer1" / "layer2";
@@ -561,6 +561,92 @@ TEST(TcpListenerTest, AcceptConnection)
     }
 }
 
+#ifdef __linux__
+TEST(TcpListenerTest, AsRawFd)
+{
+    net::Ipv4Addr ip(127, 0, 0, 1);
+    net::SocketAddrV4 addr(ip, 0);
+
+    auto listener_result = net::TcpListener::bind(addr);
+    ASSERT_TRUE(listener_result.is_ok());
+
+    auto listener = std::move(listener_result).into_ok();
+    EXPECT_GE(listener.as_raw_fd(), 0);
+
+    uint16_t port = listener.local_addr().unwrap().port();
+    auto client_result = net::TcpStream::connect(net::SocketAddrV4(ip, port));
+    ASSERT_TRUE(client_result.is_ok());
+
+    auto client = std::move(client_result).into_ok();
+    EXPECT_GE(client.as_raw_fd(), 0);
+    EXPECT_NE(client.as_raw_fd(), listener.as_raw_fd());
+
+    // The descriptor must be usable directly with OS APIs
+    int flags = fcntl(client.as_raw_fd(), F_GETFL, 0);
+    ASSERT_NE(flags, -1);
+    EXPECT_EQ(flags & O_NONBLOCK, 0);
+
+    client.set_nonblocking(true);
+    flags = fcntl(client.as_raw_fd(), F_GETFL, 0);
+    EXPECT_NE(flags & O_NONBLOCK, 0);
+}
+#endif
+
+#ifdef __linux__
+TEST(TcpListenerTest, BindReusePort)
+{
+    net::Ipv4Addr ip(127, 0, 0, 1);
+
+    auto first_result = net::TcpListener::bind_reuse_port(net::SocketAddrV4(ip, 0));
+    ASSERT_TRUE(first_result.is_ok());
+
+    auto first = std::move(first_result).into_ok();
+    EXPECT_TRUE(first.reuse_port().unwrap());
+
+    uint16_t port = first.local_addr().unwrap().port();
+    auto second_result = net::TcpListener::bind_reuse_port(net::SocketAddrV4(ip, port));
+    ASSERT_TRUE(second_result.is_ok());
+
+    auto second = std::move(second_result).into_ok();
+    EXPECT_EQ(second.local_addr().unwrap().port(), port);
+
+    // A listener without SO_REUSEPORT cannot join the group
+    auto plain_result = net::TcpListener::bind(net::SocketAddrV4(ip, port));
+    EXPECT_TRUE(plain_result.is_err());
+
+    // Every connection is queued on exactly one of the listeners
+    constexpr int CLIENTS = 32;
+    std::vector<net::TcpStream> clients;
+    for (int i = 0; i < CLIENTS; i++)
+    {
+        auto client = net::TcpStream::connect(net::SocketAddrV4(ip, port));
+        ASSERT_TRUE(client.is_ok());
+        clients.push_back(std::move(client).into_ok());
+    }
+
+    first.set_nonblocking(true);
+    second.set_nonblocking(true);
+
+    int accepted = 0;
+    for (const auto *listener : {&first, &second})
+    {
+        while (listener->accept().is_ok())
+        {
+            accepted++;
+        }
+    }
+
+    EXPECT_EQ(accepted, CLIENTS);
+}
+
+TEST(TcpListenerTest, BindWithoutReusePort)
+{
+    auto listener_result = net::TcpListener::bind(net::SocketAddrV4(net::Ipv4Addr(127, 0, 0, 1), 0));
+    ASSERT_TRUE(listener_result.is_ok());
+    EXPECT_FALSE(listener_result.unwrap().reuse_port().unwrap());
+}
+#endif
+
 TEST(TcpListenerTest, BindIPv6Localhost)
 {
     // Bind to IPv6 localhost on port 0
@@ -637,6 +723,42 @@ TEST(TcpIntegrationTest, ClientServerDataTransfer)
     EXPECT_STREQ(recv_buffer, send_data);
 }
 
+TEST(TcpIntegrationTest, ConnectNonblocking)
+{
+    net::Ipv4Addr ip(127, 0, 0, 1);
+    net::SocketAddrV4 bind_addr(ip, 0);
+
+    auto listener_result = net::TcpListener::bind(bind_addr);
+    ASSERT_TRUE(listener_result.is_ok());
+
+    auto listener = std::move(listener_result).into_ok();
+    uint16_t port = listener.local_addr().unwrap().port();
+
+    // The call returns immediately, possibly before the handshake completes
+    net::SocketAddrV4 connect_addr(ip, port);
+    auto client_result = net::TcpStream::connect_nonblocking(connect_addr);
+    ASSERT_TRUE(client_result.is_ok());
+
+    auto client = std::move(client_result).into_ok();
+
+    // Once the server has accepted, the handshake is done on both ends
+    auto accept_result = listener.accept();
+    ASSERT_TRUE(accept_result.is_ok());
+
+    auto [server_stream, peer_addr] = std::move(accept_result).into_ok();
+
+    auto error_result = client.take_error();
+    ASSERT_TRUE(error_result.is_ok());
+    EXPECT_FALSE(error_result.unwrap().has_value());
+    EXPECT_TRUE(client.peer_addr().is_ok());
+
+    // The stream stays nonblocking: reading with no pending data must not block
+    char buffer[16];
+    auto read_result = client.read(std::span<char>(buffer, sizeof(buffer)));
+    ASSERT_TRUE(read_result.is_err());
+    EXPECT_EQ(read_result.unwrap_err().kind(), io::ErrorKind::WouldBlock);
+}
+
 TEST(TcpIntegrationTest, BidirectionalDataTransfer)
 {
     // Server binds